@@ -0,0 +1,205 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+
+// Smallest block an arena takes from the pool; larger requests get a block of the next power of two so they can be reused too
+constexpr size_t ARENA_BLOCK_SIZE{ 64 * 1024 };
+
+// Size classes of the pool, ARENA_BLOCK_SIZE times 1, 2, 4 ... up to 2^31 times
+constexpr size_t ARENA_SIZE_CLASSES{ 32 };
+
+// Block memory of the arenas, kept by the pool a few frames or a few thousand loads
+struct ArenaStats
+{
+    size_t heapAllocations{};       // blocks the pool had to get from the heap
+    size_t heapFrees{};             // blocks given back to it to stay under the budget
+    size_t reuses{};                // blocks handed out again from the pool
+    size_t reservedBytes{};         // every block alive, in arenas or in the pool
+    size_t inUseBytes{};            // the blocks arenas hold right now
+    size_t peakInUseBytes{};
+    size_t budgetBytes{};           // most the pool keeps for reuse, 0 for no limit
+};
+
+inline void PrintArenaStats(const ArenaStats& stats)
+{
+    std::cout << "  staging: " << stats.inUseBytes / 1024 << " KiB in use (peak " << stats.peakInUseBytes / 1024 << " KiB), "
+        << stats.reservedBytes / 1024 << " KiB reserved";
+    if (stats.budgetBytes > 0)
+        std::cout << " of " << stats.budgetBytes / 1024 << " KiB";
+    std::cout << ", " << stats.heapAllocations << " blocks from the heap, " << stats.reuses << " reused, " << stats.heapFrees << " freed" << std::endl;
+}
+
+// Header at the start of every block, links it into an arena's list or the pool's free list without any other bookkeeping
+struct ArenaBlock
+{
+    ArenaBlock* next{};
+    size_t size{};                  // including the header
+};
+
+// Recycles arena blocks by size class. Arenas of concurrent loads may share it, so taking and returning blocks locks
+class ArenaPool
+{
+private:
+    std::mutex m_mutex;
+    ArenaBlock* m_free[ARENA_SIZE_CLASSES]{};
+    ArenaStats m_stats{};
+
+    static size_t sizeClass(size_t size)
+    {
+        size_t sizeClass{ 0 };
+        while (sizeClass + 1 < ARENA_SIZE_CLASSES && (ARENA_BLOCK_SIZE << sizeClass) < size)
+            ++sizeClass;
+        return sizeClass;
+    }
+
+public:
+    explicit ArenaPool(size_t budgetBytes = 0)
+    {
+        m_stats.budgetBytes = budgetBytes;
+    }
+
+    ~ArenaPool()
+    {
+        for (ArenaBlock*& list : m_free)
+        {
+            while (list)
+            {
+                ArenaBlock* next{ list->next };
+                ::operator delete(list);
+                list = next;
+            }
+        }
+    }
+
+    ArenaPool(const ArenaPool&) = delete;
+    ArenaPool& operator=(const ArenaPool&) = delete;
+
+    // A block of at least size bytes, header included
+    ArenaBlock* Acquire(size_t size)
+    {
+        size_t index{ sizeClass(size) };
+        size_t classSize{ std::max(ARENA_BLOCK_SIZE << index, size) };
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ArenaBlock* block{ m_free[index] };
+        if (block && block->size >= size)
+        {
+            m_free[index] = block->next;
+            ++m_stats.reuses;
+        }
+        else
+        {
+            block = static_cast<ArenaBlock*>(::operator new(classSize));
+            block->size = classSize;
+            m_stats.reservedBytes += classSize;
+            ++m_stats.heapAllocations;
+        }
+        block->next = nullptr;
+        m_stats.inUseBytes += block->size;
+        m_stats.peakInUseBytes = std::max(m_stats.peakInUseBytes, m_stats.inUseBytes);
+        return block;
+    }
+
+    // Takes back a list of blocks; past the budget they go back to the heap instead
+    void Release(ArenaBlock* blocks)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        while (blocks)
+        {
+            ArenaBlock* next{ blocks->next };
+            m_stats.inUseBytes -= blocks->size;
+            if (m_stats.budgetBytes > 0 && m_stats.reservedBytes > m_stats.budgetBytes)
+            {
+                m_stats.reservedBytes -= blocks->size;
+                ++m_stats.heapFrees;
+                ::operator delete(blocks);
+            }
+            else
+            {
+                size_t index{ sizeClass(blocks->size) };
+                blocks->next = m_free[index];
+                m_free[index] = blocks;
+            }
+            blocks = next;
+        }
+    }
+
+    ArenaStats GetStats()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_stats;
+    }
+};
+
+// Bump allocator for the staging data of one load. Nothing is freed on its own; Release (or the destructor) hands every block back
+// to the pool at once, so a load that is done with its CPU copy costs no heap traffic once the pool is warm. As a memory resource
+// it can back std::pmr containers such as MeshData
+class Arena : public std::pmr::memory_resource
+{
+private:
+    ArenaPool& m_pool;
+    ArenaBlock* m_blocks{};         // newest first
+    unsigned char* m_cursor{};
+    unsigned char* m_end{};
+    size_t m_usedBytes{};
+
+protected:
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        size_t space{ static_cast<size_t>(m_end - m_cursor) };
+        void* pointer{ m_cursor };
+        if (!m_cursor || !std::align(alignment, bytes, pointer, space))
+        {
+            // Room for the header and for aligning the first allocation
+            size_t header{ (sizeof(ArenaBlock) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t) };
+            ArenaBlock* block{ m_pool.Acquire(header + bytes + alignment) };
+            block->next = m_blocks;
+            m_blocks = block;
+            m_cursor = reinterpret_cast<unsigned char*>(block) + header;
+            m_end = reinterpret_cast<unsigned char*>(block) + block->size;
+
+            space = static_cast<size_t>(m_end - m_cursor);
+            pointer = m_cursor;
+            std::align(alignment, bytes, pointer, space);
+        }
+        m_cursor = static_cast<unsigned char*>(pointer) + bytes;
+        m_usedBytes += bytes;
+        return pointer;
+    }
+
+    // Freed with the whole arena
+    void do_deallocate(void*, size_t, size_t) override {}
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+public:
+    explicit Arena(ArenaPool& pool)
+        : m_pool{ pool }
+    {
+    }
+
+    ~Arena() override { Release(); }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // Everything allocated from the arena is gone afterwards, containers using it must not outlive this call
+    void Release()
+    {
+        m_pool.Release(m_blocks);
+        m_blocks = nullptr;
+        m_cursor = m_end = nullptr;
+        m_usedBytes = 0;
+    }
+
+    size_t GetUsedBytes() const { return m_usedBytes; }
+};
+
+#endif
@@ -83,7 +83,7 @@ public:
     }
 
     // Returns the view matrix calculated using Eular Angles and the LookAt Matrix
-    glm::mat4 GetViewMatrix()
+    glm::mat4 GetViewMatrix() const
     {
         return glm::lookAt(m_position, m_position + m_front, m_up);
     }
@@ -135,9 +135,20 @@ public:
         updateCameraVectors();
     }
 
-    GLfloat GetZoom() { return m_zoom; }
-    glm::vec3 GetPosition() { return m_position; }
-    glm::vec3 GetFront() { return m_front; }
+    // Places the camera directly, for scripted paths that do not go through the input handlers
+    void SetPose(glm::vec3 position, GLfloat yaw, GLfloat pitch)
+    {
+        m_position = position;
+        m_yaw = yaw;
+        m_pitch = pitch;
+        updateCameraVectors();
+    }
+
+    GLfloat GetZoom() const { return m_zoom; }
+    glm::vec3 GetPosition() const { return m_position; }
+    glm::vec3 GetFront() const { return m_front; }
+    GLfloat GetYaw() const { return m_yaw; }
+    GLfloat GetPitch() const { return m_pitch; }
 };
 
 #endif
\ No newline at end of file
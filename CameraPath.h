@@ -0,0 +1,46 @@
+#ifndef CAMERA_PATH_H
+#define CAMERA_PATH_H
+
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Camera.h"
+
+// Fixed timestep of the headless run, frame N always renders the scene at N / 60 seconds
+constexpr float HEADLESS_TIMESTEP{ 1.0f / 60.0f };
+
+// Scripted camera, a slow orbit around the original spheres that dollies in and out and bobs up and down. Only depends on time
+inline void UpdateScriptedCamera(Camera& camera, float time)
+{
+    const glm::vec3 target{ -0.75f, -1.1f, -1.25f };
+    float distance{ 4.0f + 1.5f * std::sin(0.35f * time) };
+    float angle{ 0.4f * time };
+
+    glm::vec3 position{ target + glm::vec3(distance * std::sin(angle), 0.8f * std::sin(0.5f * time), distance * std::cos(angle)) };
+    glm::vec3 direction{ glm::normalize(target - position) };
+    camera.SetPose(position, glm::degrees(std::atan2(direction.z, direction.x)), glm::degrees(std::asin(direction.y)));
+}
+
+// Frames of a scripted run dumped to disk, spread evenly over the run and always including the last one
+inline std::vector<unsigned> SelectSavedFrames(unsigned frameCount, unsigned savedFrameCount)
+{
+    std::vector<unsigned> frames;
+    for (unsigned i{ 0 }; i < savedFrameCount && frameCount > 0; ++i)
+        frames.push_back(frameCount - 1 - i * frameCount / savedFrameCount);
+    return frames;
+}
+
+// Where frame N of a scripted run is written, suffix tells renderers apart ("" for GL, "_cpu" for the software renderer)
+inline std::string FramePath(const std::string& directory, unsigned frame, const char* suffix = "")
+{
+    char name[48]{};
+    std::snprintf(name, sizeof(name), "frame_%05u%s.ppm", frame, suffix);
+    return (std::filesystem::path(directory) / name).string();
+}
+
+#endif
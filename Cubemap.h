@@ -0,0 +1,325 @@
+#ifndef CUBEMAP_H
+#define CUBEMAP_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <SOIL2.h>
+
+#include "GLState.h"
+#include "ThreadPool.h"
+
+// Milliseconds between two steady_clock points
+inline double ElapsedMilliseconds(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+// When the process started, main() asks first so time-to-first-frame includes the context and every load
+inline std::chrono::steady_clock::time_point GetStartupTime()
+{
+    static const std::chrono::steady_clock::time_point startup{ std::chrono::steady_clock::now() };
+    return startup;
+}
+
+// Where the time of a cubemap load went
+struct CubemapLoadStats
+{
+    double decodeWallMs{};  // first decode started -> last decode finished
+    double decodeCpuMs{};   // sum of the per-image decode times, compare with decodeWallMs to see the overlap
+    double uploadMs{};      // time the GL thread spent copying into PBOs and issuing the uploads
+    double totalMs{};       // load started -> texture complete
+    unsigned images{};
+    bool parallel{};
+};
+
+inline void PrintCubemapLoadStats(const CubemapLoadStats& stats)
+{
+    std::cout << "Cubemap load (" << (stats.parallel ? "parallel" : "serial") << ", " << stats.images << " images): "
+        << "decode " << stats.decodeWallMs << " ms wall / " << stats.decodeCpuMs << " ms cpu, "
+        << "upload " << stats.uploadMs << " ms, total " << stats.totalMs << " ms" << std::endl;
+}
+
+// One decoded face (or mip level of a face)
+struct DecodedImage
+{
+    GLenum target{};
+    GLint level{};
+    int width{};
+    int height{};
+    unsigned char* pixels{};
+    double decodeMs{};
+    std::chrono::steady_clock::time_point decodedAt;
+};
+
+inline DecodedImage DecodeCubemapImage(const GLchar* path, GLenum target, GLint level)
+{
+    DecodedImage image{};
+    image.target = target;
+    image.level = level;
+
+    auto start = std::chrono::steady_clock::now();
+    image.pixels = SOIL_load_image(path, &image.width, &image.height, 0, SOIL_LOAD_RGB);
+    image.decodedAt = std::chrono::steady_clock::now();
+    image.decodeMs = ElapsedMilliseconds(start, image.decodedAt);
+
+    if (!image.pixels)
+        std::cout << "ERROR::CUBEMAP::FAILED_TO_LOAD " << path << std::endl;
+
+    return image;
+}
+
+// Face selection and (s, t) from the major axis table of the GL specification, s and t in [0, 1] across the face
+inline int SelectCubemapFace(float x, float y, float z, float& s, float& t)
+{
+    float ax{ std::fabs(x) }, ay{ std::fabs(y) }, az{ std::fabs(z) };
+    int face{};
+    float sc{}, tc{}, ma{};
+    if (ax >= ay && ax >= az)
+    {
+        face = x > 0.0f ? 0 : 1;
+        sc = x > 0.0f ? -z : z;
+        tc = -y;
+        ma = ax;
+    }
+    else if (ay >= az)
+    {
+        face = y > 0.0f ? 2 : 3;
+        sc = x;
+        tc = y > 0.0f ? z : -z;
+        ma = ay;
+    }
+    else
+    {
+        face = z > 0.0f ? 4 : 5;
+        sc = z > 0.0f ? x : -x;
+        tc = -y;
+        ma = az;
+    }
+    ma = std::max(ma, 1e-20f);
+
+    s = 0.5f * (sc / ma + 1.0f);
+    t = 0.5f * (tc / ma + 1.0f);
+    return face;
+}
+
+inline void SetCubemapSamplerState()
+{
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+}
+
+// Bytes of one width x height image of a texture with the given internal format, as the format defines them (drivers may pad
+// RGB to four bytes, which is not visible to GL). Every GPU byte count of the environment and the resource manager goes through here
+inline size_t TextureImageBytes(GLenum internalFormat, GLsizei width, GLsizei height)
+{
+    size_t texels{ static_cast<size_t>(width) * static_cast<size_t>(height) };
+    switch (internalFormat)
+    {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+        return static_cast<size_t>((width + 3) / 4) * static_cast<size_t>((height + 3) / 4) * 8;
+    case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        return static_cast<size_t>((width + 3) / 4) * static_cast<size_t>((height + 3) / 4) * 16;
+    case GL_R8:
+        return texels;
+    case GL_RG8:
+    case GL_R16F:
+        return texels * 2;
+    case GL_RGB:
+    case GL_RGB8:
+    case GL_SRGB8:
+        return texels * 3;
+    case GL_RGB16F:
+        return texels * 6;
+    case GL_RGBA16F:
+        return texels * 8;
+    case GL_RGB32F:
+        return texels * 12;
+    case GL_RGBA32F:
+        return texels * 16;
+    default:                        // GL_RGBA8, GL_SRGB8_ALPHA8, GL_R11F_G11F_B10F, GL_R32F and the other 32 bit formats
+        return texels * 4;
+    }
+}
+
+// Decodes the faces of a cubemap on a thread pool while the GL thread keeps doing other start-up work.
+// Poll() uploads whatever finished decoding through a pixel unpack buffer, Finish() uploads the rest and hands the texture over.
+// Faces are given in GL_TEXTURE_CUBE_MAP_POSITIVE_X + i order, extra mip levels can be queued with AddLevel()
+class AsyncCubemapLoader
+{
+private:
+    ThreadPool& m_pool;
+    GLuint m_texture{};
+    std::vector<std::future<DecodedImage>> m_pending;
+    std::chrono::steady_clock::time_point m_start;
+    CubemapLoadStats m_stats{};
+
+    void upload(DecodedImage& image)
+    {
+        auto start = std::chrono::steady_clock::now();
+
+        if (image.pixels)
+        {
+            GLsizeiptr size{ static_cast<GLsizeiptr>(image.width) * image.height * 3 };
+
+            // Stage the pixels in a PBO, glTexImage2D then sources from the buffer and returns without waiting for the transfer
+            GLuint pbo{};
+            glGenBuffers(1, &pbo);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+            void* staging = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            if (staging)
+            {
+                std::memcpy(staging, image.pixels, static_cast<size_t>(size));
+                glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+                GetGLState().BindTexture(GL_TEXTURE_CUBE_MAP, m_texture);
+                glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+                glTexImage2D(image.target, image.level, GL_RGB, image.width, image.height, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+                glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+                GetGLState().BindTexture(GL_TEXTURE_CUBE_MAP, 0);
+            }
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+            // The driver keeps the storage alive until the copy into the texture is done
+            GetGLState().DeleteBuffers(1, &pbo);
+            SOIL_free_image_data(image.pixels);
+            image.pixels = nullptr;
+        }
+
+        auto end = std::chrono::steady_clock::now();
+        m_stats.uploadMs += ElapsedMilliseconds(start, end);
+        m_stats.decodeCpuMs += image.decodeMs;
+        m_stats.decodeWallMs = std::max(m_stats.decodeWallMs, ElapsedMilliseconds(m_start, image.decodedAt));
+        ++m_stats.images;
+    }
+
+public:
+    AsyncCubemapLoader(ThreadPool& pool, const std::vector<const GLchar*>& faces)
+        : m_pool{ pool }, m_start{ std::chrono::steady_clock::now() }
+    {
+        m_stats.parallel = true;
+        glGenTextures(1, &m_texture);
+        AddLevel(faces, 0);
+    }
+
+    AsyncCubemapLoader(const AsyncCubemapLoader&) = delete;
+    AsyncCubemapLoader& operator=(const AsyncCubemapLoader&) = delete;
+
+    ~AsyncCubemapLoader()
+    {
+        // Never leave decoded images or the texture behind if Finish() was not reached
+        for (std::future<DecodedImage>& pending : m_pending)
+        {
+            DecodedImage image{ pending.get() };
+            SOIL_free_image_data(image.pixels);
+        }
+        GetGLState().DeleteTextures(1, &m_texture);
+    }
+
+    // Queues the six faces of one mip level
+    void AddLevel(const std::vector<const GLchar*>& faces, GLint level)
+    {
+        for (GLuint i = 0; i < faces.size(); i++)
+        {
+            const GLchar* path{ faces[i] };
+            GLenum target{ GL_TEXTURE_CUBE_MAP_POSITIVE_X + i };
+            m_pending.push_back(m_pool.Submit([path, target, level] { return DecodeCubemapImage(path, target, level); }));
+        }
+    }
+
+    // Uploads every image that has finished decoding, never blocks. Returns true once nothing is pending
+    bool Poll()
+    {
+        for (size_t i{ 0 }; i < m_pending.size();)
+        {
+            if (m_pending[i].wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+            {
+                DecodedImage image{ m_pending[i].get() };
+                upload(image);
+                m_pending.erase(m_pending.begin() + i);
+            }
+            else
+            {
+                ++i;
+            }
+        }
+        return m_pending.empty();
+    }
+
+    // Uploads the remaining images in the order they finish and returns the completed texture
+    GLuint Finish(CubemapLoadStats* stats = nullptr)
+    {
+        while (!Poll())
+            std::this_thread::yield();
+
+        GetGLState().BindTexture(GL_TEXTURE_CUBE_MAP, m_texture);
+        SetCubemapSamplerState();
+        GetGLState().BindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+        m_stats.totalMs = ElapsedMilliseconds(m_start, std::chrono::steady_clock::now());
+        if (stats)
+            *stats = m_stats;
+
+        // The caller owns the texture from here on
+        GLuint texture{ m_texture };
+        m_texture = 0;
+        return texture;
+    }
+};
+
+// Decodes the faces on the pool and uploads them through PBOs
+inline GLuint LoadCubemap(ThreadPool& pool, const std::vector<const GLchar*>& faces, CubemapLoadStats* stats = nullptr)
+{
+    AsyncCubemapLoader loader(pool, faces);
+    return loader.Finish(stats);
+}
+
+// The original path: decode and upload one face after another on the calling thread. Kept as the reference for the timings
+inline GLuint LoadCubemapSerial(const std::vector<const GLchar*>& faces, CubemapLoadStats* stats = nullptr)
+{
+    CubemapLoadStats serialStats{};
+    auto loadStart = std::chrono::steady_clock::now();
+
+    GLuint textureID;
+    glGenTextures(1, &textureID);
+    GetGLState().BindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+
+    for (GLuint i = 0; i < faces.size(); i++)
+    {
+        DecodedImage image{ DecodeCubemapImage(faces[i], GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0) };
+        serialStats.decodeCpuMs += image.decodeMs;
+
+        auto uploadStart = std::chrono::steady_clock::now();
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(image.target, 0, GL_RGB, image.width, image.height, 0, GL_RGB, GL_UNSIGNED_BYTE, image.pixels);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        SOIL_free_image_data(image.pixels);
+        serialStats.uploadMs += ElapsedMilliseconds(uploadStart, std::chrono::steady_clock::now());
+        ++serialStats.images;
+    }
+    SetCubemapSamplerState();
+    GetGLState().BindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+    serialStats.decodeWallMs = serialStats.decodeCpuMs;
+    serialStats.totalMs = ElapsedMilliseconds(loadStart, std::chrono::steady_clock::now());
+    if (stats)
+        *stats = serialStats;
+
+    return textureID;
+}
+
+#endif
@@ -0,0 +1,228 @@
+#ifndef DYNAMIC_RESOLUTION_H
+#define DYNAMIC_RESOLUTION_H
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "GLState.h"
+
+// Frames between issuing a frame's timestamps and reading them, the controller reacts this late but never waits on the GPU
+constexpr unsigned RESOLUTION_QUERY_FRAMES{ 4 };
+
+// The scale moves at most this much per frame, and not at all while the frame time is within the dead band around the budget
+constexpr float RESOLUTION_MAX_STEP{ 0.05f };
+constexpr double RESOLUTION_DEAD_BAND{ 0.05 };
+
+// Rendered sizes are rounded to this many pixels, small changes of the scale then leave the size alone
+constexpr GLsizei RESOLUTION_GRANULARITY{ 8 };
+
+// The controller's state, plus counters since it was created
+struct ResolutionStats
+{
+    bool enabled{};
+    float scale{ 1.0f };
+    GLsizei width{};                    // rendered size, upscaled to the output
+    GLsizei height{};
+    double budgetMs{};                  // 0 for a fixed scale
+    double gpuMs{};                     // last measured frame, RESOLUTION_QUERY_FRAMES behind
+    double averageGpuMs{};              // smoothed, what the controller steers by
+    unsigned long long frames{};        // measured frames
+    unsigned long long misses{};        // measured frames over the budget
+    bool halfRateReflections{};
+};
+
+inline void PrintResolutionStats(const ResolutionStats& stats)
+{
+    if (!stats.enabled)
+        return;
+
+    std::cout << "  resolution: scale " << stats.scale << " (" << stats.width << "x" << stats.height << ")";
+    if (stats.budgetMs > 0.0)
+        std::cout << ", GPU " << stats.averageGpuMs << " ms of " << stats.budgetMs << " ms budget, " << stats.misses << " of " << stats.frames
+            << " frames over";
+    if (stats.halfRateReflections)
+        std::cout << ", reflections at half rate";
+    std::cout << std::endl;
+}
+
+// A colour texture and a depth renderbuffer, reallocated only when the requested size grows past what it holds, so a changing
+// resolution scale renders into the lower left corner of the same storage
+class RenderTarget
+{
+private:
+    GLenum m_colorFormat{};
+    GLuint m_framebuffer{};
+    GLuint m_colorTexture{};
+    GLuint m_depthBuffer{};
+    GLsizei m_width{};
+    GLsizei m_height{};
+
+public:
+    explicit RenderTarget(GLenum colorFormat)
+        : m_colorFormat{ colorFormat }
+    {
+    }
+
+    ~RenderTarget()
+    {
+        GetGLState().DeleteFramebuffers(1, &m_framebuffer);
+        GetGLState().DeleteTextures(1, &m_colorTexture);
+        glDeleteRenderbuffers(1, &m_depthBuffer);
+    }
+
+    RenderTarget(const RenderTarget&) = delete;
+    RenderTarget& operator=(const RenderTarget&) = delete;
+
+    // Makes the storage at least width x height (and never empty, a minimized window asks for 0 x 0), leaves the framebuffer binding alone
+    void Reserve(GLsizei width, GLsizei height)
+    {
+        width = std::max<GLsizei>(width, 1);
+        height = std::max<GLsizei>(height, 1);
+        if (m_framebuffer && width <= m_width && height <= m_height)
+            return;
+
+        m_width = std::max(width, m_width);
+        m_height = std::max(height, m_height);
+        GetGLState().DeleteFramebuffers(1, &m_framebuffer);
+        GetGLState().DeleteTextures(1, &m_colorTexture);
+        glDeleteRenderbuffers(1, &m_depthBuffer);
+
+        glGenTextures(1, &m_colorTexture);
+        GetGLState().BindTexture(GL_TEXTURE_2D, m_colorTexture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, m_colorFormat, m_width, m_height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        GetGLState().BindTexture(GL_TEXTURE_2D, 0);
+
+        glGenRenderbuffers(1, &m_depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, m_depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, m_width, m_height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        GLuint previous{ GetGLState().GetDrawFramebuffer() };
+        glGenFramebuffers(1, &m_framebuffer);
+        GetGLState().BindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, m_colorTexture, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, m_depthBuffer);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::RENDER_TARGET::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        GetGLState().BindFramebuffer(GL_FRAMEBUFFER, previous);
+    }
+
+    GLuint GetFramebuffer() const { return m_framebuffer; }
+    GLuint GetColorTexture() const { return m_colorTexture; }
+    GLsizei GetWidth() const { return m_width; }       // allocated size, the frame may use less
+    GLsizei GetHeight() const { return m_height; }
+};
+
+// Picks the resolution scale of every frame from the GPU time of earlier ones. Pixel cost goes with the square of the scale, so
+// the scale is moved by the square root of budget over the smoothed frame time, a step at a time and only outside a dead band
+// around the budget. A zero budget keeps the starting scale
+class ResolutionController
+{
+private:
+    double m_budgetMs{};
+    float m_minScale{};
+    GLuint m_queries[RESOLUTION_QUERY_FRAMES][2]{};
+    bool m_issued[RESOLUTION_QUERY_FRAMES]{};
+    unsigned m_frame{};
+    ResolutionStats m_stats{};
+
+    // Reads the timestamps of an older frame if they are there, never waits
+    void collectTiming(unsigned slot)
+    {
+        if (!m_issued[slot])
+            return;
+
+        GLint available{};
+        glGetQueryObjectiv(m_queries[slot][1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return;
+
+        GLuint64 begin{}, end{};
+        glGetQueryObjectui64v(m_queries[slot][0], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(m_queries[slot][1], GL_QUERY_RESULT, &end);
+        m_issued[slot] = false;
+
+        double ms{ (end - begin) / 1.0e6 };
+        m_stats.gpuMs = ms;
+        m_stats.averageGpuMs = m_stats.frames > 0 ? 0.8 * m_stats.averageGpuMs + 0.2 * ms : ms;
+        ++m_stats.frames;
+        if (m_budgetMs > 0.0 && ms > m_budgetMs)
+            ++m_stats.misses;
+        adjust();
+    }
+
+    void adjust()
+    {
+        if (m_budgetMs <= 0.0 || m_stats.averageGpuMs <= 0.0)
+            return;
+
+        double ratio{ m_budgetMs / m_stats.averageGpuMs };
+        if (std::abs(ratio - 1.0) < RESOLUTION_DEAD_BAND)
+            return;
+
+        float step{ std::clamp(static_cast<float>(std::sqrt(ratio)) * m_stats.scale - m_stats.scale, -RESOLUTION_MAX_STEP, RESOLUTION_MAX_STEP) };
+        m_stats.scale = std::clamp(m_stats.scale + step, m_minScale, 1.0f);
+    }
+
+public:
+    // Needs a current context
+    ResolutionController(double budgetMs, float scale, float minScale, bool halfRateReflections)
+        : m_budgetMs{ budgetMs }, m_minScale{ std::clamp(minScale, 0.1f, 1.0f) }
+    {
+        m_stats.enabled = true;
+        m_stats.budgetMs = budgetMs;
+        m_stats.scale = std::clamp(scale, m_minScale, 1.0f);
+        m_stats.halfRateReflections = halfRateReflections;
+        for (GLuint* queries : m_queries)
+            glGenQueries(2, queries);
+    }
+
+    ~ResolutionController()
+    {
+        for (GLuint* queries : m_queries)
+            glDeleteQueries(2, queries);
+    }
+
+    ResolutionController(const ResolutionController&) = delete;
+    ResolutionController& operator=(const ResolutionController&) = delete;
+
+    // Starts timing a frame of the given output size and returns the size to render it at, at least 1 x 1
+    void BeginFrame(GLsizei outputWidth, GLsizei outputHeight, GLsizei& width, GLsizei& height)
+    {
+        outputWidth = std::max<GLsizei>(outputWidth, 1);
+        outputHeight = std::max<GLsizei>(outputHeight, 1);
+        unsigned slot{ m_frame % RESOLUTION_QUERY_FRAMES };
+        collectTiming(slot);
+
+        auto scaled = [this](GLsizei size)
+        {
+            GLsizei rounded{ static_cast<GLsizei>(std::lround(size * m_stats.scale / RESOLUTION_GRANULARITY)) * RESOLUTION_GRANULARITY };
+            return std::clamp(rounded, std::min(size, RESOLUTION_GRANULARITY), size);
+        };
+        width = scaled(outputWidth);
+        height = scaled(outputHeight);
+        m_stats.width = width;
+        m_stats.height = height;
+        glQueryCounter(m_queries[slot][0], GL_TIMESTAMP);
+    }
+
+    void EndFrame()
+    {
+        unsigned slot{ m_frame % RESOLUTION_QUERY_FRAMES };
+        glQueryCounter(m_queries[slot][1], GL_TIMESTAMP);
+        m_issued[slot] = true;
+        ++m_frame;
+    }
+
+    const ResolutionStats& GetStats() const { return m_stats; }
+};
+
+#endif
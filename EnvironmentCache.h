@@ -0,0 +1,527 @@
+#ifndef ENVIRONMENT_CACHE_H
+#define ENVIRONMENT_CACHE_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <SOIL2.h>
+
+#include "Cubemap.h"
+#include "GLState.h"
+#include "Hash.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+
+// Baked cubemap container.
+// The file is a fixed header followed by every mip level of every face, stored exactly as glTexSubImage2D / glCompressedTexSubImage2D
+// expect them, so loading is a mapping of the file and one upload call per image. The header keeps a hash of the source images,
+// a cache that no longer matches its sources is rebuilt on the next start
+
+constexpr std::uint32_t ENVIRONMENT_CACHE_MAGIC{ 0x43564E45 }; // "ENVC"
+constexpr std::uint32_t ENVIRONMENT_CACHE_VERSION{ 1 };
+constexpr std::uint32_t ENVIRONMENT_CACHE_MAX_LEVELS{ 16 };
+constexpr std::uint32_t ENVIRONMENT_CACHE_FACES{ 6 };
+
+enum EnvironmentCacheFormat : std::uint32_t
+{
+    ENVIRONMENT_FORMAT_RGB8 = 0,
+    ENVIRONMENT_FORMAT_BC1 = 1
+};
+
+struct EnvironmentCacheLevel
+{
+    std::uint32_t size;         // width and height of the level
+    std::uint32_t faceBytes;    // bytes of one face at this level
+    std::uint64_t offset;       // file offset of face 0, the other faces follow in GL_TEXTURE_CUBE_MAP_POSITIVE_X + i order
+};
+
+struct EnvironmentCacheHeader
+{
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint64_t sourceHash;
+    std::uint32_t faceSize;
+    std::uint32_t levelCount;
+    std::uint32_t format;
+    std::uint32_t reserved;
+    EnvironmentCacheLevel levels[ENVIRONMENT_CACHE_MAX_LEVELS];
+};
+
+struct EnvironmentLoadStats
+{
+    double hashMs{};        // hashing the source images to validate the cache
+    double bakeMs{};        // only when the cache was missing or stale
+    double uploadMs{};
+    double totalMs{};
+    size_t gpuBytes{};      // texture memory of the whole mip chain
+    bool rebuilt{};
+};
+
+inline void PrintEnvironmentLoadStats(const EnvironmentLoadStats& stats)
+{
+    std::cout << "Environment cache" << (stats.rebuilt ? " (rebuilt)" : "") << ": hash " << stats.hashMs << " ms, bake " << stats.bakeMs
+        << " ms, upload " << stats.uploadMs << " ms, total " << stats.totalMs << " ms, " << stats.gpuBytes / 1024 << " KiB on the GPU" << std::endl;
+}
+
+inline std::uint64_t HashEnvironmentSources(const std::vector<const GLchar*>& faces)
+{
+    std::uint64_t hash{ FNV_OFFSET_BASIS };
+    for (const GLchar* face : faces)
+        hash = HashFile(face, hash);
+    return hash;
+}
+
+inline std::uint32_t EnvironmentFaceBytes(std::uint32_t size, std::uint32_t format)
+{
+    if (format == ENVIRONMENT_FORMAT_BC1)
+    {
+        std::uint32_t blocks{ (size + 3) / 4 };
+        return blocks * blocks * 8;
+    }
+    return size * size * 3;
+}
+
+// Halves an RGB image with a 2x2 box filter
+inline std::vector<unsigned char> DownsampleRGB(const std::vector<unsigned char>& source, std::uint32_t size)
+{
+    std::uint32_t half{ std::max(1u, size / 2) };
+    std::vector<unsigned char> result(static_cast<size_t>(half) * half * 3);
+    for (std::uint32_t y{ 0 }; y < half; ++y)
+    {
+        std::uint32_t y0{ std::min(y * 2, size - 1) }, y1{ std::min(y * 2 + 1, size - 1) };
+        for (std::uint32_t x{ 0 }; x < half; ++x)
+        {
+            std::uint32_t x0{ std::min(x * 2, size - 1) }, x1{ std::min(x * 2 + 1, size - 1) };
+            for (std::uint32_t c{ 0 }; c < 3; ++c)
+            {
+                unsigned sum = source[(y0 * size + x0) * 3 + c] + source[(y0 * size + x1) * 3 + c]
+                    + source[(y1 * size + x0) * 3 + c] + source[(y1 * size + x1) * 3 + c];
+                result[(y * half + x) * 3 + c] = static_cast<unsigned char>((sum + 2) / 4);
+            }
+        }
+    }
+    return result;
+}
+
+inline std::uint16_t PackRGB565(const float color[3])
+{
+    unsigned r = static_cast<unsigned>(std::min(std::max(color[0], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+    unsigned g = static_cast<unsigned>(std::min(std::max(color[1], 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+    unsigned b = static_cast<unsigned>(std::min(std::max(color[2], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+    return static_cast<std::uint16_t>((r << 11) | (g << 5) | b);
+}
+
+inline void UnpackRGB565(std::uint16_t packed, int color[3])
+{
+    int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+    color[0] = (r << 3) | (r >> 2);
+    color[1] = (g << 2) | (g >> 4);
+    color[2] = (b << 3) | (b >> 2);
+}
+
+// Encodes one 4x4 RGB block (48 bytes, row major) to BC1.
+// The endpoints are the extremes of the block along its principal axis, which is good enough for photographic skies
+inline void EncodeBC1Block(const unsigned char* block, unsigned char* output)
+{
+    float mean[3]{};
+    for (int i{ 0 }; i < 16; ++i)
+        for (int c{ 0 }; c < 3; ++c)
+            mean[c] += block[i * 3 + c] / 16.0f;
+
+    float covariance[6]{};
+    for (int i{ 0 }; i < 16; ++i)
+    {
+        float r{ block[i * 3] - mean[0] }, g{ block[i * 3 + 1] - mean[1] }, b{ block[i * 3 + 2] - mean[2] };
+        covariance[0] += r * r; covariance[1] += r * g; covariance[2] += r * b;
+        covariance[3] += g * g; covariance[4] += g * b; covariance[5] += b * b;
+    }
+
+    // A few power iterations are enough to find the dominant axis
+    float axis[3]{ 1.0f, 1.0f, 1.0f };
+    for (int iteration{ 0 }; iteration < 4; ++iteration)
+    {
+        float x{ covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2] };
+        float y{ covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2] };
+        float z{ covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2] };
+        float length{ std::sqrt(x * x + y * y + z * z) };
+        if (length < 1e-6f)
+            break;
+        axis[0] = x / length; axis[1] = y / length; axis[2] = z / length;
+    }
+
+    float minProjection{ 0.0f }, maxProjection{ 0.0f };
+    for (int i{ 0 }; i < 16; ++i)
+    {
+        float projection{ (block[i * 3] - mean[0]) * axis[0] + (block[i * 3 + 1] - mean[1]) * axis[1] + (block[i * 3 + 2] - mean[2]) * axis[2] };
+        minProjection = std::min(minProjection, projection);
+        maxProjection = std::max(maxProjection, projection);
+    }
+
+    float endpoint0[3], endpoint1[3];
+    for (int c{ 0 }; c < 3; ++c)
+    {
+        endpoint0[c] = mean[c] + axis[c] * maxProjection;
+        endpoint1[c] = mean[c] + axis[c] * minProjection;
+    }
+
+    std::uint16_t color0{ PackRGB565(endpoint0) }, color1{ PackRGB565(endpoint1) };
+    if (color0 < color1)
+        std::swap(color0, color1);
+
+    // color0 > color1 selects the four colour mode
+    std::uint32_t indices{ 0 };
+    if (color0 != color1)
+    {
+        int palette[4][3];
+        UnpackRGB565(color0, palette[0]);
+        UnpackRGB565(color1, palette[1]);
+        for (int c{ 0 }; c < 3; ++c)
+        {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+
+        for (int i{ 0 }; i < 16; ++i)
+        {
+            int best{ 0 }, bestDistance{ 1 << 30 };
+            for (int p{ 0 }; p < 4; ++p)
+            {
+                int dr{ block[i * 3] - palette[p][0] }, dg{ block[i * 3 + 1] - palette[p][1] }, db{ block[i * 3 + 2] - palette[p][2] };
+                int distance{ dr * dr + dg * dg + db * db };
+                if (distance < bestDistance)
+                {
+                    bestDistance = distance;
+                    best = p;
+                }
+            }
+            indices |= static_cast<std::uint32_t>(best) << (i * 2);
+        }
+    }
+
+    output[0] = static_cast<unsigned char>(color0 & 0xFF);
+    output[1] = static_cast<unsigned char>(color0 >> 8);
+    output[2] = static_cast<unsigned char>(color1 & 0xFF);
+    output[3] = static_cast<unsigned char>(color1 >> 8);
+    for (int i{ 0 }; i < 4; ++i)
+        output[4 + i] = static_cast<unsigned char>((indices >> (i * 8)) & 0xFF);
+}
+
+inline std::vector<unsigned char> EncodeBC1(const std::vector<unsigned char>& rgb, std::uint32_t size)
+{
+    std::uint32_t blocks{ (size + 3) / 4 };
+    std::vector<unsigned char> result(static_cast<size_t>(blocks) * blocks * 8);
+    unsigned char block[48];
+    for (std::uint32_t by{ 0 }; by < blocks; ++by)
+    {
+        for (std::uint32_t bx{ 0 }; bx < blocks; ++bx)
+        {
+            // Levels smaller than a block repeat their edge texels
+            for (std::uint32_t y{ 0 }; y < 4; ++y)
+            {
+                std::uint32_t sy{ std::min(by * 4 + y, size - 1) };
+                for (std::uint32_t x{ 0 }; x < 4; ++x)
+                {
+                    std::uint32_t sx{ std::min(bx * 4 + x, size - 1) };
+                    std::memcpy(&block[(y * 4 + x) * 3], &rgb[(static_cast<size_t>(sy) * size + sx) * 3], 3);
+                }
+            }
+            EncodeBC1Block(block, &result[(static_cast<size_t>(by) * blocks + bx) * 8]);
+        }
+    }
+    return result;
+}
+
+// Decodes the source faces, builds the full mip chain of each face in parallel and writes the container. It is written next to
+// cachePath and renamed over it once complete, so a failed bake never leaves a truncated cache behind. The old cache must not be
+// mapped meanwhile (Windows refuses to replace a mapped file). Needs no GL context, so it also runs as an offline step (--bake-environment)
+inline bool BakeEnvironmentCache(ThreadPool& pool, const std::vector<const GLchar*>& faces, const std::string& cachePath, EnvironmentCacheFormat format)
+{
+    if (faces.size() != ENVIRONMENT_CACHE_FACES)
+    {
+        std::cout << "ERROR::ENVIRONMENT_CACHE::NEEDS_SIX_FACES" << std::endl;
+        return false;
+    }
+
+    std::uint64_t sourceHash{ HashEnvironmentSources(faces) };
+
+    // Each task decodes one face and produces its encoded mip chain
+    std::vector<std::future<std::vector<std::vector<unsigned char>>>> chains;
+    std::vector<std::uint32_t> faceSizes(faces.size());
+    for (size_t i{ 0 }; i < faces.size(); ++i)
+    {
+        const GLchar* path{ faces[i] };
+        std::uint32_t* faceSize{ &faceSizes[i] };
+        chains.push_back(pool.Submit([path, faceSize, format]
+        {
+            std::vector<std::vector<unsigned char>> levels;
+            DecodedImage image{ DecodeCubemapImage(path, GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0) };
+            if (!image.pixels || image.width != image.height)
+            {
+                SOIL_free_image_data(image.pixels);
+                return levels;
+            }
+
+            std::uint32_t size{ static_cast<std::uint32_t>(image.width) };
+            *faceSize = size;
+            std::vector<unsigned char> level(image.pixels, image.pixels + static_cast<size_t>(size) * size * 3);
+            SOIL_free_image_data(image.pixels);
+
+            for (;;)
+            {
+                levels.push_back(format == ENVIRONMENT_FORMAT_BC1 ? EncodeBC1(level, size) : level);
+                if (size == 1 || levels.size() == ENVIRONMENT_CACHE_MAX_LEVELS)
+                    break;
+                level = DownsampleRGB(level, size);
+                size = std::max(1u, size / 2);
+            }
+            return levels;
+        }));
+    }
+
+    std::vector<std::vector<std::vector<unsigned char>>> faceLevels;
+    for (auto& chain : chains)
+        faceLevels.push_back(chain.get());
+
+    for (size_t i{ 0 }; i < faceLevels.size(); ++i)
+    {
+        if (faceLevels[i].empty() || faceSizes[i] != faceSizes[0])
+        {
+            std::cout << "ERROR::ENVIRONMENT_CACHE::FACES_MUST_BE_SQUARE_AND_EQUAL " << faces[i] << std::endl;
+            return false;
+        }
+    }
+
+    EnvironmentCacheHeader header{};
+    header.magic = ENVIRONMENT_CACHE_MAGIC;
+    header.version = ENVIRONMENT_CACHE_VERSION;
+    header.sourceHash = sourceHash;
+    header.faceSize = faceSizes[0];
+    header.levelCount = static_cast<std::uint32_t>(faceLevels[0].size());
+    header.format = format;
+
+    std::uint64_t offset{ sizeof(EnvironmentCacheHeader) };
+    for (std::uint32_t level{ 0 }; level < header.levelCount; ++level)
+    {
+        header.levels[level].size = std::max(1u, header.faceSize >> level);
+        header.levels[level].faceBytes = EnvironmentFaceBytes(header.levels[level].size, format);
+        header.levels[level].offset = offset;
+        offset += static_cast<std::uint64_t>(header.levels[level].faceBytes) * ENVIRONMENT_CACHE_FACES;
+    }
+
+    std::string temporaryPath{ cachePath + ".tmp" };
+    {
+        std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+        if (file)
+        {
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            for (std::uint32_t level{ 0 }; level < header.levelCount; ++level)
+                for (size_t face{ 0 }; face < ENVIRONMENT_CACHE_FACES; ++face)
+                    file.write(reinterpret_cast<const char*>(faceLevels[face][level].data()), faceLevels[face][level].size());
+            file.close();
+        }
+        if (!file)
+        {
+            std::cout << "ERROR::ENVIRONMENT_CACHE::CANNOT_WRITE " << temporaryPath << std::endl;
+            std::error_code ignored{};
+            std::filesystem::remove(temporaryPath, ignored);
+            return false;
+        }
+    }
+
+    std::error_code error{};
+    std::filesystem::rename(temporaryPath, cachePath, error);
+    if (error)
+    {
+        std::cout << "ERROR::ENVIRONMENT_CACHE::CANNOT_REPLACE " << cachePath << ": " << error.message() << std::endl;
+        std::filesystem::remove(temporaryPath, error);
+        return false;
+    }
+    return true;
+}
+
+// A mapped, validated cache file
+class EnvironmentCache
+{
+private:
+    MappedFile m_file;
+    const EnvironmentCacheHeader* m_header{};
+
+public:
+    // Maps the file and checks it was baked from sources with the given hash. A file that fails any check is unmapped again, so it
+    // can be rebaked in place
+    bool Open(const std::string& cachePath, std::uint64_t expectedHash)
+    {
+        Close();
+        if (!m_file.Open(cachePath))
+            return false;
+        if (m_file.GetSize() < sizeof(EnvironmentCacheHeader))
+        {
+            Close();
+            return false;
+        }
+
+        const EnvironmentCacheHeader* header{ reinterpret_cast<const EnvironmentCacheHeader*>(m_file.GetData()) };
+        if (header->magic != ENVIRONMENT_CACHE_MAGIC || header->version != ENVIRONMENT_CACHE_VERSION || header->sourceHash != expectedHash
+            || header->levelCount == 0 || header->levelCount > ENVIRONMENT_CACHE_MAX_LEVELS)
+        {
+            Close();
+            return false;
+        }
+
+        const EnvironmentCacheLevel& last{ header->levels[header->levelCount - 1] };
+        if (last.offset + static_cast<std::uint64_t>(last.faceBytes) * ENVIRONMENT_CACHE_FACES > m_file.GetSize())
+        {
+            Close();
+            return false;
+        }
+
+        m_header = header;
+        return true;
+    }
+
+    void Close()
+    {
+        m_header = nullptr;
+        m_file.Close();
+    }
+
+    bool IsValid() const { return m_header != nullptr; }
+    const EnvironmentCacheHeader& GetHeader() const { return *m_header; }
+
+    const unsigned char* GetFaceData(std::uint32_t level, std::uint32_t face) const
+    {
+        const EnvironmentCacheLevel& entry{ m_header->levels[level] };
+        return m_file.GetData() + entry.offset + static_cast<std::uint64_t>(entry.faceBytes) * face;
+    }
+
+    // Faults in the pages of every face of a level, for a pool thread to run ahead of the upload
+    void PrefetchLevel(std::uint32_t level) const
+    {
+        const EnvironmentCacheLevel& entry{ m_header->levels[level] };
+        m_file.Touch(static_cast<size_t>(entry.offset), static_cast<size_t>(entry.faceBytes) * ENVIRONMENT_CACHE_FACES);
+    }
+
+    GLenum GetInternalFormat() const
+    {
+        return m_header->format == ENVIRONMENT_FORMAT_BC1 ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_RGB8;
+    }
+
+    // Uploads the level range [firstLevel, lastLevel] straight from the mapping into an allocated texture
+    void UploadLevels(GLuint texture, std::uint32_t firstLevel, std::uint32_t lastLevel) const
+    {
+        GetGLState().BindTexture(GL_TEXTURE_CUBE_MAP, texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (std::uint32_t level{ firstLevel }; level <= lastLevel && level < m_header->levelCount; ++level)
+        {
+            const EnvironmentCacheLevel& entry{ m_header->levels[level] };
+            GLsizei size{ static_cast<GLsizei>(entry.size) };
+            for (std::uint32_t face{ 0 }; face < ENVIRONMENT_CACHE_FACES; ++face)
+            {
+                GLenum target{ GL_TEXTURE_CUBE_MAP_POSITIVE_X + face };
+                if (m_header->format == ENVIRONMENT_FORMAT_BC1)
+                    glCompressedTexSubImage2D(target, level, 0, 0, size, size, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, entry.faceBytes, GetFaceData(level, face));
+                else
+                    glTexSubImage2D(target, level, 0, 0, size, size, GL_RGB, GL_UNSIGNED_BYTE, GetFaceData(level, face));
+            }
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        GetGLState().BindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    }
+
+    // GPU bytes of the level range once uploaded
+    size_t GetLevelBytes(std::uint32_t firstLevel, std::uint32_t lastLevel) const
+    {
+        size_t bytes{ 0 };
+        for (std::uint32_t level{ firstLevel }; level <= lastLevel && level < m_header->levelCount; ++level)
+        {
+            GLsizei size{ static_cast<GLsizei>(m_header->levels[level].size) };
+            bytes += TextureImageBytes(GetInternalFormat(), size, size) * ENVIRONMENT_CACHE_FACES;
+        }
+        return bytes;
+    }
+
+    // Creates the immutable cubemap with the full mip chain and uploads every level
+    GLuint CreateTexture() const
+    {
+        GLuint texture{};
+        glGenTextures(1, &texture);
+        GetGLState().BindTexture(GL_TEXTURE_CUBE_MAP, texture);
+        glTexStorage2D(GL_TEXTURE_CUBE_MAP, m_header->levelCount, GetInternalFormat(), m_header->faceSize, m_header->faceSize);
+        SetCubemapSamplerState();
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, m_header->levelCount - 1);
+        GetGLState().BindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+        UploadLevels(texture, 0, m_header->levelCount - 1);
+        return texture;
+    }
+};
+
+// Maps the baked cache, rebuilding it first when it is missing, older than its sources or in another format than the one the
+// textures will be created with. Needs a current context. Fills the hash and bake times of stats
+inline bool OpenEnvironmentCache(ThreadPool& pool, const std::vector<const GLchar*>& faces, const std::string& cachePath, EnvironmentCacheFormat format,
+    EnvironmentCache& cache, EnvironmentLoadStats& stats)
+{
+    // S3TC is not core GL; without it a BC1 texture cannot be created, so the cache is used (and rebaked if need be) as RGB8
+    if (format == ENVIRONMENT_FORMAT_BC1 && !GLEW_EXT_texture_compression_s3tc)
+    {
+        std::cout << "Environment cache: no S3TC support, using uncompressed RGB8" << std::endl;
+        format = ENVIRONMENT_FORMAT_RGB8;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::uint64_t sourceHash{ HashEnvironmentSources(faces) };
+    auto hashed = std::chrono::steady_clock::now();
+    stats.hashMs = ElapsedMilliseconds(start, hashed);
+
+    // A cache baked in another format than the one requested is treated as stale too
+    if (!cache.Open(cachePath, sourceHash) || cache.GetHeader().format != format)
+    {
+        // Unmapped before the bake replaces the file
+        cache.Close();
+        stats.rebuilt = true;
+        if (!BakeEnvironmentCache(pool, faces, cachePath, format) || !cache.Open(cachePath, sourceHash))
+        {
+            std::cout << "ERROR::ENVIRONMENT_CACHE::REBUILD_FAILED " << cachePath << std::endl;
+            return false;
+        }
+        stats.bakeMs = ElapsedMilliseconds(hashed, std::chrono::steady_clock::now());
+    }
+    return true;
+}
+
+// Returns the cubemap from the baked cache, rebuilding the cache first when it is missing or older than its sources
+inline GLuint LoadEnvironmentCubemap(ThreadPool& pool, const std::vector<const GLchar*>& faces, const std::string& cachePath,
+    EnvironmentCacheFormat format, EnvironmentLoadStats* stats = nullptr)
+{
+    EnvironmentLoadStats loadStats{};
+    auto start = std::chrono::steady_clock::now();
+
+    EnvironmentCache cache;
+    if (!OpenEnvironmentCache(pool, faces, cachePath, format, cache, loadStats))
+        return 0;
+
+    auto uploadStart = std::chrono::steady_clock::now();
+    GLuint texture{ cache.CreateTexture() };
+    loadStats.uploadMs = ElapsedMilliseconds(uploadStart, std::chrono::steady_clock::now());
+    loadStats.gpuBytes = cache.GetLevelBytes(0, cache.GetHeader().levelCount - 1);
+    loadStats.totalMs = ElapsedMilliseconds(start, std::chrono::steady_clock::now());
+
+    if (stats)
+        *stats = loadStats;
+    return texture;
+}
+
+#endif
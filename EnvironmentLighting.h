@@ -0,0 +1,656 @@
+#ifndef ENVIRONMENT_LIGHTING_H
+#define ENVIRONMENT_LIGHTING_H
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <SOIL2.h>
+
+#include <glm/glm.hpp>
+
+#include "Cubemap.h"
+#include "EnvironmentCache.h"
+#include "GLState.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include "UniformBlocks.h"
+
+// Image based lighting baked from the skybox faces on the CPU:
+// - nine spherical harmonic coefficients of the irradiance, convolved with the cosine lobe so evaluating them gives the diffuse radiance
+// - a cubemap whose level i is the environment filtered with a GGX lobe of roughness i / (levels - 1), read with a single textureLod
+// Both live in one cache file keyed by the hash of the faces, like the environment cache, and are rebuilt when the faces change
+
+constexpr std::uint32_t ENVIRONMENT_LIGHTING_MAGIC{ 0x434C4249 }; // "IBLC"
+constexpr std::uint32_t ENVIRONMENT_LIGHTING_VERSION{ 1 };
+constexpr std::uint32_t PREFILTERED_SIZE{ 256 };        // level 0, the mirror-like one
+constexpr std::uint32_t PREFILTERED_LEVELS{ 6 };        // 256 down to 8, roughness 0, 0.2, ... 1
+constexpr std::uint32_t PREFILTER_SAMPLES{ 64 };        // GGX samples per texel, reading from a mip of the source matched to each sample's footprint
+constexpr std::uint32_t PREFILTER_SOURCE_SIZE{ 512 };   // faces are box filtered down to this size before anything is sampled
+constexpr int ENVIRONMENT_LIGHTING_ROWS_PER_TASK{ 16 };
+
+struct EnvironmentLightingHeader
+{
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint64_t sourceHash;
+    std::uint32_t faceSize;
+    std::uint32_t levelCount;
+    std::uint32_t sampleCount;
+    std::uint32_t reserved;
+    float irradiance[9][4];
+    EnvironmentCacheLevel levels[ENVIRONMENT_CACHE_MAX_LEVELS];
+};
+
+struct EnvironmentLightingStats
+{
+    double hashMs{};
+    double decodeMs{};      // decoding and box filtering the faces, only when rebuilt
+    double projectMs{};     // SH projection
+    double prefilterMs{};
+    double totalMs{};
+    size_t gpuBytes{};
+    bool rebuilt{};
+};
+
+inline void PrintEnvironmentLightingStats(const EnvironmentLightingStats& stats)
+{
+    std::cout << "Environment lighting" << (stats.rebuilt ? " (rebuilt)" : "") << ": hash " << stats.hashMs << " ms, decode " << stats.decodeMs
+        << " ms, SH projection " << stats.projectMs << " ms, prefilter " << stats.prefilterMs << " ms, total " << stats.totalMs << " ms, "
+        << stats.gpuBytes / 1024 << " KiB on the GPU" << std::endl;
+}
+
+// Direction through LANES texel centres of one face, s and t in [-1, 1]. Inverse of SelectCubemapFace, the result is not normalized
+inline Vec3Lanes CubemapFaceDirection(int face, FloatLanes s, FloatLanes t)
+{
+    const FloatLanes one{ 1.0f }, zero{ 0.0f };
+    switch (face)
+    {
+    case 0:     return { one, zero - t, zero - s };
+    case 1:     return { zero - one, zero - t, s };
+    case 2:     return { s, one, t };
+    case 3:     return { s, zero - one, zero - t };
+    case 4:     return { s, zero - t, one };
+    default:    return { zero - s, zero - t, zero - one };
+    }
+}
+
+// Real SH basis up to band 2, the constants of IrradianceSH() in lighting.frag
+inline void EvaluateSH9(const Vec3Lanes& n, FloatLanes basis[9])
+{
+    basis[0] = 0.282095f;
+    basis[1] = n.y * 0.488603f;
+    basis[2] = n.z * 0.488603f;
+    basis[3] = n.x * 0.488603f;
+    basis[4] = n.x * n.y * 1.092548f;
+    basis[5] = n.y * n.z * 1.092548f;
+    basis[6] = (n.z * n.z * 3.0f - 1.0f) * 0.315392f;
+    basis[7] = n.x * n.z * 1.092548f;
+    basis[8] = (n.x * n.x - n.y * n.y) * 0.546274f;
+}
+
+// Diffuse radiance around LANES normals
+inline Vec3Lanes EvaluateIrradiance(const glm::vec3 coefficients[9], const Vec3Lanes& normal)
+{
+    FloatLanes basis[9];
+    EvaluateSH9(normal, basis);
+    Vec3Lanes result{ 0.0f, 0.0f, 0.0f };
+    for (int i{ 0 }; i < 9; ++i)
+        result = result + Vec3Lanes(coefficients[i].x, coefficients[i].y, coefficients[i].z) * basis[i];
+    return { Max(result.x, 0.0f), Max(result.y, 0.0f), Max(result.z, 0.0f) };
+}
+
+// Float cubemap with one plane per channel, sampled like a GL cubemap with GL_LINEAR_MIPMAP_LINEAR and clamped edges
+class FloatCubemap
+{
+private:
+    struct Level
+    {
+        int size{};
+        std::vector<float> planes[6][3];
+    };
+
+    std::vector<Level> m_levels;
+
+    static glm::vec3 fetch(const Level& level, int face, float s, float t)
+    {
+        int size{ level.size };
+        float u{ s * size - 0.5f }, v{ t * size - 0.5f };
+        float u0{ std::floor(u) }, v0{ std::floor(v) };
+        float fu{ u - u0 }, fv{ v - v0 };
+        int x0{ std::clamp(static_cast<int>(u0), 0, size - 1) }, x1{ std::clamp(static_cast<int>(u0) + 1, 0, size - 1) };
+        int y0{ std::clamp(static_cast<int>(v0), 0, size - 1) }, y1{ std::clamp(static_cast<int>(v0) + 1, 0, size - 1) };
+
+        glm::vec3 result{};
+        for (int c{ 0 }; c < 3; ++c)
+        {
+            const float* plane{ level.planes[face][c].data() };
+            float top{ plane[y0 * size + x0] + (plane[y0 * size + x1] - plane[y0 * size + x0]) * fu };
+            float bottom{ plane[y1 * size + x0] + (plane[y1 * size + x1] - plane[y1 * size + x0]) * fu };
+            result[c] = top + (bottom - top) * fv;
+        }
+        return result;
+    }
+
+public:
+    // Appends a level from six RGB8 faces in GL_TEXTURE_CUBE_MAP_POSITIVE_X + i order
+    void AddLevel(int size, const unsigned char* const faces[6])
+    {
+        Level level{};
+        level.size = size;
+        size_t texels{ static_cast<size_t>(size) * size };
+        for (int face{ 0 }; face < 6; ++face)
+        {
+            for (int c{ 0 }; c < 3; ++c)
+            {
+                level.planes[face][c].resize(texels);
+                for (size_t i{ 0 }; i < texels; ++i)
+                    level.planes[face][c][i] = faces[face][i * 3 + c] * (1.0f / 255.0f);
+            }
+        }
+        m_levels.push_back(std::move(level));
+    }
+
+    // Appends 2x2 box filtered levels down to 1x1
+    void BuildMipChain()
+    {
+        while (!m_levels.empty() && m_levels.back().size > 1)
+        {
+            const Level& source{ m_levels.back() };
+            Level level{};
+            level.size = source.size / 2;
+            for (int face{ 0 }; face < 6; ++face)
+            {
+                for (int c{ 0 }; c < 3; ++c)
+                {
+                    const std::vector<float>& plane{ source.planes[face][c] };
+                    std::vector<float>& half{ level.planes[face][c] };
+                    half.resize(static_cast<size_t>(level.size) * level.size);
+                    for (int y{ 0 }; y < level.size; ++y)
+                        for (int x{ 0 }; x < level.size; ++x)
+                            half[y * level.size + x] = 0.25f * (plane[(2 * y) * source.size + 2 * x] + plane[(2 * y) * source.size + 2 * x + 1]
+                                + plane[(2 * y + 1) * source.size + 2 * x] + plane[(2 * y + 1) * source.size + 2 * x + 1]);
+                }
+            }
+            m_levels.push_back(std::move(level));
+        }
+    }
+
+    bool IsEmpty() const { return m_levels.empty(); }
+    int GetLevelCount() const { return static_cast<int>(m_levels.size()); }
+    int GetSize(int level) const { return m_levels[level].size; }
+    const float* GetPlane(int level, int face, int channel) const { return m_levels[level].planes[face][channel].data(); }
+
+    // Trilinear lookup, lod is clamped to the chain
+    glm::vec3 Sample(const glm::vec3& direction, float lod) const
+    {
+        float s{}, t{};
+        int face{ SelectCubemapFace(direction.x, direction.y, direction.z, s, t) };
+        lod = std::clamp(lod, 0.0f, static_cast<float>(m_levels.size() - 1));
+        int level{ static_cast<int>(lod) };
+        float blend{ lod - level };
+
+        glm::vec3 result{ fetch(m_levels[level], face, s, t) };
+        if (blend > 0.0f && level + 1 < static_cast<int>(m_levels.size()))
+            result = glm::mix(result, fetch(m_levels[level + 1], face, s, t), blend);
+        return result;
+    }
+};
+
+// One GGX sample of a prefiltered level, in the tangent frame of the texel being filtered (z along the normal, which is also the view
+// direction), with the source level whose texels match the sample's solid angle
+struct PrefilterSample
+{
+    float x, y, z;
+    float lod;
+};
+
+inline std::vector<PrefilterSample> BuildPrefilterSamples(float roughness, int sourceSize, int sourceLevels, int outputSize)
+{
+    std::vector<PrefilterSample> samples;
+    if (roughness <= 0.0f)
+    {
+        // Mirror level, a plain resample of the source
+        samples.push_back({ 0.0f, 0.0f, 1.0f, std::log2(static_cast<float>(sourceSize) / outputSize) });
+        return samples;
+    }
+
+    float alpha{ roughness * roughness };
+    float alpha2{ alpha * alpha };
+    float texelSolidAngle{ 4.0f * 3.14159265f / (6.0f * sourceSize * sourceSize) };
+    for (std::uint32_t i{ 0 }; i < PREFILTER_SAMPLES; ++i)
+    {
+        // Hammersley point, then a GGX half vector
+        std::uint32_t bits{ i };
+        bits = (bits << 16) | (bits >> 16);
+        bits = ((bits & 0x55555555u) << 1) | ((bits & 0xAAAAAAAAu) >> 1);
+        bits = ((bits & 0x33333333u) << 2) | ((bits & 0xCCCCCCCCu) >> 2);
+        bits = ((bits & 0x0F0F0F0Fu) << 4) | ((bits & 0xF0F0F0F0u) >> 4);
+        bits = ((bits & 0x00FF00FFu) << 8) | ((bits & 0xFF00FF00u) >> 8);
+        float u{ (i + 0.5f) / PREFILTER_SAMPLES }, v{ bits * 2.3283064365386963e-10f };
+
+        float phi{ 2.0f * 3.14159265f * u };
+        float cosTheta{ std::sqrt((1.0f - v) / (1.0f + (alpha2 - 1.0f) * v)) };
+        float sinTheta{ std::sqrt(1.0f - cosTheta * cosTheta) };
+        glm::vec3 half{ sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta };
+
+        // With the view along the normal, the light is the view reflected about the half vector
+        glm::vec3 light{ 2.0f * half.z * half.x, 2.0f * half.z * half.y, 2.0f * half.z * half.z - 1.0f };
+        if (light.z <= 0.0f)
+            continue;
+
+        // pdf of the light direction is D / 4 when N = V
+        float denominator{ cosTheta * cosTheta * (alpha2 - 1.0f) + 1.0f };
+        float distribution{ alpha2 / (3.14159265f * denominator * denominator) };
+        float sampleSolidAngle{ 1.0f / (PREFILTER_SAMPLES * distribution * 0.25f) };
+        float lod{ std::clamp(0.5f * std::log2(sampleSolidAngle / texelSolidAngle) + 1.0f, 0.0f, static_cast<float>(sourceLevels - 1)) };
+        samples.push_back({ light.x, light.y, light.z, lod });
+    }
+    return samples;
+}
+
+// SH irradiance and prefiltered cubemap, baked or read from the cache
+class EnvironmentLighting
+{
+private:
+    glm::vec3 m_irradiance[9]{};
+    std::uint32_t m_faceSize{};
+    std::vector<std::vector<unsigned char>> m_levels;   // per level, the six RGB8 faces back to back
+
+    // Projects the source onto the SH basis, one task per band of rows of a face, LANES texels at a time
+    void projectIrradiance(ThreadPool& pool, const FloatCubemap& source)
+    {
+        int size{ source.GetSize(0) };
+        float texel{ 2.0f / size };
+        std::vector<std::future<std::array<float, 28>>> tasks;
+        for (int face{ 0 }; face < 6; ++face)
+        {
+            for (int firstRow{ 0 }; firstRow < size; firstRow += ENVIRONMENT_LIGHTING_ROWS_PER_TASK)
+            {
+                tasks.push_back(pool.Submit([&source, size, texel, face, firstRow]
+                {
+                    FloatLanes sums[28];
+                    const float* planes[3]{ source.GetPlane(0, face, 0), source.GetPlane(0, face, 1), source.GetPlane(0, face, 2) };
+                    int lastRow{ std::min(firstRow + ENVIRONMENT_LIGHTING_ROWS_PER_TASK, size) };
+                    for (int y{ firstRow }; y < lastRow; ++y)
+                    {
+                        FloatLanes t{ (y + 0.5f) * texel - 1.0f };
+                        for (int x{ 0 }; x < size; x += LANES)
+                        {
+                            FloatLanes column{ FloatLanes::Ramp() + FloatLanes(static_cast<float>(x)) };
+                            FloatLanes s{ (column + FloatLanes(0.5f)) * FloatLanes(texel) - FloatLanes(1.0f) };
+
+                            // Solid angle of the texel, zero past the end of the row
+                            FloatLanes invLength{ FloatLanes(1.0f) / Sqrt(FloatLanes(1.0f) + s * s + t * t) };
+                            FloatLanes weight{ invLength * invLength * invLength * FloatLanes(texel * texel) };
+                            weight = Select(column < FloatLanes(static_cast<float>(size)), weight, FloatLanes(0.0f));
+
+                            FloatLanes basis[9];
+                            EvaluateSH9(CubemapFaceDirection(face, s, t) * invLength, basis);
+                            for (int c{ 0 }; c < 3; ++c)
+                            {
+                                FloatLanes radiance{ LoadPartial(planes[c] + static_cast<size_t>(y) * size + x, size - x) * weight };
+                                for (int i{ 0 }; i < 9; ++i)
+                                    sums[i * 3 + c] += basis[i] * radiance;
+                            }
+                            sums[27] += weight;
+                        }
+                    }
+
+                    std::array<float, 28> result{};
+                    for (int i{ 0 }; i < 28; ++i)
+                        result[i] = HorizontalSum(sums[i]);
+                    return result;
+                }));
+            }
+        }
+
+        // Summed in submission order so the coefficients do not depend on the thread count
+        std::array<double, 28> total{};
+        for (auto& task : tasks)
+        {
+            std::array<float, 28> partial{ task.get() };
+            for (int i{ 0 }; i < 28; ++i)
+                total[i] += partial[i];
+        }
+
+        // Cosine lobe convolution divided by pi: 1, 2/3 and 1/4 per band. The solid angles are renormalized to 4 pi
+        const float bandScale[9]{ 1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+        double normalization{ 4.0 * 3.14159265358979 / total[27] };
+        for (int i{ 0 }; i < 9; ++i)
+            for (int c{ 0 }; c < 3; ++c)
+                m_irradiance[i][c] = static_cast<float>(total[i * 3 + c] * normalization * bandScale[i]);
+    }
+
+    // Filters one level, one task per band of rows of a face
+    void prefilterLevel(ThreadPool& pool, const FloatCubemap& source, std::uint32_t level, std::vector<std::future<void>>& tasks)
+    {
+        int size{ static_cast<int>(std::max(1u, m_faceSize >> level)) };
+        float roughness{ m_levels.size() > 1 ? static_cast<float>(level) / (m_levels.size() - 1) : 0.0f };
+        auto samples = std::make_shared<std::vector<PrefilterSample>>(BuildPrefilterSamples(roughness, source.GetSize(0), source.GetLevelCount(), size));
+        float totalWeight{ 0.0f };
+        for (const PrefilterSample& sample : *samples)
+            totalWeight += sample.z;
+
+        unsigned char* output{ m_levels[level].data() };
+        size_t faceBytes{ static_cast<size_t>(size) * size * 3 };
+        float texel{ 2.0f / size };
+        for (int face{ 0 }; face < 6; ++face)
+        {
+            for (int firstRow{ 0 }; firstRow < size; firstRow += ENVIRONMENT_LIGHTING_ROWS_PER_TASK)
+            {
+                tasks.push_back(pool.Submit([&source, samples, totalWeight, output, faceBytes, size, texel, face, firstRow]
+                {
+                    alignas(32) float direction[3][LANES];
+                    alignas(32) float color[3][LANES];
+                    int lastRow{ std::min(firstRow + ENVIRONMENT_LIGHTING_ROWS_PER_TASK, size) };
+                    for (int y{ firstRow }; y < lastRow; ++y)
+                    {
+                        FloatLanes t{ (y + 0.5f) * texel - 1.0f };
+                        for (int x{ 0 }; x < size; x += LANES)
+                        {
+                            FloatLanes s{ (FloatLanes::Ramp() + FloatLanes(x + 0.5f)) * FloatLanes(texel) - FloatLanes(1.0f) };
+                            Vec3Lanes normal{ Normalize(CubemapFaceDirection(face, s, t)) };
+
+                            // Any up vector that is not parallel to the normal gives a tangent frame
+                            FloatLanes nearPole{ normal.z * normal.z > FloatLanes(0.998f) };
+                            Vec3Lanes up{ Select(nearPole, Vec3Lanes(1.0f, 0.0f, 0.0f), Vec3Lanes(0.0f, 0.0f, 1.0f)) };
+                            Vec3Lanes tangentX{ Normalize(Cross(up, normal)) };
+                            Vec3Lanes tangentY{ Cross(normal, tangentX) };
+
+                            Vec3Lanes sum{ 0.0f, 0.0f, 0.0f };
+                            for (const PrefilterSample& sample : *samples)
+                            {
+                                Vec3Lanes light{ tangentX * FloatLanes(sample.x) + tangentY * FloatLanes(sample.y) + normal * FloatLanes(sample.z) };
+                                light.x.Store(direction[0]);
+                                light.y.Store(direction[1]);
+                                light.z.Store(direction[2]);
+                                for (int lane{ 0 }; lane < LANES; ++lane)
+                                {
+                                    glm::vec3 value{ source.Sample(glm::vec3(direction[0][lane], direction[1][lane], direction[2][lane]), sample.lod) };
+                                    color[0][lane] = value.r;
+                                    color[1][lane] = value.g;
+                                    color[2][lane] = value.b;
+                                }
+                                sum = sum + Vec3Lanes(FloatLanes::Load(color[0]), FloatLanes::Load(color[1]), FloatLanes::Load(color[2])) * FloatLanes(sample.z);
+                            }
+
+                            FloatLanes scale{ 255.0f / totalWeight };
+                            Clamp(sum.x * scale, 0.0f, 255.0f).Store(color[0]);
+                            Clamp(sum.y * scale, 0.0f, 255.0f).Store(color[1]);
+                            Clamp(sum.z * scale, 0.0f, 255.0f).Store(color[2]);
+                            unsigned char* out{ output + face * faceBytes + (static_cast<size_t>(y) * size + x) * 3 };
+                            for (int lane{ 0 }; lane < LANES && x + lane < size; ++lane)
+                                for (int c{ 0 }; c < 3; ++c)
+                                    out[lane * 3 + c] = static_cast<unsigned char>(color[c][lane] + 0.5f);
+                        }
+                    }
+                }));
+            }
+        }
+    }
+
+public:
+    // Decodes the faces and computes everything on the pool, needs no GL context
+    bool Bake(ThreadPool& pool, const std::vector<const GLchar*>& faces, EnvironmentLightingStats* stats = nullptr)
+    {
+        if (faces.size() != ENVIRONMENT_CACHE_FACES)
+        {
+            std::cout << "ERROR::ENVIRONMENT_LIGHTING::NEEDS_SIX_FACES" << std::endl;
+            return false;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+
+        // Each task decodes a face and box filters it down to the prefilter source size
+        std::vector<std::future<std::vector<unsigned char>>> decoded;
+        std::vector<std::uint32_t> sizes(faces.size());
+        for (size_t i{ 0 }; i < faces.size(); ++i)
+        {
+            const GLchar* path{ faces[i] };
+            std::uint32_t* faceSize{ &sizes[i] };
+            decoded.push_back(pool.Submit([path, faceSize]
+            {
+                DecodedImage image{ DecodeCubemapImage(path, GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0) };
+                std::vector<unsigned char> pixels;
+                if (!image.pixels || image.width != image.height)
+                {
+                    SOIL_free_image_data(image.pixels);
+                    return pixels;
+                }
+
+                std::uint32_t size{ static_cast<std::uint32_t>(image.width) };
+                pixels.assign(image.pixels, image.pixels + static_cast<size_t>(size) * size * 3);
+                SOIL_free_image_data(image.pixels);
+                while (size > PREFILTER_SOURCE_SIZE)
+                {
+                    pixels = DownsampleRGB(pixels, size);
+                    size /= 2;
+                }
+                *faceSize = size;
+                return pixels;
+            }));
+        }
+
+        std::vector<std::vector<unsigned char>> sourceFaces;
+        for (auto& face : decoded)
+            sourceFaces.push_back(face.get());
+        for (size_t i{ 0 }; i < sourceFaces.size(); ++i)
+        {
+            if (sourceFaces[i].empty() || sizes[i] != sizes[0])
+            {
+                std::cout << "ERROR::ENVIRONMENT_LIGHTING::FACES_MUST_BE_SQUARE_AND_EQUAL " << faces[i] << std::endl;
+                return false;
+            }
+        }
+
+        FloatCubemap source;
+        const unsigned char* facePixels[6];
+        for (int i{ 0 }; i < 6; ++i)
+            facePixels[i] = sourceFaces[i].data();
+        source.AddLevel(static_cast<int>(sizes[0]), facePixels);
+        source.BuildMipChain();
+        auto decodedAt = std::chrono::steady_clock::now();
+
+        projectIrradiance(pool, source);
+        auto projected = std::chrono::steady_clock::now();
+
+        m_faceSize = std::min(PREFILTERED_SIZE, sizes[0]);
+        std::uint32_t levelCount{ 1 };
+        while (levelCount < PREFILTERED_LEVELS && (m_faceSize >> levelCount) > 0)
+            ++levelCount;
+
+        m_levels.assign(levelCount, {});
+        for (std::uint32_t level{ 0 }; level < levelCount; ++level)
+        {
+            std::uint32_t size{ std::max(1u, m_faceSize >> level) };
+            m_levels[level].resize(static_cast<size_t>(size) * size * 3 * ENVIRONMENT_CACHE_FACES);
+        }
+
+        // Every level is queued before waiting so the pool stays busy through the small ones
+        std::vector<std::future<void>> tasks;
+        for (std::uint32_t level{ 0 }; level < levelCount; ++level)
+            prefilterLevel(pool, source, level, tasks);
+        for (auto& task : tasks)
+            task.get();
+        auto filtered = std::chrono::steady_clock::now();
+
+        if (stats)
+        {
+            stats->decodeMs = ElapsedMilliseconds(start, decodedAt);
+            stats->projectMs = ElapsedMilliseconds(decodedAt, projected);
+            stats->prefilterMs = ElapsedMilliseconds(projected, filtered);
+        }
+        return true;
+    }
+
+    bool Write(const std::string& path, std::uint64_t sourceHash) const
+    {
+        EnvironmentLightingHeader header{};
+        header.magic = ENVIRONMENT_LIGHTING_MAGIC;
+        header.version = ENVIRONMENT_LIGHTING_VERSION;
+        header.sourceHash = sourceHash;
+        header.faceSize = m_faceSize;
+        header.levelCount = static_cast<std::uint32_t>(m_levels.size());
+        header.sampleCount = PREFILTER_SAMPLES;
+        for (int i{ 0 }; i < 9; ++i)
+            for (int c{ 0 }; c < 3; ++c)
+                header.irradiance[i][c] = m_irradiance[i][c];
+
+        std::uint64_t offset{ sizeof(EnvironmentLightingHeader) };
+        for (std::uint32_t level{ 0 }; level < header.levelCount; ++level)
+        {
+            header.levels[level].size = std::max(1u, m_faceSize >> level);
+            header.levels[level].faceBytes = header.levels[level].size * header.levels[level].size * 3;
+            header.levels[level].offset = offset;
+            offset += m_levels[level].size();
+        }
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            std::cout << "ERROR::ENVIRONMENT_LIGHTING::CANNOT_WRITE " << path << std::endl;
+            return false;
+        }
+
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for (const std::vector<unsigned char>& level : m_levels)
+            file.write(reinterpret_cast<const char*>(level.data()), level.size());
+        return static_cast<bool>(file);
+    }
+
+    // Reads a cache baked from sources with the given hash with the current parameters
+    bool Read(const std::string& path, std::uint64_t expectedHash)
+    {
+        std::ifstream file(path, std::ios::binary);
+        EnvironmentLightingHeader header{};
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.magic != ENVIRONMENT_LIGHTING_MAGIC
+            || header.version != ENVIRONMENT_LIGHTING_VERSION || header.sourceHash != expectedHash || header.sampleCount != PREFILTER_SAMPLES
+            || header.faceSize == 0 || header.faceSize > PREFILTERED_SIZE || header.levelCount == 0 || header.levelCount > PREFILTERED_LEVELS)
+            return false;
+
+        std::vector<std::vector<unsigned char>> levels(header.levelCount);
+        for (std::uint32_t level{ 0 }; level < header.levelCount; ++level)
+        {
+            std::uint32_t size{ std::max(1u, header.faceSize >> level) };
+            if (header.levels[level].size != size || header.levels[level].faceBytes != size * size * 3)
+                return false;
+
+            levels[level].resize(static_cast<size_t>(header.levels[level].faceBytes) * ENVIRONMENT_CACHE_FACES);
+            file.seekg(static_cast<std::streamoff>(header.levels[level].offset));
+            if (!file.read(reinterpret_cast<char*>(levels[level].data()), levels[level].size()))
+                return false;
+        }
+
+        for (int i{ 0 }; i < 9; ++i)
+            m_irradiance[i] = glm::vec3(header.irradiance[i][0], header.irradiance[i][1], header.irradiance[i][2]);
+        m_faceSize = header.faceSize;
+        m_levels = std::move(levels);
+        return true;
+    }
+
+    bool IsValid() const { return !m_levels.empty(); }
+    const glm::vec3* GetIrradiance() const { return m_irradiance; }
+    float GetMaxLod() const { return m_levels.empty() ? 0.0f : static_cast<float>(m_levels.size() - 1); }
+
+    EnvironmentBlock GetBlock() const
+    {
+        EnvironmentBlock block{};
+        for (int i{ 0 }; i < 9; ++i)
+            block.irradiance[i] = glm::vec4(m_irradiance[i], 0.0f);
+        block.prefilteredMaxLod = GetMaxLod();
+        block.enabled = IsValid() ? 1 : 0;
+        return block;
+    }
+
+    // Texture memory of the prefiltered chain, RGB8 is padded to four bytes per texel by the drivers
+    size_t GetGpuBytes() const
+    {
+        size_t bytes{ 0 };
+        for (const std::vector<unsigned char>& level : m_levels)
+            bytes += level.size() / 3 * 4;
+        return bytes;
+    }
+
+    // Immutable RGB8 cubemap of the prefiltered chain, sampled trilinearly with the roughness as the level
+    GLuint CreateTexture() const
+    {
+        GLuint texture{};
+        glGenTextures(1, &texture);
+        GetGLState().BindTexture(GL_TEXTURE_CUBE_MAP, texture);
+        glTexStorage2D(GL_TEXTURE_CUBE_MAP, static_cast<GLsizei>(m_levels.size()), GL_RGB8, m_faceSize, m_faceSize);
+        SetCubemapSamplerState();
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(m_levels.size()) - 1);
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (size_t level{ 0 }; level < m_levels.size(); ++level)
+        {
+            GLsizei size{ static_cast<GLsizei>(std::max(1u, m_faceSize >> level)) };
+            size_t faceBytes{ static_cast<size_t>(size) * size * 3 };
+            for (GLuint face{ 0 }; face < ENVIRONMENT_CACHE_FACES; ++face)
+                glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, static_cast<GLint>(level), 0, 0, size, size, GL_RGB, GL_UNSIGNED_BYTE,
+                    m_levels[level].data() + face * faceBytes);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        GetGLState().BindTexture(GL_TEXTURE_CUBE_MAP, 0);
+        return texture;
+    }
+
+    // The same chain for the software renderer
+    FloatCubemap CreateFloatCubemap() const
+    {
+        FloatCubemap cubemap;
+        for (size_t level{ 0 }; level < m_levels.size(); ++level)
+        {
+            int size{ static_cast<int>(std::max(1u, m_faceSize >> level)) };
+            size_t faceBytes{ static_cast<size_t>(size) * size * 3 };
+            const unsigned char* faces[6];
+            for (int face{ 0 }; face < 6; ++face)
+                faces[face] = m_levels[level].data() + face * faceBytes;
+            cubemap.AddLevel(size, faces);
+        }
+        return cubemap;
+    }
+};
+
+// Reads the cache, rebuilding it first when it is missing or was baked from other faces
+inline bool LoadEnvironmentLighting(ThreadPool& pool, const std::vector<const GLchar*>& faces, const std::string& cachePath, EnvironmentLighting& lighting,
+    EnvironmentLightingStats* stats = nullptr)
+{
+    EnvironmentLightingStats loadStats{};
+    auto start = std::chrono::steady_clock::now();
+
+    std::uint64_t sourceHash{ HashEnvironmentSources(faces) };
+    loadStats.hashMs = ElapsedMilliseconds(start, std::chrono::steady_clock::now());
+
+    if (!lighting.Read(cachePath, sourceHash))
+    {
+        loadStats.rebuilt = true;
+        if (!lighting.Bake(pool, faces, &loadStats))
+        {
+            std::cout << "ERROR::ENVIRONMENT_LIGHTING::REBUILD_FAILED " << cachePath << std::endl;
+            return false;
+        }
+        lighting.Write(cachePath, sourceHash);
+    }
+
+    loadStats.gpuBytes = lighting.GetGpuBytes();
+    loadStats.totalMs = ElapsedMilliseconds(start, std::chrono::steady_clock::now());
+    if (stats)
+        *stats = loadStats;
+    return true;
+}
+
+#endif
@@ -0,0 +1,357 @@
+#ifndef ENVIRONMENT_STREAMER_H
+#define ENVIRONMENT_STREAMER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "Cubemap.h"
+#include "EnvironmentCache.h"
+#include "GLState.h"
+#include "ThreadPool.h"
+
+// Levels this size or smaller make up the mip tail uploaded before the first frame
+constexpr std::uint32_t ENVIRONMENT_TAIL_SIZE{ 64 };
+
+// Free video memory is checked this often where the driver reports it, under ENVIRONMENT_PRESSURE_FREE_KIB the finest level is dropped
+constexpr unsigned ENVIRONMENT_PRESSURE_CHECK_FRAMES{ 60 };
+constexpr GLint ENVIRONMENT_PRESSURE_FREE_KIB{ 64 * 1024 };
+
+// Where the progressive environment load stands
+struct EnvironmentStreamStats
+{
+    std::uint32_t levels{};
+    std::uint32_t baseLevel{};          // finest level the sampler may use
+    std::uint32_t targetLevel{};        // finest level the residency cap allows
+    std::uint32_t baseSize{};           // face size of the base level
+    size_t residentBytes{};             // complete levels plus the one being uploaded
+    size_t residencyCap{};              // 0 for none
+    size_t uploadedLastFrame{};
+    size_t uploadedTotal{};
+    unsigned droppedLevels{};           // given back under memory pressure or a lower cap
+    double tailMs{};                    // opening the cache and uploading the tail, what the first frame waited for
+    double completeMs{};                // from opening to the target level, valid once complete
+    bool complete{};
+};
+
+inline void PrintEnvironmentStreamStats(const EnvironmentStreamStats& stats)
+{
+    if (stats.levels == 0)
+        return;
+
+    std::cout << "  environment: level " << stats.baseLevel << " of 0.." << stats.levels - 1 << " resident (" << stats.baseSize << " px faces), "
+        << stats.residentBytes / 1024 << " KiB on the GPU";
+    if (stats.residencyCap > 0)
+        std::cout << " (cap " << stats.residencyCap / 1024 << " KiB, level " << stats.targetLevel << ")";
+    std::cout << ", " << stats.uploadedLastFrame / 1024 << " KiB uploaded last frame, tail in " << stats.tailMs << " ms";
+    if (stats.complete)
+        std::cout << ", complete after " << stats.completeMs << " ms";
+    if (stats.droppedLevels > 0)
+        std::cout << ", " << stats.droppedLevels << " levels dropped";
+    std::cout << std::endl;
+}
+
+// Streams a baked environment cache into a cubemap, coarsest levels first.
+// The mip tail is uploaded before the first frame; every finer level is then uploaded a few rows at a time under a per-frame byte
+// budget, from pages a pool thread has already faulted in, and GL_TEXTURE_BASE_LEVEL only moves down to a level once all six faces
+// of it are in. The texture is mutable so each level is allocated when its upload starts and can be released again: levels finer
+// than the residency cap are never loaded, and where the driver reports free video memory the finest one is given back when it
+// runs low
+class EnvironmentStreamer
+{
+private:
+    ThreadPool& m_pool;
+    EnvironmentCache m_cache;
+    GLuint m_texture{};
+    size_t m_uploadBudget{};
+    size_t m_residencyCap{};
+    std::uint32_t m_tailLevel{};
+    std::uint32_t m_baseLevel{};
+    std::uint32_t m_targetLevel{};
+
+    // Progress through the level being uploaded, always m_baseLevel - 1
+    bool m_levelAllocated{};
+    std::uint32_t m_face{};
+    std::uint32_t m_row{};
+    std::future<void> m_prefetch;
+
+    std::chrono::steady_clock::time_point m_start{};
+    unsigned m_frame{};
+    EnvironmentStreamStats m_stats{};
+
+    bool isCompressed() const { return m_cache.GetHeader().format == ENVIRONMENT_FORMAT_BC1; }
+    std::uint32_t getLastLevel() const { return m_cache.GetHeader().levelCount - 1; }
+
+    // Defines (or with size 0 releases) the storage of every face of a level, with the given texels or none
+    void defineLevel(std::uint32_t level, GLsizei size, bool withData)
+    {
+        const EnvironmentCacheLevel& entry{ m_cache.GetHeader().levels[level] };
+        GetGLState().BindTexture(GL_TEXTURE_CUBE_MAP, m_texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (std::uint32_t face{ 0 }; face < ENVIRONMENT_CACHE_FACES; ++face)
+        {
+            GLenum target{ GL_TEXTURE_CUBE_MAP_POSITIVE_X + face };
+            const unsigned char* data{ withData ? m_cache.GetFaceData(level, face) : nullptr };
+            if (isCompressed())
+                glCompressedTexImage2D(target, level, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, size, size, 0, size > 0 ? entry.faceBytes : 0, data);
+            else
+                glTexImage2D(target, level, GL_RGB8, size, size, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        GetGLState().BindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    }
+
+    void setBaseLevel(std::uint32_t level)
+    {
+        m_baseLevel = level;
+        GetGLState().BindTexture(GL_TEXTURE_CUBE_MAP, m_texture);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BASE_LEVEL, static_cast<GLint>(level));
+        GetGLState().BindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    }
+
+    // Rows [firstRow, firstRow + rowCount) of one face; with BC1 both are multiples of four or reach the bottom of the face
+    size_t uploadRows(std::uint32_t level, std::uint32_t face, std::uint32_t firstRow, std::uint32_t rowCount)
+    {
+        const EnvironmentCacheLevel& entry{ m_cache.GetHeader().levels[level] };
+        GLsizei size{ static_cast<GLsizei>(entry.size) };
+        GLenum target{ GL_TEXTURE_CUBE_MAP_POSITIVE_X + face };
+        GetGLState().BindTexture(GL_TEXTURE_CUBE_MAP, m_texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+        size_t bytes{};
+        if (isCompressed())
+        {
+            size_t blockRowBytes{ static_cast<size_t>((entry.size + 3) / 4) * 8 };
+            bytes = (rowCount + 3) / 4 * blockRowBytes;
+            glCompressedTexSubImage2D(target, level, 0, firstRow, size, rowCount, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, static_cast<GLsizei>(bytes),
+                m_cache.GetFaceData(level, face) + firstRow / 4 * blockRowBytes);
+        }
+        else
+        {
+            size_t rowBytes{ static_cast<size_t>(entry.size) * 3 };
+            bytes = rowCount * rowBytes;
+            glTexSubImage2D(target, level, 0, firstRow, size, rowCount, GL_RGB, GL_UNSIGNED_BYTE, m_cache.GetFaceData(level, face) + firstRow * rowBytes);
+        }
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        GetGLState().BindTexture(GL_TEXTURE_CUBE_MAP, 0);
+        return bytes;
+    }
+
+    void prefetchLevel(std::uint32_t level)
+    {
+        if (m_prefetch.valid())
+            m_prefetch.wait();
+        const EnvironmentCache* cache{ &m_cache };
+        m_prefetch = m_pool.Submit([cache, level]() { cache->PrefetchLevel(level); });
+    }
+
+    // Finest level whose chain down to the last level fits the cap, never finer than the tail
+    std::uint32_t selectTargetLevel() const
+    {
+        std::uint32_t level{ 0 };
+        while (m_residencyCap > 0 && level < m_tailLevel && m_cache.GetLevelBytes(level, getLastLevel()) > m_residencyCap)
+            ++level;
+        return level;
+    }
+
+    // Releases the level being uploaded, or else the finest complete one above the tail
+    bool dropFinestLevel()
+    {
+        if (m_levelAllocated)
+        {
+            defineLevel(m_baseLevel - 1, 0, false);
+            m_levelAllocated = false;
+        }
+        else if (m_baseLevel < m_tailLevel)
+        {
+            std::uint32_t level{ m_baseLevel };
+            setBaseLevel(level + 1);
+            defineLevel(level, 0, false);
+        }
+        else
+            return false;
+
+        ++m_stats.droppedLevels;
+        return true;
+    }
+
+    // Free video memory as reported by NVX_gpu_memory_info or ATI_meminfo, -1 where neither is there
+    static GLint queryFreeVideoMemoryKiB()
+    {
+        if (GLEW_NVX_gpu_memory_info)
+        {
+            GLint available{};
+            glGetIntegerv(GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX, &available);
+            return available;
+        }
+        if (GLEW_ATI_meminfo)
+        {
+            GLint info[4]{};
+            glGetIntegerv(GL_TEXTURE_FREE_MEMORY_ATI, info);
+            return info[0];
+        }
+        return -1;
+    }
+
+    void updateStats()
+    {
+        m_stats.baseLevel = m_baseLevel;
+        m_stats.targetLevel = m_targetLevel;
+        m_stats.baseSize = m_cache.GetHeader().levels[m_baseLevel].size;
+        m_stats.residentBytes = m_cache.GetLevelBytes(m_baseLevel, getLastLevel()) + (m_levelAllocated ? m_cache.GetLevelBytes(m_baseLevel - 1, m_baseLevel - 1) : 0);
+        m_stats.residencyCap = m_residencyCap;
+        bool complete{ m_baseLevel <= m_targetLevel };
+        if (complete && !m_stats.complete)
+            m_stats.completeMs = ElapsedMilliseconds(m_start, std::chrono::steady_clock::now());
+        m_stats.complete = complete;
+    }
+
+public:
+    // uploadBudget: bytes uploaded per frame at most; residencyCap: bytes the texture may hold, 0 for no limit
+    EnvironmentStreamer(ThreadPool& pool, size_t uploadBudget, size_t residencyCap)
+        : m_pool{ pool }, m_uploadBudget{ std::max<size_t>(uploadBudget, 1) }, m_residencyCap{ residencyCap }
+    {
+    }
+
+    ~EnvironmentStreamer()
+    {
+        if (m_prefetch.valid())
+            m_prefetch.wait();
+        GetGLState().DeleteTextures(1, &m_texture);
+    }
+
+    EnvironmentStreamer(const EnvironmentStreamer&) = delete;
+    EnvironmentStreamer& operator=(const EnvironmentStreamer&) = delete;
+
+    // Maps the cache (baking it when stale) and uploads the mip tail, the texture can be sampled from here on
+    bool Open(const std::vector<const GLchar*>& faces, const std::string& cachePath, EnvironmentCacheFormat format, EnvironmentLoadStats* stats = nullptr)
+    {
+        EnvironmentLoadStats loadStats{};
+        m_start = std::chrono::steady_clock::now();
+        if (!OpenEnvironmentCache(m_pool, faces, cachePath, format, m_cache, loadStats))
+            return false;
+
+        const EnvironmentCacheHeader& header{ m_cache.GetHeader() };
+        m_tailLevel = 0;
+        while (m_tailLevel < getLastLevel() && header.levels[m_tailLevel].size > ENVIRONMENT_TAIL_SIZE)
+            ++m_tailLevel;
+        m_targetLevel = selectTargetLevel();
+
+        auto uploadStart = std::chrono::steady_clock::now();
+        glGenTextures(1, &m_texture);
+        GetGLState().BindTexture(GL_TEXTURE_CUBE_MAP, m_texture);
+        SetCubemapSamplerState();
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(getLastLevel()));
+        GetGLState().BindTexture(GL_TEXTURE_CUBE_MAP, 0);
+        for (std::uint32_t level{ m_tailLevel }; level <= getLastLevel(); ++level)
+            defineLevel(level, static_cast<GLsizei>(header.levels[level].size), true);
+        setBaseLevel(m_tailLevel);
+        if (m_tailLevel > m_targetLevel)
+            prefetchLevel(m_tailLevel - 1);
+
+        auto end = std::chrono::steady_clock::now();
+        loadStats.uploadMs = ElapsedMilliseconds(uploadStart, end);
+        loadStats.gpuBytes = m_cache.GetLevelBytes(m_tailLevel, getLastLevel());
+        loadStats.totalMs = ElapsedMilliseconds(m_start, end);
+        if (stats)
+            *stats = loadStats;
+
+        m_stats = EnvironmentStreamStats{};
+        m_stats.levels = header.levelCount;
+        m_stats.uploadedTotal = loadStats.gpuBytes;
+        m_stats.tailMs = loadStats.totalMs;
+        updateStats();
+        return true;
+    }
+
+    // Once per frame on the GL thread: gives memory back under pressure, then uploads up to the budget towards the target level.
+    // A level whose pages are still being read on the pool is left for a later frame rather than waited for
+    void Update()
+    {
+        if (!m_texture)
+            return;
+
+        ++m_frame;
+        m_stats.uploadedLastFrame = 0;
+        if (m_frame % ENVIRONMENT_PRESSURE_CHECK_FRAMES == 0)
+        {
+            GLint freeKiB{ queryFreeVideoMemoryKiB() };
+            if (freeKiB >= 0 && freeKiB < ENVIRONMENT_PRESSURE_FREE_KIB && dropFinestLevel())
+            {
+                m_targetLevel = m_baseLevel;
+                m_residencyCap = m_cache.GetLevelBytes(m_baseLevel, getLastLevel());
+            }
+        }
+
+        size_t budget{ m_uploadBudget };
+        while (m_baseLevel > m_targetLevel && budget > 0)
+        {
+            std::uint32_t level{ m_baseLevel - 1 };
+            const EnvironmentCacheLevel& entry{ m_cache.GetHeader().levels[level] };
+            if (!m_levelAllocated)
+            {
+                if (m_prefetch.valid() && m_prefetch.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                    break;
+
+                defineLevel(level, static_cast<GLsizei>(entry.size), false);
+                m_levelAllocated = true;
+                m_face = 0;
+                m_row = 0;
+                if (level > m_targetLevel)
+                    prefetchLevel(level - 1);
+            }
+
+            // Whole block rows with BC1, and at least one step per frame so a tiny budget still makes progress
+            std::uint32_t step{ isCompressed() ? 4u : 1u };
+            size_t stepBytes{ isCompressed() ? static_cast<size_t>((entry.size + 3) / 4) * 8 : static_cast<size_t>(entry.size) * 3 };
+            if (budget < stepBytes && m_stats.uploadedLastFrame > 0)
+                break;
+            std::uint32_t rows{ static_cast<std::uint32_t>(std::max<size_t>(1, budget / stepBytes)) * step };
+            rows = std::min(rows, entry.size - m_row);
+
+            size_t bytes{ uploadRows(level, m_face, m_row, rows) };
+            budget -= std::min(budget, bytes);
+            m_stats.uploadedLastFrame += bytes;
+            m_stats.uploadedTotal += bytes;
+            m_row += rows;
+
+            if (m_row < entry.size)
+                continue;
+            m_row = 0;
+            if (++m_face < ENVIRONMENT_CACHE_FACES)
+                continue;
+
+            // Every face of the level is in, the sampler may use it
+            m_levelAllocated = false;
+            setBaseLevel(level);
+        }
+        updateStats();
+    }
+
+    // Lowers or raises the cap; levels finer than a lower cap are released right away, a higher one lets streaming continue
+    void SetResidencyCap(size_t residencyCap)
+    {
+        m_residencyCap = residencyCap;
+        m_targetLevel = selectTargetLevel();
+        while ((m_levelAllocated && m_baseLevel - 1 < m_targetLevel) || m_baseLevel < m_targetLevel)
+            dropFinestLevel();
+        if (m_baseLevel > m_targetLevel && !m_levelAllocated)
+            prefetchLevel(m_baseLevel - 1);
+        updateStats();
+    }
+
+    GLuint GetTexture() const { return m_texture; }
+    bool IsComplete() const { return m_stats.complete; }
+    const EnvironmentStreamStats& GetStats() const { return m_stats; }
+};
+
+#endif
@@ -0,0 +1,410 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <unordered_map>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+// Texture units and indexed buffer binding points whose bindings are tracked, calls beyond them always reach GL
+constexpr GLuint GL_STATE_TEXTURE_UNITS{ 16 };
+constexpr GLuint GL_STATE_BUFFER_BINDINGS{ 16 };
+
+// Calls that reached GL and calls dropped because they would not have changed anything
+struct GLStateStats
+{
+    unsigned long long issued{};
+    unsigned long long elided{};
+};
+
+// The last full frame and everything since the context was made current
+struct GLStateFrameStats
+{
+    bool enabled{};
+    GLStateStats lastFrame{};
+    GLStateStats total{};
+    unsigned long long frames{};
+};
+
+inline void PrintGLStateStats(const GLStateFrameStats& stats)
+{
+    if (stats.frames == 0)
+        return;
+
+    const GLStateStats& frame{ stats.lastFrame };
+    unsigned long long calls{ frame.issued + frame.elided };
+    std::cout << "  gl state: " << frame.issued << " calls issued, " << frame.elided << " elided last frame ("
+        << (calls > 0 ? 100.0 * frame.elided / calls : 0.0) << "%), " << stats.total.issued / stats.frames << " issued per frame on average"
+        << (stats.enabled ? "" : " (cache off)") << std::endl;
+}
+
+// Mirror of the binds and fixed-function state the renderer sets, in front of GL for the thread that owns the context. A call
+// that matches the mirrored value is dropped, so every pass can state what it needs without unbinding after itself. Anything
+// changed behind its back goes stale, so every bind of these kinds goes through here, deletions included (GL resets the bindings
+// of a deleted object and may hand its name out again). Unknown state reads as a value no call matches. Switched off, every call
+// is issued and counted, for comparison
+class GLStateCache
+{
+private:
+    static constexpr GLuint UNKNOWN{ ~0u };
+
+    // Texture targets with tracked bindings, everything else is issued as is
+    enum TextureSlot { TEXTURE_2D, TEXTURE_CUBE_MAP, TEXTURE_CUBE_MAP_ARRAY, TEXTURE_SLOTS, TEXTURE_UNTRACKED = TEXTURE_SLOTS };
+
+    struct BufferBinding
+    {
+        GLuint buffer{ UNKNOWN };
+        GLintptr offset{};
+        GLsizeiptr size{};      // 0 for glBindBufferBase
+    };
+
+    bool m_enabled{ true };
+    GLuint m_program{ UNKNOWN };
+    GLuint m_vertexArray{ UNKNOWN };
+    GLuint m_drawFramebuffer{ UNKNOWN };
+    GLuint m_readFramebuffer{ UNKNOWN };
+    GLenum m_activeTexture{ UNKNOWN };
+    GLuint m_textures[GL_STATE_TEXTURE_UNITS][TEXTURE_SLOTS]{};
+    BufferBinding m_uniformBuffers[GL_STATE_BUFFER_BINDINGS]{};
+    BufferBinding m_storageBuffers[GL_STATE_BUFFER_BINDINGS]{};
+    GLint m_viewport[4]{};
+    bool m_viewportKnown{};
+    GLint m_blend{ -1 };        // -1 unknown, else the enable flag
+    GLint m_depthTest{ -1 };
+    GLint m_cullFace{ -1 };
+    GLenum m_depthFunc{ UNKNOWN };
+    GLenum m_blendSource{ UNKNOWN };
+    GLenum m_blendDestination{ UNKNOWN };
+    std::unordered_map<std::uint64_t, GLint> m_uniforms;   // (program << 32 | location * 2 + component) -> int value
+
+    GLStateStats m_frame{};
+    GLStateFrameStats m_stats{};
+
+    // True when the call has to reach GL, and counts it either way
+    bool change(bool differs)
+    {
+        if (differs || !m_enabled)
+        {
+            ++m_frame.issued;
+            ++m_stats.total.issued;
+            return true;
+        }
+        ++m_frame.elided;
+        ++m_stats.total.elided;
+        return false;
+    }
+
+    static TextureSlot textureSlot(GLenum target)
+    {
+        switch (target)
+        {
+        case GL_TEXTURE_2D:             return TEXTURE_2D;
+        case GL_TEXTURE_CUBE_MAP:       return TEXTURE_CUBE_MAP;
+        case GL_TEXTURE_CUBE_MAP_ARRAY: return TEXTURE_CUBE_MAP_ARRAY;
+        default:                        return TEXTURE_UNTRACKED;
+        }
+    }
+
+    GLint* capability(GLenum cap)
+    {
+        switch (cap)
+        {
+        case GL_BLEND:      return &m_blend;
+        case GL_DEPTH_TEST: return &m_depthTest;
+        case GL_CULL_FACE:  return &m_cullFace;
+        default:            return nullptr;
+        }
+    }
+
+    BufferBinding* bufferBinding(GLenum target, GLuint index)
+    {
+        if (index >= GL_STATE_BUFFER_BINDINGS)
+            return nullptr;
+        if (target == GL_UNIFORM_BUFFER)
+            return &m_uniformBuffers[index];
+        if (target == GL_SHADER_STORAGE_BUFFER)
+            return &m_storageBuffers[index];
+        return nullptr;
+    }
+
+    void setCapability(GLenum cap, bool enabled)
+    {
+        GLint* state{ capability(cap) };
+        if (!change(!state || *state != static_cast<GLint>(enabled)))
+            return;
+        if (enabled)
+            glEnable(cap);
+        else
+            glDisable(cap);
+        if (state)
+            *state = enabled;
+    }
+
+    bool setUniform(GLint location, GLuint component, GLint value)
+    {
+        std::uint64_t key{ static_cast<std::uint64_t>(m_program) << 32 | (static_cast<std::uint32_t>(location) * 2 + component) };
+        auto it = m_uniforms.find(key);
+        bool differs{ m_program == UNKNOWN || it == m_uniforms.end() || it->second != value };
+        m_uniforms[key] = value;
+        return differs;
+    }
+
+public:
+    GLStateCache()
+    {
+        Invalidate();
+    }
+
+    GLStateCache(const GLStateCache&) = delete;
+    GLStateCache& operator=(const GLStateCache&) = delete;
+
+    // Forgets everything, for a context that was just made current
+    void Invalidate()
+    {
+        m_program = m_vertexArray = m_drawFramebuffer = m_readFramebuffer = m_activeTexture = UNKNOWN;
+        for (auto& unit : m_textures)
+            for (GLuint& texture : unit)
+                texture = UNKNOWN;
+        for (BufferBinding& binding : m_uniformBuffers)
+            binding = BufferBinding{};
+        for (BufferBinding& binding : m_storageBuffers)
+            binding = BufferBinding{};
+        m_viewportKnown = false;
+        m_blend = m_depthTest = m_cullFace = -1;
+        m_depthFunc = m_blendSource = m_blendDestination = UNKNOWN;
+        m_uniforms.clear();
+        m_frame = GLStateStats{};
+        m_stats = GLStateFrameStats{};
+        m_stats.enabled = m_enabled;
+    }
+
+    void SetEnabled(bool enabled)
+    {
+        m_enabled = enabled;
+        m_stats.enabled = enabled;
+    }
+
+    // Closes the counters of a frame, the calls made since the last one make up its stats
+    void EndFrame()
+    {
+        m_stats.lastFrame = m_frame;
+        ++m_stats.frames;
+        m_frame = GLStateStats{};
+    }
+
+    const GLStateFrameStats& GetStats() const { return m_stats; }
+
+    void UseProgram(GLuint program)
+    {
+        if (change(program != m_program))
+            glUseProgram(program);
+        m_program = program;
+    }
+
+    void BindVertexArray(GLuint vertexArray)
+    {
+        if (change(vertexArray != m_vertexArray))
+            glBindVertexArray(vertexArray);
+        m_vertexArray = vertexArray;
+    }
+
+    // GL_FRAMEBUFFER sets both the draw and the read binding
+    void BindFramebuffer(GLenum target, GLuint framebuffer)
+    {
+        bool draw{ target != GL_READ_FRAMEBUFFER }, read{ target != GL_DRAW_FRAMEBUFFER };
+        if (change((draw && framebuffer != m_drawFramebuffer) || (read && framebuffer != m_readFramebuffer)))
+            glBindFramebuffer(target, framebuffer);
+        if (draw)
+            m_drawFramebuffer = framebuffer;
+        if (read)
+            m_readFramebuffer = framebuffer;
+    }
+
+    void ActiveTexture(GLenum unit)
+    {
+        if (change(unit != m_activeTexture))
+            glActiveTexture(unit);
+        m_activeTexture = unit;
+    }
+
+    // Binds to the active unit
+    void BindTexture(GLenum target, GLuint texture)
+    {
+        TextureSlot slot{ textureSlot(target) };
+        GLuint unit{ m_activeTexture - GL_TEXTURE0 };
+        bool tracked{ slot != TEXTURE_UNTRACKED && m_activeTexture != UNKNOWN && unit < GL_STATE_TEXTURE_UNITS };
+        if (change(!tracked || m_textures[unit][slot] != texture))
+            glBindTexture(target, texture);
+        if (tracked)
+            m_textures[unit][slot] = texture;
+    }
+
+    // Selects the unit, binds, and leaves unit 0 active as the rest of the code expects
+    void BindTextureUnit(GLuint unit, GLenum target, GLuint texture)
+    {
+        ActiveTexture(GL_TEXTURE0 + unit);
+        BindTexture(target, texture);
+        ActiveTexture(GL_TEXTURE0);
+    }
+
+    void BindBufferBase(GLenum target, GLuint index, GLuint buffer)
+    {
+        BufferBinding* binding{ bufferBinding(target, index) };
+        if (change(!binding || binding->buffer != buffer || binding->size != 0))
+            glBindBufferBase(target, index, buffer);
+        if (binding)
+            *binding = { buffer, 0, 0 };
+    }
+
+    void BindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+    {
+        BufferBinding* binding{ bufferBinding(target, index) };
+        if (change(!binding || binding->buffer != buffer || binding->offset != offset || binding->size != size))
+            glBindBufferRange(target, index, buffer, offset, size);
+        if (binding)
+            *binding = { buffer, offset, size };
+    }
+
+    void Viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+    {
+        if (change(!m_viewportKnown || m_viewport[0] != x || m_viewport[1] != y || m_viewport[2] != width || m_viewport[3] != height))
+            glViewport(x, y, width, height);
+        m_viewport[0] = x;
+        m_viewport[1] = y;
+        m_viewport[2] = width;
+        m_viewport[3] = height;
+        m_viewportKnown = true;
+    }
+
+    void Enable(GLenum cap) { setCapability(cap, true); }
+    void Disable(GLenum cap) { setCapability(cap, false); }
+
+    void DepthFunc(GLenum func)
+    {
+        if (change(func != m_depthFunc))
+            glDepthFunc(func);
+        m_depthFunc = func;
+    }
+
+    void BlendFunc(GLenum source, GLenum destination)
+    {
+        if (change(source != m_blendSource || destination != m_blendDestination))
+            glBlendFunc(source, destination);
+        m_blendSource = source;
+        m_blendDestination = destination;
+    }
+
+    // Integer uniforms of the program in use
+    void Uniform1i(GLint location, GLint value)
+    {
+        if (location < 0)
+            return;
+        if (change(setUniform(location, 0, value)))
+            glUniform1i(location, value);
+    }
+
+    void Uniform2i(GLint location, GLint x, GLint y)
+    {
+        if (location < 0)
+            return;
+        bool differs{ setUniform(location, 0, x) };
+        differs = setUniform(location, 1, y) || differs;
+        if (change(differs))
+            glUniform2i(location, x, y);
+    }
+
+    // Without a mirrored value these ask GL once, after that they never stall on a query
+    void GetViewport(GLint viewport[4])
+    {
+        if (!m_viewportKnown || !m_enabled)
+        {
+            glGetIntegerv(GL_VIEWPORT, m_viewport);
+            m_viewportKnown = true;
+        }
+        for (int i{ 0 }; i < 4; ++i)
+            viewport[i] = m_viewport[i];
+    }
+
+    GLuint GetDrawFramebuffer()
+    {
+        if (m_drawFramebuffer == UNKNOWN || !m_enabled)
+        {
+            GLint framebuffer{};
+            glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+            m_drawFramebuffer = static_cast<GLuint>(framebuffer);
+        }
+        return m_drawFramebuffer;
+    }
+
+    // Deletions, GL drops the bindings of the deleted objects in this context
+    void DeleteTextures(GLsizei count, const GLuint* textures)
+    {
+        for (GLsizei i{ 0 }; i < count; ++i)
+            for (auto& unit : m_textures)
+                for (GLuint& texture : unit)
+                    if (texture == textures[i] && textures[i] != 0)
+                        texture = 0;
+        glDeleteTextures(count, textures);
+    }
+
+    void DeleteFramebuffers(GLsizei count, const GLuint* framebuffers)
+    {
+        for (GLsizei i{ 0 }; i < count; ++i)
+        {
+            if (framebuffers[i] == 0)
+                continue;
+            if (m_drawFramebuffer == framebuffers[i])
+                m_drawFramebuffer = 0;
+            if (m_readFramebuffer == framebuffers[i])
+                m_readFramebuffer = 0;
+        }
+        glDeleteFramebuffers(count, framebuffers);
+    }
+
+    void DeleteVertexArrays(GLsizei count, const GLuint* vertexArrays)
+    {
+        for (GLsizei i{ 0 }; i < count; ++i)
+            if (vertexArrays[i] != 0 && m_vertexArray == vertexArrays[i])
+                m_vertexArray = 0;
+        glDeleteVertexArrays(count, vertexArrays);
+    }
+
+    void DeleteBuffers(GLsizei count, const GLuint* buffers)
+    {
+        for (GLsizei i{ 0 }; i < count; ++i)
+        {
+            if (buffers[i] == 0)
+                continue;
+            for (BufferBinding& binding : m_uniformBuffers)
+                if (binding.buffer == buffers[i])
+                    binding = { 0, 0, 0 };
+            for (BufferBinding& binding : m_storageBuffers)
+                if (binding.buffer == buffers[i])
+                    binding = { 0, 0, 0 };
+        }
+        glDeleteBuffers(count, buffers);
+    }
+
+    // A program in use lives on until it is replaced, its name is not reused before that, but its uniforms go with it
+    void DeleteProgram(GLuint program)
+    {
+        for (auto it = m_uniforms.begin(); it != m_uniforms.end();)
+            it = (it->first >> 32) == program ? m_uniforms.erase(it) : std::next(it);
+        if (m_program == program)
+            m_program = UNKNOWN;
+        glDeleteProgram(program);
+    }
+};
+
+// The one cache of the process, for its single GL context. Only the thread that owns that context may use it; a second
+// context would need its own cache (or an Invalidate() whenever it is made current)
+inline GLStateCache& GetGLState()
+{
+    static GLStateCache cache;
+    return cache;
+}
+
+#endif
@@ -0,0 +1,343 @@
+#ifndef GPU_CULLING_H
+#define GPU_CULLING_H
+
+#include <algorithm>
+#include <iostream>
+#include <numeric>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include "GLState.h"
+#include "Mesh.h"
+#include "Shader.h"
+#include "StreamingBuffer.h"
+#include "TransformStore.h"
+#include "UniformBlocks.h"
+
+// Frames between a readback copy and the moment its counters are read, so the CPU never waits for the GPU
+constexpr unsigned CULL_READBACK_FRAMES{ 3 };
+
+// Projected diameters in pixels under which LOD 1, 2 and 3 take over
+const glm::vec4 DEFAULT_LOD_THRESHOLDS{ 160.0f, 60.0f, 20.0f, 0.0f };
+
+// Counters of one culled frame, a few frames old
+struct CullStats
+{
+    GLuint visiblePerLod[MAX_CULL_LODS]{};
+    GLuint visiblePerBin[MAX_CULL_BINS]{};
+    GLuint binCount{};
+    GLuint visible{};
+    GLuint culled{};
+    GLuint total{};
+    bool valid{};
+};
+
+inline void PrintCullStats(const CullStats& stats)
+{
+    if (!stats.valid)
+        return;
+
+    std::cout << "  culling: " << stats.visible << " visible, " << stats.culled << " culled of " << stats.total << ", per LOD";
+    for (GLuint lod : stats.visiblePerLod)
+        std::cout << " " << lod;
+    if (stats.binCount > 1)
+    {
+        std::cout << ", per bin";
+        for (GLuint bin{ 0 }; bin < stats.binCount; ++bin)
+            std::cout << " " << stats.visiblePerBin[bin];
+    }
+    std::cout << std::endl;
+}
+
+// Gribb-Hartmann planes of a view-projection matrix, normals point inside and are normalized
+inline void ExtractFrustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6])
+{
+    glm::vec4 rows[4];
+    for (int i{ 0 }; i < 4; ++i)
+        rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+
+    planes[0] = rows[3] + rows[0];  // left
+    planes[1] = rows[3] - rows[0];  // right
+    planes[2] = rows[3] + rows[1];  // bottom
+    planes[3] = rows[3] - rows[1];  // top
+    planes[4] = rows[3] + rows[2];  // near
+    planes[5] = rows[3] - rows[2];  // far
+
+    for (int i{ 0 }; i < 6; ++i)
+        planes[i] /= glm::length(glm::vec3(planes[i]));
+}
+
+// Culls the instances of a mesh against the view frustum and picks their LOD on the GPU.
+// A compute pass writes one indirect command per LOD plus the list of visible instance indices, the mesh is then drawn with a
+// single glMultiDrawElementsIndirect, so the CPU never walks the instances. When disabled every instance is drawn at LOD 0.
+// Instances are also sorted into bins by material, each bin with its own commands and range of the list, so every bin can be
+// drawn with its own program
+class GpuCuller
+{
+private:
+    Mesh& m_mesh;
+    Shader m_shader;
+    GLuint m_commandBuffer{};
+    GLuint m_commandTemplate{};
+    GLuint m_visibleBuffer{};
+    GLuint m_counterBuffer{};
+    GLuint m_readbackBuffers[CULL_READBACK_FRAMES]{};
+    GLsync m_readbackFences[CULL_READBACK_FRAMES]{};
+    unsigned m_frame{};
+
+    GLuint m_instanceCount{};
+    GLuint m_capacity{};        // instances the visible list has room for, per LOD
+    GLuint m_lodCount{};
+    GLuint m_binCount{ 1 };
+    GLuint m_materialBins[MAX_MATERIALS]{};
+    GLuint m_binSizes[MAX_CULL_BINS]{};     // instances of each bin among the first m_instanceCount
+    GLuint m_binFirst[MAX_CULL_BINS]{};     // first slot of each bin in the visible list
+    float m_boundingRadius{};
+    glm::vec4 m_lodThresholds{ DEFAULT_LOD_THRESHOLDS };
+    bool m_enabled{};
+    CullStats m_stats{};
+
+    static constexpr GLsizeiptr COMMANDS_SIZE{ MAX_CULL_BINS * MAX_CULL_LODS * sizeof(DrawElementsIndirectCommand) };
+
+    // Lays the bins out one after the other in the visible list, each one with a range per LOD when culling, and points the
+    // commands at them. Without culling the list is rewritten as every instance sorted by bin
+    void layoutBins(const TransformStore& transforms)
+    {
+        GLuint first{ 0 };
+        for (GLuint bin{ 0 }; bin < m_binCount; ++bin)
+        {
+            m_binFirst[bin] = first;
+            first += (m_enabled ? m_lodCount : 1) * m_binSizes[bin];
+        }
+
+        if (!m_enabled)
+        {
+            std::vector<GLuint> sorted(std::max<GLuint>(1, m_instanceCount));
+            GLuint next[MAX_CULL_BINS]{};
+            std::copy(m_binFirst, m_binFirst + m_binCount, next);
+            for (GLuint i{ 0 }; i < m_instanceCount; ++i)
+                sorted[next[binOf(transforms.GetMaterial(i))]++] = i;
+            glBindBuffer(GL_COPY_WRITE_BUFFER, m_visibleBuffer);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, 0, sorted.size() * sizeof(GLuint), sorted.data());
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            return;
+        }
+
+        std::vector<DrawElementsIndirectCommand> commands(MAX_CULL_BINS * MAX_CULL_LODS);
+        for (GLuint bin{ 0 }; bin < m_binCount; ++bin)
+            for (GLuint lod{ 0 }; lod < m_lodCount; ++lod)
+            {
+                const MeshLod& entry{ m_mesh.GetLod(lod) };
+                DrawElementsIndirectCommand& command{ commands[bin * MAX_CULL_LODS + lod] };
+                command.count = entry.indexCount;
+                command.instanceCount = 0;
+                command.firstIndex = entry.firstIndex;
+                command.baseVertex = entry.baseVertex;
+                command.baseInstance = m_binFirst[bin] + lod * m_binSizes[bin];
+            }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_commandTemplate);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, 0, COMMANDS_SIZE, commands.data());
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    GLuint binOf(GLuint material) const { return std::min(m_materialBins[std::min(material, MAX_MATERIALS - 1)], m_binCount - 1); }
+
+    // Picks up the counters of an older frame if the GPU is already done with them
+    void readCounters(unsigned slot)
+    {
+        if (!m_readbackFences[slot])
+            return;
+
+        if (glClientWaitSync(m_readbackFences[slot], 0, 0) == GL_TIMEOUT_EXPIRED)
+            return;
+
+        glDeleteSync(m_readbackFences[slot]);
+        m_readbackFences[slot] = nullptr;
+
+        DrawElementsIndirectCommand commands[MAX_CULL_BINS * MAX_CULL_LODS]{};
+        GLuint culled{};
+        glBindBuffer(GL_COPY_READ_BUFFER, m_readbackBuffers[slot]);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, COMMANDS_SIZE, commands);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, COMMANDS_SIZE, sizeof(GLuint), &culled);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+        m_stats = CullStats{};
+        for (GLuint bin{ 0 }; bin < m_binCount; ++bin)
+            for (GLuint lod{ 0 }; lod < MAX_CULL_LODS; ++lod)
+            {
+                GLuint visible{ commands[bin * MAX_CULL_LODS + lod].instanceCount };
+                m_stats.visiblePerLod[lod] += visible;
+                m_stats.visiblePerBin[bin] += visible;
+                m_stats.visible += visible;
+            }
+        m_stats.binCount = m_binCount;
+        m_stats.culled = culled;
+        m_stats.total = m_instanceCount;
+        m_stats.valid = true;
+    }
+
+public:
+    GpuCuller(Mesh& mesh, GLuint instanceCount, float boundingRadius, bool enabled)
+        : m_mesh{ mesh }, m_shader{ "cull.comp" }, m_capacity{ instanceCount },
+        m_lodCount{ static_cast<GLuint>(std::min<size_t>(mesh.GetLodCount(), MAX_CULL_LODS)) }, m_boundingRadius{ boundingRadius }, m_enabled{ enabled }
+    {
+        m_shader.BindUniformBlock("CullBlock", CULL_BLOCK_BINDING);
+
+        // One command per bin and LOD, each one reading its own range of the visible list; laid out once the instances are known
+        std::vector<DrawElementsIndirectCommand> commands(MAX_CULL_BINS * MAX_CULL_LODS);
+        glGenBuffers(1, &m_commandTemplate);
+        glBindBuffer(GL_COPY_READ_BUFFER, m_commandTemplate);
+        glBufferData(GL_COPY_READ_BUFFER, COMMANDS_SIZE, commands.data(), GL_DYNAMIC_DRAW);
+
+        glGenBuffers(1, &m_commandBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_commandBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, COMMANDS_SIZE, commands.data(), GL_DYNAMIC_COPY);
+
+        glGenBuffers(1, &m_counterBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_counterBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+
+        glGenBuffers(CULL_READBACK_FRAMES, m_readbackBuffers);
+        for (GLuint buffer : m_readbackBuffers)
+        {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+            glBufferData(GL_COPY_WRITE_BUFFER, COMMANDS_SIZE + sizeof(GLuint), nullptr, GL_STREAM_READ);
+        }
+
+        // The visible list holds lodCount ranges per bin when culling, or every instance sorted by bin when it is off
+        std::vector<GLuint> identity;
+        if (!m_enabled)
+        {
+            identity.resize(m_capacity);
+            std::iota(identity.begin(), identity.end(), 0u);
+        }
+        glGenBuffers(1, &m_visibleBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_visibleBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, std::max<GLsizeiptr>(1, static_cast<GLsizeiptr>(m_enabled ? m_lodCount : 1) * m_capacity) * sizeof(GLuint),
+            m_enabled ? nullptr : identity.data(), GL_DYNAMIC_COPY);
+
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        m_mesh.AttachInstanceAttribute(INSTANCE_INDEX_ATTRIBUTE, m_visibleBuffer);
+    }
+
+    GpuCuller(const GpuCuller&) = delete;
+    GpuCuller& operator=(const GpuCuller&) = delete;
+
+    ~GpuCuller()
+    {
+        for (GLsync fence : m_readbackFences)
+            if (fence)
+                glDeleteSync(fence);
+        GetGLState().DeleteBuffers(CULL_READBACK_FRAMES, m_readbackBuffers);
+        GetGLState().DeleteBuffers(1, &m_commandBuffer);
+        GetGLState().DeleteBuffers(1, &m_commandTemplate);
+        GetGLState().DeleteBuffers(1, &m_visibleBuffer);
+        GetGLState().DeleteBuffers(1, &m_counterBuffer);
+    }
+
+    // Runs the culling pass for this frame's camera, the cull block goes into the frame's streaming segment
+    void Cull(StreamingBuffer& stream, const glm::mat4& view, const glm::mat4& projection, const glm::vec3& cameraPosition, float viewportHeight)
+    {
+        if (!m_enabled || m_instanceCount == 0)
+            return;
+
+        unsigned slot{ m_frame % CULL_READBACK_FRAMES };
+        readCounters(slot);
+
+        CullBlock block{};
+        ExtractFrustumPlanes(projection * view, block.frustumPlanes);
+        block.lodThresholds = m_lodThresholds;
+        block.cameraPosition = cameraPosition;
+        block.projectionScale = projection[1][1] * viewportHeight;
+        block.instanceCount = m_instanceCount;
+        block.lodCount = m_lodCount;
+        block.binCount = m_binCount;
+        block.boundingRadius = m_boundingRadius;
+        for (GLuint material{ 0 }; material < MAX_MATERIALS; ++material)
+            block.materialBins[material / 4][material % 4] = m_materialBins[material];
+        for (GLuint bin{ 0 }; bin < m_binCount; ++bin)
+            block.binRanges[bin] = glm::uvec4(m_binFirst[bin], m_binSizes[bin], 0, 0);
+        stream.WriteAndBind(block, CULL_BLOCK_BINDING);
+
+        // Reset the instance counts and the culled counter without touching the CPU copy
+        glBindBuffer(GL_COPY_READ_BUFFER, m_commandTemplate);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_commandBuffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, COMMANDS_SIZE);
+        GLuint zero{ 0 };
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_counterBuffer);
+        glClearBufferData(GL_COPY_WRITE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+        GetGLState().BindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_COMMAND_BUFFER_BINDING, m_commandBuffer);
+        GetGLState().BindBufferBase(GL_SHADER_STORAGE_BUFFER, VISIBLE_INSTANCE_BUFFER_BINDING, m_visibleBuffer);
+        GetGLState().BindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_COUNTER_BUFFER_BINDING, m_counterBuffer);
+
+        m_shader.Use();
+        glDispatchCompute((m_instanceCount + 63) / 64, 1, 1);
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+        // Queue the counters for readback, they are read CULL_READBACK_FRAMES frames later
+        glBindBuffer(GL_COPY_READ_BUFFER, m_commandBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_readbackBuffers[slot]);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, COMMANDS_SIZE);
+        glBindBuffer(GL_COPY_READ_BUFFER, m_counterBuffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, COMMANDS_SIZE, sizeof(GLuint));
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        m_readbackFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        ++m_frame;
+    }
+
+    // Draws the surviving instances of one bin, the mesh's VAO must be bound
+    void Draw(GLuint bin = 0) const
+    {
+        if (bin >= m_binCount || m_binSizes[bin] == 0)
+            return;
+
+        if (!m_enabled)
+        {
+            m_mesh.DrawInstanced(0, m_binSizes[bin], m_binFirst[bin]);
+            return;
+        }
+
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_commandBuffer);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, m_mesh.GetIndexType(), (GLvoid*)(bin * MAX_CULL_LODS * sizeof(DrawElementsIndirectCommand)), m_lodCount, 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+
+    // Waits for the culling program, it compiles alongside the other ones while the scene is being set up
+    bool FinishShader() { return m_shader.Finish(); }
+
+    // Bin of every material, at most MAX_CULL_BINS of them; everything is in bin 0 until this is called. Takes effect with the
+    // next SetInstances
+    void SetMaterialBins(const GLuint materialBins[MAX_MATERIALS], GLuint binCount)
+    {
+        m_binCount = std::max(1u, std::min(binCount, MAX_CULL_BINS));
+        std::copy(materialBins, materialBins + MAX_MATERIALS, m_materialBins);
+        m_instanceCount = 0;
+        std::fill(std::begin(m_binSizes), std::end(m_binSizes), 0u);
+    }
+
+    // Culls and draws the first objects of the store, fewer than all of them for scenes that are still streaming in; the count given
+    // at construction is the most. Only the objects added since the last call are counted into the bins
+    void SetInstances(const TransformStore& transforms)
+    {
+        GLuint count{ static_cast<GLuint>(std::min<size_t>(transforms.Size(), m_capacity)) };
+        for (GLuint i{ m_instanceCount }; i < count; ++i)
+            ++m_binSizes[binOf(transforms.GetMaterial(i))];
+        m_instanceCount = count;
+        layoutBins(transforms);
+    }
+    void SetLodThresholds(const glm::vec4& thresholds) { m_lodThresholds = thresholds; }
+    bool IsEnabled() const { return m_enabled; }
+    GLuint GetBinSize(GLuint bin) const { return bin < m_binCount ? m_binSizes[bin] : 0; }
+    const CullStats& GetStats() const { return m_stats; }
+};
+
+#endif
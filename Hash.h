@@ -0,0 +1,58 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// 64-bit FNV-1a, used to key on-disk caches on the exact bytes they were built from
+constexpr std::uint64_t FNV_OFFSET_BASIS{ 14695981039346656037ull };
+constexpr std::uint64_t FNV_PRIME{ 1099511628211ull };
+
+inline std::uint64_t HashBytes(const void* data, size_t size, std::uint64_t hash = FNV_OFFSET_BASIS)
+{
+    const unsigned char* bytes{ static_cast<const unsigned char*>(data) };
+    for (size_t i{ 0 }; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+inline std::uint64_t HashString(const std::string& text, std::uint64_t hash = FNV_OFFSET_BASIS)
+{
+    return HashBytes(text.data(), text.size(), hash);
+}
+
+// Folds the whole content of a file into the hash. A missing file hashes its path only, so it still changes the key
+inline std::uint64_t HashFile(const std::string& path, std::uint64_t hash = FNV_OFFSET_BASIS)
+{
+    hash = HashString(path, hash);
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return hash;
+
+    std::vector<char> chunk(1 << 16);
+    while (file)
+    {
+        file.read(chunk.data(), chunk.size());
+        hash = HashBytes(chunk.data(), static_cast<size_t>(file.gcount()), hash);
+    }
+    return hash;
+}
+
+// Lower case hexadecimal form, handy for cache file names
+inline std::string HashToString(std::uint64_t hash)
+{
+    static const char digits[]{ "0123456789abcdef" };
+    std::string text(16, '0');
+    for (int i{ 15 }; i >= 0; --i, hash >>= 4)
+        text[i] = digits[hash & 0xF];
+    return text;
+}
+
+#endif
@@ -0,0 +1,872 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#if defined(__linux__)
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#else
+#include <SFML/Window.hpp>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "Camera.h"
+#include "CameraPath.h"
+#include "Cubemap.h"
+#include "GLState.h"
+#include "GpuCulling.h"
+#include "Options.h"
+#include "Ppm.h"
+#include "Renderer.h"
+#include "ResourceManager.h"
+#include "Scene.h"
+#include "ThreadPool.h"
+#include "TransformStore.h"
+
+// Frames rendered at time 0 before measuring, they absorb shader compilation and first-use allocations in the driver
+constexpr unsigned HEADLESS_WARMUP_FRAMES{ 3 };
+
+// Point light counts of --light-benchmark, and the most frames measured for each
+const unsigned LIGHT_BENCHMARK_COUNTS[]{ 1, 10, 100, 1000, 10000 };
+constexpr unsigned LIGHT_BENCHMARK_FRAMES{ 120 };
+
+// Object counts of the scenes --scene-benchmark generates
+const unsigned SCENE_BENCHMARK_COUNTS[]{ 1000, 100000, 1000000 };
+
+// Sphere counts of --sphere-benchmark, and the most frames measured for each mode
+const unsigned SPHERE_BENCHMARK_COUNTS[]{ 100, 1000, 10000, 100000 };
+constexpr unsigned SPHERE_BENCHMARK_FRAMES{ 60 };
+
+// Output sizes of --post-benchmark, and the most frames measured for each chain
+const GLsizei POST_BENCHMARK_SIZES[][2]{ { 1920, 1080 }, { 3840, 2160 } };
+constexpr unsigned POST_BENCHMARK_FRAMES{ 30 };
+
+// Meshes --resource-benchmark keeps loaded at once, and the rounds of loading and unloading them all
+constexpr unsigned RESOURCE_BENCHMARK_MESHES{ 1000 };
+constexpr unsigned RESOURCE_BENCHMARK_ROUNDS{ 8 };
+
+// GL 4.5 core context without a window. On Linux this is a surfaceless EGL context so it also runs on render nodes
+// without a display (Mesa llvmpipe included); elsewhere SFML's hidden context is used
+class HeadlessContext
+{
+private:
+#if defined(__linux__)
+    EGLDisplay m_display{ EGL_NO_DISPLAY };
+    EGLContext m_context{ EGL_NO_CONTEXT };
+#else
+    std::unique_ptr<sf::Context> m_context;
+#endif
+    bool m_valid{};
+
+public:
+    HeadlessContext()
+    {
+#if defined(__linux__)
+        auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+        m_display = getPlatformDisplay ? getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr) : eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+        EGLint major{}, minor{};
+        if (m_display == EGL_NO_DISPLAY || !eglInitialize(m_display, &major, &minor))
+        {
+            std::cout << "ERROR::HEADLESS::NO_EGL_DISPLAY" << std::endl;
+            return;
+        }
+
+        const EGLint configAttributes[] = { EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+        EGLConfig config{};
+        EGLint configCount{};
+        eglChooseConfig(m_display, configAttributes, &config, 1, &configCount);
+        eglBindAPI(EGL_OPENGL_API);
+
+        const EGLint contextAttributes[] = {
+            EGL_CONTEXT_MAJOR_VERSION, 4,
+            EGL_CONTEXT_MINOR_VERSION, 5,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE
+        };
+        m_context = eglCreateContext(m_display, configCount > 0 ? config : EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, contextAttributes);
+        m_valid = m_context != EGL_NO_CONTEXT && eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, m_context);
+#else
+        sf::ContextSettings settings;
+        settings.majorVersion = 4;
+        settings.minorVersion = 5;
+        settings.attributeFlags = 1;
+        m_context.reset(new sf::Context(settings, 1, 1));
+        m_valid = m_context->setActive(true);
+#endif
+        if (!m_valid)
+            std::cout << "ERROR::HEADLESS::CONTEXT_CREATION_FAILED" << std::endl;
+        GetGLState().Invalidate();
+    }
+
+    ~HeadlessContext()
+    {
+#if defined(__linux__)
+        if (m_display != EGL_NO_DISPLAY)
+        {
+            eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            if (m_context != EGL_NO_CONTEXT)
+                eglDestroyContext(m_display, m_context);
+            eglTerminate(m_display);
+        }
+#endif
+    }
+
+    HeadlessContext(const HeadlessContext&) = delete;
+    HeadlessContext& operator=(const HeadlessContext&) = delete;
+
+    bool IsValid() const { return m_valid; }
+};
+
+// Colour and depth renderbuffers standing in for the window's default framebuffer
+class OffscreenTarget
+{
+private:
+    GLuint m_framebuffer{};
+    GLuint m_colorBuffer{};
+    GLuint m_depthBuffer{};
+    GLsizei m_width{};
+    GLsizei m_height{};
+
+public:
+    OffscreenTarget(GLsizei width, GLsizei height)
+        : m_width{ width }, m_height{ height }
+    {
+        glGenRenderbuffers(1, &m_colorBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, m_colorBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+
+        glGenRenderbuffers(1, &m_depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, m_depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glGenFramebuffers(1, &m_framebuffer);
+        GetGLState().BindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, m_colorBuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, m_depthBuffer);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::HEADLESS::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        GetGLState().Viewport(0, 0, width, height);
+    }
+
+    ~OffscreenTarget()
+    {
+        GetGLState().DeleteFramebuffers(1, &m_framebuffer);
+        glDeleteRenderbuffers(1, &m_colorBuffer);
+        glDeleteRenderbuffers(1, &m_depthBuffer);
+    }
+
+    OffscreenTarget(const OffscreenTarget&) = delete;
+    OffscreenTarget& operator=(const OffscreenTarget&) = delete;
+
+    // RGB8 rows, bottom-up the way WritePPM takes them
+    std::vector<unsigned char> ReadPixels() const
+    {
+        std::vector<unsigned char> pixels(static_cast<size_t>(m_width) * m_height * 3);
+        GetGLState().BindFramebuffer(GL_READ_FRAMEBUFFER, m_framebuffer);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, m_width, m_height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+        return pixels;
+    }
+
+    bool SaveFrame(const std::string& path) const
+    {
+        std::vector<unsigned char> pixels{ ReadPixels() };
+        return WritePPM(path, m_width, m_height, pixels.data());
+    }
+
+    GLuint GetFramebuffer() const { return m_framebuffer; }
+};
+
+// Per-frame measurements of a headless run
+struct HeadlessFrameTiming
+{
+    double cpuMs{};     // recording the frame
+    double frameMs{};   // recording plus glFinish
+    double gpuMs{};     // GL_TIME_ELAPSED around the frame
+    GLuint visible{};   // culling counters lag a few frames behind, see CULL_READBACK_FRAMES
+    float scale{ 1.0f };    // resolution scale the frame was rendered at
+    GLStateStats state{};   // GL calls issued and elided by the state cache
+};
+
+inline void PrintTimingSummary(const char* name, const std::vector<double>& values)
+{
+    if (values.empty())
+        return;
+
+    std::vector<double> sorted{ values };
+    std::sort(sorted.begin(), sorted.end());
+    double sum{ 0.0 };
+    for (double value : sorted)
+        sum += value;
+
+    std::cout << "  " << std::setw(6) << name << ": avg " << sum / sorted.size() << " ms, min " << sorted.front() << " ms, median "
+        << sorted[sorted.size() / 2] << " ms, max " << sorted.back() << " ms" << std::endl;
+}
+
+// Time to first frame and how much of the scene and environment it had, call after the frame has finished
+inline void PrintFirstFrame(const Renderer& renderer, const SceneFile* scene)
+{
+    std::cout << "First frame finished " << ElapsedMilliseconds(GetStartupTime(), std::chrono::steady_clock::now()) << " ms after start-up";
+    if (scene)
+        std::cout << ", " << renderer.GetSphereCount() << " of " << scene->GetObjectCount() << " objects in";
+    EnvironmentStreamStats environment{ renderer.GetEnvironmentStreamStats() };
+    if (environment.levels > 0)
+        std::cout << ", environment at " << environment.baseSize << " px";
+    std::cout << std::endl;
+}
+
+// Loads the GL entry points once the headless context is current and creates the output directory
+inline bool InitializeHeadless(const Options& options)
+{
+    // GLEW has to be built with EGL support (GLEW_EGL) to load entry points from a surfaceless context on Linux
+    glewExperimental = GL_TRUE;
+    GLenum glewStatus{ glewInit() };
+    if (glewStatus != GLEW_OK)
+    {
+        std::cout << "ERROR::HEADLESS::GLEW_INIT_FAILED" << std::endl;
+        return false;
+    }
+
+    Shader::SetCacheDirectory(options.shaderCache ? SHADER_CACHE_DIRECTORY : "");
+
+    std::error_code error{};
+    std::filesystem::create_directories(options.outputDirectory, error);
+    if (error)
+    {
+        std::cout << "ERROR::HEADLESS::CANNOT_CREATE " << options.outputDirectory << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Renders a fixed number of frames into an offscreen target along the scripted path and writes the timings (and optionally frames)
+// to the output directory. With the same options the run is reproducible, so the CSVs can be compared across commits. A scene file
+// and the environment's finer levels are streamed in during the warm-up frames, which last until both are complete
+inline int RunHeadlessBenchmark(const Options& options, ThreadPool& threadPool, const std::vector<const GLchar*>& faces, const SceneFile* scene = nullptr)
+{
+    HeadlessContext context{};
+    if (!context.IsValid() || !InitializeHeadless(options))
+        return 1;
+
+    const GLsizei width{ static_cast<GLsizei>(options.width) }, height{ static_cast<GLsizei>(options.height) };
+    const GLubyte* rendererName{ glGetString(GL_RENDERER) };
+    const GLubyte* versionName{ glGetString(GL_VERSION) };
+    std::cout << "Headless benchmark on " << rendererName << " (" << versionName << "), " << width << "x" << height << ", "
+        << options.frameCount << " frames" << std::endl;
+
+    OffscreenTarget target(width, height);
+    Renderer renderer(options, threadPool, faces, static_cast<float>(width) / static_cast<float>(height), scene);
+    Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
+
+    GLuint timerQuery{};
+    glGenQueries(1, &timerQuery);
+
+    std::vector<unsigned> savedFrames{ SelectSavedFrames(options.frameCount, options.savedFrameCount) };
+
+    for (unsigned frame{ 0 }; frame < HEADLESS_WARMUP_FRAMES || !renderer.IsLoaded(); ++frame)
+    {
+        UpdateScriptedCamera(camera, 0.0f);
+        renderer.RenderFrame(camera, 0.0f, static_cast<float>(height));
+        if (frame == 0)
+        {
+            glFinish();
+            PrintFirstFrame(renderer, scene);
+        }
+    }
+    glFinish();
+
+    Profiler& profiler{ renderer.GetProfiler() };
+    std::vector<HeadlessFrameTiming> timings(options.frameCount);
+    for (unsigned frame{ 0 }; frame < options.frameCount; ++frame)
+    {
+        float time{ frame * HEADLESS_TIMESTEP };
+        UpdateScriptedCamera(camera, time);
+
+        profiler.BeginFrame();
+        auto frameStart = std::chrono::steady_clock::now();
+        glBeginQuery(GL_TIME_ELAPSED, timerQuery);
+        {
+            ProfileScope scope(profiler, "render");
+            renderer.RenderFrame(camera, time, static_cast<float>(height));
+        }
+        glEndQuery(GL_TIME_ELAPSED);
+        auto recorded = std::chrono::steady_clock::now();
+        {
+            ProfileScope scope(profiler, "finish", false);
+            glFinish();
+        }
+        auto finished = std::chrono::steady_clock::now();
+        profiler.EndFrame();
+
+        GLuint64 gpuNanoseconds{};
+        glGetQueryObjectui64v(timerQuery, GL_QUERY_RESULT, &gpuNanoseconds);
+
+        timings[frame].cpuMs = ElapsedMilliseconds(frameStart, recorded);
+        timings[frame].frameMs = ElapsedMilliseconds(frameStart, finished);
+        timings[frame].gpuMs = gpuNanoseconds / 1.0e6;
+        timings[frame].visible = renderer.GetCullStats().valid ? renderer.GetCullStats().visible : renderer.GetSphereCount();
+        timings[frame].scale = renderer.GetResolutionStats().scale;
+        timings[frame].state = GetGLState().GetStats().lastFrame;
+
+        if (std::find(savedFrames.begin(), savedFrames.end(), frame) != savedFrames.end())
+        {
+            std::string path{ FramePath(options.outputDirectory, frame) };
+            if (!target.SaveFrame(path))
+                std::cout << "ERROR::HEADLESS::CANNOT_WRITE " << path << std::endl;
+        }
+    }
+
+    glDeleteQueries(1, &timerQuery);
+
+    // The header records everything needed to reproduce the run
+    std::filesystem::path timingsPath{ std::filesystem::path(options.outputDirectory) / "timings.csv" };
+    std::ofstream csv(timingsPath);
+    csv << "# renderer: " << rendererName << "\n# version: " << versionName << "\n# spheres: " << options.sphereCount << ", seed: " << options.seed
+        << ", frames: " << options.frameCount << ", size: " << width << "x" << height << ", gpu culling: " << (options.gpuCulling ? "on" : "off")
+        << ", animate: " << (options.animate ? "on" : "off") << ", ibl: " << (options.imageBasedLighting ? "on" : "off")
+        << ", probes: " << options.probeCount << ", lights: " << options.pointLightCount << ", scene: " << (scene ? options.sceneFile : "none")
+        << ", frame budget: " << options.frameBudgetMs << " ms, resolution scale: " << options.resolutionScale << " (min " << options.minResolutionScale << ")"
+        << ", half rate reflections: " << (options.halfRateReflections ? "on" : "off") << ", state cache: " << (options.stateCache ? "on" : "off")
+        << ", sphere mode: " << SphereModeName(options.sphereMode) << ", shader variants: " << (options.shaderVariants ? "on" : "off")
+        << ", material features: " << (options.materialFeatures ? "on" : "off") << ", hdr: " << (options.hdr ? (options.naivePost ? "per level" : "single pass") : "off")
+        << ", bloom: " << options.bloomStrength << ", exposure key: " << options.exposureKey << "\n";
+    csv << "frame,cpu_ms,frame_ms,gpu_ms,visible,scale,gl_issued,gl_elided\n";
+    for (unsigned frame{ 0 }; frame < options.frameCount; ++frame)
+        csv << frame << "," << timings[frame].cpuMs << "," << timings[frame].frameMs << "," << timings[frame].gpuMs << "," << timings[frame].visible
+            << "," << timings[frame].scale << "," << timings[frame].state.issued << "," << timings[frame].state.elided << "\n";
+
+    if (!csv)
+    {
+        std::cout << "ERROR::HEADLESS::CANNOT_WRITE " << timingsPath.string() << std::endl;
+        return 1;
+    }
+
+    std::vector<double> cpuMs, frameMs, gpuMs;
+    for (const HeadlessFrameTiming& timing : timings)
+    {
+        cpuMs.push_back(timing.cpuMs);
+        frameMs.push_back(timing.frameMs);
+        gpuMs.push_back(timing.gpuMs);
+    }
+
+    std::cout << options.frameCount << " frames, " << renderer.GetSphereCount() << " spheres, timings written to " << timingsPath.string() << std::endl;
+    PrintTimingSummary("cpu", cpuMs);
+    PrintTimingSummary("frame", frameMs);
+    PrintTimingSummary("gpu", gpuMs);
+    PrintCullStats(renderer.GetCullStats());
+    PrintClusterStats(renderer.GetClusterStats());
+    PrintStreamingStats(renderer.GetStreamingStats());
+    PrintTransformStats(renderer.GetTransformStats());
+    PrintEnvironmentStreamStats(renderer.GetEnvironmentStreamStats());
+    PrintResolutionStats(renderer.GetResolutionStats());
+    PrintGLStateStats(GetGLState().GetStats());
+    PrintProbeStats(renderer.GetProbeStats());
+    PrintBvhStats(renderer.GetBvhStats());
+    PrintShaderVariantStats(renderer.GetShaderVariantStats());
+    PrintPostProcessStats(renderer.GetPostProcessStats());
+    PrintResourceStats(renderer.GetResourceStats());
+    profiler.PrintSummary();
+
+    if (!options.traceFile.empty() && profiler.WriteTrace(options.traceFile))
+        std::cout << profiler.GetTraceEventCount() << " trace events written to " << options.traceFile << std::endl;
+    return 0;
+}
+
+// --light-benchmark: the same scripted path rendered with 1, 10, ... 10000 point lights scattered through the sphere field.
+// Every step reports its frame and GPU times and how many lights the clusters ended up with, and the table goes to lights.csv
+inline int RunLightBenchmark(const Options& options, ThreadPool& threadPool, const std::vector<const GLchar*>& faces, const SceneFile* scene = nullptr)
+{
+    HeadlessContext context{};
+    if (!context.IsValid() || !InitializeHeadless(options))
+        return 1;
+
+    const GLsizei width{ static_cast<GLsizei>(options.width) }, height{ static_cast<GLsizei>(options.height) };
+    const unsigned frameCount{ std::max(1u, std::min(options.frameCount, LIGHT_BENCHMARK_FRAMES)) };
+    const GLubyte* rendererName{ glGetString(GL_RENDERER) };
+    std::cout << "Light benchmark on " << rendererName << ", " << width << "x" << height << ", " << frameCount << " frames per step, "
+        << CLUSTER_GRID_X << "x" << CLUSTER_GRID_Y << "x" << CLUSTER_GRID_Z << " clusters" << std::endl;
+
+    OffscreenTarget target(width, height);
+    Renderer renderer(options, threadPool, faces, static_cast<float>(width) / static_cast<float>(height), scene);
+    Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
+
+    GLuint timerQuery{};
+    glGenQueries(1, &timerQuery);
+
+    std::filesystem::path csvPath{ std::filesystem::path(options.outputDirectory) / "lights.csv" };
+    std::ofstream csv(csvPath);
+    csv << "# renderer: " << rendererName << "\n# spheres: " << options.sphereCount << ", seed: " << options.seed << ", frames: " << frameCount
+        << ", size: " << width << "x" << height << "\n";
+    csv << "lights,frame_ms,gpu_ms,lights_per_cluster,lights_per_occupied_cluster,occupied_clusters,max_cluster_lights,overflowed_clusters\n";
+
+    for (unsigned lightCount : LIGHT_BENCHMARK_COUNTS)
+    {
+        renderer.SetPointLights(BuildPointLights(lightCount, options.seed, options.sphereCount));
+        for (unsigned frame{ 0 }; frame < HEADLESS_WARMUP_FRAMES || !renderer.IsLoaded(); ++frame)
+        {
+            UpdateScriptedCamera(camera, 0.0f);
+            renderer.RenderFrame(camera, 0.0f, static_cast<float>(height));
+        }
+        glFinish();
+
+        double frameMs{ 0.0 }, gpuMs{ 0.0 };
+        for (unsigned frame{ 0 }; frame < frameCount; ++frame)
+        {
+            float time{ frame * HEADLESS_TIMESTEP };
+            UpdateScriptedCamera(camera, time);
+
+            auto frameStart = std::chrono::steady_clock::now();
+            glBeginQuery(GL_TIME_ELAPSED, timerQuery);
+            renderer.RenderFrame(camera, time, static_cast<float>(height));
+            glEndQuery(GL_TIME_ELAPSED);
+            glFinish();
+            frameMs += ElapsedMilliseconds(frameStart, std::chrono::steady_clock::now());
+
+            GLuint64 gpuNanoseconds{};
+            glGetQueryObjectui64v(timerQuery, GL_QUERY_RESULT, &gpuNanoseconds);
+            gpuMs += gpuNanoseconds / 1.0e6;
+        }
+        frameMs /= frameCount;
+        gpuMs /= frameCount;
+
+        // The counters lag CLUSTER_READBACK_FRAMES behind, so they come from this step's last frames
+        ClusterStats stats{ renderer.GetClusterStats() };
+        std::cout << std::setw(6) << lightCount << " lights: frame " << frameMs << " ms, gpu " << gpuMs << " ms, " << stats.AverageLightsPerCluster()
+            << " lights per cluster (" << stats.AverageLightsPerOccupiedCluster() << " per occupied), max " << stats.maxLights << ", "
+            << stats.overflowed << " clusters over " << MAX_LIGHTS_PER_CLUSTER << std::endl;
+        csv << lightCount << "," << frameMs << "," << gpuMs << "," << stats.AverageLightsPerCluster() << "," << stats.AverageLightsPerOccupiedCluster()
+            << "," << stats.occupied << "," << stats.maxLights << "," << stats.overflowed << "\n";
+    }
+
+    glDeleteQueries(1, &timerQuery);
+
+    if (!csv)
+    {
+        std::cout << "ERROR::HEADLESS::CANNOT_WRITE " << csvPath.string() << std::endl;
+        return 1;
+    }
+    std::cout << "Light scaling written to " << csvPath.string() << std::endl;
+    return 0;
+}
+
+// --sphere-benchmark: the scripted path rendered in every sphere mode over fields of 100 to 100000 spheres, each step with a renderer
+// of its own. The last frame of every step is saved as spheres_<count>_<mode>.ppm and compared with the mesh path's; frame and GPU
+// times, set-up time (the BVH build included) and the differences go to spheres.csv
+inline int RunSphereBenchmark(const Options& options, ThreadPool& threadPool, const std::vector<const GLchar*>& faces)
+{
+    HeadlessContext context{};
+    if (!context.IsValid() || !InitializeHeadless(options))
+        return 1;
+
+    const GLsizei width{ static_cast<GLsizei>(options.width) }, height{ static_cast<GLsizei>(options.height) };
+    const unsigned frameCount{ std::max(1u, std::min(options.frameCount, SPHERE_BENCHMARK_FRAMES)) };
+    const GLubyte* rendererName{ glGetString(GL_RENDERER) };
+    std::cout << "Sphere benchmark on " << rendererName << ", " << width << "x" << height << ", " << frameCount << " frames per step" << std::endl;
+
+    OffscreenTarget target(width, height);
+    Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
+
+    GLuint timerQuery{};
+    glGenQueries(1, &timerQuery);
+
+    std::filesystem::path csvPath{ std::filesystem::path(options.outputDirectory) / "spheres.csv" };
+    std::ofstream csv(csvPath);
+    csv << "# renderer: " << rendererName << "\n# seed: " << options.seed << ", frames: " << frameCount << ", size: " << width << "x" << height
+        << ", gpu culling: " << (options.gpuCulling ? "on" : "off") << "\n";
+    csv << "spheres,mode,setup_ms,frame_ms,gpu_ms,mean_difference,max_difference\n";
+
+    for (unsigned sphereCount : SPHERE_BENCHMARK_COUNTS)
+    {
+        std::vector<unsigned char> meshPixels;
+        for (SphereMode mode : { SPHERE_MESH, SPHERE_IMPOSTOR, SPHERE_RAYTRACE })
+        {
+            Options step{ options };
+            step.sphereCount = sphereCount;
+            step.sphereMode = mode;
+
+            auto setupStart = std::chrono::steady_clock::now();
+            Renderer renderer(step, threadPool, faces, static_cast<float>(width) / static_cast<float>(height));
+            for (unsigned frame{ 0 }; frame < HEADLESS_WARMUP_FRAMES || !renderer.IsLoaded(); ++frame)
+            {
+                UpdateScriptedCamera(camera, 0.0f);
+                renderer.RenderFrame(camera, 0.0f, static_cast<float>(height));
+            }
+            glFinish();
+            double setupMs{ ElapsedMilliseconds(setupStart, std::chrono::steady_clock::now()) };
+
+            double frameMs{ 0.0 }, gpuMs{ 0.0 };
+            for (unsigned frame{ 0 }; frame < frameCount; ++frame)
+            {
+                float time{ frame * HEADLESS_TIMESTEP };
+                UpdateScriptedCamera(camera, time);
+
+                auto frameStart = std::chrono::steady_clock::now();
+                glBeginQuery(GL_TIME_ELAPSED, timerQuery);
+                renderer.RenderFrame(camera, time, static_cast<float>(height));
+                glEndQuery(GL_TIME_ELAPSED);
+                glFinish();
+                frameMs += ElapsedMilliseconds(frameStart, std::chrono::steady_clock::now());
+
+                GLuint64 gpuNanoseconds{};
+                glGetQueryObjectui64v(timerQuery, GL_QUERY_RESULT, &gpuNanoseconds);
+                gpuMs += gpuNanoseconds / 1.0e6;
+            }
+            frameMs /= frameCount;
+            gpuMs /= frameCount;
+
+            // Same camera and time in every mode, so the last frames should only differ by tessellation and sampling
+            std::vector<unsigned char> pixels{ target.ReadPixels() };
+            std::string framePath{ (std::filesystem::path(options.outputDirectory) / ("spheres_" + std::to_string(sphereCount) + "_" + SphereModeName(mode) + ".ppm")).string() };
+            if (!WritePPM(framePath, width, height, pixels.data()))
+                std::cout << "ERROR::HEADLESS::CANNOT_WRITE " << framePath << std::endl;
+            if (mode == SPHERE_MESH)
+                meshPixels = pixels;
+
+            double sum{ 0.0 };
+            int largest{ 0 };
+            for (size_t i{ 0 }; i < pixels.size(); ++i)
+            {
+                int difference{ std::abs(static_cast<int>(pixels[i]) - static_cast<int>(meshPixels[i])) };
+                sum += difference;
+                largest = std::max(largest, difference);
+            }
+            double mean{ sum / std::max<size_t>(pixels.size(), 1) };
+
+            std::cout << std::setw(7) << sphereCount << " spheres, " << std::setw(8) << SphereModeName(mode) << ": set-up " << setupMs << " ms, frame "
+                << frameMs << " ms, gpu " << gpuMs << " ms";
+            if (mode != SPHERE_MESH)
+                std::cout << ", against mesh: mean difference " << mean << ", max " << largest;
+            std::cout << std::endl;
+            csv << sphereCount << "," << SphereModeName(mode) << "," << setupMs << "," << frameMs << "," << gpuMs << "," << mean << "," << largest << "\n";
+        }
+    }
+
+    glDeleteQueries(1, &timerQuery);
+
+    if (!csv)
+    {
+        std::cout << "ERROR::HEADLESS::CANNOT_WRITE " << csvPath.string() << std::endl;
+        return 1;
+    }
+    std::cout << "Sphere mode comparison written to " << csvPath.string() << std::endl;
+    return 0;
+}
+
+// --post-benchmark: the scripted path rendered with --hdr at 1080p and 4K, once with the single pass downsampler and once with a
+// dispatch per level, each with a renderer of its own. The GPU time of the pyramid and exposure and of the bloom and tonemap pass
+// are averaged from the chain's own timestamps; the last frame of every run is saved as post_<W>x<H>_<chain>.ppm and the two chains'
+// frames are compared. The table goes to post.csv
+inline int RunPostBenchmark(const Options& options, ThreadPool& threadPool, const std::vector<const GLchar*>& faces)
+{
+    HeadlessContext context{};
+    if (!context.IsValid() || !InitializeHeadless(options))
+        return 1;
+
+    const unsigned frameCount{ std::max(1u, std::min(options.frameCount, POST_BENCHMARK_FRAMES)) };
+    const GLubyte* rendererName{ glGetString(GL_RENDERER) };
+    std::cout << "Post chain benchmark on " << rendererName << ", " << options.sphereCount << " spheres, " << frameCount << " frames per step" << std::endl;
+
+    Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
+
+    GLuint timerQuery{};
+    glGenQueries(1, &timerQuery);
+
+    std::filesystem::path csvPath{ std::filesystem::path(options.outputDirectory) / "post.csv" };
+    std::ofstream csv(csvPath);
+    csv << "# renderer: " << rendererName << "\n# spheres: " << options.sphereCount << ", seed: " << options.seed << ", frames: " << frameCount
+        << ", bloom: " << options.bloomStrength << ", exposure key: " << options.exposureKey << "\n";
+    csv << "width,height,chain,dispatches,downsample_ms,tonemap_ms,frame_gpu_ms,mean_difference,max_difference\n";
+
+    for (const GLsizei* size : POST_BENCHMARK_SIZES)
+    {
+        const GLsizei width{ size[0] }, height{ size[1] };
+        OffscreenTarget target(width, height);
+        std::vector<unsigned char> singlePassPixels;
+        for (bool naive : { false, true })
+        {
+            Options step{ options };
+            step.width = width;
+            step.height = height;
+            step.naivePost = naive;
+            const char* chain{ naive ? "per_level" : "single_pass" };
+
+            Renderer renderer(step, threadPool, faces, static_cast<float>(width) / static_cast<float>(height));
+            for (unsigned frame{ 0 }; frame < HEADLESS_WARMUP_FRAMES || !renderer.IsLoaded(); ++frame)
+            {
+                UpdateScriptedCamera(camera, 0.0f);
+                renderer.RenderFrame(camera, 0.0f, static_cast<float>(height));
+            }
+            glFinish();
+
+            // The chain's timestamps are read a few frames late, so the means come from the difference of its running totals
+            PostProcessStats before{ renderer.GetPostProcessStats() };
+            double gpuMs{ 0.0 };
+            for (unsigned frame{ 0 }; frame < frameCount; ++frame)
+            {
+                float time{ frame * HEADLESS_TIMESTEP };
+                UpdateScriptedCamera(camera, time);
+
+                glBeginQuery(GL_TIME_ELAPSED, timerQuery);
+                renderer.RenderFrame(camera, time, static_cast<float>(height));
+                glEndQuery(GL_TIME_ELAPSED);
+                glFinish();
+
+                GLuint64 gpuNanoseconds{};
+                glGetQueryObjectui64v(timerQuery, GL_QUERY_RESULT, &gpuNanoseconds);
+                gpuMs += gpuNanoseconds / 1.0e6;
+            }
+            gpuMs /= frameCount;
+            PostProcessStats after{ renderer.GetPostProcessStats() };
+            unsigned timed{ std::max(after.frames - before.frames, 1u) };
+            double downsampleMs{ (after.totalDownsampleGpuMs - before.totalDownsampleGpuMs) / timed };
+            double tonemapMs{ (after.totalTonemapGpuMs - before.totalTonemapGpuMs) / timed };
+
+            // Both chains see the same frames, so the outputs should only differ by rounding and the edge handling of the levels
+            std::vector<unsigned char> pixels{ target.ReadPixels() };
+            std::string framePath{ (std::filesystem::path(options.outputDirectory) / ("post_" + std::to_string(width) + "x" + std::to_string(height) + "_" + chain + ".ppm")).string() };
+            if (!WritePPM(framePath, width, height, pixels.data()))
+                std::cout << "ERROR::HEADLESS::CANNOT_WRITE " << framePath << std::endl;
+            if (!naive)
+                singlePassPixels = pixels;
+
+            double sum{ 0.0 };
+            int largest{ 0 };
+            for (size_t i{ 0 }; i < pixels.size(); ++i)
+            {
+                int difference{ std::abs(static_cast<int>(pixels[i]) - static_cast<int>(singlePassPixels[i])) };
+                sum += difference;
+                largest = std::max(largest, difference);
+            }
+            double mean{ sum / std::max<size_t>(pixels.size(), 1) };
+
+            std::cout << std::setw(4) << width << "x" << std::setw(4) << height << ", " << std::setw(11) << chain << ": " << after.dispatches
+                << (after.dispatches == 1 ? " dispatch" : " dispatches") << ", downsample " << downsampleMs << " ms GPU, bloom and tonemap " << tonemapMs
+                << " ms, frame " << gpuMs << " ms GPU";
+            if (naive)
+                std::cout << ", against single pass: mean difference " << mean << ", max " << largest;
+            std::cout << std::endl;
+            csv << width << "," << height << "," << chain << "," << after.dispatches << "," << downsampleMs << "," << tonemapMs << "," << gpuMs << ","
+                << mean << "," << largest << "\n";
+        }
+    }
+
+    glDeleteQueries(1, &timerQuery);
+
+    if (!csv)
+    {
+        std::cout << "ERROR::HEADLESS::CANNOT_WRITE " << csvPath.string() << std::endl;
+        return 1;
+    }
+    std::cout << "Post chain comparison written to " << csvPath.string() << std::endl;
+    return 0;
+}
+
+// Heap with a count of the allocations made through it, what the staging of the heap path costs
+class CountingMemoryResource : public std::pmr::memory_resource
+{
+private:
+    size_t m_allocations{};
+
+protected:
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        ++m_allocations;
+        return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* pointer, size_t bytes, size_t alignment) override
+    {
+        std::pmr::new_delete_resource()->deallocate(pointer, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+public:
+    size_t GetAllocations() const { return m_allocations; }
+};
+
+// --resource-benchmark: every round loads RESOURCE_BENCHMARK_MESHES small spheres of assorted tessellations (the LOD chain and the
+// vertex cache optimization included) and unloads them all, once built on the heap into meshes owned one by one and once through
+// the resource manager's arenas. Loads per second and the heap allocations of the staging are reported per round; past the first
+// round the manager's should be none at all. The table goes to resources.csv
+inline int RunResourceBenchmark(const Options& options)
+{
+    HeadlessContext context{};
+    if (!context.IsValid() || !InitializeHeadless(options))
+        return 1;
+
+    const GLubyte* rendererName{ glGetString(GL_RENDERER) };
+    std::cout << "Resource benchmark on " << rendererName << ", " << RESOURCE_BENCHMARK_MESHES << " meshes per round, " << RESOURCE_BENCHMARK_ROUNDS
+        << " rounds" << std::endl;
+
+    std::filesystem::path csvPath{ std::filesystem::path(options.outputDirectory) / "resources.csv" };
+    std::ofstream csv(csvPath);
+    csv << "# renderer: " << rendererName << "\n# meshes: " << RESOURCE_BENCHMARK_MESHES << ", cpu budget: " << options.cpuBudgetMiB << " MiB\n";
+    csv << "path,round,loads_per_second,heap_allocations,staging_peak_kib,gpu_kib\n";
+
+    // 8 to 38 stacks and slices, so the staging blocks come in a few sizes
+    auto tessellation = [](unsigned mesh) { return 8 + static_cast<int>(mesh % 16) * 2; };
+
+    ResourceManager resources(static_cast<size_t>(options.cpuBudgetMiB) * 1024 * 1024, static_cast<size_t>(options.gpuBudgetMiB) * 1024 * 1024);
+    std::vector<MeshHandle> handles;
+    std::vector<std::unique_ptr<Mesh>> meshes;
+    handles.reserve(RESOURCE_BENCHMARK_MESHES);
+    meshes.reserve(RESOURCE_BENCHMARK_MESHES);
+
+    for (bool arena : { false, true })
+    {
+        const char* path{ arena ? "arena" : "heap" };
+        for (unsigned round{ 0 }; round < RESOURCE_BENCHMARK_ROUNDS; ++round)
+        {
+            CountingMemoryResource heap;
+            ArenaStats before{ resources.GetStats().staging };
+            size_t gpuBytes{ 0 };
+
+            auto start = std::chrono::steady_clock::now();
+            for (unsigned mesh{ 0 }; mesh < RESOURCE_BENCHMARK_MESHES; ++mesh)
+            {
+                int detail{ tessellation(mesh) };
+                if (arena)
+                {
+                    handles.push_back(resources.LoadMesh([detail](std::pmr::memory_resource* memory)
+                    {
+                        return BuildSphereMesh(detail, detail, radius, 4, true, memory);
+                    }));
+                }
+                else
+                {
+                    meshes.emplace_back(new Mesh(BuildSphereMesh(detail, detail, radius, 4, true, &heap)));
+                    gpuBytes += meshes.back()->GetGpuBytes();
+                }
+            }
+            if (arena)
+                gpuBytes = resources.GetStats().gpuBytes;
+            for (MeshHandle handle : handles)
+                resources.Unload(handle);
+            handles.clear();
+            meshes.clear();
+            glFinish();
+            double seconds{ std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() };
+
+            ArenaStats after{ resources.GetStats().staging };
+            size_t heapAllocations{ arena ? after.heapAllocations - before.heapAllocations : heap.GetAllocations() };
+            double loadsPerSecond{ RESOURCE_BENCHMARK_MESHES / std::max(seconds, 1e-9) };
+            size_t stagingPeakKiB{ arena ? after.peakInUseBytes / 1024 : 0 };
+
+            std::cout << std::setw(5) << path << " round " << round << ": " << static_cast<unsigned>(loadsPerSecond) << " loads/s, "
+                << heapAllocations << " heap allocations for staging, " << gpuBytes / 1024 << " KiB on the GPU" << std::endl;
+            csv << path << "," << round << "," << loadsPerSecond << "," << heapAllocations << "," << stagingPeakKiB << "," << gpuBytes / 1024 << "\n";
+        }
+    }
+    PrintResourceStats(resources.GetStats());
+
+    if (!csv)
+    {
+        std::cout << "ERROR::HEADLESS::CANNOT_WRITE " << csvPath.string() << std::endl;
+        return 1;
+    }
+    std::cout << "Resource comparison written to " << csvPath.string() << std::endl;
+    return 0;
+}
+
+// --scene-benchmark: generated scenes of 1k, 100k and 1M spheres are written in both forms, then each is loaded into a transform
+// store. The text is parsed line by line; the compiled file is mapped and read in place, timed to its first chunk (what the first
+// frame of a streamed load waits for) and to the whole scene. No context is needed. The files were just written, so both loads
+// come from the OS cache, and they are deleted afterwards; the table goes to scenes.csv
+inline int RunSceneBenchmark(const Options& options, const std::vector<const GLchar*>& faces)
+{
+    std::error_code error{};
+    std::filesystem::create_directories(options.outputDirectory, error);
+    if (error)
+    {
+        std::cout << "ERROR::SCENE::CANNOT_CREATE " << options.outputDirectory << std::endl;
+        return 1;
+    }
+
+    std::cout << "Scene load benchmark, chunks of " << options.sceneChunkObjects << " objects" << std::endl;
+    std::filesystem::path csvPath{ std::filesystem::path(options.outputDirectory) / "scenes.csv" };
+    std::ofstream csv(csvPath);
+    csv << "# seed: " << options.seed << ", lights: " << options.pointLightCount << ", chunk: " << options.sceneChunkObjects << "\n";
+    csv << "objects,text_bytes,compiled_bytes,text_load_ms,compiled_open_ms,compiled_first_chunk_ms,compiled_load_ms\n";
+
+    for (unsigned objectCount : SCENE_BENCHMARK_COUNTS)
+    {
+        Options generated{ options };
+        generated.sphereCount = objectCount;
+        SceneDescription description{ BuildSceneDescription(generated, faces) };
+        std::string baseName{ (std::filesystem::path(options.outputDirectory) / ("scene_" + std::to_string(objectCount))).string() };
+        std::string textPath{ baseName + ".txt" }, scenePath{ baseName + ".scene" };
+        if (!WriteSceneText(textPath, description) || !WriteSceneFile(scenePath, description))
+            return 1;
+
+        auto textStart = std::chrono::steady_clock::now();
+        SceneDescription parsed;
+        if (!ParseSceneText(textPath, parsed))
+            return 1;
+        TransformStore textTransforms{};
+        textTransforms.Reserve(parsed.objects.size());
+        AddSceneObjects(textTransforms, parsed.objects.data(), parsed.objects.size());
+        double textMs{ ElapsedMilliseconds(textStart, std::chrono::steady_clock::now()) };
+
+        double openMs{}, firstChunkMs{}, compiledMs{};
+        size_t compiledObjects{};
+        {
+            auto compiledStart = std::chrono::steady_clock::now();
+            SceneFile scene;
+            if (!scene.Open(scenePath))
+                return 1;
+            openMs = scene.GetOpenMs();
+
+            TransformStore compiledTransforms{};
+            compiledTransforms.Reserve(scene.GetObjectCount());
+            scene.AddObjects(compiledTransforms, 0, options.sceneChunkObjects);
+            firstChunkMs = ElapsedMilliseconds(compiledStart, std::chrono::steady_clock::now());
+            scene.AddObjects(compiledTransforms, compiledTransforms.Size(), scene.GetObjectCount());
+            compiledMs = ElapsedMilliseconds(compiledStart, std::chrono::steady_clock::now());
+            compiledObjects = compiledTransforms.Size();
+        }
+
+        if (compiledObjects != textTransforms.Size())
+        {
+            std::cout << "ERROR::SCENE::LOAD_MISMATCH " << scenePath << std::endl;
+            return 1;
+        }
+
+        std::uintmax_t textBytes{ std::filesystem::file_size(textPath, error) }, compiledBytes{ std::filesystem::file_size(scenePath, error) };
+        std::cout << std::setw(8) << objectCount << " objects: text " << textBytes / 1024 << " KiB loaded in " << textMs << " ms, compiled "
+            << compiledBytes / 1024 << " KiB opened in " << openMs << " ms, first chunk " << firstChunkMs << " ms, whole scene " << compiledMs
+            << " ms (" << textMs / std::max(compiledMs, 1e-3) << "x faster)" << std::endl;
+        csv << objectCount << "," << textBytes << "," << compiledBytes << "," << textMs << "," << openMs << "," << firstChunkMs << "," << compiledMs << "\n";
+
+        std::filesystem::remove(textPath, error);
+        std::filesystem::remove(scenePath, error);
+    }
+
+    if (!csv)
+    {
+        std::cout << "ERROR::SCENE::CANNOT_WRITE " << csvPath.string() << std::endl;
+        return 1;
+    }
+    std::cout << "Scene load times written to " << csvPath.string() << std::endl;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,198 @@
+#ifndef INPUT_THREAD_H
+#define INPUT_THREAD_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include <SFML/Window.hpp>
+
+#include <glm/glm.hpp>
+
+#include "Camera.h"
+#include "TripleBuffer.h"
+
+// Camera state as published by the input side, plus when the input that last moved it was sampled
+struct CameraSnapshot
+{
+    glm::vec3 position{};
+    GLfloat yaw{ YAW };
+    GLfloat pitch{ PITCH };
+    unsigned long long inputSequence{};     // number of samples that moved the camera so far
+    std::chrono::steady_clock::time_point inputTime{};
+};
+
+// Input-to-present latency: from the sample that moved the camera to the end of the display() that first showed it
+struct InputLatencyStats
+{
+    unsigned samples{};
+    double totalMs{};
+    double maxMs{};
+
+    void Add(double ms)
+    {
+        ++samples;
+        totalMs += ms;
+        maxMs = std::max(maxMs, ms);
+    }
+};
+
+inline void PrintInputLatencyStats(const InputLatencyStats& stats, const char* mode)
+{
+    if (stats.samples == 0)
+        return;
+
+    std::cout << "  input (" << mode << "): latency avg " << stats.totalMs / stats.samples << " ms, max " << stats.maxMs << " ms over "
+        << stats.samples << " moves" << std::endl;
+}
+
+// Samples the keyboard and mouse state and integrates the camera over a known time step, so movement no longer depends on the
+// frame rate or on how often the OS repeats key events
+class CameraInput
+{
+private:
+    Camera m_camera;
+    sf::Vector2i m_lastMouse{};
+    bool m_firstMouse{ true };
+    unsigned long long m_inputSequence{};
+    std::chrono::steady_clock::time_point m_inputTime{};
+
+public:
+    explicit CameraInput(const Camera& camera)
+        : m_camera{ camera }
+    {
+    }
+
+    // Applies the keys held and the mouse motion since the last sample; without focus the input is ignored
+    void Sample(GLfloat deltaTime, bool focused)
+    {
+        auto now = std::chrono::steady_clock::now();
+        if (!focused)
+        {
+            m_firstMouse = true;
+            return;
+        }
+
+        bool moved{ false };
+        auto held = [](sf::Keyboard::Key a, sf::Keyboard::Key b) { return sf::Keyboard::isKeyPressed(a) || sf::Keyboard::isKeyPressed(b); };
+        if (held(sf::Keyboard::Up, sf::Keyboard::W))
+        {
+            m_camera.ProcessKeyboard(Camera_Movement::FORWARD, deltaTime);
+            moved = true;
+        }
+        if (held(sf::Keyboard::Down, sf::Keyboard::S))
+        {
+            m_camera.ProcessKeyboard(Camera_Movement::BACKWARD, deltaTime);
+            moved = true;
+        }
+        if (held(sf::Keyboard::Right, sf::Keyboard::D))
+        {
+            m_camera.ProcessKeyboard(Camera_Movement::RIGHT, deltaTime);
+            moved = true;
+        }
+        if (held(sf::Keyboard::Left, sf::Keyboard::A))
+        {
+            m_camera.ProcessKeyboard(Camera_Movement::LEFT, deltaTime);
+            moved = true;
+        }
+
+        sf::Vector2i mouse{ sf::Mouse::getPosition() };
+        if (m_firstMouse)
+        {
+            m_lastMouse = mouse;
+            m_firstMouse = false;
+        }
+        if (mouse != m_lastMouse)
+        {
+            m_camera.ProcessMouseMovement(static_cast<GLfloat>(mouse.x - m_lastMouse.x), static_cast<GLfloat>(m_lastMouse.y - mouse.y));
+            m_lastMouse = mouse;
+            moved = true;
+        }
+
+        if (moved)
+        {
+            ++m_inputSequence;
+            m_inputTime = now;
+        }
+    }
+
+    CameraSnapshot GetSnapshot() const
+    {
+        CameraSnapshot snapshot{};
+        snapshot.position = m_camera.GetPosition();
+        snapshot.yaw = m_camera.GetYaw();
+        snapshot.pitch = m_camera.GetPitch();
+        snapshot.inputSequence = m_inputSequence;
+        snapshot.inputTime = m_inputTime;
+        return snapshot;
+    }
+};
+
+// SFML reads the keyboard and mouse on the main thread only on macOS, so there the camera input is always sampled per frame
+#ifdef __APPLE__
+constexpr bool INPUT_THREAD_SUPPORTED{ false };
+#else
+constexpr bool INPUT_THREAD_SUPPORTED{ true };
+#endif
+
+// Runs CameraInput at a fixed rate on its own thread and publishes every step through a triple buffer, the render loop picks up
+// the newest camera right before recording a frame without ever blocking the input side. Not used where INPUT_THREAD_SUPPORTED
+// is false, since CameraInput::Sample polls sf::Keyboard and sf::Mouse from this thread
+class InputThread
+{
+private:
+    CameraInput m_input;
+    TripleBuffer<CameraSnapshot> m_snapshots;
+    std::chrono::steady_clock::duration m_period{};
+    std::atomic<bool> m_running{ true };
+    std::atomic<bool> m_focused{ true };
+    std::thread m_thread;
+
+    void run()
+    {
+        GLfloat step{ std::chrono::duration<GLfloat>(m_period).count() };
+        auto next = std::chrono::steady_clock::now();
+        while (m_running.load(std::memory_order_relaxed))
+        {
+            m_input.Sample(step, m_focused.load(std::memory_order_relaxed));
+            m_snapshots.Write(m_input.GetSnapshot());
+
+            // Fixed steps; after a long stall the schedule restarts instead of replaying the missed steps at once
+            next += m_period;
+            auto now = std::chrono::steady_clock::now();
+            if (now - next > 4 * m_period)
+                next = now;
+            std::this_thread::sleep_until(next);
+        }
+    }
+
+public:
+    InputThread(const Camera& camera, unsigned rate)
+        : m_input{ camera }, m_snapshots{ m_input.GetSnapshot() },
+        m_period{ std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / std::max(rate, 1u))) }
+    {
+        m_thread = std::thread(&InputThread::run, this);
+    }
+
+    ~InputThread()
+    {
+        m_running = false;
+        m_thread.join();
+    }
+
+    InputThread(const InputThread&) = delete;
+    InputThread& operator=(const InputThread&) = delete;
+
+    void SetFocused(bool focused) { m_focused = focused; }
+
+    // Render thread only
+    const CameraSnapshot& GetLatest()
+    {
+        m_snapshots.Update();
+        return m_snapshots.Read();
+    }
+};
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include <iostream>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include "GLState.h"
+#include "Shader.h"
+#include "StorageBuffer.h"
+#include "StreamingBuffer.h"
+#include "UniformBlocks.h"
+
+// Frames between a readback copy and the moment its counters are read, as for the culling counters
+constexpr unsigned CLUSTER_READBACK_FRAMES{ 3 };
+
+// Counters of one clustered frame, a few frames old
+struct ClusterStats
+{
+    GLuint lights{};
+    GLuint assigned{};              // light index slots filled over all clusters
+    GLuint occupied{};              // clusters with at least one light
+    GLuint overflowed{};            // clusters that had more than MAX_LIGHTS_PER_CLUSTER lights
+    GLuint maxLights{};             // most lights touching one cluster, dropped ones included
+    bool valid{};
+
+    double AverageLightsPerCluster() const { return static_cast<double>(assigned) / CLUSTER_COUNT; }
+    double AverageLightsPerOccupiedCluster() const { return occupied ? static_cast<double>(assigned) / occupied : 0.0; }
+};
+
+inline void PrintClusterStats(const ClusterStats& stats)
+{
+    if (!stats.valid || stats.lights == 0)
+        return;
+
+    std::cout << "  lights: " << stats.lights << " point lights, " << stats.AverageLightsPerCluster() << " per cluster ("
+        << stats.AverageLightsPerOccupiedCluster() << " in the " << stats.occupied << " of " << CLUSTER_COUNT << " occupied), max " << stats.maxLights
+        << ", " << stats.overflowed << " clusters over " << MAX_LIGHTS_PER_CLUSTER << std::endl;
+}
+
+// Bins point lights into view-space clusters on the GPU.
+// The view frustum is split in CLUSTER_GRID_X x CLUSTER_GRID_Y screen tiles and CLUSTER_GRID_Z exponential depth slices; every frame
+// a compute pass tests each light's sphere against each cluster's bounds and writes the cluster's light list, so lighting.frag
+// only loops over the lights of the cluster it falls in
+class LightClusters
+{
+private:
+    Shader m_shader;
+    StorageBuffer<PointLight> m_lightBuffer;
+    GLuint m_countBuffer{};
+    GLuint m_indexBuffer{};
+    GLuint m_counterBuffer{};
+    GLuint m_readbackBuffers[CLUSTER_READBACK_FRAMES]{};
+    GLsync m_readbackFences[CLUSTER_READBACK_FRAMES]{};
+    unsigned m_frame{};
+    GLuint m_lightCount{};
+    ClusterStats m_stats{};
+
+    static constexpr GLsizeiptr COUNTERS_SIZE{ 4 * sizeof(GLuint) };
+
+    // Picks up the counters of an older frame if the GPU is already done with them
+    void readCounters(unsigned slot)
+    {
+        if (!m_readbackFences[slot])
+            return;
+
+        if (glClientWaitSync(m_readbackFences[slot], 0, 0) == GL_TIMEOUT_EXPIRED)
+            return;
+
+        glDeleteSync(m_readbackFences[slot]);
+        m_readbackFences[slot] = nullptr;
+
+        GLuint counters[4]{};
+        glBindBuffer(GL_COPY_READ_BUFFER, m_readbackBuffers[slot]);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, COUNTERS_SIZE, counters);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+        m_stats.assigned = counters[0];
+        m_stats.occupied = counters[1];
+        m_stats.overflowed = counters[2];
+        m_stats.maxLights = counters[3];
+        m_stats.valid = true;
+    }
+
+public:
+    LightClusters()
+        : m_shader{ "cluster.comp" }, m_lightBuffer(POINT_LIGHT_BUFFER_BINDING)
+    {
+        m_shader.BindUniformBlock("CameraBlock", CAMERA_BLOCK_BINDING);
+        m_shader.BindUniformBlock("ClusterBlock", CLUSTER_BLOCK_BINDING);
+
+        glGenBuffers(1, &m_countBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_countBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, CLUSTER_COUNT * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+        GLuint zero{ 0 };
+        glClearBufferData(GL_COPY_WRITE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+        glGenBuffers(1, &m_indexBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_indexBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, CLUSTER_COUNT * MAX_LIGHTS_PER_CLUSTER * sizeof(GLuint), nullptr, GL_DYNAMIC_COPY);
+
+        glGenBuffers(1, &m_counterBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_counterBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, COUNTERS_SIZE, nullptr, GL_DYNAMIC_COPY);
+
+        glGenBuffers(CLUSTER_READBACK_FRAMES, m_readbackBuffers);
+        for (GLuint buffer : m_readbackBuffers)
+        {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+            glBufferData(GL_COPY_WRITE_BUFFER, COUNTERS_SIZE, nullptr, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        // The lookup in lighting.frag reads these whether or not there are lights
+        m_lightBuffer.Upload({});
+        GetGLState().BindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_LIGHT_COUNT_BUFFER_BINDING, m_countBuffer);
+        GetGLState().BindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_LIGHT_INDEX_BUFFER_BINDING, m_indexBuffer);
+    }
+
+    LightClusters(const LightClusters&) = delete;
+    LightClusters& operator=(const LightClusters&) = delete;
+
+    ~LightClusters()
+    {
+        for (GLsync fence : m_readbackFences)
+            if (fence)
+                glDeleteSync(fence);
+        GetGLState().DeleteBuffers(CLUSTER_READBACK_FRAMES, m_readbackBuffers);
+        GetGLState().DeleteBuffers(1, &m_countBuffer);
+        GetGLState().DeleteBuffers(1, &m_indexBuffer);
+        GetGLState().DeleteBuffers(1, &m_counterBuffer);
+    }
+
+    // Replaces the light set, the counters of earlier frames are dropped with it
+    void SetLights(const std::vector<PointLight>& lights)
+    {
+        m_lightBuffer.Upload(lights);
+        m_lightCount = static_cast<GLuint>(lights.size());
+        for (GLsync& fence : m_readbackFences)
+        {
+            if (fence)
+                glDeleteSync(fence);
+            fence = nullptr;
+        }
+        m_stats = ClusterStats{};
+        m_stats.lights = m_lightCount;
+    }
+
+    // Writes this frame's cluster block into the streaming segment and rebuilds the cluster lists, the camera block must be bound
+    void Update(StreamingBuffer& stream, const glm::mat4& projection, float nearPlane, float farPlane, const glm::vec2& viewportSize)
+    {
+        ClusterBlock block{};
+        block.inverseProjection = glm::inverse(projection);
+        block.viewportSize = viewportSize;
+        block.nearPlane = nearPlane;
+        block.farPlane = farPlane;
+        block.lightCount = m_lightCount;
+        stream.WriteAndBind(block, CLUSTER_BLOCK_BINDING);
+
+        if (m_lightCount == 0)
+            return;
+
+        unsigned slot{ m_frame % CLUSTER_READBACK_FRAMES };
+        readCounters(slot);
+
+        GLuint zero{ 0 };
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_counterBuffer);
+        glClearBufferData(GL_COPY_WRITE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        GetGLState().BindBufferBase(GL_SHADER_STORAGE_BUFFER, POINT_LIGHT_BUFFER_BINDING, m_lightBuffer.GetBuffer());
+        GetGLState().BindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_LIGHT_COUNT_BUFFER_BINDING, m_countBuffer);
+        GetGLState().BindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_LIGHT_INDEX_BUFFER_BINDING, m_indexBuffer);
+        GetGLState().BindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_COUNTER_BUFFER_BINDING, m_counterBuffer);
+
+        m_shader.Use();
+        glDispatchCompute((CLUSTER_COUNT + 127) / 128, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+        // Queue the counters for readback, they are read CLUSTER_READBACK_FRAMES frames later
+        glBindBuffer(GL_COPY_READ_BUFFER, m_counterBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_readbackBuffers[slot]);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, COUNTERS_SIZE);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        m_readbackFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        ++m_frame;
+    }
+
+    // Waits for the clustering program, it compiles alongside the other ones while the scene is being set up
+    bool FinishShader() { return m_shader.Finish(); }
+
+    GLuint GetLightCount() const { return m_lightCount; }
+    const ClusterStats& GetStats() const { return m_stats; }
+};
+
+#endif
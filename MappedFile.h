@@ -0,0 +1,147 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Smallest page size of the platforms we run on, Touch() reads one byte per page
+constexpr size_t MAPPED_FILE_PAGE_SIZE{ 4096 };
+
+// Read-only view of a whole file. The pages are brought in by the OS on first touch, nothing is copied or parsed up front
+class MappedFile
+{
+private:
+    const unsigned char* m_data{};
+    size_t m_size{};
+#ifdef _WIN32
+    HANDLE m_file{ INVALID_HANDLE_VALUE };
+    HANDLE m_mapping{};
+#else
+    int m_file{ -1 };
+#endif
+
+public:
+    MappedFile() = default;
+
+    explicit MappedFile(const std::string& path)
+    {
+        Open(path);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile()
+    {
+        Close();
+    }
+
+    bool Open(const std::string& path)
+    {
+        Close();
+#ifdef _WIN32
+        m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (m_file == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER size{};
+        if (!GetFileSizeEx(m_file, &size) || size.QuadPart == 0)
+        {
+            Close();
+            return false;
+        }
+
+        m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!m_mapping)
+        {
+            Close();
+            return false;
+        }
+
+        m_data = static_cast<const unsigned char*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+        m_size = static_cast<size_t>(size.QuadPart);
+#else
+        m_file = open(path.c_str(), O_RDONLY);
+        if (m_file < 0)
+            return false;
+
+        struct stat info{};
+        if (fstat(m_file, &info) != 0 || info.st_size == 0)
+        {
+            Close();
+            return false;
+        }
+
+        void* data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, m_file, 0);
+        if (data == MAP_FAILED)
+        {
+            Close();
+            return false;
+        }
+
+        m_data = static_cast<const unsigned char*>(data);
+        m_size = static_cast<size_t>(info.st_size);
+#endif
+        if (!m_data)
+        {
+            Close();
+            return false;
+        }
+        return true;
+    }
+
+    void Close()
+    {
+#ifdef _WIN32
+        if (m_data)
+            UnmapViewOfFile(m_data);
+        if (m_mapping)
+            CloseHandle(m_mapping);
+        if (m_file != INVALID_HANDLE_VALUE)
+            CloseHandle(m_file);
+        m_mapping = nullptr;
+        m_file = INVALID_HANDLE_VALUE;
+#else
+        if (m_data)
+            munmap(const_cast<unsigned char*>(m_data), m_size);
+        if (m_file >= 0)
+            close(m_file);
+        m_file = -1;
+#endif
+        m_data = nullptr;
+        m_size = 0;
+    }
+
+    // Reads one byte per page of the range so the OS faults it in now, on whichever thread calls this
+    void Touch(size_t offset, size_t size) const
+    {
+        if (!m_data || offset >= m_size)
+            return;
+
+        size = std::min(size, m_size - offset);
+        volatile unsigned char sink{};
+        for (size_t i{ 0 }; i < size; i += MAPPED_FILE_PAGE_SIZE)
+            sink = sink + m_data[offset + i];
+        if (size > 0)
+            sink = sink + m_data[offset + size - 1];
+    }
+
+    bool IsOpen() const { return m_data != nullptr; }
+    const unsigned char* GetData() const { return m_data; }
+    size_t GetSize() const { return m_size; }
+};
+
+#endif
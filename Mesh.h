@@ -0,0 +1,493 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <memory_resource>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include "GLState.h"
+
+// Interleaved vertex shared by every mesh, 32 bytes
+struct MeshVertex
+{
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec2 uv;
+};
+
+// One level of detail inside a MeshData. Indices are local to the LOD and offset by baseVertex when drawn
+struct MeshLod
+{
+    GLuint firstIndex{};
+    GLuint indexCount{};
+    GLint baseVertex{};
+    GLuint vertexCount{};
+    float acmrBefore{};     // average cache miss ratio of the generated order
+    float acmrAfter{};      // ... and after the vertex cache optimization
+};
+
+// Most LODs a mesh can carry
+constexpr size_t MAX_MESH_LODS{ 8 };
+
+// CPU side geometry of a mesh and its LOD chain, sized exactly for the tessellation. The arrays and every temporary the builders
+// and optimizers below make come from one memory resource, the heap unless a load arena is given
+struct MeshData
+{
+    std::pmr::vector<MeshVertex> vertices;
+    std::pmr::vector<std::uint32_t> indices;
+    std::pmr::vector<MeshLod> lods;
+
+    explicit MeshData(std::pmr::memory_resource* memory = std::pmr::get_default_resource())
+        : vertices(memory), indices(memory), lods(memory)
+    {
+    }
+
+    std::pmr::memory_resource* GetMemory() const { return vertices.get_allocator().resource(); }
+};
+
+// Post-transform cache sizes used for optimizing and for reporting
+constexpr size_t OPTIMIZER_CACHE_SIZE{ 32 };
+constexpr size_t ACMR_CACHE_SIZE{ 16 };
+
+// Misses per triangle of a FIFO post-transform cache, 0.5 is the ideal for a regular grid, 3 means no reuse at all
+inline float ComputeACMR(const std::pmr::vector<std::uint32_t>& indices, size_t vertexCount, size_t cacheSize = ACMR_CACHE_SIZE)
+{
+    if (indices.empty())
+        return 0.0f;
+
+    constexpr size_t NOT_CACHED{ std::numeric_limits<size_t>::max() };
+    std::pmr::vector<size_t> insertedAt(vertexCount, NOT_CACHED, indices.get_allocator().resource());
+    size_t misses{ 0 };
+    for (std::uint32_t index : indices)
+    {
+        // A vertex stays in the FIFO until cacheSize newer vertices were pushed after it
+        if (insertedAt[index] == NOT_CACHED || misses - insertedAt[index] >= cacheSize)
+        {
+            insertedAt[index] = misses;
+            ++misses;
+        }
+    }
+    return static_cast<float>(misses) / (indices.size() / 3);
+}
+
+// Tom Forsyth's linear-speed vertex cache optimization score
+inline float VertexCacheScore(int cachePosition, int remainingTriangles)
+{
+    if (remainingTriangles == 0)
+        return -1.0f;
+
+    float score{ 0.0f };
+    if (cachePosition >= 0)
+    {
+        // The last triangle's vertices get a fixed score so the next one does not just reuse the same edge
+        if (cachePosition < 3)
+            score = 0.75f;
+        else
+            score = std::pow(1.0f - (cachePosition - 3) / static_cast<float>(OPTIMIZER_CACHE_SIZE - 3), 1.5f);
+    }
+
+    // Favour vertices with few triangles left so they leave the working set early
+    score += 2.0f * std::pow(static_cast<float>(remainingTriangles), -0.5f);
+    return score;
+}
+
+// Reorders the triangles of an indexed list for post-transform cache hits, the result from the same memory resource as indices
+inline std::pmr::vector<std::uint32_t> OptimizeVertexCache(const std::pmr::vector<std::uint32_t>& indices, size_t vertexCount)
+{
+    size_t triangleCount{ indices.size() / 3 };
+    std::pmr::memory_resource* memory{ indices.get_allocator().resource() };
+
+    // Triangles adjacent to each vertex, the live ones are kept at the front of each vertex's range
+    std::pmr::vector<std::uint32_t> offsets(vertexCount + 1, 0, memory);
+    for (std::uint32_t index : indices)
+        ++offsets[index + 1];
+    for (size_t v{ 0 }; v < vertexCount; ++v)
+        offsets[v + 1] += offsets[v];
+
+    std::pmr::vector<int> remaining(vertexCount, 0, memory);
+    std::pmr::vector<std::uint32_t> adjacency(indices.size(), memory);
+    for (size_t t{ 0 }; t < triangleCount; ++t)
+    {
+        for (size_t k{ 0 }; k < 3; ++k)
+        {
+            std::uint32_t v{ indices[t * 3 + k] };
+            adjacency[offsets[v] + remaining[v]++] = static_cast<std::uint32_t>(t);
+        }
+    }
+
+    std::pmr::vector<int> cachePosition(vertexCount, -1, memory);
+    std::pmr::vector<float> vertexScore(vertexCount, memory);
+    for (size_t v{ 0 }; v < vertexCount; ++v)
+        vertexScore[v] = VertexCacheScore(-1, remaining[v]);
+
+    std::pmr::vector<float> triangleScore(triangleCount, memory);
+    for (size_t t{ 0 }; t < triangleCount; ++t)
+        triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+
+    std::pmr::vector<bool> emitted(triangleCount, false, memory);
+    std::pmr::vector<std::uint32_t> result(memory);
+    result.reserve(indices.size());
+
+    std::pmr::vector<std::uint32_t> cache(memory), nextCache(memory);
+    cache.reserve(OPTIMIZER_CACHE_SIZE + 3);
+    nextCache.reserve(OPTIMIZER_CACHE_SIZE + 3);
+
+    long long best{ -1 };
+    size_t scanCursor{ 0 };
+    for (size_t emittedCount{ 0 }; emittedCount < triangleCount; ++emittedCount)
+    {
+        // Nothing adjacent to the cache is left, restart from the best remaining triangle
+        if (best < 0)
+        {
+            float bestScore{ -1.0f };
+            for (size_t t{ scanCursor }; t < triangleCount; ++t)
+            {
+                if (!emitted[t] && triangleScore[t] > bestScore)
+                {
+                    bestScore = triangleScore[t];
+                    best = static_cast<long long>(t);
+                }
+            }
+            while (scanCursor < triangleCount && emitted[scanCursor])
+                ++scanCursor;
+        }
+
+        size_t triangle{ static_cast<size_t>(best) };
+        emitted[triangle] = true;
+
+        nextCache.clear();
+        for (size_t k{ 0 }; k < 3; ++k)
+        {
+            std::uint32_t v{ indices[triangle * 3 + k] };
+            result.push_back(v);
+            nextCache.push_back(v);
+
+            // Drop the triangle from the vertex's live list
+            std::uint32_t* begin{ &adjacency[offsets[v]] };
+            std::uint32_t* end{ begin + remaining[v] };
+            std::uint32_t* found{ std::find(begin, end, static_cast<std::uint32_t>(triangle)) };
+            std::swap(*found, *(end - 1));
+            --remaining[v];
+        }
+
+        for (std::uint32_t v : cache)
+        {
+            if (v != nextCache[0] && v != nextCache[1] && v != nextCache[2])
+                nextCache.push_back(v);
+        }
+
+        // Vertices pushed out of the cache lose their position bonus
+        for (size_t i{ OPTIMIZER_CACHE_SIZE }; i < nextCache.size(); ++i)
+        {
+            cachePosition[nextCache[i]] = -1;
+            vertexScore[nextCache[i]] = VertexCacheScore(-1, remaining[nextCache[i]]);
+        }
+        if (nextCache.size() > OPTIMIZER_CACHE_SIZE)
+            nextCache.resize(OPTIMIZER_CACHE_SIZE);
+
+        for (size_t i{ 0 }; i < nextCache.size(); ++i)
+        {
+            cachePosition[nextCache[i]] = static_cast<int>(i);
+            vertexScore[nextCache[i]] = VertexCacheScore(static_cast<int>(i), remaining[nextCache[i]]);
+        }
+
+        // Rescore the triangles touching the cache and pick the best of them
+        best = -1;
+        float bestScore{ -1.0f };
+        for (std::uint32_t v : nextCache)
+        {
+            for (int i{ 0 }; i < remaining[v]; ++i)
+            {
+                std::uint32_t t{ adjacency[offsets[v] + i] };
+                triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+                if (triangleScore[t] > bestScore)
+                {
+                    bestScore = triangleScore[t];
+                    best = t;
+                }
+            }
+        }
+
+        std::swap(cache, nextCache);
+    }
+    return result;
+}
+
+// Renumbers the vertices in the order the indices first use them, so vertex fetches walk memory forward
+inline void OptimizeVertexFetch(std::pmr::vector<MeshVertex>& vertices, std::pmr::vector<std::uint32_t>& indices)
+{
+    constexpr std::uint32_t UNUSED{ std::numeric_limits<std::uint32_t>::max() };
+    std::pmr::memory_resource* memory{ vertices.get_allocator().resource() };
+    std::pmr::vector<std::uint32_t> remap(vertices.size(), UNUSED, memory);
+    std::pmr::vector<MeshVertex> reordered(memory);
+    reordered.reserve(vertices.size());
+
+    for (std::uint32_t& index : indices)
+    {
+        if (remap[index] == UNUSED)
+        {
+            remap[index] = static_cast<std::uint32_t>(reordered.size());
+            reordered.push_back(vertices[index]);
+        }
+        index = remap[index];
+    }
+    vertices.swap(reordered);
+}
+
+// Sizes of one sphere LOD, so the arrays can be allocated exactly once
+inline size_t SphereLodVertexCount(int stacks, int slices)
+{
+    return static_cast<size_t>(stacks + 1) * (slices + 1);
+}
+
+inline size_t SphereLodIndexCount(int stacks, int slices)
+{
+    return static_cast<size_t>(slices) * (stacks - 1) * 6;
+}
+
+// Appends a UV sphere of the given tessellation to the mesh as a new LOD.
+// stacks are the latitude bands, slices the longitude segments. The seam column is duplicated so the UVs wrap cleanly
+// and the pole rows only get one triangle per segment, so nothing is degenerate
+inline void AppendSphereLod(MeshData& mesh, int stacks, int slices, float radius, bool optimize = true)
+{
+    const float pi{ glm::pi<float>() };
+    std::pmr::memory_resource* memory{ mesh.GetMemory() };
+
+    std::pmr::vector<MeshVertex> vertices(memory);
+    vertices.reserve(SphereLodVertexCount(stacks, slices));
+    for (int i{ 0 }; i <= stacks; ++i)
+    {
+        float phi{ i * (pi / stacks) };
+        for (int j{ 0 }; j <= slices; ++j)
+        {
+            float theta{ j * (pi * 2.0f / slices) };
+            glm::vec3 normal{ std::cos(theta) * std::sin(phi), std::cos(phi), std::sin(theta) * std::sin(phi) };
+
+            MeshVertex vertex{};
+            vertex.position = normal * radius;
+            vertex.normal = normal;
+            vertex.uv = glm::vec2(static_cast<float>(j) / slices, static_cast<float>(i) / stacks);
+            vertices.push_back(vertex);
+        }
+    }
+
+    std::pmr::vector<std::uint32_t> indices(memory);
+    indices.reserve(SphereLodIndexCount(stacks, slices));
+    for (int i{ 0 }; i < stacks; ++i)
+    {
+        for (int j{ 0 }; j < slices; ++j)
+        {
+            std::uint32_t a = i * (slices + 1) + j;
+            std::uint32_t b = a + slices + 1;
+            std::uint32_t c = a + 1;
+            std::uint32_t d = b + 1;
+
+            // Counter-clockwise seen from outside
+            if (i != 0)
+                indices.insert(indices.end(), { a, c, b });
+            if (i != stacks - 1)
+                indices.insert(indices.end(), { c, d, b });
+        }
+    }
+
+    MeshLod lod{};
+    lod.acmrBefore = ComputeACMR(indices, vertices.size());
+    lod.acmrAfter = lod.acmrBefore;
+    if (optimize)
+    {
+        // Tiny LODs already fit the cache, keep the generated order when reordering does not help
+        std::pmr::vector<std::uint32_t> optimized{ OptimizeVertexCache(indices, vertices.size()) };
+        float acmr{ ComputeACMR(optimized, vertices.size()) };
+        if (acmr < lod.acmrBefore)
+        {
+            indices.swap(optimized);
+            lod.acmrAfter = acmr;
+        }
+        OptimizeVertexFetch(vertices, indices);
+    }
+
+    lod.firstIndex = static_cast<GLuint>(mesh.indices.size());
+    lod.indexCount = static_cast<GLuint>(indices.size());
+    lod.baseVertex = static_cast<GLint>(mesh.vertices.size());
+    lod.vertexCount = static_cast<GLuint>(vertices.size());
+
+    mesh.vertices.insert(mesh.vertices.end(), vertices.begin(), vertices.end());
+    mesh.indices.insert(mesh.indices.end(), indices.begin(), indices.end());
+    mesh.lods.push_back(lod);
+}
+
+// A sphere and its LOD chain (at most MAX_MESH_LODS), halving the tessellation at each level
+inline MeshData BuildSphereMesh(int stacks, int slices, float radius, int lodCount = 4, bool optimize = true,
+    std::pmr::memory_resource* memory = std::pmr::get_default_resource())
+{
+    lodCount = std::min(lodCount, static_cast<int>(MAX_MESH_LODS));
+    size_t vertexCount{ 0 }, indexCount{ 0 };
+    for (int lod{ 0 }; lod < lodCount; ++lod)
+    {
+        vertexCount += SphereLodVertexCount(std::max(stacks >> lod, 3), std::max(slices >> lod, 4));
+        indexCount += SphereLodIndexCount(std::max(stacks >> lod, 3), std::max(slices >> lod, 4));
+    }
+
+    MeshData mesh(memory);
+    mesh.vertices.reserve(vertexCount);
+    mesh.indices.reserve(indexCount);
+    mesh.lods.reserve(lodCount);
+    for (int lod{ 0 }; lod < lodCount; ++lod)
+        AppendSphereLod(mesh, std::max(stacks >> lod, 3), std::max(slices >> lod, 4), radius, optimize);
+    return mesh;
+}
+
+// Unit quad in the xy plane, corners at -1 and 1, facing +z. A single LOD, so culling always draws it as it is
+inline MeshData BuildQuadMesh(std::pmr::memory_resource* memory = std::pmr::get_default_resource())
+{
+    MeshData mesh(memory);
+    for (int corner{ 0 }; corner < 4; ++corner)
+    {
+        glm::vec2 uv{ static_cast<float>(corner & 1), static_cast<float>(corner >> 1) };
+        mesh.vertices.push_back({ glm::vec3(uv * 2.0f - 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), uv });
+    }
+    mesh.indices = { 0, 1, 3, 0, 3, 2 };
+
+    MeshLod lod{};
+    lod.indexCount = 6;
+    lod.vertexCount = 4;
+    lod.acmrBefore = lod.acmrAfter = ComputeACMR(mesh.indices, mesh.vertices.size());
+    mesh.lods.push_back(lod);
+    return mesh;
+}
+
+// True when every LOD can be addressed with 16-bit indices (indices are relative to the LOD's base vertex)
+inline bool FitsShortIndices(const MeshData& mesh)
+{
+    for (const MeshLod& lod : mesh.lods)
+        if (lod.vertexCount > 65536)
+            return false;
+    return true;
+}
+
+inline size_t MeshIndexSize(const MeshData& mesh)
+{
+    return FitsShortIndices(mesh) ? sizeof(std::uint16_t) : sizeof(std::uint32_t);
+}
+
+inline void PrintMeshStats(const char* name, const MeshData& mesh)
+{
+    size_t indexSize{ MeshIndexSize(mesh) };
+    std::cout << name << ": " << mesh.vertices.size() * sizeof(MeshVertex) + mesh.indices.size() * indexSize << " bytes ("
+        << mesh.vertices.size() << " vertices, " << mesh.indices.size() << " " << indexSize * 8 << "-bit indices, "
+        << mesh.lods.size() << " LODs)" << std::endl;
+
+    for (size_t i{ 0 }; i < mesh.lods.size(); ++i)
+    {
+        const MeshLod& lod{ mesh.lods[i] };
+        std::cout << "  LOD " << i << ": " << lod.indexCount / 3 << " triangles, " << lod.vertexCount << " vertices, "
+            << lod.vertexCount * sizeof(MeshVertex) + lod.indexCount * indexSize << " bytes, ACMR "
+            << lod.acmrBefore << " -> " << lod.acmrAfter << std::endl;
+    }
+}
+
+// GPU copy of a MeshData: one interleaved vertex buffer, one index buffer and the VAO describing them.
+// Attribute 0 is the position, 1 the normal and 2 the texture coordinates. Nothing of the data is kept but the LOD table, and the
+// 16-bit index copy is staged in the data's own memory resource
+class Mesh
+{
+private:
+    GLuint m_vao{};
+    GLuint m_vertexBuffer{};
+    GLuint m_indexBuffer{};
+    GLenum m_indexType{};
+    size_t m_indexSize{};
+    MeshLod m_lods[MAX_MESH_LODS]{};
+    size_t m_lodCount{};
+    size_t m_gpuBytes{};
+
+public:
+    explicit Mesh(const MeshData& data)
+        : m_lodCount{ std::min(data.lods.size(), MAX_MESH_LODS) }
+    {
+        std::copy(data.lods.begin(), data.lods.begin() + m_lodCount, m_lods);
+        m_indexSize = MeshIndexSize(data);
+        m_gpuBytes = data.vertices.size() * sizeof(MeshVertex) + data.indices.size() * m_indexSize;
+        m_indexType = m_indexSize == sizeof(std::uint16_t) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+        glGenVertexArrays(1, &m_vao);
+        GetGLState().BindVertexArray(m_vao);
+
+        glGenBuffers(1, &m_vertexBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+        glBufferData(GL_ARRAY_BUFFER, data.vertices.size() * sizeof(MeshVertex), data.vertices.data(), GL_STATIC_DRAW);
+
+        glGenBuffers(1, &m_indexBuffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+        if (m_indexType == GL_UNSIGNED_SHORT)
+        {
+            std::pmr::vector<std::uint16_t> shortIndices(data.indices.begin(), data.indices.end(), data.GetMemory());
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * sizeof(std::uint16_t), shortIndices.data(), GL_STATIC_DRAW);
+        }
+        else
+        {
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, data.indices.size() * sizeof(std::uint32_t), data.indices.data(), GL_STATIC_DRAW);
+        }
+
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (GLvoid*)offsetof(MeshVertex, position));
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (GLvoid*)offsetof(MeshVertex, normal));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (GLvoid*)offsetof(MeshVertex, uv));
+        glEnableVertexAttribArray(2);
+
+        GetGLState().BindVertexArray(0);
+    }
+
+    Mesh(const Mesh&) = delete;
+    Mesh& operator=(const Mesh&) = delete;
+
+    ~Mesh()
+    {
+        GetGLState().DeleteVertexArrays(1, &m_vao);
+        GetGLState().DeleteBuffers(1, &m_vertexBuffer);
+        GetGLState().DeleteBuffers(1, &m_indexBuffer);
+    }
+
+    // Feeds a per-instance unsigned integer attribute from a buffer. baseInstance offsets into it, which is what indirect draws rely on
+    void AttachInstanceAttribute(GLuint location, GLuint buffer)
+    {
+        GetGLState().BindVertexArray(m_vao);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glVertexAttribIPointer(location, 1, GL_UNSIGNED_INT, sizeof(GLuint), (GLvoid*)0);
+        glVertexAttribDivisor(location, 1);
+        glEnableVertexAttribArray(location);
+        GetGLState().BindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // Draws one LOD for instanceCount instances, the instanced attributes starting at baseInstance; the VAO must be bound
+    void DrawInstanced(size_t lod, GLsizei instanceCount, GLuint baseInstance = 0) const
+    {
+        const MeshLod& entry{ m_lods[lod] };
+        glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, entry.indexCount, m_indexType,
+            (GLvoid*)(entry.firstIndex * m_indexSize), instanceCount, entry.baseVertex, baseInstance);
+    }
+
+    GLuint GetVAO() const { return m_vao; }
+    GLuint GetVertexBuffer() const { return m_vertexBuffer; }
+    GLuint GetIndexBuffer() const { return m_indexBuffer; }
+    GLenum GetIndexType() const { return m_indexType; }
+    size_t GetIndexSize() const { return m_indexSize; }
+    size_t GetLodCount() const { return m_lodCount; }
+    const MeshLod& GetLod(size_t lod) const { return m_lods[lod]; }
+    size_t GetGpuBytes() const { return m_gpuBytes; }     // vertex and index buffers
+};
+
+#endif
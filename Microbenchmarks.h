@@ -0,0 +1,351 @@
+#ifndef MICROBENCHMARKS_H
+#define MICROBENCHMARKS_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Camera.h"
+#include "Cubemap.h"
+#include "GpuCulling.h"
+#include "Mesh.h"
+#include "Renderer.h"
+#include "Simd.h"
+#include "TransformStore.h"
+#include "UniformBlocks.h"
+
+// Stacks and slices of the sphere mesh cases, STACKS x SLICES is the one the renderer builds
+const int MICROBENCHMARK_MESH_SIZES[]{ 10, 25, 50, 100 };
+
+// Objects of the frame setup cases: the original scene, a small field and a large one
+const unsigned MICROBENCHMARK_FRAME_OBJECTS[]{ 2, 1000, 100000 };
+
+// Camera updates per repetition of the camera cases
+constexpr unsigned MICROBENCHMARK_CAMERA_UPDATES{ 1000000 };
+
+// Options of the benchmarks program, parsed the way ParseOptions does for the viewer
+struct MicrobenchmarkOptions
+{
+    std::string outputDirectory{ "benchmark" };     // --output DIR: where microbenchmarks.csv is written
+    std::string baselineFile{};                     // --compare FILE: compare with an earlier microbenchmarks.csv, exit with 1 on a regression
+    double thresholdPercent{ 10.0 };                // --threshold PCT: slowdown of the median past which a case counts as a regression
+    unsigned repetitions{ 7 };                      // --repetitions N: timed repetitions of every case, the median is kept
+    std::string filter{};                           // --filter TEXT: only the cases whose name contains TEXT
+};
+
+inline MicrobenchmarkOptions ParseMicrobenchmarkOptions(int argc, char* argv[])
+{
+    MicrobenchmarkOptions options{};
+    for (int i{ 1 }; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            options.outputDirectory = argv[++i];
+        else if (std::strcmp(argv[i], "--compare") == 0 && i + 1 < argc)
+            options.baselineFile = argv[++i];
+        else if (std::strcmp(argv[i], "--threshold") == 0 && i + 1 < argc)
+            options.thresholdPercent = std::max(0.0, std::strtod(argv[++i], nullptr));
+        else if (std::strcmp(argv[i], "--repetitions") == 0 && i + 1 < argc)
+            options.repetitions = std::max(1u, static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10)));
+        else if (std::strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+            options.filter = argv[++i];
+        else
+            std::cout << "Unknown option " << argv[i] << std::endl;
+    }
+    return options;
+}
+
+// Timings of one case, per iteration
+struct MicrobenchmarkResult
+{
+    std::string name;
+    unsigned iterations{};          // per repetition
+    double medianMs{};
+    double minMs{};
+    double maxMs{};
+};
+
+// One CPU path timed in isolation: whatever it needs is built before the timing starts, run does iterations passes over it
+struct Microbenchmark
+{
+    std::string name;
+    unsigned iterations{};
+    std::function<void(unsigned iterations)> run;
+};
+
+// Results are folded into this so the compiler cannot drop the work that produced them
+inline volatile float g_microbenchmarkSink{};
+
+inline void KeepResult(float value) { g_microbenchmarkSink = g_microbenchmarkSink + value; }
+
+inline std::string MicrobenchmarkCompiler()
+{
+#if defined(__clang__)
+    return "clang " __clang_version__;
+#elif defined(__GNUC__)
+    return "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+    return "msvc " + std::to_string(_MSC_VER);
+#else
+    return "unknown";
+#endif
+}
+
+// Mesh generation, skybox decoding, camera math and the per-frame CPU setup of the sphere pass
+inline std::vector<Microbenchmark> BuildMicrobenchmarks(const std::vector<const GLchar*>& faces)
+{
+    std::vector<Microbenchmark> cases;
+
+    // BuildSphereMesh as the renderer calls it (4 LODs, cache optimized), and the plain grid it starts from
+    for (int size : MICROBENCHMARK_MESH_SIZES)
+    {
+        unsigned iterations{ std::max(1u, 10000u / static_cast<unsigned>(size * size)) };
+        cases.push_back({ "mesh/sphere_" + std::to_string(size) + "x" + std::to_string(size), iterations, [size](unsigned iterations) {
+            for (unsigned i{ 0 }; i < iterations; ++i)
+                KeepResult(static_cast<float>(BuildSphereMesh(size, size, radius).indices.size()));
+        } });
+    }
+    cases.push_back({ "mesh/sphere_" + std::to_string(STACKS) + "x" + std::to_string(SLICES) + "_grid", 20, [](unsigned iterations) {
+        for (unsigned i{ 0 }; i < iterations; ++i)
+            KeepResult(static_cast<float>(BuildSphereMesh(STACKS, SLICES, radius, 1, false).indices.size()));
+    } });
+
+    // The JPEG faces, decoded the way every cubemap loader does; the first repetition warms the OS file cache
+    for (const GLchar* face : faces)
+    {
+        if (!std::ifstream(face))
+        {
+            std::cout << "ERROR::MICROBENCHMARK::MISSING_FACE " << face << std::endl;
+            continue;
+        }
+        cases.push_back({ "decode/" + std::filesystem::path(face).filename().string(), 1, [face](unsigned iterations) {
+            for (unsigned i{ 0 }; i < iterations; ++i)
+            {
+                DecodedImage image{ DecodeCubemapImage(face, GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0) };
+                KeepResult(static_cast<float>(image.width));
+                SOIL_free_image_data(image.pixels);
+            }
+        } });
+    }
+
+    // Mouse look recomputes the camera vectors every call, the view matrix is rebuilt from them every frame
+    cases.push_back({ "camera/mouse_look", MICROBENCHMARK_CAMERA_UPDATES, [](unsigned iterations) {
+        Camera camera{ glm::vec3(0.0f, 0.0f, 3.0f) };
+        for (unsigned i{ 0 }; i < iterations; ++i)
+            camera.ProcessMouseMovement((i & 1) ? 3.0f : -2.0f, (i & 2) ? 1.5f : -1.5f);
+        KeepResult(camera.GetViewMatrix()[0][0]);
+    } });
+    cases.push_back({ "camera/keyboard_move", MICROBENCHMARK_CAMERA_UPDATES, [](unsigned iterations) {
+        Camera camera{ glm::vec3(0.0f, 0.0f, 3.0f) };
+        for (unsigned i{ 0 }; i < iterations; ++i)
+            camera.ProcessKeyboard(static_cast<Camera_Movement>(i & 3), 1.0f / 240.0f);
+        KeepResult(camera.GetPosition().x);
+    } });
+    cases.push_back({ "camera/view_matrix", MICROBENCHMARK_CAMERA_UPDATES, [](unsigned iterations) {
+        Camera camera{ glm::vec3(0.0f, 0.0f, 3.0f) };
+        float sum{};
+        for (unsigned i{ 0 }; i < iterations; ++i)
+            sum += camera.GetViewMatrix()[3][2];
+        KeepResult(sum);
+    } });
+
+    // What RenderFrame does on the CPU before it draws: camera and light blocks, the frustum planes of the cull block, and the
+    // moved transforms written into the instance array (on the calling thread, the pool is left out)
+    for (unsigned objects : MICROBENCHMARK_FRAME_OBJECTS)
+    {
+        auto transforms = std::make_shared<TransformStore>(BuildSphereTransforms(objects, 1234, MAX_MATERIALS));
+        auto basePositions = std::make_shared<std::vector<glm::vec3>>();
+        for (size_t i{ 0 }; i < transforms->Size(); ++i)
+            basePositions->push_back(transforms->GetPosition(i));
+        auto instances = std::make_shared<std::vector<SphereInstance>>(transforms->Size());
+        unsigned iterations{ std::max(2u, 200000u / objects) };
+
+        cases.push_back({ "frame/setup_" + std::to_string(objects), iterations, [transforms, basePositions, instances](unsigned iterations) {
+            Camera camera{ glm::vec3(0.0f, 0.0f, 3.0f) };
+            glm::mat4 projection{ glm::perspective(ZOOM, 4.0f / 3.0f, NEAR_PLANE, FAR_PLANE) };
+            for (unsigned i{ 0 }; i < iterations; ++i)
+            {
+                float time{ i / 60.0f };
+                CameraBlock cameraBlock{};
+                cameraBlock.view = camera.GetViewMatrix();
+                cameraBlock.projection = projection;
+                cameraBlock.position = camera.GetPosition();
+                LightBlock lightBlock{ BuildLightBlock(time) };
+                CullBlock cullBlock{};
+                ExtractFrustumPlanes(cameraBlock.projection * cameraBlock.view, cullBlock.frustumPlanes);
+
+                AnimateSphereTransforms(*transforms, *basePositions, time);
+                transforms->Update(nullptr, instances->data());
+                KeepResult(lightBlock.diffuse.r + cullBlock.frustumPlanes[0].w + (*instances)[0].model[3][1]);
+            }
+        } });
+    }
+    return cases;
+}
+
+// Every repetition times all iterations of the case once, after one untimed warm-up repetition
+inline MicrobenchmarkResult RunMicrobenchmark(const Microbenchmark& benchmark, unsigned repetitions)
+{
+    benchmark.run(benchmark.iterations);
+
+    std::vector<double> samples;
+    for (unsigned repetition{ 0 }; repetition < repetitions; ++repetition)
+    {
+        auto start = std::chrono::steady_clock::now();
+        benchmark.run(benchmark.iterations);
+        samples.push_back(ElapsedMilliseconds(start, std::chrono::steady_clock::now()) / benchmark.iterations);
+    }
+    std::sort(samples.begin(), samples.end());
+
+    MicrobenchmarkResult result{};
+    result.name = benchmark.name;
+    result.iterations = benchmark.iterations;
+    result.medianMs = samples[samples.size() / 2];
+    result.minMs = samples.front();
+    result.maxMs = samples.back();
+    return result;
+}
+
+// Reads a file written by WriteMicrobenchmarkResults, its # line is kept for the report
+inline bool ReadMicrobenchmarkResults(const std::string& path, std::map<std::string, MicrobenchmarkResult>& results, std::string& header)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        std::cout << "ERROR::MICROBENCHMARK::CANNOT_READ " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    for (unsigned lineNumber{ 1 }; std::getline(file, line); ++lineNumber)
+    {
+        if (!line.empty() && line[0] == '#')
+            header = line.substr(std::min<size_t>(2, line.size()));
+        if (line.empty() || line[0] == '#' || line.compare(0, 5, "name,") == 0)
+            continue;
+
+        std::replace(line.begin(), line.end(), ',', ' ');
+        std::istringstream tokens(line);
+        MicrobenchmarkResult result{};
+        if (!(tokens >> result.name >> result.iterations >> result.medianMs >> result.minMs >> result.maxMs))
+        {
+            std::cout << "ERROR::MICROBENCHMARK::PARSE_FAILED " << path << ":" << lineNumber << std::endl;
+            return false;
+        }
+        results[result.name] = result;
+    }
+    return true;
+}
+
+inline bool WriteMicrobenchmarkResults(const std::string& path, const std::vector<MicrobenchmarkResult>& results, unsigned repetitions)
+{
+    std::ofstream csv(path);
+    csv << "# compiler: " << MicrobenchmarkCompiler() << ", simd: " << SIMD_INSTRUCTION_SET << ", repetitions: " << repetitions << "\n";
+    csv << "name,iterations,median_ms,min_ms,max_ms\n";
+    csv << std::setprecision(9);
+    for (const MicrobenchmarkResult& result : results)
+        csv << result.name << "," << result.iterations << "," << result.medianMs << "," << result.minMs << "," << result.maxMs << "\n";
+
+    if (!csv)
+    {
+        std::cout << "ERROR::MICROBENCHMARK::CANNOT_WRITE " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Median against the baseline's, a case slower by more than the threshold is a regression. Returns the regression count
+inline unsigned CompareMicrobenchmarkResults(const std::vector<MicrobenchmarkResult>& results, const std::map<std::string, MicrobenchmarkResult>& baseline,
+    double thresholdPercent, const std::string& filter)
+{
+    unsigned regressions{ 0 };
+    for (const MicrobenchmarkResult& result : results)
+    {
+        auto entry = baseline.find(result.name);
+        std::cout << "  " << std::left << std::setw(28) << result.name << std::right;
+        if (entry == baseline.end() || entry->second.medianMs <= 0.0)
+        {
+            std::cout << " not in the baseline" << std::endl;
+            continue;
+        }
+
+        double change{ 100.0 * (result.medianMs - entry->second.medianMs) / entry->second.medianMs };
+        std::cout << " " << entry->second.medianMs << " -> " << result.medianMs << " ms (" << std::showpos << change << std::noshowpos << "%)";
+        if (change > thresholdPercent)
+        {
+            std::cout << " REGRESSION";
+            ++regressions;
+        }
+        else if (change < -thresholdPercent)
+            std::cout << " faster";
+        std::cout << std::endl;
+    }
+
+    for (const auto& entry : baseline)
+        if (entry.first.find(filter) != std::string::npos && std::none_of(results.begin(), results.end(), [&](const MicrobenchmarkResult& result) { return result.name == entry.first; }))
+            std::cout << "  " << std::left << std::setw(28) << entry.first << std::right << " in the baseline only" << std::endl;
+    return regressions;
+}
+
+// The whole suite: runs the cases, writes microbenchmarks.csv and, with a baseline, returns 1 when any case regressed
+inline int RunMicrobenchmarks(const MicrobenchmarkOptions& options, const std::vector<const GLchar*>& faces)
+{
+    std::map<std::string, MicrobenchmarkResult> baseline;
+    std::string baselineHeader;
+    if (!options.baselineFile.empty() && !ReadMicrobenchmarkResults(options.baselineFile, baseline, baselineHeader))
+        return 1;
+
+    std::error_code error{};
+    std::filesystem::create_directories(options.outputDirectory, error);
+    if (error)
+    {
+        std::cout << "ERROR::MICROBENCHMARK::CANNOT_CREATE " << options.outputDirectory << std::endl;
+        return 1;
+    }
+
+    std::cout << "CPU microbenchmarks, " << MicrobenchmarkCompiler() << ", " << SIMD_INSTRUCTION_SET << ", median of " << options.repetitions
+        << " repetitions" << std::endl;
+    std::vector<MicrobenchmarkResult> results;
+    for (const Microbenchmark& benchmark : BuildMicrobenchmarks(faces))
+    {
+        if (!options.filter.empty() && benchmark.name.find(options.filter) == std::string::npos)
+            continue;
+
+        results.push_back(RunMicrobenchmark(benchmark, options.repetitions));
+        const MicrobenchmarkResult& result{ results.back() };
+        std::cout << "  " << std::left << std::setw(28) << result.name << std::right << " " << result.medianMs << " ms per iteration (min "
+            << result.minMs << ", max " << result.maxMs << ", " << result.iterations << " iterations)" << std::endl;
+    }
+
+    std::string csvPath{ (std::filesystem::path(options.outputDirectory) / "microbenchmarks.csv").string() };
+    if (!WriteMicrobenchmarkResults(csvPath, results, options.repetitions))
+        return 1;
+    std::cout << "Results written to " << csvPath << std::endl;
+
+    if (options.baselineFile.empty())
+        return 0;
+
+    std::cout << "Against " << options.baselineFile << " (" << baselineHeader << "), threshold " << options.thresholdPercent << "%" << std::endl;
+    unsigned regressions{ CompareMicrobenchmarkResults(results, baseline, options.thresholdPercent, options.filter) };
+    std::cout << regressions << " regression" << (regressions == 1 ? "" : "s") << std::endl;
+    return regressions > 0 ? 1 : 0;
+}
+
+#endif
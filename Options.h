@@ -0,0 +1,226 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+// How the spheres are drawn: tessellated meshes, one ray cast quad per sphere, or one ray traced full screen pass over a BVH
+enum SphereMode
+{
+    SPHERE_MESH,
+    SPHERE_IMPOSTOR,
+    SPHERE_RAYTRACE
+};
+
+inline const char* SphereModeName(SphereMode mode)
+{
+    return mode == SPHERE_IMPOSTOR ? "impostor" : mode == SPHERE_RAYTRACE ? "raytrace" : "mesh";
+}
+
+// Command line switches of the viewer
+struct Options
+{
+    bool serialCubemapLoad{ false };    // --serial-cubemap: decode and upload the faces one by one on the GL thread
+    bool environmentCache{ true };      // --no-environment-cache: decode the JPEG faces instead of mapping the baked cache
+    bool bakeEnvironment{ false };      // --bake-environment: rebuild the environment cache and exit, no window is opened
+    bool compressEnvironment{ true };   // --uncompressed-environment: bake RGB8 instead of BC1
+    bool streamEnvironment{ true };     // --no-environment-streaming: upload the whole cached mip chain before the first frame
+    unsigned environmentUploadKiB{ 4096 };  // --environment-upload KIB: environment texels uploaded per frame while the finer levels stream in
+    unsigned environmentResidencyMiB{ 0 };  // --environment-residency MIB: most memory the environment texture may hold, 0 for no limit
+    unsigned sphereCount{ 2 };          // --spheres N: size of the sphere field, 2 is the original scene
+    unsigned seed{ 1234 };              // --seed S: seed of the generated sphere field
+    bool gpuCulling{ true };            // --no-gpu-culling: draw every sphere at full detail with one instanced call
+    SphereMode sphereMode{ SPHERE_MESH };   // --sphere-mode mesh|impostor|raytrace: how the spheres are drawn
+    bool shaderVariants{ true };        // --no-shader-variants: one lighting program that branches on every material's features per pixel
+    bool materialFeatures{ false };     // --material-features: give the generated palette a mix of lighting features instead of the full set
+    unsigned width{ 800 };              // --size W H: window or offscreen target size
+    unsigned height{ 600 };
+    bool headless{ false };             // --headless: render a scripted benchmark offscreen, no window
+    unsigned frameCount{ 600 };         // --frames N: length of the headless run
+    std::string outputDirectory{ "benchmark" }; // --output DIR: where the headless run writes timings.csv and frames
+    bool shaderCache{ true };           // --no-shader-cache: always compile the shaders from source
+    bool stateCache{ true };            // --no-state-cache: issue every bind and state change to GL even when nothing changes
+    bool profile{ false };              // --profile: per-pass CPU and GPU timings, summarized with the frame time report
+    std::string traceFile{};            // --trace FILE: also record every scope and write a Chrome trace on exit, implies --profile
+    bool software{ false };             // --software: render the headless run on the CPU and compare with the GL frames, no GPU needed
+    unsigned savedFrameCount{ 1 };      // --save-frames K: frames of the headless run dumped as PPM, 0 for none
+    bool animate{ false };              // --animate: move the spheres every frame, their transforms are streamed to the GPU
+    bool imageBasedLighting{ false };   // --ibl: SH irradiance and a roughness-prefiltered reflection baked from the skybox
+    unsigned probeCount{ 0 };           // --probes N: dynamic reflection probes on the first N spheres
+    unsigned probeSize{ 128 };          // --probe-size S: face resolution of every probe
+    double probeBudgetMs{ 1.0 };        // --probe-budget MS: GPU time per frame spent refreshing probes
+    double frameBudgetMs{ 0.0 };        // --frame-budget MS: GPU frame time the resolution scale is steered towards, 0 to leave it fixed
+    float resolutionScale{ 1.0f };      // --resolution-scale S: scale of the rendered size, the starting point with a frame budget
+    float minResolutionScale{ 0.5f };   // --min-resolution-scale S: lowest scale the frame budget may pick
+    bool halfRateReflections{ false };  // --half-rate-reflections: shade the reflection at half resolution and upsample it by depth
+    bool hdr{ false };                  // --hdr: render into a half float target, then bloom, auto exposure and a filmic tonemap
+    bool naivePost{ false };            // --naive-post: build the bloom pyramid with one dispatch per level instead of a single pass
+    float bloomStrength{ 0.05f };       // --bloom S: share of the bloom in the final colour
+    float exposureKey{ 0.18f };         // --exposure-key K: luminance the scene's average is exposed to
+    unsigned pointLightCount{ 0 };      // --lights N: point lights on top of the original one, culled per view-space cluster
+    unsigned inputRate{ 240 };          // --input-rate HZ: camera input steps per second on the input thread
+    bool frameInput{ false };           // --frame-input: sample the camera input once per frame on the render thread instead, for comparison
+    unsigned frameLimit{ 0 };           // --frame-limit FPS: cap the window's frame rate, 0 for none
+    bool lightBenchmark{ false };       // --light-benchmark: headless sweep from 1 to 10000 point lights, implies --headless
+    std::string sceneFile{};            // --scene FILE: draw a compiled scene instead of the generated field, streamed in while rendering
+    unsigned sceneChunkObjects{ 65536 }; // --scene-chunk N: objects of the scene added per frame while it streams in
+    std::string convertSceneInput{};    // --convert-scene TEXT FILE: compile a readable scene and exit
+    std::string convertSceneOutput{};
+    std::string exportScene{};          // --export-scene TEXT: write the scene the other options generate in readable form and exit
+    bool sceneBenchmark{ false };       // --scene-benchmark: load times of generated scenes of 1k, 100k and 1M objects, text against compiled
+    bool sphereBenchmark{ false };      // --sphere-benchmark: headless sweep of the sphere modes over 100 to 100000 spheres, implies --headless
+    bool postBenchmark{ false };        // --post-benchmark: single pass against per level post chain at 1080p and 4K, implies --headless and --hdr
+    unsigned cpuBudgetMiB{ 64 };        // --cpu-budget MIB: staging memory kept for reuse between loads, 0 for no limit
+    unsigned gpuBudgetMiB{ 0 };         // --gpu-budget MIB: mesh and cubemap memory reported against, 0 for no limit
+    bool resourceBenchmark{ false };    // --resource-benchmark: load and unload thousands of meshes, arena staging against the heap, implies --headless
+};
+
+inline Options ParseOptions(int argc, char* argv[])
+{
+    Options options{};
+    for (int i{ 1 }; i < argc; ++i)
+    {
+        if (std::strcmp(argv[i], "--serial-cubemap") == 0)
+            options.serialCubemapLoad = true;
+        else if (std::strcmp(argv[i], "--no-environment-cache") == 0)
+            options.environmentCache = false;
+        else if (std::strcmp(argv[i], "--bake-environment") == 0)
+            options.bakeEnvironment = true;
+        else if (std::strcmp(argv[i], "--uncompressed-environment") == 0)
+            options.compressEnvironment = false;
+        else if (std::strcmp(argv[i], "--no-environment-streaming") == 0)
+            options.streamEnvironment = false;
+        else if (std::strcmp(argv[i], "--environment-upload") == 0 && i + 1 < argc)
+            options.environmentUploadKiB = std::max(1u, static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10)));
+        else if (std::strcmp(argv[i], "--environment-residency") == 0 && i + 1 < argc)
+            options.environmentResidencyMiB = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        else if (std::strcmp(argv[i], "--frame-budget") == 0 && i + 1 < argc)
+            options.frameBudgetMs = std::max(0.0, std::strtod(argv[++i], nullptr));
+        else if (std::strcmp(argv[i], "--resolution-scale") == 0 && i + 1 < argc)
+            options.resolutionScale = std::clamp(std::strtof(argv[++i], nullptr), 0.1f, 1.0f);
+        else if (std::strcmp(argv[i], "--min-resolution-scale") == 0 && i + 1 < argc)
+            options.minResolutionScale = std::clamp(std::strtof(argv[++i], nullptr), 0.1f, 1.0f);
+        else if (std::strcmp(argv[i], "--half-rate-reflections") == 0)
+            options.halfRateReflections = true;
+        else if (std::strcmp(argv[i], "--hdr") == 0)
+            options.hdr = true;
+        else if (std::strcmp(argv[i], "--naive-post") == 0)
+            options.naivePost = true;
+        else if (std::strcmp(argv[i], "--bloom") == 0 && i + 1 < argc)
+            options.bloomStrength = std::clamp(std::strtof(argv[++i], nullptr), 0.0f, 1.0f);
+        else if (std::strcmp(argv[i], "--exposure-key") == 0 && i + 1 < argc)
+            options.exposureKey = std::max(0.001f, std::strtof(argv[++i], nullptr));
+        else if (std::strcmp(argv[i], "--no-state-cache") == 0)
+            options.stateCache = false;
+        else if (std::strcmp(argv[i], "--no-gpu-culling") == 0)
+            options.gpuCulling = false;
+        else if (std::strcmp(argv[i], "--no-shader-variants") == 0)
+            options.shaderVariants = false;
+        else if (std::strcmp(argv[i], "--material-features") == 0)
+            options.materialFeatures = true;
+        else if (std::strcmp(argv[i], "--sphere-mode") == 0 && i + 1 < argc)
+        {
+            const char* mode{ argv[++i] };
+            if (std::strcmp(mode, "mesh") == 0)
+                options.sphereMode = SPHERE_MESH;
+            else if (std::strcmp(mode, "impostor") == 0)
+                options.sphereMode = SPHERE_IMPOSTOR;
+            else if (std::strcmp(mode, "raytrace") == 0)
+                options.sphereMode = SPHERE_RAYTRACE;
+            else
+                std::cout << "Unknown sphere mode " << mode << std::endl;
+        }
+        else if (std::strcmp(argv[i], "--sphere-benchmark") == 0)
+        {
+            options.sphereBenchmark = true;
+            options.headless = true;
+        }
+        else if (std::strcmp(argv[i], "--post-benchmark") == 0)
+        {
+            options.postBenchmark = true;
+            options.hdr = true;
+            options.headless = true;
+        }
+        else if (std::strcmp(argv[i], "--resource-benchmark") == 0)
+        {
+            options.resourceBenchmark = true;
+            options.headless = true;
+        }
+        else if (std::strcmp(argv[i], "--cpu-budget") == 0 && i + 1 < argc)
+            options.cpuBudgetMiB = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        else if (std::strcmp(argv[i], "--gpu-budget") == 0 && i + 1 < argc)
+            options.gpuBudgetMiB = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        else if (std::strcmp(argv[i], "--headless") == 0)
+            options.headless = true;
+        else if (std::strcmp(argv[i], "--no-shader-cache") == 0)
+            options.shaderCache = false;
+        else if (std::strcmp(argv[i], "--profile") == 0)
+            options.profile = true;
+        else if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+        {
+            options.traceFile = argv[++i];
+            options.profile = true;
+        }
+        else if (std::strcmp(argv[i], "--software") == 0)
+            options.software = true;
+        else if (std::strcmp(argv[i], "--animate") == 0)
+            options.animate = true;
+        else if (std::strcmp(argv[i], "--ibl") == 0)
+            options.imageBasedLighting = true;
+        else if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            options.frameCount = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        else if (std::strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            options.outputDirectory = argv[++i];
+        else if (std::strcmp(argv[i], "--save-frames") == 0 && i + 1 < argc)
+            options.savedFrameCount = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        else if (std::strcmp(argv[i], "--size") == 0 && i + 2 < argc)
+        {
+            options.width = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+            options.height = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (std::strcmp(argv[i], "--spheres") == 0 && i + 1 < argc)
+            options.sphereCount = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        else if (std::strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+            options.seed = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        else if (std::strcmp(argv[i], "--light-benchmark") == 0)
+        {
+            options.lightBenchmark = true;
+            options.headless = true;
+        }
+        else if (std::strcmp(argv[i], "--lights") == 0 && i + 1 < argc)
+            options.pointLightCount = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        else if (std::strcmp(argv[i], "--frame-input") == 0)
+            options.frameInput = true;
+        else if (std::strcmp(argv[i], "--input-rate") == 0 && i + 1 < argc)
+            options.inputRate = std::max(1u, static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10)));
+        else if (std::strcmp(argv[i], "--frame-limit") == 0 && i + 1 < argc)
+            options.frameLimit = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        else if (std::strcmp(argv[i], "--scene") == 0 && i + 1 < argc)
+            options.sceneFile = argv[++i];
+        else if (std::strcmp(argv[i], "--scene-chunk") == 0 && i + 1 < argc)
+            options.sceneChunkObjects = std::max(1u, static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10)));
+        else if (std::strcmp(argv[i], "--convert-scene") == 0 && i + 2 < argc)
+        {
+            options.convertSceneInput = argv[++i];
+            options.convertSceneOutput = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--export-scene") == 0 && i + 1 < argc)
+            options.exportScene = argv[++i];
+        else if (std::strcmp(argv[i], "--scene-benchmark") == 0)
+            options.sceneBenchmark = true;
+        else if (std::strcmp(argv[i], "--probes") == 0 && i + 1 < argc)
+            options.probeCount = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        else if (std::strcmp(argv[i], "--probe-size") == 0 && i + 1 < argc)
+            options.probeSize = std::max(1u, static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10)));
+        else if (std::strcmp(argv[i], "--probe-budget") == 0 && i + 1 < argc)
+            options.probeBudgetMs = std::strtod(argv[++i], nullptr);
+        else
+            std::cout << "Unknown option " << argv[i] << std::endl;
+    }
+    return options;
+}
+
+#endif
@@ -0,0 +1,340 @@
+#ifndef POST_PROCESS_H
+#define POST_PROCESS_H
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <memory>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "GLState.h"
+#include "Shader.h"
+#include "StreamingBuffer.h"
+#include "UniformBlocks.h"
+
+// Downsample levels below the scene, level 1 being half its size. Each level is an image unit of the single pass program and GL 4.3
+// only promises 8 of them; keep in sync with MAX_LEVELS in downsample.comp
+constexpr GLint POST_MAX_LEVELS{ 8 };
+
+// Scene pixels a workgroup of the single pass program reduces per side, and the levels that takes; keep in sync with downsample.comp
+constexpr GLint POST_TILE_SIZE{ 64 };
+constexpr GLint POST_TILE_LEVELS{ 6 };
+
+// Range the auto exposure is kept in, and how fast it follows the scene (per second)
+constexpr float POST_MIN_EXPOSURE{ 0.1f };
+constexpr float POST_MAX_EXPOSURE{ 10.0f };
+constexpr float POST_ADAPTATION_RATE{ 1.5f };
+
+// Frames between timing or copying the exposure and reading the result, so reading never waits
+constexpr unsigned POST_READBACK_FRAMES{ 3 };
+
+// Timing and exposure of the post chain, a few frames old
+struct PostProcessStats
+{
+    bool valid{};
+    bool singlePass{};
+    GLsizei width{};                // scene size the chain ran at
+    GLsizei height{};
+    GLint levels{};
+    GLuint dispatches{};            // compute dispatches per frame for the pyramid and the exposure
+    double downsampleGpuMs{};       // last frame
+    double tonemapGpuMs{};
+    double averageDownsampleGpuMs{};    // smoothed
+    double averageTonemapGpuMs{};
+    unsigned frames{};              // frames timed, with the sums below for exact means over a run
+    double totalDownsampleGpuMs{};
+    double totalTonemapGpuMs{};
+    float exposure{};
+    float averageLuminance{};       // geometric mean over the scene
+};
+
+inline void PrintPostProcessStats(const PostProcessStats& stats)
+{
+    if (!stats.valid)
+        return;
+
+    std::cout << "  post: " << stats.width << "x" << stats.height << " HDR, " << stats.levels << " levels in " << stats.dispatches
+        << (stats.dispatches == 1 ? " dispatch" : " dispatches") << (stats.singlePass ? " (single pass)" : " (one per level)") << ", downsample "
+        << stats.averageDownsampleGpuMs << " ms GPU, bloom and tonemap " << stats.averageTonemapGpuMs << " ms, exposure " << stats.exposure
+        << " (average luminance " << stats.averageLuminance << ")" << std::endl;
+}
+
+// Turns the half float scene into the displayed frame: a pyramid of downsampled levels feeds the bloom, the average log luminance
+// over the scene drives the exposure, and a filmic curve maps the result into the output framebuffer.
+// The single pass program builds the whole pyramid and the luminance in one dispatch, each workgroup reducing its tile in shared
+// memory; --naive-post runs the usual dispatch per level instead, to measure against
+class PostProcessChain
+{
+private:
+    std::unique_ptr<Shader> m_downsampleShader;     // downsample.comp, or downsample_level.comp with --naive-post
+    Shader m_tonemapShader;
+    bool m_singlePass{};
+    float m_exposureKey{};
+    float m_bloomStrength{};
+
+    GLuint m_pyramid{};
+    GLsizei m_pyramidWidth{};           // level 1 as allocated, a multiple of every level's texel footprint
+    GLsizei m_pyramidHeight{};
+    GLuint m_tileBuffer{};
+    GLsizeiptr m_tileCapacity{};
+    GLuint m_stateBuffer{};
+    GLuint m_sampler{};
+    GLuint m_vao{};
+
+    GLuint m_queries[POST_READBACK_FRAMES][3]{};
+    bool m_issued[POST_READBACK_FRAMES]{};
+    GLuint m_readbackBuffers[POST_READBACK_FRAMES]{};
+    GLsync m_readbackFences[POST_READBACK_FRAMES]{};
+    unsigned m_frame{};
+    float m_lastTime{};
+    PostProcessStats m_stats{};
+
+    static constexpr GLsizeiptr STATE_SIZE{ 4 * sizeof(GLuint) };
+
+    static GLint levelCount(GLsizei width, GLsizei height)
+    {
+        GLint levels{ 0 };
+        while (levels < POST_MAX_LEVELS && (std::max(width, height) >> (levels + 1)) > 0)
+            ++levels;
+        return std::max(levels, 1);
+    }
+
+    // Grows the pyramid and the tile list for a scene of width x height
+    void reserve(GLsizei width, GLsizei height)
+    {
+        GLsizei footprint{ 1 << (POST_MAX_LEVELS - 1) };
+        GLsizei levelWidth{ ((width + 1) / 2 + footprint - 1) / footprint * footprint };
+        GLsizei levelHeight{ ((height + 1) / 2 + footprint - 1) / footprint * footprint };
+        if (!m_pyramid || levelWidth > m_pyramidWidth || levelHeight > m_pyramidHeight)
+        {
+            m_pyramidWidth = std::max(levelWidth, m_pyramidWidth);
+            m_pyramidHeight = std::max(levelHeight, m_pyramidHeight);
+            GetGLState().DeleteTextures(1, &m_pyramid);
+            glGenTextures(1, &m_pyramid);
+            GetGLState().BindTexture(GL_TEXTURE_2D, m_pyramid);
+            glTexStorage2D(GL_TEXTURE_2D, POST_MAX_LEVELS, GL_RGBA16F, m_pyramidWidth, m_pyramidHeight);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            GetGLState().BindTexture(GL_TEXTURE_2D, 0);
+        }
+
+        GLsizeiptr tiles{ static_cast<GLsizeiptr>((width + POST_TILE_SIZE - 1) / POST_TILE_SIZE) * ((height + POST_TILE_SIZE - 1) / POST_TILE_SIZE) };
+        if (tiles > m_tileCapacity)
+        {
+            m_tileCapacity = tiles;
+            glBindBuffer(GL_COPY_WRITE_BUFFER, m_tileBuffer);
+            glBufferData(GL_COPY_WRITE_BUFFER, m_tileCapacity * sizeof(glm::vec4), nullptr, GL_DYNAMIC_COPY);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        }
+    }
+
+    // Picks up the timestamps and the exposure of an older frame if the GPU is already done with them
+    void collect(unsigned slot)
+    {
+        if (m_issued[slot])
+        {
+            GLint available{};
+            glGetQueryObjectiv(m_queries[slot][2], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available)
+            {
+                GLuint64 begin{}, downsampled{}, end{};
+                glGetQueryObjectui64v(m_queries[slot][0], GL_QUERY_RESULT, &begin);
+                glGetQueryObjectui64v(m_queries[slot][1], GL_QUERY_RESULT, &downsampled);
+                glGetQueryObjectui64v(m_queries[slot][2], GL_QUERY_RESULT, &end);
+                m_issued[slot] = false;
+
+                m_stats.downsampleGpuMs = (downsampled - begin) / 1.0e6;
+                m_stats.tonemapGpuMs = (end - downsampled) / 1.0e6;
+                bool first{ m_stats.frames == 0 };
+                m_stats.averageDownsampleGpuMs = first ? m_stats.downsampleGpuMs : 0.9 * m_stats.averageDownsampleGpuMs + 0.1 * m_stats.downsampleGpuMs;
+                m_stats.averageTonemapGpuMs = first ? m_stats.tonemapGpuMs : 0.9 * m_stats.averageTonemapGpuMs + 0.1 * m_stats.tonemapGpuMs;
+                m_stats.totalDownsampleGpuMs += m_stats.downsampleGpuMs;
+                m_stats.totalTonemapGpuMs += m_stats.tonemapGpuMs;
+                ++m_stats.frames;
+                m_stats.valid = true;
+            }
+        }
+
+        if (m_readbackFences[slot] && glClientWaitSync(m_readbackFences[slot], 0, 0) != GL_TIMEOUT_EXPIRED)
+        {
+            glDeleteSync(m_readbackFences[slot]);
+            m_readbackFences[slot] = nullptr;
+
+            GLfloat state[4]{};
+            glBindBuffer(GL_COPY_READ_BUFFER, m_readbackBuffers[slot]);
+            glGetBufferSubData(GL_COPY_READ_BUFFER, 0, STATE_SIZE, state);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            m_stats.exposure = state[1];
+            m_stats.averageLuminance = std::exp(state[2]);
+        }
+    }
+
+    void downsampleSinglePass(GLsizei width, GLsizei height)
+    {
+        GLuint tilesX{ static_cast<GLuint>((width + POST_TILE_SIZE - 1) / POST_TILE_SIZE) };
+        GLuint tilesY{ static_cast<GLuint>((height + POST_TILE_SIZE - 1) / POST_TILE_SIZE) };
+        for (GLint level{ 0 }; level < POST_MAX_LEVELS; ++level)
+            glBindImageTexture(level, m_pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+        GetGLState().BindBufferBase(GL_SHADER_STORAGE_BUFFER, DOWNSAMPLE_TILE_BUFFER_BINDING, m_tileBuffer);
+
+        m_downsampleShader->Use();
+        glDispatchCompute(tilesX, tilesY, 1);
+        m_stats.dispatches = 1;
+    }
+
+    void downsamplePerLevel(GLsizei width, GLsizei height, GLint levels)
+    {
+        GetGLState().BindTextureUnit(POST_PYRAMID_TEXTURE_UNIT, GL_TEXTURE_2D, m_pyramid);
+        m_downsampleShader->Use();
+        GLint levelLocation{ m_downsampleShader->GetUniformLocation("level") };
+        for (GLint level{ 1 }; level <= levels; ++level)
+        {
+            GLsizei levelWidth{ (width + (1 << level) - 1) >> level };
+            GLsizei levelHeight{ (height + (1 << level) - 1) >> level };
+            glBindImageTexture(0, m_pyramid, level - 1, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+            GetGLState().Uniform1i(levelLocation, level);
+            glDispatchCompute((levelWidth + 7) / 8, (levelHeight + 7) / 8, 1);
+            glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+        }
+        GetGLState().Uniform1i(levelLocation, levels + 1);
+        glDispatchCompute(1, 1, 1);
+        m_stats.dispatches = levels + 1;
+    }
+
+public:
+    PostProcessChain(bool singlePass, float exposureKey, float bloomStrength)
+        : m_downsampleShader{ new Shader(singlePass ? "downsample.comp" : "downsample_level.comp") }, m_tonemapShader("postprocess.vs", "tonemap.frag"),
+        m_singlePass{ singlePass }, m_exposureKey{ exposureKey }, m_bloomStrength{ bloomStrength }
+    {
+        m_downsampleShader->BindUniformBlock("PostBlock", POST_BLOCK_BINDING);
+        m_tonemapShader.BindUniformBlock("PostBlock", POST_BLOCK_BINDING);
+        m_stats.singlePass = singlePass;
+
+        glGenBuffers(1, &m_tileBuffer);
+
+        // The exposure starts over, the counter of finished workgroups at 0
+        glGenBuffers(1, &m_stateBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_stateBuffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, STATE_SIZE, nullptr, GL_DYNAMIC_COPY);
+        GLuint zero{ 0 };
+        glClearBufferData(GL_COPY_WRITE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+
+        glGenBuffers(POST_READBACK_FRAMES, m_readbackBuffers);
+        for (GLuint buffer : m_readbackBuffers)
+        {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+            glBufferData(GL_COPY_WRITE_BUFFER, STATE_SIZE, nullptr, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        for (GLuint* queries : m_queries)
+            glGenQueries(3, queries);
+
+        // The scene target is nearest filtered for the blit, the tonemap pass reads it through this instead; no other pass uses the unit
+        glGenSamplers(1, &m_sampler);
+        glSamplerParameteri(m_sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glSamplerParameteri(m_sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glSamplerParameteri(m_sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glSamplerParameteri(m_sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindSampler(POST_SCENE_TEXTURE_UNIT, m_sampler);
+
+        // The full screen triangle has no attributes, core profile still wants a vertex array
+        glGenVertexArrays(1, &m_vao);
+    }
+
+    ~PostProcessChain()
+    {
+        for (GLsync fence : m_readbackFences)
+            if (fence)
+                glDeleteSync(fence);
+        for (GLuint* queries : m_queries)
+            glDeleteQueries(3, queries);
+        GetGLState().DeleteBuffers(POST_READBACK_FRAMES, m_readbackBuffers);
+        GetGLState().DeleteBuffers(1, &m_tileBuffer);
+        GetGLState().DeleteBuffers(1, &m_stateBuffer);
+        GetGLState().DeleteTextures(1, &m_pyramid);
+        GetGLState().DeleteVertexArrays(1, &m_vao);
+        glBindSampler(POST_SCENE_TEXTURE_UNIT, 0);
+        glDeleteSamplers(1, &m_sampler);
+    }
+
+    PostProcessChain(const PostProcessChain&) = delete;
+    PostProcessChain& operator=(const PostProcessChain&) = delete;
+
+    // Waits for the programs, they compile alongside the other ones while the scene is being set up
+    bool FinishShaders()
+    {
+        bool linked{ m_downsampleShader->Finish() };
+        return m_tonemapShader.Finish() && linked;
+    }
+
+    // Post processes the width x height corner of sceneTexture (allocated textureWidth x textureHeight) into the viewport of the
+    // output framebuffer, which is left bound with that viewport. time is the frame's, the exposure adapts by the step since the last one
+    void Apply(StreamingBuffer& stream, GLuint sceneTexture, GLsizei width, GLsizei height, GLsizei textureWidth, GLsizei textureHeight,
+        GLuint outputFramebuffer, const GLint viewport[4], float time)
+    {
+        GLStateCache& state{ GetGLState() };
+        unsigned slot{ m_frame % POST_READBACK_FRAMES };
+        collect(slot);
+        reserve(width, height);
+
+        PostBlock block{};
+        block.outputViewport = glm::ivec4(viewport[0], viewport[1], viewport[2], viewport[3]);
+        block.sceneSize = glm::ivec2(width, height);
+        block.sceneTextureSize = glm::ivec2(textureWidth, textureHeight);
+        block.levelCount = levelCount(width, height);
+        block.deltaTime = m_frame > 0 ? std::max(time - m_lastTime, 0.0f) : 0.0f;
+        block.exposureKey = m_exposureKey;
+        block.adaptationRate = POST_ADAPTATION_RATE;
+        block.bloomStrength = m_bloomStrength;
+        block.minExposure = POST_MIN_EXPOSURE;
+        block.maxExposure = POST_MAX_EXPOSURE;
+        stream.WriteAndBind(block, POST_BLOCK_BINDING);
+        m_lastTime = time;
+        m_stats.width = width;
+        m_stats.height = height;
+        m_stats.levels = block.levelCount;
+
+        // The scene was just rendered into, its writes have to land before the compute pass fetches them
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+        glQueryCounter(m_queries[slot][0], GL_TIMESTAMP);
+        state.BindTextureUnit(POST_SCENE_TEXTURE_UNIT, GL_TEXTURE_2D, sceneTexture);
+        state.BindBufferBase(GL_SHADER_STORAGE_BUFFER, POST_STATE_BUFFER_BINDING, m_stateBuffer);
+        if (m_singlePass)
+            downsampleSinglePass(width, height);
+        else
+            downsamplePerLevel(width, height, block.levelCount);
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+        glQueryCounter(m_queries[slot][1], GL_TIMESTAMP);
+
+        state.BindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer);
+        state.Viewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        state.Disable(GL_DEPTH_TEST);
+        state.BindTextureUnit(POST_PYRAMID_TEXTURE_UNIT, GL_TEXTURE_2D, m_pyramid);
+        m_tonemapShader.Use();
+        state.BindVertexArray(m_vao);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        state.Enable(GL_DEPTH_TEST);
+        glQueryCounter(m_queries[slot][2], GL_TIMESTAMP);
+        m_issued[slot] = true;
+
+        // Queue the exposure for readback, it is read POST_READBACK_FRAMES frames later
+        glBindBuffer(GL_COPY_READ_BUFFER, m_stateBuffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_readbackBuffers[slot]);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, STATE_SIZE);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        if (m_readbackFences[slot])
+            glDeleteSync(m_readbackFences[slot]);
+        m_readbackFences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        ++m_frame;
+    }
+
+    const PostProcessStats& GetStats() const { return m_stats; }
+};
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef PPM_H
+#define PPM_H
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Binary PPM (P6) files. Pixels are RGB8 rows stored bottom-up, the way glReadPixels returns them, and are flipped on disk so the image is upright
+inline bool WritePPM(const std::string& path, int width, int height, const unsigned char* pixels)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    file << "P6\n" << width << " " << height << "\n255\n";
+    size_t rowBytes{ static_cast<size_t>(width) * 3 };
+    for (int y{ height - 1 }; y >= 0; --y)
+        file.write(reinterpret_cast<const char*>(pixels + y * rowBytes), rowBytes);
+    return static_cast<bool>(file);
+}
+
+// Reads back what WritePPM wrote, comments and other maximum values are not supported
+inline bool ReadPPM(const std::string& path, int& width, int& height, std::vector<unsigned char>& pixels)
+{
+    std::ifstream file(path, std::ios::binary);
+    std::string magic;
+    int maxValue{};
+    if (!(file >> magic >> width >> height >> maxValue) || magic != "P6" || maxValue != 255 || width <= 0 || height <= 0)
+        return false;
+    file.get();
+
+    size_t rowBytes{ static_cast<size_t>(width) * 3 };
+    pixels.resize(rowBytes * height);
+    for (int y{ height - 1 }; y >= 0; --y)
+        file.read(reinterpret_cast<char*>(pixels.data() + y * rowBytes), rowBytes);
+    return static_cast<bool>(file);
+}
+
+#endif
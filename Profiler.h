@@ -0,0 +1,338 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+// Frames of timer queries in flight, results are read this many frames later so the CPU never waits on them
+constexpr unsigned PROFILER_FRAME_LATENCY{ 4 };
+
+// Scopes per frame, the rest are timed on the CPU only
+constexpr unsigned PROFILER_MAX_GPU_SCOPES{ 32 };
+
+// Samples per pass kept for the rolling summary
+constexpr size_t PROFILER_HISTORY{ 240 };
+
+// The trace stops growing after this many events
+constexpr size_t PROFILER_MAX_TRACE_EVENTS{ 1 << 20 };
+
+// Rolling window of one pass's timings
+class ProfileHistory
+{
+private:
+    std::vector<double> m_values;
+    size_t m_next{};
+
+public:
+    void Add(double value)
+    {
+        if (m_values.size() < PROFILER_HISTORY)
+            m_values.push_back(value);
+        else
+            m_values[m_next] = value;
+        m_next = (m_next + 1) % PROFILER_HISTORY;
+    }
+
+    bool IsEmpty() const { return m_values.empty(); }
+
+    // min, average and 99th percentile of the window
+    void Summarize(double& minimum, double& average, double& p99) const
+    {
+        std::vector<double> sorted{ m_values };
+        std::sort(sorted.begin(), sorted.end());
+        double sum{ 0.0 };
+        for (double value : sorted)
+            sum += value;
+
+        minimum = sorted.front();
+        average = sum / sorted.size();
+        p99 = sorted[std::min(sorted.size() - 1, sorted.size() * 99 / 100)];
+    }
+};
+
+struct ProfilePass
+{
+    std::string name;
+    int depth{};
+    ProfileHistory cpu;
+    ProfileHistory gpu;
+};
+
+// Chrome trace "complete" event, timestamps in microseconds since the profiler started
+struct TraceEvent
+{
+    const char* name{};
+    bool gpu{};
+    double start{};
+    double duration{};
+};
+
+// CPU scoped timers paired with GL_TIMESTAMP queries around each pass.
+// Queries go into a ring of PROFILER_FRAME_LATENCY frames and are only read once available, a frame whose results are still not
+// there when its slot comes round again is dropped instead of stalling. Disabled profilers cost one branch per scope
+class Profiler
+{
+private:
+    struct Scope
+    {
+        const char* name{};
+        int depth{};
+        int query{ -1 };    // first of the two timestamp queries, -1 when CPU only
+        double cpuStart{};
+        double cpuEnd{};
+    };
+
+    struct FrameSlot
+    {
+        std::vector<Scope> scopes;
+        int queriesUsed{};
+        bool pending{};
+    };
+
+    bool m_enabled{};
+    bool m_recordTrace{};
+    FrameSlot m_slots[PROFILER_FRAME_LATENCY];
+    GLuint m_queries[PROFILER_FRAME_LATENCY][PROFILER_MAX_GPU_SCOPES * 2]{};
+    std::vector<size_t> m_open;
+    unsigned m_frame{};
+    unsigned m_droppedFrames{};
+
+    std::chrono::steady_clock::time_point m_start;
+    double m_gpuOffset{};   // microseconds to add to a GL timestamp to land on the CPU timeline
+
+    std::vector<ProfilePass> m_passes;
+    std::vector<TraceEvent> m_trace;
+
+    double nowMicroseconds() const
+    {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - m_start).count();
+    }
+
+    // GL timestamps and steady_clock tick at the same rate but from different origins
+    void calibrate()
+    {
+        GLint64 gpuNow{};
+        glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+        m_gpuOffset = nowMicroseconds() - gpuNow / 1000.0;
+    }
+
+    ProfilePass& pass(const char* name, int depth)
+    {
+        for (ProfilePass& entry : m_passes)
+            if (entry.name == name)
+                return entry;
+        m_passes.push_back({ name, depth, {}, {} });
+        return m_passes.back();
+    }
+
+    void trace(const char* name, bool gpu, double start, double end)
+    {
+        if (m_recordTrace && m_trace.size() < PROFILER_MAX_TRACE_EVENTS)
+            m_trace.push_back({ name, gpu, start, end - start });
+    }
+
+    // Reads back an older frame's queries if the GPU is done with all of them
+    void collect(FrameSlot& slot, GLuint* queries)
+    {
+        if (!slot.pending)
+            return;
+        slot.pending = false;
+        if (slot.queriesUsed == 0)
+            return;
+
+        // Nested scopes end out of order, so every query is checked rather than the last one allocated
+        for (int i{ 0 }; i < slot.queriesUsed; ++i)
+        {
+            GLint available{};
+            glGetQueryObjectiv(queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+            {
+                ++m_droppedFrames;
+                return;
+            }
+        }
+
+        for (const Scope& scope : slot.scopes)
+        {
+            if (scope.query < 0)
+                continue;
+
+            GLuint64 begin{}, end{};
+            glGetQueryObjectui64v(queries[scope.query], GL_QUERY_RESULT, &begin);
+            glGetQueryObjectui64v(queries[scope.query + 1], GL_QUERY_RESULT, &end);
+            pass(scope.name, scope.depth).gpu.Add((end - begin) / 1.0e6);
+            trace(scope.name, true, begin / 1000.0 + m_gpuOffset, end / 1000.0 + m_gpuOffset);
+        }
+    }
+
+public:
+    // Needs a current context when enabled
+    Profiler(bool enabled, bool recordTrace)
+        : m_enabled{ enabled }, m_recordTrace{ enabled && recordTrace }, m_start{ std::chrono::steady_clock::now() }
+    {
+        if (!m_enabled)
+            return;
+
+        for (GLuint* queries : m_queries)
+            glGenQueries(PROFILER_MAX_GPU_SCOPES * 2, queries);
+        calibrate();
+    }
+
+    ~Profiler()
+    {
+        if (m_enabled)
+            for (GLuint* queries : m_queries)
+                glDeleteQueries(PROFILER_MAX_GPU_SCOPES * 2, queries);
+    }
+
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+
+    void BeginFrame()
+    {
+        if (!m_enabled)
+            return;
+
+        unsigned slot{ m_frame % PROFILER_FRAME_LATENCY };
+        collect(m_slots[slot], m_queries[slot]);
+        m_slots[slot].scopes.clear();
+        m_slots[slot].queriesUsed = 0;
+        m_open.clear();
+
+        // Clocks drift apart slowly, re-align them every few seconds
+        if (m_frame % 256 == 0)
+            calibrate();
+    }
+
+    void EndFrame()
+    {
+        if (!m_enabled)
+            return;
+
+        m_slots[m_frame % PROFILER_FRAME_LATENCY].pending = true;
+        ++m_frame;
+    }
+
+    // Scopes nest; gpu adds a pair of timestamp queries around the commands issued inside
+    void BeginScope(const char* name, bool gpu = true)
+    {
+        if (!m_enabled)
+            return;
+
+        unsigned index{ m_frame % PROFILER_FRAME_LATENCY };
+        FrameSlot& slot{ m_slots[index] };
+        Scope scope{};
+        scope.name = name;
+        scope.depth = static_cast<int>(m_open.size());
+        if (gpu && slot.queriesUsed + 2 <= static_cast<int>(PROFILER_MAX_GPU_SCOPES * 2))
+        {
+            scope.query = slot.queriesUsed;
+            slot.queriesUsed += 2;
+            glQueryCounter(m_queries[index][scope.query], GL_TIMESTAMP);
+        }
+        scope.cpuStart = nowMicroseconds();
+        pass(name, scope.depth);    // registered in call order so the summary reads like the frame
+
+        m_open.push_back(slot.scopes.size());
+        slot.scopes.push_back(scope);
+    }
+
+    void EndScope()
+    {
+        if (!m_enabled || m_open.empty())
+            return;
+
+        unsigned index{ m_frame % PROFILER_FRAME_LATENCY };
+        Scope& scope{ m_slots[index].scopes[m_open.back()] };
+        m_open.pop_back();
+
+        scope.cpuEnd = nowMicroseconds();
+        if (scope.query >= 0)
+            glQueryCounter(m_queries[index][scope.query + 1], GL_TIMESTAMP);
+
+        pass(scope.name, scope.depth).cpu.Add((scope.cpuEnd - scope.cpuStart) / 1000.0);
+        trace(scope.name, false, scope.cpuStart, scope.cpuEnd);
+    }
+
+    // min/avg/p99 of every pass over the last PROFILER_HISTORY frames
+    void PrintSummary() const
+    {
+        if (!m_enabled || m_passes.empty())
+            return;
+
+        std::cout << "  " << std::left << std::setw(18) << "pass" << std::setw(30) << "cpu ms min/avg/p99" << "gpu ms min/avg/p99" << std::right << std::endl;
+        for (const ProfilePass& entry : m_passes)
+        {
+            std::string columns[2];
+            const ProfileHistory* histories[2]{ &entry.cpu, &entry.gpu };
+            for (int i{ 0 }; i < 2; ++i)
+            {
+                if (histories[i]->IsEmpty())
+                    continue;
+
+                double minimum{}, average{}, p99{};
+                histories[i]->Summarize(minimum, average, p99);
+                char text[64]{};
+                std::snprintf(text, sizeof(text), "%.3f / %.3f / %.3f", minimum, average, p99);
+                columns[i] = text;
+            }
+            std::cout << "  " << std::left << std::setw(18) << (std::string(entry.depth * 2, ' ') + entry.name) << std::setw(30) << columns[0] << columns[1]
+                << std::right << std::endl;
+        }
+        if (m_droppedFrames > 0)
+            std::cout << "  (" << m_droppedFrames << " frames of GPU timings dropped, the GPU was more than " << PROFILER_FRAME_LATENCY << " frames behind)" << std::endl;
+    }
+
+    // Chrome trace event format, loads in chrome://tracing and Perfetto. CPU scopes are thread 1, GPU passes thread 2
+    bool WriteTrace(const std::string& path) const
+    {
+        std::ofstream file(path);
+        if (!file)
+            return false;
+
+        file << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n";
+        file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}";
+        for (const TraceEvent& event : m_trace)
+        {
+            file << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"" << (event.gpu ? "gpu" : "cpu") << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << (event.gpu ? 2 : 1)
+                << ",\"ts\":" << event.start << ",\"dur\":" << event.duration << "}";
+        }
+        file << "\n]}\n";
+        return static_cast<bool>(file);
+    }
+
+    bool IsEnabled() const { return m_enabled; }
+    size_t GetTraceEventCount() const { return m_trace.size(); }
+};
+
+// Times the enclosing block
+class ProfileScope
+{
+private:
+    Profiler& m_profiler;
+
+public:
+    ProfileScope(Profiler& profiler, const char* name, bool gpu = true)
+        : m_profiler{ profiler }
+    {
+        m_profiler.BeginScope(name, gpu);
+    }
+
+    ~ProfileScope() { m_profiler.EndScope(); }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+};
+
+#endif
@@ -0,0 +1,292 @@
+#ifndef REFLECTION_PROBES_H
+#define REFLECTION_PROBES_H
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "GLState.h"
+#include "Mesh.h"
+#include "Shader.h"
+#include "StreamingBuffer.h"
+#include "TransformStore.h"
+#include "UniformBlocks.h"
+
+// Most probes refreshed in one frame, whatever the budget allows
+constexpr unsigned MAX_PROBE_UPDATES_PER_FRAME{ 8 };
+
+// Largest probe array, 6 layers each
+constexpr unsigned MAX_PROBES{ 256 };
+
+// Frames between issuing a probe pass's timestamps and reading them
+constexpr unsigned PROBE_QUERY_FRAMES{ 4 };
+
+// Stream bytes the probe updates of one frame may take, alignment included
+constexpr GLsizeiptr PROBE_STREAM_BYTES{ MAX_PROBE_UPDATES_PER_FRAME * (sizeof(CameraBlock) + sizeof(ProbeBlock) + 2 * 256) + sizeof(ClusterBlock) + 256 };
+
+// Counters since the probes were created, plus the state of the last frame
+struct ProbeStats
+{
+    unsigned probes{};
+    unsigned updatesLastFrame{};
+    unsigned updateLimit{};             // what the budget allowed last frame
+    unsigned long long updates{};
+    unsigned long long refreshes{};     // updates of a probe that had been rendered before, the ones latencies are taken from
+    unsigned long long latencySum{};    // frames between two updates of the same probe
+    unsigned maxLatency{};
+    unsigned oldest{};                  // frames since the stalest probe was rendered
+    unsigned neverUpdated{};
+    double gpuMsPerProbe{};             // smoothed, drives the budget
+    double gpuMsLastFrame{};
+};
+
+inline void PrintProbeStats(const ProbeStats& stats)
+{
+    if (stats.probes == 0)
+        return;
+
+    std::cout << "  probes: " << stats.probes << " (" << stats.neverUpdated << " not rendered yet), " << stats.updatesLastFrame << " updated last frame (limit "
+        << stats.updateLimit << "), latency " << (stats.refreshes ? static_cast<double>(stats.latencySum) / stats.refreshes : 0.0) << " frames average / "
+        << stats.maxLatency << " max, oldest " << stats.oldest << " frames, GPU " << stats.gpuMsLastFrame << " ms last frame, " << stats.gpuMsPerProbe
+        << " ms per probe" << std::endl;
+}
+
+// Dynamic cubemap probes so spheres reflect each other.
+// Every probe is six layers of one cubemap array, filled by a single instanced draw whose geometry shader sends each triangle to the
+// six faces. Only a few probes are refreshed per frame: as many as fit in the GPU budget given the measured cost of one, picked by
+// how stale they are and how close to the camera. Probes only hold the other spheres, alpha marks where they cover the sky, so the
+// environment itself still comes from the full resolution skybox
+class ReflectionProbes
+{
+private:
+    Shader m_shader;
+    GLuint m_colorArray{};
+    GLuint m_depthArray{};
+    GLuint m_framebuffer{};
+    GLsizei m_size{};
+    GLuint m_count{};
+    size_t m_lod{};
+    double m_budgetMs{};
+
+    unsigned m_frame{};
+    std::vector<unsigned> m_lastUpdate;     // frame of the last update, only meaningful when m_rendered is set
+    std::vector<bool> m_rendered;
+    std::vector<GLuint> m_order;
+
+    GLuint m_queries[PROBE_QUERY_FRAMES][2]{};
+    unsigned m_queryProbes[PROBE_QUERY_FRAMES]{};
+    ProbeStats m_stats{};
+
+    // Reads the timestamps of an older frame if they are there, never waits
+    void collectTiming(unsigned slot)
+    {
+        if (m_queryProbes[slot] == 0)
+            return;
+
+        GLint available{};
+        glGetQueryObjectiv(m_queries[slot][1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return;
+
+        GLuint64 begin{}, end{};
+        glGetQueryObjectui64v(m_queries[slot][0], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(m_queries[slot][1], GL_QUERY_RESULT, &end);
+        double ms{ (end - begin) / 1.0e6 };
+        double perProbe{ ms / m_queryProbes[slot] };
+        m_stats.gpuMsLastFrame = ms;
+        m_stats.gpuMsPerProbe = m_stats.gpuMsPerProbe > 0.0 ? 0.8 * m_stats.gpuMsPerProbe + 0.2 * perProbe : perProbe;
+        m_queryProbes[slot] = 0;
+    }
+
+    static void faceViewProjections(const glm::vec3& center, glm::mat4 faces[6])
+    {
+        // GL cube face orientations, +X -X +Y -Y +Z -Z
+        const glm::vec3 directions[6]{ { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+        const glm::vec3 ups[6]{ { 0, -1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }, { 0, -1, 0 }, { 0, -1, 0 } };
+        glm::mat4 projection{ glm::perspective(glm::radians(90.0f), 1.0f, 0.05f, 100.0f) };
+        for (int i{ 0 }; i < 6; ++i)
+            faces[i] = projection * glm::lookAt(center, center + directions[i], ups[i]);
+    }
+
+public:
+    // Needs a current context; probe i belongs to instance i
+    ReflectionProbes(const Mesh& mesh, GLuint count, GLsizei size, double budgetMs)
+        : m_shader("probe.vs", "probe.geom", "lighting.frag"), m_size{ size }, m_count{ std::min(count, MAX_PROBES) }, m_budgetMs{ budgetMs }
+    {
+        // A coarse LOD is plenty at probe resolution
+        m_lod = std::min<size_t>(2, mesh.GetLodCount() - 1);
+        m_lastUpdate.assign(m_count, 0);
+        m_rendered.assign(m_count, false);
+        m_order.resize(m_count);
+        m_stats.probes = m_count;
+        m_stats.neverUpdated = m_count;
+
+        m_shader.BindUniformBlock("CameraBlock", CAMERA_BLOCK_BINDING);
+        m_shader.BindUniformBlock("LightBlock", LIGHT_BLOCK_BINDING);
+        m_shader.BindUniformBlock("MaterialBlock", MATERIAL_BLOCK_BINDING);
+        m_shader.BindUniformBlock("EnvironmentBlock", ENVIRONMENT_BLOCK_BINDING);
+        m_shader.BindUniformBlock("ProbeBlock", PROBE_BLOCK_BINDING);
+        m_shader.BindUniformBlock("ClusterBlock", CLUSTER_BLOCK_BINDING);
+
+        glGenTextures(1, &m_colorArray);
+        GetGLState().BindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, m_colorArray);
+        glTexStorage3D(GL_TEXTURE_CUBE_MAP_ARRAY, 1, GL_RGBA8, m_size, m_size, m_count * 6);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+        glGenTextures(1, &m_depthArray);
+        GetGLState().BindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, m_depthArray);
+        glTexStorage3D(GL_TEXTURE_CUBE_MAP_ARRAY, 1, GL_DEPTH_COMPONENT24, m_size, m_size, m_count * 6);
+        GetGLState().BindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, 0);
+
+        // Unrendered probes read as fully transparent, the spheres then show the plain environment
+        const GLubyte clear[4]{ 0, 0, 0, 0 };
+        glClearTexImage(m_colorArray, 0, GL_RGBA, GL_UNSIGNED_BYTE, clear);
+
+        // Layered attachments, gl_Layer picks the probe face
+        GLuint previous{ GetGLState().GetDrawFramebuffer() };
+        glGenFramebuffers(1, &m_framebuffer);
+        GetGLState().BindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, m_colorArray, 0);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_depthArray, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::REFLECTION_PROBES::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        GetGLState().BindFramebuffer(GL_FRAMEBUFFER, previous);
+
+        for (GLuint* queries : m_queries)
+            glGenQueries(2, queries);
+    }
+
+    ~ReflectionProbes()
+    {
+        for (GLuint* queries : m_queries)
+            glDeleteQueries(2, queries);
+        GetGLState().DeleteFramebuffers(1, &m_framebuffer);
+        GetGLState().DeleteTextures(1, &m_depthArray);
+        GetGLState().DeleteTextures(1, &m_colorArray);
+    }
+
+    ReflectionProbes(const ReflectionProbes&) = delete;
+    ReflectionProbes& operator=(const ReflectionProbes&) = delete;
+
+    bool FinishShader() { return m_shader.Finish(); }
+
+    // Refreshes the probes the budget allows this frame. The light, material and environment blocks, the instance buffer and the
+    // skybox textures must be bound; the camera, probe and cluster block bindings are left pointing at the probes' own
+    void Update(StreamingBuffer& stream, const Mesh& mesh, GLsizei instanceCount, const TransformStore& transforms, const glm::vec3& cameraPosition)
+    {
+        unsigned slot{ m_frame % PROBE_QUERY_FRAMES };
+        collectTiming(slot);
+
+        // As many as the last measured cost fits in the budget, one per frame until there is a measurement
+        unsigned limit{ 1 };
+        if (m_stats.gpuMsPerProbe > 0.0)
+            limit = static_cast<unsigned>(std::clamp(m_budgetMs / m_stats.gpuMsPerProbe, 1.0, static_cast<double>(MAX_PROBE_UPDATES_PER_FRAME)));
+        limit = std::min(limit, m_count);
+        m_stats.updateLimit = limit;
+
+        // Probes never rendered come first, nearest first, then the stalest relative to their distance
+        auto score = [&](GLuint probe)
+        {
+            float distance{ glm::length(transforms.GetPosition(probe) - cameraPosition) };
+            float age{ m_rendered[probe] ? static_cast<float>(m_frame - m_lastUpdate[probe]) : std::numeric_limits<float>::max() / 4.0f };
+            return age / (1.0f + distance);
+        };
+        std::iota(m_order.begin(), m_order.end(), 0u);
+        std::partial_sort(m_order.begin(), m_order.begin() + limit, m_order.end(), [&](GLuint a, GLuint b)
+        {
+            float scoreA{ score(a) }, scoreB{ score(b) };
+            return scoreA != scoreB ? scoreA > scoreB : a < b;
+        });
+
+        GLStateCache& state{ GetGLState() };
+        GLint viewport[4]{};
+        state.GetViewport(viewport);
+        GLuint previousFramebuffer{ state.GetDrawFramebuffer() };
+
+        glQueryCounter(m_queries[slot][0], GL_TIMESTAMP);
+        state.BindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+        state.Viewport(0, 0, m_size, m_size);
+        state.BindTextureUnit(PROBE_TEXTURE_UNIT, GL_TEXTURE_CUBE_MAP_ARRAY, 0);
+        state.DepthFunc(GL_LESS);
+        m_shader.Use();
+        state.BindVertexArray(mesh.GetVAO());
+
+        // The point lights are left out of the probes, a cluster block without lights switches them off
+        if (limit > 0 && !stream.WriteAndBind(ClusterBlock{}, CLUSTER_BLOCK_BINDING))
+            limit = 0;
+
+        const GLubyte clearColor[4]{ 0, 0, 0, 0 };
+        const GLfloat clearDepth{ 1.0f };
+        unsigned updated{ 0 };
+        for (unsigned i{ 0 }; i < limit; ++i)
+        {
+            GLuint probe{ m_order[i] };
+            glm::vec3 center{ transforms.GetPosition(probe) };
+
+            // lighting.frag takes its view vector from the camera block
+            CameraBlock cameraBlock{};
+            cameraBlock.position = center;
+            ProbeBlock probeBlock{};
+            faceViewProjections(center, probeBlock.faceViewProjection);
+            probeBlock.firstLayer = static_cast<GLint>(probe * 6);
+            probeBlock.skipInstance = static_cast<GLint>(probe);
+            if (!stream.WriteAndBind(cameraBlock, CAMERA_BLOCK_BINDING) || !stream.WriteAndBind(probeBlock, PROBE_BLOCK_BINDING))
+                break;
+
+            glClearTexSubImage(m_colorArray, 0, 0, 0, probe * 6, m_size, m_size, 6, GL_RGBA, GL_UNSIGNED_BYTE, clearColor);
+            glClearTexSubImage(m_depthArray, 0, 0, 0, probe * 6, m_size, m_size, 6, GL_DEPTH_COMPONENT, GL_FLOAT, &clearDepth);
+            mesh.DrawInstanced(m_lod, instanceCount);
+
+            if (m_rendered[probe])
+            {
+                unsigned latency{ m_frame - m_lastUpdate[probe] };
+                ++m_stats.refreshes;
+                m_stats.latencySum += latency;
+                m_stats.maxLatency = std::max(m_stats.maxLatency, latency);
+            }
+            else
+            {
+                m_rendered[probe] = true;
+                --m_stats.neverUpdated;
+            }
+            m_lastUpdate[probe] = m_frame;
+            ++updated;
+        }
+
+        state.BindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+        state.Viewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        glQueryCounter(m_queries[slot][1], GL_TIMESTAMP);
+        m_queryProbes[slot] = updated;
+
+        m_stats.updates += updated;
+        m_stats.updatesLastFrame = updated;
+        m_stats.oldest = 0;
+        for (GLuint probe{ 0 }; probe < m_count; ++probe)
+            if (m_rendered[probe])
+                m_stats.oldest = std::max(m_stats.oldest, m_frame - m_lastUpdate[probe]);
+        ++m_frame;
+    }
+
+    // For the sphere pass
+    void Bind() const
+    {
+        GetGLState().BindTextureUnit(PROBE_TEXTURE_UNIT, GL_TEXTURE_CUBE_MAP_ARRAY, m_colorArray);
+    }
+
+    GLuint GetCount() const { return m_count; }
+    const ProbeStats& GetStats() const { return m_stats; }
+};
+
+#endif
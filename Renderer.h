@@ -0,0 +1,849 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Camera.h"
+#include "Cubemap.h"
+#include "DynamicResolution.h"
+#include "EnvironmentCache.h"
+#include "EnvironmentLighting.h"
+#include "EnvironmentStreamer.h"
+#include "GLState.h"
+#include "GpuCulling.h"
+#include "LightClusters.h"
+#include "Mesh.h"
+#include "Options.h"
+#include "PostProcess.h"
+#include "Profiler.h"
+#include "ReflectionProbes.h"
+#include "ResourceManager.h"
+#include "Scene.h"
+#include "Shader.h"
+#include "ShaderPermutations.h"
+#include "SphereBvh.h"
+#include "StorageBuffer.h"
+#include "StreamingBuffer.h"
+#include "ThreadPool.h"
+#include "TransformStore.h"
+#include "UniformBuffer.h"
+#include "UniformBlocks.h"
+
+constexpr int STACKS{ 50 };
+constexpr int SLICES{ 50 };
+constexpr float radius{ 0.5 };
+
+// Depth range of the main camera, the light clusters are sliced over it
+constexpr float NEAR_PLANE{ 0.1f };
+constexpr float FAR_PLANE{ 1000.0f };
+
+// reflectionMode of lighting.frag, keep in sync with its REFLECTION_* defines
+enum ReflectionMode : GLint
+{
+    REFLECTION_FULL_RATE = 0,
+    REFLECTION_WRITE_HALF_RATE = 1,
+    REFLECTION_READ_HALF_RATE = 2
+};
+
+// Vertex stage of the sphere program in each SphereMode, lighting.frag is compiled with the matching defines
+inline const GLchar* SphereVertexShader(SphereMode mode)
+{
+    return mode == SPHERE_IMPOSTOR ? "impostor.vs" : mode == SPHERE_RAYTRACE ? "raytrace.vs" : "lighting.vs";
+}
+
+inline std::string SphereShaderDefines(SphereMode mode)
+{
+    if (mode == SPHERE_MESH)
+        return {};
+    return std::string(mode == SPHERE_IMPOSTOR ? "#define IMPOSTOR\n" : "#define RAYTRACE\n") + "#define SPHERE_RADIUS " + std::to_string(radius) + "\n";
+}
+
+constexpr const char* ENVIRONMENT_CACHE_PATH{ "Yokohama3/environment.envcache" };
+constexpr const char* ENVIRONMENT_LIGHTING_PATH{ "Yokohama3/environment.iblcache" };
+
+const GLfloat SKYBOX_VERTICES[] = {
+    // Positions
+    -1.0f,  1.0f, -1.0f,
+    -1.0f, -1.0f, -1.0f,
+    1.0f, -1.0f, -1.0f,
+    1.0f, -1.0f, -1.0f,
+    1.0f,  1.0f, -1.0f,
+    -1.0f,  1.0f, -1.0f,
+
+    -1.0f, -1.0f,  1.0f,
+    -1.0f, -1.0f, -1.0f,
+    -1.0f,  1.0f, -1.0f,
+    -1.0f,  1.0f, -1.0f,
+    -1.0f,  1.0f,  1.0f,
+    -1.0f, -1.0f,  1.0f,
+
+    1.0f, -1.0f, -1.0f,
+    1.0f, -1.0f,  1.0f,
+    1.0f,  1.0f,  1.0f,
+    1.0f,  1.0f,  1.0f,
+    1.0f,  1.0f, -1.0f,
+    1.0f, -1.0f, -1.0f,
+
+    -1.0f, -1.0f,  1.0f,
+    -1.0f,  1.0f,  1.0f,
+    1.0f,  1.0f,  1.0f,
+    1.0f,  1.0f,  1.0f,
+    1.0f, -1.0f,  1.0f,
+    -1.0f, -1.0f,  1.0f,
+
+    -1.0f,  1.0f, -1.0f,
+    1.0f,  1.0f, -1.0f,
+    1.0f,  1.0f,  1.0f,
+    1.0f,  1.0f,  1.0f,
+    -1.0f,  1.0f,  1.0f,
+    -1.0f,  1.0f, -1.0f,
+
+    -1.0f, -1.0f, -1.0f,
+    -1.0f, -1.0f,  1.0f,
+    1.0f, -1.0f, -1.0f,
+    1.0f, -1.0f, -1.0f,
+    -1.0f, -1.0f,  1.0f,
+    1.0f, -1.0f,  1.0f
+};
+
+// Lays out the sphere field. The first two spheres are the original scene, the rest fill a cube behind them deterministically from the seed
+inline std::vector<SceneObject> BuildSphereField(unsigned count, unsigned seed, GLuint materialCount)
+{
+    const glm::vec3 spherePositions[] = {
+    glm::vec3(0.0f, 0.0f, 0.0f),
+    glm::vec3(-1.5f, -2.2f, -2.5f),
+    };
+
+    std::vector<SceneObject> objects;
+    objects.reserve(count);
+    std::mt19937 generator{ seed };
+    float extent{ 2.0f * std::cbrt(static_cast<float>(count)) };
+    std::uniform_real_distribution<float> lateral{ -extent, extent };
+    std::uniform_real_distribution<float> depth{ -2.0f * extent - 4.0f, -4.0f };
+    std::uniform_int_distribution<GLuint> material{ 1, materialCount - 1 };
+
+    for (unsigned i{ 0 }; i < count; ++i)
+    {
+        glm::vec3 position{ i < 2 ? spherePositions[i] : glm::vec3(lateral(generator), lateral(generator), depth(generator)) };
+        GLuint materialIndex{ i < 2 || materialCount < 2 ? 0 : material(generator) };
+        objects.push_back({ position, materialIndex, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f), glm::vec3(1.0f), 0 });
+    }
+    return objects;
+}
+
+// The sphere field in a transform store, copies is the number of instance buffers the store's updates rotate through
+inline TransformStore BuildSphereTransforms(unsigned count, unsigned seed, GLuint materialCount, unsigned copies = 1)
+{
+    std::vector<SceneObject> objects{ BuildSphereField(count, seed, materialCount) };
+    TransformStore transforms{ copies };
+    transforms.Reserve(objects.size());
+    AddSceneObjects(transforms, objects.data(), objects.size());
+    return transforms;
+}
+
+// --animate: every sphere bobs on its own phase around its place in the field
+inline void AnimateSphereTransforms(TransformStore& transforms, const std::vector<glm::vec3>& basePositions, float time)
+{
+    for (size_t i{ 0 }; i < basePositions.size(); ++i)
+        transforms.SetPosition(i, basePositions[i] + glm::vec3(0.0f, 0.25f * std::sin(1.5f * time + 0.37f * i), 0.0f));
+}
+
+// --lights N: point lights scattered through the volume of the sphere field (see BuildSphereTransforms), deterministic from the seed
+inline std::vector<PointLight> BuildPointLights(unsigned count, unsigned seed, unsigned sphereCount)
+{
+    std::vector<PointLight> lights(count);
+    std::mt19937 generator{ seed ^ 0x9e3779b9u };
+    float extent{ 2.0f * std::cbrt(static_cast<float>(std::max(sphereCount, 2u))) };
+    std::uniform_real_distribution<float> lateral{ -extent, extent };
+    std::uniform_real_distribution<float> depth{ -2.0f * extent - 4.0f, 2.0f };
+    std::uniform_real_distribution<float> range{ 1.0f, 2.5f };
+    std::uniform_real_distribution<float> hue{ 0.0f, 1.0f };
+
+    for (PointLight& light : lights)
+    {
+        light.position = glm::vec3(lateral(generator), lateral(generator), depth(generator));
+        light.radius = range(generator);
+        float h{ hue(generator) };
+        light.color = glm::vec3(0.5f + 0.5f * std::cos(6.2831f * h), 0.5f + 0.5f * std::cos(6.2831f * (h + 0.33f)), 0.5f + 0.5f * std::cos(6.2831f * (h + 0.67f)));
+    }
+    return lights;
+}
+
+// Lighting features the generated palette cycles through with --material-features, the original material keeps the full set
+const GLuint PALETTE_FEATURES[]{ LIGHTING_DEFAULT_FEATURES, LIGHTING_PHONG, LIGHTING_DEFAULT_FEATURES | LIGHTING_FRESNEL, LIGHTING_REFLECT,
+    LIGHTING_REFRACT, LIGHTING_PHONG | LIGHTING_REFLECT };
+
+// The original copper-like material first, then a fixed palette for the generated spheres. A scene's own materials replace the
+// first entries
+inline MaterialBlock BuildMaterials(const SceneFile* scene = nullptr, bool materialFeatures = false)
+{
+    MaterialBlock block{};
+    for (GLuint i{ 0 }; i < MAX_MATERIALS; ++i)
+    {
+        float hue{ i * 0.61803f };
+        glm::vec3 tint{ 0.5f + 0.5f * std::cos(6.2831f * hue), 0.5f + 0.5f * std::cos(6.2831f * (hue + 0.33f)), 0.5f + 0.5f * std::cos(6.2831f * (hue + 0.67f)) };
+        block.materials[i].ambient = tint;
+        block.materials[i].diffuse = tint;
+        block.materials[i].specular = glm::vec3(0.5f, 0.5f, 0.5f);
+        block.materials[i].shininess = 8.0f + 8.0f * (i % 8);
+        if (materialFeatures && i > 0)
+            block.materials[i].features = PALETTE_FEATURES[i % (sizeof(PALETTE_FEATURES) / sizeof(PALETTE_FEATURES[0]))];
+    }
+
+    block.materials[0].ambient = glm::vec3(1.0f, 0.5f, 0.31f);
+    block.materials[0].diffuse = glm::vec3(1.0f, 0.5f, 0.31f);
+    block.materials[0].specular = glm::vec3(0.5f, 0.5f, 0.5f); // Specular doesn't have full effect on this object's material
+    block.materials[0].shininess = 32.0f;
+
+    if (scene)
+        std::copy(scene->GetMaterials(), scene->GetMaterials() + scene->GetMaterialCount(), block.materials);
+    return block;
+}
+
+// Groups the materials by the lighting program they need, one bin per distinct feature set. Sets past MAX_CULL_BINS - 1 share the
+// last bin, drawn with the dynamic program; without variants everything is one dynamic bin. Returns the bin count
+inline GLuint AssignMaterialBins(const MaterialBlock& block, bool variants, GLuint materialBins[MAX_MATERIALS], GLuint binFeatures[MAX_CULL_BINS])
+{
+    std::fill(materialBins, materialBins + MAX_MATERIALS, 0u);
+    binFeatures[0] = LIGHTING_DYNAMIC_FEATURES;
+    if (!variants)
+        return 1;
+
+    GLuint binCount{ 0 };
+    for (GLuint i{ 0 }; i < MAX_MATERIALS; ++i)
+    {
+        GLuint features{ ResolveMaterialFeatures(block.materials[i].features) };
+        GLuint bin{ static_cast<GLuint>(std::find(binFeatures, binFeatures + binCount, features) - binFeatures) };
+        if (bin == binCount && binCount < MAX_CULL_BINS)
+            binFeatures[binCount++] = features;
+        else if (bin == binCount)
+        {
+            bin = MAX_CULL_BINS - 1;
+            binFeatures[bin] = LIGHTING_DYNAMIC_FEATURES;
+        }
+        materialBins[i] = bin;
+    }
+    return binCount;
+}
+
+// The light's colour cycles with time
+inline LightBlock BuildLightBlock(float time, const glm::vec3& position = LIGHT_POSITION)
+{
+    glm::vec3 lightColor{};
+    lightColor.r = sin(time * 2.0f);
+    lightColor.g = sin(time * 0.7f);
+    lightColor.b = sin(time * 1.3f);
+
+    // Set light properties
+    LightBlock lightBlock{};
+    lightBlock.position = position;
+    lightBlock.diffuse = lightColor * glm::vec3(0.7f); // Decrease the influence
+    lightBlock.ambient = lightBlock.diffuse * glm::vec3(0.2f); // Low influence
+    lightBlock.specular = 0.75f;
+    return lightBlock;
+}
+
+// --export-scene: the scene the options would generate in its readable form, so it can be edited and compiled with --convert-scene
+inline SceneDescription BuildSceneDescription(const Options& options, const std::vector<const GLchar*>& faces)
+{
+    SceneDescription scene;
+    scene.objects = BuildSphereField(options.sphereCount, options.seed, MAX_MATERIALS);
+    MaterialBlock materials{ BuildMaterials(nullptr, options.materialFeatures) };
+    scene.materials.assign(std::begin(materials.materials), std::end(materials.materials));
+    scene.pointLights = BuildPointLights(options.pointLightCount, options.seed, options.sphereCount);
+    scene.environmentFaces.assign(faces.begin(), faces.end());
+    return scene;
+}
+
+// Owns the scene's GL resources and records the sphere and skybox passes, shared by the window and the headless benchmark
+class Renderer
+{
+private:
+    ThreadPool& m_threadPool;
+    Profiler m_profiler;
+
+    // Meshes, environment cubemaps and the skybox program, freed after everything that uses them. The pointers below are the
+    // manager's and stay valid as long as it holds the resource
+    ResourceManager m_resources;
+    ShaderPermutations m_lightingPrograms;
+    Shader* m_skyboxShader{};
+
+    // Camera, light and cull blocks are rewritten every frame through a fenced ring, the material table never changes
+    StreamingBuffer m_frameStream;
+    UniformBuffer<MaterialBlock> m_materialBuffer;
+    UniformBuffer<EnvironmentBlock> m_environmentBuffer;
+
+    // Sphere transforms in SoA form. Static instances are written once into m_instanceBuffer; with --animate the moved ones are
+    // written every frame straight into the mapped instance ring (through m_stagingInstances without buffer storage)
+    TransformStore m_transforms;
+    std::vector<glm::vec3> m_basePositions;
+    StorageBuffer<SphereInstance> m_instanceBuffer;
+    std::unique_ptr<StreamingBuffer> m_instanceStream;
+    std::vector<SphereInstance> m_stagingInstances;
+    Mesh* m_sphereMesh{};
+    std::unique_ptr<GpuCuller> m_sphereCuller;
+
+    // The culler sorts the visible spheres into one bin per lighting feature set, each bin is drawn with the program specialized
+    // for it (built the first time it is needed), so no pixel branches on the material's features
+    GLuint m_binCount{ 1 };
+    GLuint m_binFeatures[MAX_CULL_BINS]{};
+
+    // --sphere-mode: impostors are culled and drawn as quads instead of the mesh (which the probes keep using); ray tracing skips
+    // culling and draws one full screen triangle that walks m_bvh
+    SphereMode m_sphereMode{ SPHERE_MESH };
+    Mesh* m_quadMesh{};
+    std::unique_ptr<SphereBvh> m_bvh;
+    std::unique_ptr<ReflectionProbes> m_probes;
+    LightClusters m_lightClusters;
+    GLsizei m_sphereCount{};
+    GLuint m_probeCount{};
+    glm::vec3 m_lightPosition{ LIGHT_POSITION };
+
+    // --scene: the objects come from the mapped file a chunk per frame, the spheres already in are drawn meanwhile. The buffers
+    // above are sized for the whole scene from the start
+    const SceneFile* m_scene{};
+    size_t m_sceneChunkObjects{};
+    std::future<void> m_scenePrefetch;
+    SceneLoadStats m_sceneStats{};
+
+    GLuint m_skyboxVAO{};
+    GLuint m_skyboxVBO{};
+    GLuint m_cubemapTexture{};          // the streamer's own texture while it streams the environment in, the manager's otherwise
+    GLuint m_prefilteredTexture{};
+    std::unique_ptr<EnvironmentStreamer> m_environmentStreamer;
+
+    // --frame-budget and --resolution-scale render into m_sceneTarget at the controller's scale and upscale it to the bound framebuffer;
+    // --half-rate-reflections shades the reflection into m_reflectionTarget first. With --hdr the scene target is half float and
+    // m_postProcess takes the place of the upscale
+    std::unique_ptr<ResolutionController> m_resolution;
+    std::unique_ptr<RenderTarget> m_sceneTarget;
+    std::unique_ptr<RenderTarget> m_reflectionTarget;
+    std::unique_ptr<PostProcessChain> m_postProcess;
+
+    glm::mat4 m_projection{};
+    double m_submitMs{};
+
+    // Variant key of a bin's program, point lights are a frame-wide feature
+    GLuint binProgram(GLuint bin) const
+    {
+        if (m_binFeatures[bin] == LIGHTING_DYNAMIC_FEATURES)
+            return LIGHTING_DYNAMIC_FEATURES;
+        return m_binFeatures[bin] | (m_lightClusters.GetLightCount() > 0 ? LIGHTING_POINT_LIGHTS : 0u);
+    }
+
+    // Makes a bin's program current with its reflection mode
+    void useLightingProgram(GLuint bin, ReflectionMode mode, GLsizei reflectionWidth = 0, GLsizei reflectionHeight = 0)
+    {
+        Shader& shader{ m_lightingPrograms.Get(binProgram(bin)) };
+        shader.Use();
+        GLStateCache& state{ GetGLState() };
+        state.Uniform1i(shader.GetUniformLocation("reflectionMode"), mode);
+        if (mode == REFLECTION_WRITE_HALF_RATE)
+            state.Uniform2i(shader.GetUniformLocation("reflectionSize"), reflectionWidth, reflectionHeight);
+    }
+
+    // Draws the spheres of one bin with the lighting program, which the caller has set up
+    void drawSpheres(GLuint bin)
+    {
+        GLStateCache& state{ GetGLState() };
+        if (m_probes)
+            m_probes->Bind();
+        if (m_bvh)
+        {
+            m_bvh->Bind();
+            state.BindVertexArray(m_skyboxVAO);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            return;
+        }
+
+        state.BindVertexArray(m_quadMesh ? m_quadMesh->GetVAO() : m_sphereMesh->GetVAO());
+        m_sphereCuller->Draw(bin);
+    }
+
+    // Draws the visible spheres again at half the rendered size, writing only their reflection and view depth, and binds the result
+    // for the sphere pass to upsample. The culling results of the frame are reused as they are
+    void renderHalfRateReflections(GLsizei width, GLsizei height)
+    {
+        GLsizei halfWidth{ (width + 1) / 2 }, halfHeight{ (height + 1) / 2 };
+        m_reflectionTarget->Reserve(halfWidth, halfHeight);
+
+        GLStateCache& state{ GetGLState() };
+        GLint viewport[4]{};
+        state.GetViewport(viewport);
+        GLuint previousFramebuffer{ state.GetDrawFramebuffer() };
+        state.BindFramebuffer(GL_FRAMEBUFFER, m_reflectionTarget->GetFramebuffer());
+        state.Viewport(0, 0, halfWidth, halfHeight);
+
+        // Zero alpha is a view depth no fragment matches, uncovered texels never take part in the upsample. Blending is off for
+        // the whole frame, it would scale the colour by the depth in alpha
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        state.BindTextureUnit(REFLECTION_TEXTURE_UNIT, GL_TEXTURE_2D, 0);
+
+        for (GLuint bin{ 0 }; bin < m_binCount; ++bin)
+        {
+            if (m_sphereCuller->GetBinSize(bin) == 0 && !m_bvh)
+                continue;
+            useLightingProgram(bin, REFLECTION_WRITE_HALF_RATE, halfWidth, halfHeight);
+            drawSpheres(bin);
+        }
+
+        state.BindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+        state.Viewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        state.BindTextureUnit(REFLECTION_TEXTURE_UNIT, GL_TEXTURE_2D, m_reflectionTarget->GetColorTexture());
+    }
+
+    // Takes the objects added to the store since first into the instance buffers and the draw
+    void addObjects(size_t first)
+    {
+        for (size_t i{ first }; i < m_transforms.Size(); ++i)
+        {
+            m_basePositions.push_back(m_transforms.GetPosition(i));
+            if (i < m_probeCount)
+                m_transforms.SetProbe(i, static_cast<GLint>(i));
+        }
+
+        if (!m_instanceStream || !m_instanceStream->IsPersistent())
+            m_transforms.Update(&m_threadPool, m_stagingInstances.data());
+        if (!m_instanceStream && first == 0)
+            m_instanceBuffer.Upload(m_stagingInstances);
+        else if (!m_instanceStream)
+            m_instanceBuffer.UploadRange(m_stagingInstances, first, m_transforms.Size() - first);
+
+        m_sphereCount = static_cast<GLsizei>(m_transforms.Size());
+        m_sphereCuller->SetInstances(m_transforms);
+        if (m_bvh)
+            m_bvh->Build(m_transforms, radius);
+    }
+
+    // Adds the next chunk of the scene file. Its pages were faulted in on the pool during the previous frame, and the one after it
+    // is queued the same way
+    void streamScene(size_t chunkObjects)
+    {
+        if (!m_scene || m_transforms.Size() >= m_scene->GetObjectCount())
+            return;
+
+        auto start = std::chrono::steady_clock::now();
+        if (m_scenePrefetch.valid())
+            m_scenePrefetch.get();
+
+        size_t first{ m_transforms.Size() };
+        m_scene->AddObjects(m_transforms, first, chunkObjects);
+        addObjects(first);
+
+        auto end = std::chrono::steady_clock::now();
+        double chunkMs{ ElapsedMilliseconds(start, end) };
+        if (m_sceneStats.chunks++ == 0)
+            m_sceneStats.firstChunkMs = chunkMs;
+        m_sceneStats.loadMs += chunkMs;
+        m_sceneStats.loaded = m_transforms.Size();
+
+        if (m_transforms.Size() < m_scene->GetObjectCount())
+        {
+            const SceneFile* scene{ m_scene };
+            size_t next{ m_transforms.Size() }, count{ m_sceneChunkObjects };
+            m_scenePrefetch = m_threadPool.Submit([scene, next, count]() { scene->PrefetchObjects(next, count); });
+        }
+        else
+        {
+            m_sceneStats.completeMs = ElapsedMilliseconds(m_scene->GetOpenTime(), end);
+            PrintSceneLoadStats(m_sceneStats);
+        }
+    }
+
+public:
+    // Needs a current context; decodes the skybox on the pool while the buffers are set up. The scene file, when given, has to
+    // stay open as long as the renderer
+    Renderer(const Options& options, ThreadPool& threadPool, const std::vector<const GLchar*>& faces, float aspect, const SceneFile* scene = nullptr)
+        : m_threadPool{ threadPool }, m_profiler(options.profile, !options.traceFile.empty()),
+        m_resources(static_cast<size_t>(options.cpuBudgetMiB) * 1024 * 1024, static_cast<size_t>(options.gpuBudgetMiB) * 1024 * 1024),
+        m_lightingPrograms(SphereVertexShader(options.sphereMode), "lighting.frag", SphereShaderDefines(options.sphereMode)),
+        m_frameStream(GL_UNIFORM_BUFFER, 3 * 256 + sizeof(CameraBlock) + sizeof(LightBlock) + sizeof(CullBlock) + sizeof(ClusterBlock) + 256 + (options.hdr ? sizeof(PostBlock) + 256 : 0) + (options.probeCount ? PROBE_STREAM_BYTES : 0)),
+        m_materialBuffer(MATERIAL_BLOCK_BINDING), m_environmentBuffer(ENVIRONMENT_BLOCK_BINDING), m_instanceBuffer(INSTANCE_BUFFER_BINDING)
+    {
+        m_skyboxShader = m_resources.Get(m_resources.LoadProgram("skybox.vs", "skybox.frag"));
+
+        // Setup OpenGL options
+        GetGLState().Enable(GL_DEPTH_TEST);
+
+        // Alpha blending for transparent passes; everything drawn so far is opaque, so RenderFrame keeps it switched off
+        GetGLState().BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+        // Start decoding the skybox right away when it does not come from the cache, the faces are uploaded once the rest of the setup is done
+        std::unique_ptr<AsyncCubemapLoader> cubemapLoader;
+        if (!options.environmentCache && !options.serialCubemapLoad)
+            cubemapLoader.reset(new AsyncCubemapLoader(threadPool, faces));
+
+        // Uniform blocks shared by both programs, each one is a range of the frame's streaming segment
+        m_lightingPrograms.BindUniformBlock("CameraBlock", CAMERA_BLOCK_BINDING);
+        m_lightingPrograms.BindUniformBlock("LightBlock", LIGHT_BLOCK_BINDING);
+        m_lightingPrograms.BindUniformBlock("MaterialBlock", MATERIAL_BLOCK_BINDING);
+        m_lightingPrograms.BindUniformBlock("EnvironmentBlock", ENVIRONMENT_BLOCK_BINDING);
+        m_lightingPrograms.BindUniformBlock("ClusterBlock", CLUSTER_BLOCK_BINDING);
+        m_skyboxShader->BindUniformBlock("CameraBlock", CAMERA_BLOCK_BINDING);
+
+        // Set material properties, they never change so the table is written once
+        MaterialBlock materials{ BuildMaterials(scene, options.materialFeatures) };
+        m_materialBuffer.Update(materials);
+        if (scene)
+            m_lightPosition = scene->GetLightPosition();
+
+        // Sphere and its LOD chain, built in a staging arena that is gone once the buffers are uploaded
+        m_sphereMesh = m_resources.Get(m_resources.LoadMesh([](std::pmr::memory_resource* memory)
+        {
+            MeshData sphereData{ BuildSphereMesh(STACKS, SLICES, radius, 4, true, memory) };
+            PrintMeshStats("Sphere mesh", sphereData);
+            return sphereData;
+        }));
+        m_sphereMode = options.sphereMode;
+        if (m_sphereMode == SPHERE_IMPOSTOR)
+            m_quadMesh = m_resources.Get(m_resources.LoadMesh([](std::pmr::memory_resource* memory) { return BuildQuadMesh(memory); }));
+        else if (m_sphereMode == SPHERE_RAYTRACE)
+            m_bvh.reset(new SphereBvh());
+
+        // Frustum culling and LOD selection on the GPU, feeding one multi-draw-indirect for the whole field
+        GLuint sphereCapacity{ scene ? static_cast<GLuint>(scene->GetObjectCount()) : options.sphereCount };
+        m_sphereCuller.reset(new GpuCuller(m_quadMesh ? *m_quadMesh : *m_sphereMesh, sphereCapacity, radius, options.gpuCulling));
+
+        // One bin per feature set of the material table; ray tracing draws every sphere in one triangle, so it keeps a single dynamic bin
+        GLuint materialBins[MAX_MATERIALS]{};
+        m_binCount = AssignMaterialBins(materials, options.shaderVariants && m_sphereMode != SPHERE_RAYTRACE, materialBins, m_binFeatures);
+        m_sphereCuller->SetMaterialBins(materialBins, m_binCount);
+
+        // Per-sphere transforms and material indices, drawn with a single instanced call. A persistently mapped ring gets every
+        // change once per segment, so the store keeps changes pending for STREAMING_FRAMES updates
+        if (options.animate && sphereCapacity > 0)
+            m_instanceStream.reset(new StreamingBuffer(GL_SHADER_STORAGE_BUFFER, sphereCapacity * sizeof(SphereInstance)));
+        unsigned copies{ m_instanceStream && m_instanceStream->IsPersistent() ? STREAMING_FRAMES : 1 };
+        if (!m_instanceStream || !m_instanceStream->IsPersistent())
+            m_stagingInstances.resize(sphereCapacity);
+
+        // The first spheres (the original two come first) carry a reflection probe each. A scene's first chunk always holds them
+        m_probeCount = std::min<GLuint>({ options.probeCount, MAX_PROBES, sphereCapacity });
+        if (scene)
+        {
+            m_scene = scene;
+            m_sceneChunkObjects = std::max(1u, options.sceneChunkObjects);
+            m_sceneStats.objects = scene->GetObjectCount();
+            m_sceneStats.openMs = scene->GetOpenMs();
+            m_transforms = TransformStore{ copies };
+            m_transforms.Reserve(sphereCapacity);
+            streamScene(std::max<size_t>(m_sceneChunkObjects, m_probeCount));
+        }
+        else
+        {
+            m_transforms = BuildSphereTransforms(options.sphereCount, options.seed, MAX_MATERIALS, copies);
+            addObjects(0);
+        }
+
+        // Point lights, binned into clusters every frame. A scene's own lights replace the generated ones
+        if (scene && scene->GetPointLightCount() > 0)
+            m_lightClusters.SetLights(std::vector<PointLight>(scene->GetPointLights(), scene->GetPointLights() + scene->GetPointLightCount()));
+        else if (options.pointLightCount > 0)
+            m_lightClusters.SetLights(BuildPointLights(options.pointLightCount, options.seed, sphereCapacity));
+
+        // Start compiling the programs of the bins in use, the others are built when a streamed in object first needs them
+        for (GLuint bin{ 0 }; bin < m_binCount; ++bin)
+            if (m_sphereCuller->GetBinSize(bin) > 0 || m_bvh)
+                m_lightingPrograms.Prepare(binProgram(bin));
+
+        // Cubemap array the probed spheres read the others' reflections from
+        if (m_probeCount > 0)
+            m_probes.reset(new ReflectionProbes(*m_sphereMesh, m_probeCount, options.probeSize, options.probeBudgetMs));
+
+        // Upload whatever faces are already decoded while the buffers are being set up
+        if (cubemapLoader)
+            cubemapLoader->Poll();
+
+        // Skybox, its vertices never change so they are uploaded here and only here
+        glGenVertexArrays(1, &m_skyboxVAO);
+        GetGLState().BindVertexArray(m_skyboxVAO);
+
+        glGenBuffers(1, &m_skyboxVBO);
+        glBindBuffer(GL_ARRAY_BUFFER, m_skyboxVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(SKYBOX_VERTICES), &SKYBOX_VERTICES, GL_STATIC_DRAW);
+
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
+        GetGLState().BindVertexArray(0);
+
+        if (options.environmentCache && options.streamEnvironment)
+        {
+            // Only the mip tail before the first frame, the finer levels follow under the per-frame upload budget
+            EnvironmentCacheFormat environmentFormat{ options.compressEnvironment ? ENVIRONMENT_FORMAT_BC1 : ENVIRONMENT_FORMAT_RGB8 };
+            EnvironmentLoadStats environmentStats{};
+            m_environmentStreamer.reset(new EnvironmentStreamer(threadPool, static_cast<size_t>(options.environmentUploadKiB) * 1024,
+                static_cast<size_t>(options.environmentResidencyMiB) * 1024 * 1024));
+            if (m_environmentStreamer->Open(faces, ENVIRONMENT_CACHE_PATH, environmentFormat, &environmentStats))
+                m_cubemapTexture = m_environmentStreamer->GetTexture();
+            PrintEnvironmentLoadStats(environmentStats);
+        }
+        else if (options.environmentCache)
+        {
+            EnvironmentCacheFormat environmentFormat{ options.compressEnvironment ? ENVIRONMENT_FORMAT_BC1 : ENVIRONMENT_FORMAT_RGB8 };
+            EnvironmentLoadStats environmentStats{};
+            m_cubemapTexture = LoadEnvironmentCubemap(threadPool, faces, ENVIRONMENT_CACHE_PATH, environmentFormat, &environmentStats);
+            m_resources.AdoptCubemap(m_cubemapTexture);
+            PrintEnvironmentLoadStats(environmentStats);
+        }
+        else
+        {
+            CubemapLoadStats cubemapStats{};
+            m_cubemapTexture = cubemapLoader ? cubemapLoader->Finish(&cubemapStats) : LoadCubemapSerial(faces, &cubemapStats);
+            cubemapLoader.reset();
+            m_resources.AdoptCubemap(m_cubemapTexture);
+            PrintCubemapLoadStats(cubemapStats);
+        }
+
+        // Irradiance and prefiltered reflections, read from their cache (or baked on the pool) and uploaded once. Left disabled, the
+        // block keeps the shader on the original skybox lookup
+        EnvironmentBlock environmentBlock{};
+        if (options.imageBasedLighting)
+        {
+            EnvironmentLighting lighting;
+            EnvironmentLightingStats lightingStats{};
+            if (LoadEnvironmentLighting(threadPool, faces, ENVIRONMENT_LIGHTING_PATH, lighting, &lightingStats))
+            {
+                m_prefilteredTexture = lighting.CreateTexture();
+                m_resources.AdoptCubemap(m_prefilteredTexture);
+                environmentBlock = lighting.GetBlock();
+                PrintEnvironmentLightingStats(lightingStats);
+            }
+        }
+        m_environmentBuffer.Update(environmentBlock);
+
+        m_projection = glm::perspective(ZOOM, aspect, NEAR_PLANE, FAR_PLANE);
+
+        bool scaled{ options.frameBudgetMs > 0.0 || options.resolutionScale < 1.0f };
+        if (scaled || options.halfRateReflections)
+            m_resolution.reset(new ResolutionController(options.frameBudgetMs, options.resolutionScale, options.minResolutionScale, options.halfRateReflections));
+        if (options.hdr)
+        {
+            m_sceneTarget.reset(new RenderTarget(GL_RGBA16F));
+            m_postProcess.reset(new PostProcessChain(!options.naivePost, options.exposureKey, options.bloomStrength));
+        }
+        else if (scaled)
+            m_sceneTarget.reset(new RenderTarget(GL_RGBA8));
+        if (options.halfRateReflections)
+            m_reflectionTarget.reset(new RenderTarget(GL_RGBA16F));
+
+        // Collect the programs last, they have been compiling (or loading from the binary cache) while everything else was set up
+        m_lightingPrograms.Finish();
+        m_skyboxShader->Finish();
+        m_sphereCuller->FinishShader();
+        m_lightClusters.FinishShader();
+        if (m_probes)
+            m_probes->FinishShader();
+        if (m_postProcess)
+            m_postProcess->FinishShaders();
+    }
+
+    ~Renderer()
+    {
+        if (m_scenePrefetch.valid())
+            m_scenePrefetch.wait();
+        GetGLState().DeleteBuffers(1, &m_skyboxVBO);
+        GetGLState().DeleteVertexArrays(1, &m_skyboxVAO);
+    }
+
+    Renderer(const Renderer&) = delete;
+    Renderer& operator=(const Renderer&) = delete;
+
+    // Clears the bound framebuffer and draws the spheres then the skybox; time drives the light colour so a fixed timestep gives identical frames.
+    // With a resolution scale the frame is drawn smaller offscreen and upscaled into the bound framebuffer's viewport, with --hdr it is post processed into it
+    void RenderFrame(Camera& camera, float time, float viewportHeight)
+    {
+        // Every pass states the bindings and state it needs, the cache drops whatever is already set
+        GLStateCache& state{ GetGLState() };
+        GLint viewport[4]{};
+        state.GetViewport(viewport);
+        GLuint outputFramebuffer{ state.GetDrawFramebuffer() };
+        // A minimized window has an empty viewport, the offscreen targets are still at least 1 x 1
+        GLsizei width{ std::max<GLsizei>(viewport[2], 1) }, height{ std::max<GLsizei>(viewport[3], 1) };
+        if (m_resolution)
+            m_resolution->BeginFrame(width, height, width, height);
+
+        // Only waits when the GPU is still reading the segment written STREAMING_FRAMES frames ago
+        m_frameStream.BeginFrame();
+        if (m_instanceStream)
+            m_instanceStream->BeginFrame();
+
+        CameraBlock cameraBlock{};
+        GLintptr cameraOffset{};
+        {
+            ProfileScope scope(m_profiler, "uploads");
+
+            // get camera view
+            cameraBlock.view = camera.GetViewMatrix();
+            cameraBlock.projection = m_projection;
+            cameraBlock.position = camera.GetPosition();
+            cameraOffset = m_frameStream.Write(&cameraBlock, sizeof(CameraBlock));
+            m_frameStream.BindRange(CAMERA_BLOCK_BINDING, cameraOffset, sizeof(CameraBlock));
+            m_frameStream.WriteAndBind(BuildLightBlock(time, m_lightPosition), LIGHT_BLOCK_BINDING);
+            streamScene(m_sceneChunkObjects);
+            if (m_environmentStreamer)
+                m_environmentStreamer->Update();
+
+            if (m_instanceStream)
+            {
+                AnimateSphereTransforms(m_transforms, m_basePositions, time);
+                GLsizeiptr size{ static_cast<GLsizeiptr>(m_transforms.Size() * sizeof(SphereInstance)) };
+                GLintptr offset{};
+                if (void* mapped = m_instanceStream->Allocate(size, offset))
+                {
+                    m_transforms.Update(&m_threadPool, static_cast<SphereInstance*>(mapped));
+                    m_instanceStream->BindRange(INSTANCE_BUFFER_BINDING, offset, size);
+                }
+                else
+                {
+                    m_transforms.Update(&m_threadPool, m_stagingInstances.data());
+                    m_instanceStream->WriteAndBind(m_stagingInstances.data(), size, INSTANCE_BUFFER_BINDING);
+                }
+                if (m_bvh)
+                    m_bvh->Refit(m_transforms, radius);
+            }
+        }
+
+        state.BindTextureUnit(0, GL_TEXTURE_CUBE_MAP, m_cubemapTexture);
+        if (m_prefilteredTexture)
+            state.BindTextureUnit(PREFILTERED_TEXTURE_UNIT, GL_TEXTURE_CUBE_MAP, m_prefilteredTexture);
+        state.Disable(GL_BLEND);
+
+        // Refresh the probes the budget allows, they take over the camera binding so the main camera goes back afterwards
+        if (m_probes)
+        {
+            ProfileScope scope(m_profiler, "probes");
+            m_probes->Update(m_frameStream, *m_sphereMesh, m_sphereCount, m_transforms, cameraBlock.position);
+            m_frameStream.BindRange(CAMERA_BLOCK_BINDING, cameraOffset, sizeof(CameraBlock));
+        }
+
+        if (m_sceneTarget)
+        {
+            m_sceneTarget->Reserve(width, height);
+            state.BindFramebuffer(GL_FRAMEBUFFER, m_sceneTarget->GetFramebuffer());
+            state.Viewport(0, 0, width, height);
+        }
+        glClearColor(0.1f, 0.1f, 0.1f, 0.1f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        // Light lists of the clusters of this frame's view, the cluster block is written even without lights to switch them off
+        {
+            ProfileScope scope(m_profiler, "lights");
+            m_lightClusters.Update(m_frameStream, m_projection, NEAR_PLANE, FAR_PLANE, glm::vec2(width, height));
+        }
+
+        // Draw every visible sphere in one call, the vertex shader fetches its transform and material from the instance buffer.
+        // LODs are picked for the size actually rendered. Ray tracing finds its spheres through the BVH instead
+        auto submitStart = std::chrono::steady_clock::now();
+        if (!m_bvh)
+        {
+            ProfileScope scope(m_profiler, "cull");
+            m_sphereCuller->Cull(m_frameStream, cameraBlock.view, m_projection, cameraBlock.position, viewportHeight * height / std::max(viewport[3], 1));
+        }
+        if (m_reflectionTarget)
+        {
+            ProfileScope scope(m_profiler, "reflections");
+            renderHalfRateReflections(width, height);
+        }
+        {
+            ProfileScope scope(m_profiler, "spheres");
+            state.DepthFunc(GL_LESS);
+            for (GLuint bin{ 0 }; bin < m_binCount; ++bin)
+            {
+                if (m_sphereCuller->GetBinSize(bin) == 0 && !m_bvh)
+                    continue;
+                GLuint program{ binProgram(bin) };
+                m_lightingPrograms.BeginTiming(program);
+                useLightingProgram(bin, m_reflectionTarget ? REFLECTION_READ_HALF_RATE : REFLECTION_FULL_RATE);
+                drawSpheres(bin);
+                m_lightingPrograms.EndTiming(program);
+            }
+            m_lightingPrograms.EndFrame();
+        }
+        m_submitMs = ElapsedMilliseconds(submitStart, std::chrono::steady_clock::now());
+
+        {
+            ProfileScope scope(m_profiler, "skybox");
+            state.DepthFunc(GL_LEQUAL);  // Change depth function so depth test passes when values are equal to depth buffer's content
+            m_skyboxShader->Use();
+
+            state.BindVertexArray(m_skyboxVAO);
+            state.BindTexture(GL_TEXTURE_CUBE_MAP, m_cubemapTexture);
+            glDrawArrays(GL_TRIANGLES, 0, 36);
+        }
+
+        if (m_postProcess)
+        {
+            ProfileScope scope(m_profiler, "post");
+            m_postProcess->Apply(m_frameStream, m_sceneTarget->GetColorTexture(), width, height, m_sceneTarget->GetWidth(), m_sceneTarget->GetHeight(),
+                outputFramebuffer, viewport, time);
+        }
+        else if (m_sceneTarget)
+        {
+            ProfileScope scope(m_profiler, "upscale");
+            state.BindFramebuffer(GL_READ_FRAMEBUFFER, m_sceneTarget->GetFramebuffer());
+            state.BindFramebuffer(GL_DRAW_FRAMEBUFFER, outputFramebuffer);
+            glBlitFramebuffer(0, 0, width, height, viewport[0], viewport[1], viewport[0] + viewport[2], viewport[1] + viewport[3], GL_COLOR_BUFFER_BIT, GL_LINEAR);
+            state.BindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer);
+            state.Viewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        }
+        if (m_resolution)
+            m_resolution->EndFrame();
+
+        // Everything this frame reads from the rings has been submitted, fence the segments
+        m_frameStream.EndFrame();
+        if (m_instanceStream)
+            m_instanceStream->EndFrame();
+        state.EndFrame();
+    }
+
+    // Replaces the point lights, for the light scaling benchmark
+    void SetPointLights(const std::vector<PointLight>& lights) { m_lightClusters.SetLights(lights); }
+
+    // Frame boundaries and extra scopes (events, display) come from the caller's loop
+    Profiler& GetProfiler() { return m_profiler; }
+    GLsizei GetSphereCount() const { return m_sphereCount; }     // spheres drawn, the part of the scene streamed in so far
+    // Both the scene and the environment have finished streaming in (the environment up to its residency cap)
+    bool IsLoaded() const
+    {
+        return (!m_scene || m_transforms.Size() >= m_scene->GetObjectCount()) && (!m_environmentStreamer || m_environmentStreamer->IsComplete());
+    }
+    const SceneLoadStats& GetSceneStats() const { return m_sceneStats; }
+    double GetSubmitMs() const { return m_submitMs; }    // CPU cost of the last frame's sphere pass
+    CullStats GetCullStats() const { return m_sphereCuller->GetStats(); }
+    ClusterStats GetClusterStats() const { return m_lightClusters.GetStats(); }
+    const TransformStats& GetTransformStats() const { return m_transforms.GetStats(); }
+    EnvironmentStreamStats GetEnvironmentStreamStats() const { return m_environmentStreamer ? m_environmentStreamer->GetStats() : EnvironmentStreamStats{}; }
+    ProbeStats GetProbeStats() const { return m_probes ? m_probes->GetStats() : ProbeStats{}; }
+    ResolutionStats GetResolutionStats() const { return m_resolution ? m_resolution->GetStats() : ResolutionStats{}; }
+    BvhStats GetBvhStats() const { return m_bvh ? m_bvh->GetStats() : BvhStats{}; }
+    std::vector<ShaderVariantStats> GetShaderVariantStats() const { return m_lightingPrograms.GetStats(); }
+    PostProcessStats GetPostProcessStats() const { return m_postProcess ? m_postProcess->GetStats() : PostProcessStats{}; }
+    ResourceStats GetResourceStats() { return m_resources.GetStats(); }
+    SphereMode GetSphereMode() const { return m_sphereMode; }
+
+    // Bytes written through the streaming rings and the times a segment was still in flight
+    StreamingStats GetStreamingStats() const
+    {
+        StreamingStats stats{ m_frameStream.GetStats() };
+        if (m_instanceStream)
+            AccumulateStreamingStats(stats, m_instanceStream->GetStats());
+        return stats;
+    }
+};
+
+#endif
@@ -0,0 +1,320 @@
+#ifndef RESOURCE_MANAGER_H
+#define RESOURCE_MANAGER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <memory_resource>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "Arena.h"
+#include "Cubemap.h"
+#include "GLState.h"
+#include "Mesh.h"
+#include "Shader.h"
+
+// Reference to a resource of the manager: its slot and the generation the slot was at when the resource was loaded. A handle to
+// something unloaded (or to a slot taken again since) resolves to nothing instead of to the new occupant, and the tag keeps a
+// mesh handle from being passed where a program is expected
+template <typename Tag>
+struct ResourceHandle
+{
+    std::uint32_t index{};
+    std::uint32_t generation{};     // 0 is never live, so a default handle is empty
+
+    explicit operator bool() const { return generation != 0; }
+};
+
+using MeshHandle = ResourceHandle<struct MeshResourceTag>;
+using CubemapHandle = ResourceHandle<struct CubemapResourceTag>;
+using ProgramHandle = ResourceHandle<struct ProgramResourceTag>;
+
+// Cubemap texture owned by the manager, deleted with it
+class CubemapTexture
+{
+private:
+    GLuint m_texture{};
+    size_t m_gpuBytes{};
+
+public:
+    CubemapTexture(GLuint texture, size_t gpuBytes)
+        : m_texture{ texture }, m_gpuBytes{ gpuBytes }
+    {
+    }
+
+    ~CubemapTexture() { GetGLState().DeleteTextures(1, &m_texture); }
+
+    CubemapTexture(const CubemapTexture&) = delete;
+    CubemapTexture& operator=(const CubemapTexture&) = delete;
+
+    GLuint GetTexture() const { return m_texture; }
+    size_t GetGpuBytes() const { return m_gpuBytes; }
+};
+
+// Storage of a cubemap's levels from the sizes and internal format the driver reports, counted like the environment loaders do
+inline size_t CubemapGpuBytes(GLuint texture)
+{
+    size_t bytes{ 0 };
+    GetGLState().BindTexture(GL_TEXTURE_CUBE_MAP, texture);
+    for (GLint level{ 0 };; ++level)
+    {
+        GLint width{}, height{};
+        glGetTexLevelParameteriv(GL_TEXTURE_CUBE_MAP_POSITIVE_X, level, GL_TEXTURE_WIDTH, &width);
+        glGetTexLevelParameteriv(GL_TEXTURE_CUBE_MAP_POSITIVE_X, level, GL_TEXTURE_HEIGHT, &height);
+        if (width == 0 || height == 0)
+            break;
+
+        GLint internalFormat{};
+        glGetTexLevelParameteriv(GL_TEXTURE_CUBE_MAP_POSITIVE_X, level, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+        bytes += TextureImageBytes(static_cast<GLenum>(internalFormat), width, height) * 6;
+    }
+    GetGLState().BindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    return bytes;
+}
+
+// Slots of one kind of resource. A slot is taken again once its resource is unloaded, with a new generation; the deque never moves
+// what it holds, so resources need not be movable, and past the most resources held at once neither container grows any more
+template <typename T, typename Handle>
+class ResourceTable
+{
+private:
+    struct Slot
+    {
+        std::optional<T> resource;
+        std::uint32_t generation{ 1 };
+    };
+
+    std::deque<Slot> m_slots;
+    std::vector<std::uint32_t> m_free;
+    size_t m_count{};
+
+public:
+    template <typename... Args>
+    Handle Emplace(Args&&... args)
+    {
+        std::uint32_t index{};
+        if (!m_free.empty())
+        {
+            index = m_free.back();
+            m_free.pop_back();
+        }
+        else
+        {
+            index = static_cast<std::uint32_t>(m_slots.size());
+            m_slots.emplace_back();
+        }
+
+        Slot& slot{ m_slots[index] };
+        slot.resource.emplace(std::forward<Args>(args)...);
+        ++m_count;
+        return Handle{ index, slot.generation };
+    }
+
+    T* Get(Handle handle)
+    {
+        if (!handle || handle.index >= m_slots.size())
+            return nullptr;
+        Slot& slot{ m_slots[handle.index] };
+        return slot.generation == handle.generation && slot.resource ? &*slot.resource : nullptr;
+    }
+
+    // Destroys the resource, false when the handle was stale
+    bool Remove(Handle handle)
+    {
+        if (!Get(handle))
+            return false;
+
+        Slot& slot{ m_slots[handle.index] };
+        slot.resource.reset();
+        if (++slot.generation == 0)
+            slot.generation = 1;
+        m_free.push_back(handle.index);
+        --m_count;
+        return true;
+    }
+
+    // Everything at once, in the reverse order of the slots
+    void Clear()
+    {
+        for (auto slot = m_slots.rbegin(); slot != m_slots.rend(); ++slot)
+            slot->resource.reset();
+        m_slots.clear();
+        m_free.clear();
+        m_count = 0;
+    }
+
+    size_t Size() const { return m_count; }
+    size_t GetSlotCount() const { return m_slots.size(); }
+};
+
+// What the manager holds and what it has cost
+struct ResourceStats
+{
+    size_t meshes{};
+    size_t cubemaps{};
+    size_t programs{};
+    size_t slots{};                 // slots of all three tables, the most resources held at once
+    size_t loads{};
+    size_t unloads{};
+    size_t gpuBytes{};              // mesh buffers and cubemap storage
+    size_t peakGpuBytes{};
+    size_t gpuBudgetBytes{};        // 0 for no limit
+    size_t overBudgetLoads{};       // loads that left the GPU bytes past the budget
+    ArenaStats staging{};
+};
+
+inline void PrintResourceStats(const ResourceStats& stats)
+{
+    std::cout << "  resources: " << stats.meshes << " meshes, " << stats.cubemaps << " cubemaps, " << stats.programs << " programs in "
+        << stats.slots << " slots, " << stats.gpuBytes / 1024 << " KiB on the GPU";
+    if (stats.gpuBudgetBytes > 0)
+        std::cout << " of " << stats.gpuBudgetBytes / 1024 << " KiB";
+    std::cout << " (peak " << stats.peakGpuBytes / 1024 << " KiB), " << stats.loads << " loads, " << stats.unloads << " unloads";
+    if (stats.overBudgetLoads > 0)
+        std::cout << ", " << stats.overBudgetLoads << " over budget";
+    std::cout << std::endl;
+    PrintArenaStats(stats.staging);
+}
+
+// Owns the meshes, cubemaps and programs of a renderer behind typed handles, and frees whatever is left when it goes.
+// A mesh is built into an arena of its own that goes back to the pool as soon as the buffers are uploaded, so loading and
+// unloading meshes all the time reuses the same staging blocks and table slots instead of going to the heap. Cubemaps are adopted
+// from the loaders, which stage the faces themselves (the decoder's buffers or the mapped cache). GPU bytes are counted against
+// a budget; going past it is reported, never refused, since nothing can be drawn without its resources
+class ResourceManager
+{
+private:
+    ArenaPool m_staging;
+    ResourceTable<Mesh, MeshHandle> m_meshes;
+    ResourceTable<CubemapTexture, CubemapHandle> m_cubemaps;
+    ResourceTable<Shader, ProgramHandle> m_programs;
+    ResourceStats m_stats{};
+
+    void loaded(size_t gpuBytes)
+    {
+        ++m_stats.loads;
+        m_stats.gpuBytes += gpuBytes;
+        m_stats.peakGpuBytes = std::max(m_stats.peakGpuBytes, m_stats.gpuBytes);
+        if (m_stats.gpuBudgetBytes > 0 && m_stats.gpuBytes > m_stats.gpuBudgetBytes)
+            ++m_stats.overBudgetLoads;
+    }
+
+    void unloaded(size_t gpuBytes)
+    {
+        ++m_stats.unloads;
+        m_stats.gpuBytes -= gpuBytes;
+    }
+
+public:
+    // cpuBudgetBytes caps the staging blocks kept for reuse, gpuBudgetBytes is what the GPU bytes are reported against
+    explicit ResourceManager(size_t cpuBudgetBytes = 0, size_t gpuBudgetBytes = 0)
+        : m_staging(cpuBudgetBytes)
+    {
+        m_stats.gpuBudgetBytes = gpuBudgetBytes;
+    }
+
+    // Programs first, then the textures and buffers
+    ~ResourceManager()
+    {
+        m_programs.Clear();
+        m_cubemaps.Clear();
+        m_meshes.Clear();
+    }
+
+    ResourceManager(const ResourceManager&) = delete;
+    ResourceManager& operator=(const ResourceManager&) = delete;
+
+    // build(memory) returns the MeshData to upload, allocated from memory (BuildSphereMesh and BuildQuadMesh take it last)
+    template <typename Builder>
+    MeshHandle LoadMesh(Builder build)
+    {
+        Arena arena(m_staging);
+        MeshHandle handle{};
+        {
+            MeshData data{ build(static_cast<std::pmr::memory_resource*>(&arena)) };
+            handle = m_meshes.Emplace(data);
+        }
+        loaded(m_meshes.Get(handle)->GetGpuBytes());
+        return handle;
+    }
+
+    // Takes over a cubemap texture made by one of the loaders
+    CubemapHandle AdoptCubemap(GLuint texture)
+    {
+        if (!texture)
+            return CubemapHandle{};
+
+        size_t gpuBytes{ CubemapGpuBytes(texture) };
+        CubemapHandle handle{ m_cubemaps.Emplace(texture, gpuBytes) };
+        loaded(gpuBytes);
+        return handle;
+    }
+
+    // Starts building a program like the Shader constructors do, Finish or the first Use waits for it
+    ProgramHandle LoadProgram(const GLchar* vertexPath, const GLchar* fragmentPath)
+    {
+        ProgramHandle handle{ m_programs.Emplace(vertexPath, fragmentPath) };
+        loaded(0);
+        return handle;
+    }
+
+    ProgramHandle LoadProgram(const GLchar* vertexPath, const GLchar* fragmentPath, const std::string& defines)
+    {
+        ProgramHandle handle{ m_programs.Emplace(vertexPath, fragmentPath, defines) };
+        loaded(0);
+        return handle;
+    }
+
+    Mesh* Get(MeshHandle handle) { return m_meshes.Get(handle); }
+    Shader* Get(ProgramHandle handle) { return m_programs.Get(handle); }
+    GLuint GetTexture(CubemapHandle handle)
+    {
+        CubemapTexture* cubemap{ m_cubemaps.Get(handle) };
+        return cubemap ? cubemap->GetTexture() : 0;
+    }
+
+    // Frees the resource right away, the handle (and every copy of it) is stale afterwards; a stale handle is ignored
+    void Unload(MeshHandle handle)
+    {
+        if (Mesh* mesh = m_meshes.Get(handle))
+        {
+            unloaded(mesh->GetGpuBytes());
+            m_meshes.Remove(handle);
+        }
+    }
+
+    void Unload(CubemapHandle handle)
+    {
+        if (CubemapTexture* cubemap = m_cubemaps.Get(handle))
+        {
+            unloaded(cubemap->GetGpuBytes());
+            m_cubemaps.Remove(handle);
+        }
+    }
+
+    void Unload(ProgramHandle handle)
+    {
+        if (m_programs.Remove(handle))
+            unloaded(0);
+    }
+
+    ResourceStats GetStats()
+    {
+        ResourceStats stats{ m_stats };
+        stats.meshes = m_meshes.Size();
+        stats.cubemaps = m_cubemaps.Size();
+        stats.programs = m_programs.Size();
+        stats.slots = m_meshes.GetSlotCount() + m_cubemaps.GetSlotCount() + m_programs.GetSlotCount();
+        stats.staging = m_staging.GetStats();
+        return stats;
+    }
+};
+
+#endif
@@ -0,0 +1,419 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include "Cubemap.h"
+#include "MappedFile.h"
+#include "ShaderPermutations.h"
+#include "TransformStore.h"
+#include "UniformBlocks.h"
+
+// Compiled scene container.
+// The file is a fixed header followed by flat arrays of objects, materials and point lights and a block of null-terminated strings
+// (the environment faces). The header only holds offsets into the file, so opening a scene is a mapping and a few bounds checks,
+// and the materials and lights are laid out exactly as the GL blocks expect them. Objects are read straight from the mapping in
+// chunks, so a large scene can be drawn while the rest of it is still coming in
+
+constexpr std::uint32_t SCENE_MAGIC{ 0x454E4353 };    // "SCNE"
+constexpr std::uint32_t SCENE_VERSION{ 1 };
+constexpr std::uint32_t SCENE_ENVIRONMENT_FACES{ 6 };
+constexpr std::uint64_t SCENE_SECTION_ALIGNMENT{ 16 };
+
+// Position of the original light, scenes that do not name one keep it
+const glm::vec3 LIGHT_POSITION{ 1.2f, 1.0f, 2.0f };
+
+// One sphere of the scene
+struct SceneObject
+{
+    glm::vec3 position;
+    GLuint materialIndex;
+    glm::vec4 rotation;             // unit quaternion (x, y, z, w)
+    glm::vec3 scale;
+    GLuint padding0;
+};
+
+// A flat array in the file
+struct SceneSection
+{
+    std::uint64_t offset;
+    std::uint64_t count;            // elements, bytes for the string block
+};
+
+struct SceneFileHeader
+{
+    std::uint32_t magic;
+    std::uint32_t version;
+    std::uint64_t fileSize;
+    glm::vec3 lightPosition;
+    std::uint32_t environmentFaceCount;                     // 0, or SCENE_ENVIRONMENT_FACES
+    std::uint32_t environmentFaces[SCENE_ENVIRONMENT_FACES];  // offsets into the string block
+    std::uint32_t reserved[2];
+    SceneSection objects;
+    SceneSection materials;
+    SceneSection pointLights;
+    SceneSection strings;
+};
+
+static_assert(sizeof(SceneObject) == 48, "SceneObject is part of the file format");
+static_assert(sizeof(SceneFileHeader) == 128, "SceneFileHeader is part of the file format");
+
+// A scene in memory: what the text form parses into and what the compiled form is written from
+struct SceneDescription
+{
+    std::vector<SceneObject> objects;
+    std::vector<Material> materials;            // at most MAX_MATERIALS, the rest of the table keeps the built-in palette
+    std::vector<PointLight> pointLights;
+    glm::vec3 lightPosition{ LIGHT_POSITION };
+    std::vector<std::string> environmentFaces;  // none, or the six faces in GL_TEXTURE_CUBE_MAP_POSITIVE_X + i order
+};
+
+// Adds objects to the store, material indices past the table are clamped to its last entry
+inline void AddSceneObjects(TransformStore& transforms, const SceneObject* objects, size_t count)
+{
+    for (size_t i{ 0 }; i < count; ++i)
+        transforms.Add(objects[i].position, objects[i].rotation, objects[i].scale, std::min(objects[i].materialIndex, MAX_MATERIALS - 1));
+}
+
+// Readable form, one entry per line and # starts a comment:
+//   environment posx negx posy negy posz negz
+//   light x y z
+//   material ambient.rgb diffuse.rgb specular.rgb shininess [features phong+reflect+refract+fresnel]
+//   pointlight x y z radius r g b
+//   sphere x y z material [rotation qx qy qz qw] [scale s | scale sx sy sz]
+inline bool ParseSceneText(const std::string& path, SceneDescription& scene)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        std::cout << "ERROR::SCENE::CANNOT_READ " << path << std::endl;
+        return false;
+    }
+
+    scene = SceneDescription{};
+    std::string line;
+    for (unsigned lineNumber{ 1 }; std::getline(file, line); ++lineNumber)
+    {
+        line = line.substr(0, line.find('#'));
+        std::istringstream tokens(line);
+        std::string keyword;
+        if (!(tokens >> keyword))
+            continue;
+
+        bool valid{ true };
+        if (keyword == "sphere")
+        {
+            SceneObject object{ glm::vec3(0.0f), 0, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f), glm::vec3(1.0f), 0 };
+            valid = static_cast<bool>(tokens >> object.position.x >> object.position.y >> object.position.z >> object.materialIndex);
+            std::string option;
+            while (valid && tokens >> option)
+            {
+                if (option == "rotation")
+                    valid = static_cast<bool>(tokens >> object.rotation.x >> object.rotation.y >> object.rotation.z >> object.rotation.w) && glm::length(object.rotation) > 0.0f;
+                else if (option == "scale" && tokens >> object.scale.x)
+                {
+                    // One value is a uniform scale
+                    float y{};
+                    if (tokens >> y)
+                    {
+                        object.scale.y = y;
+                        valid = static_cast<bool>(tokens >> object.scale.z);
+                    }
+                    else
+                    {
+                        object.scale.y = object.scale.z = object.scale.x;
+                        tokens.clear();
+                    }
+                }
+                else
+                    valid = false;
+            }
+            scene.objects.push_back(object);
+        }
+        else if (keyword == "material")
+        {
+            Material material{};
+            valid = tokens >> material.ambient.r >> material.ambient.g >> material.ambient.b >> material.diffuse.r >> material.diffuse.g >> material.diffuse.b
+                >> material.specular.r >> material.specular.g >> material.specular.b >> material.shininess && scene.materials.size() < MAX_MATERIALS;
+            std::string word, features;
+            if (valid && tokens >> word)
+            {
+                valid = word == "features" && tokens >> features;
+                material.features = valid ? ParseMaterialFeatures(features) : 0;
+                valid = valid && material.features != 0;
+            }
+            scene.materials.push_back(material);
+        }
+        else if (keyword == "pointlight")
+        {
+            PointLight light{};
+            valid = static_cast<bool>(tokens >> light.position.x >> light.position.y >> light.position.z >> light.radius >> light.color.r >> light.color.g >> light.color.b);
+            scene.pointLights.push_back(light);
+        }
+        else if (keyword == "light")
+            valid = static_cast<bool>(tokens >> scene.lightPosition.x >> scene.lightPosition.y >> scene.lightPosition.z);
+        else if (keyword == "environment")
+        {
+            scene.environmentFaces.clear();
+            for (std::string face; tokens >> face; )
+                scene.environmentFaces.push_back(face);
+            valid = scene.environmentFaces.size() == SCENE_ENVIRONMENT_FACES;
+        }
+        else
+            valid = false;
+
+        if (!valid)
+        {
+            std::cout << "ERROR::SCENE::PARSE_FAILED " << path << ":" << lineNumber << std::endl;
+            return false;
+        }
+    }
+
+    // Indices are checked against the table the renderer will end up with
+    GLuint materialCount{ scene.materials.empty() ? MAX_MATERIALS : static_cast<GLuint>(scene.materials.size()) };
+    for (size_t i{ 0 }; i < scene.objects.size(); ++i)
+    {
+        if (scene.objects[i].materialIndex >= materialCount)
+        {
+            std::cout << "ERROR::SCENE::MATERIAL_OUT_OF_RANGE " << path << " sphere " << i << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Writes the readable form, floats with enough digits to read back the same values
+inline bool WriteSceneText(const std::string& path, const SceneDescription& scene)
+{
+    std::ofstream file(path, std::ios::trunc);
+    if (!file)
+    {
+        std::cout << "ERROR::SCENE::CANNOT_WRITE " << path << std::endl;
+        return false;
+    }
+
+    file << std::setprecision(std::numeric_limits<float>::max_digits10);
+    if (!scene.environmentFaces.empty())
+    {
+        file << "environment";
+        for (const std::string& face : scene.environmentFaces)
+            file << " " << face;
+        file << "\n";
+    }
+    file << "light " << scene.lightPosition.x << " " << scene.lightPosition.y << " " << scene.lightPosition.z << "\n";
+
+    for (const Material& material : scene.materials)
+    {
+        file << "material " << material.ambient.r << " " << material.ambient.g << " " << material.ambient.b << "  " << material.diffuse.r << " " << material.diffuse.g
+            << " " << material.diffuse.b << "  " << material.specular.r << " " << material.specular.g << " " << material.specular.b << "  " << material.shininess;
+        if (material.features != 0)
+            file << "  features " << LightingFeatureNames(material.features);
+        file << "\n";
+    }
+
+    for (const PointLight& light : scene.pointLights)
+        file << "pointlight " << light.position.x << " " << light.position.y << " " << light.position.z << " " << light.radius << " " << light.color.r
+            << " " << light.color.g << " " << light.color.b << "\n";
+
+    for (const SceneObject& object : scene.objects)
+    {
+        file << "sphere " << object.position.x << " " << object.position.y << " " << object.position.z << " " << object.materialIndex;
+        if (object.rotation != glm::vec4(0.0f, 0.0f, 0.0f, 1.0f))
+            file << " rotation " << object.rotation.x << " " << object.rotation.y << " " << object.rotation.z << " " << object.rotation.w;
+        if (object.scale != glm::vec3(1.0f))
+            file << " scale " << object.scale.x << " " << object.scale.y << " " << object.scale.z;
+        file << "\n";
+    }
+    return static_cast<bool>(file);
+}
+
+// Writes the compiled form
+inline bool WriteSceneFile(const std::string& path, const SceneDescription& scene)
+{
+    auto align = [](std::uint64_t offset) { return (offset + SCENE_SECTION_ALIGNMENT - 1) / SCENE_SECTION_ALIGNMENT * SCENE_SECTION_ALIGNMENT; };
+
+    std::string strings;
+    SceneFileHeader header{};
+    header.magic = SCENE_MAGIC;
+    header.version = SCENE_VERSION;
+    header.lightPosition = scene.lightPosition;
+    if (scene.environmentFaces.size() == SCENE_ENVIRONMENT_FACES)
+    {
+        header.environmentFaceCount = SCENE_ENVIRONMENT_FACES;
+        for (std::uint32_t i{ 0 }; i < SCENE_ENVIRONMENT_FACES; ++i)
+        {
+            header.environmentFaces[i] = static_cast<std::uint32_t>(strings.size());
+            strings += scene.environmentFaces[i];
+            strings += '\0';
+        }
+    }
+
+    header.objects = { align(sizeof(SceneFileHeader)), scene.objects.size() };
+    header.materials = { align(header.objects.offset + header.objects.count * sizeof(SceneObject)), std::min<std::uint64_t>(scene.materials.size(), MAX_MATERIALS) };
+    header.pointLights = { align(header.materials.offset + header.materials.count * sizeof(Material)), scene.pointLights.size() };
+    header.strings = { align(header.pointLights.offset + header.pointLights.count * sizeof(PointLight)), strings.size() };
+    header.fileSize = header.strings.offset + header.strings.count;
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+        std::cout << "ERROR::SCENE::CANNOT_WRITE " << path << std::endl;
+        return false;
+    }
+
+    // Every section starts at its offset, the gaps before them are zeroes
+    auto writeSection = [&file](std::uint64_t offset, const void* data, std::uint64_t bytes)
+    {
+        static const char zeroes[SCENE_SECTION_ALIGNMENT]{};
+        file.write(zeroes, static_cast<std::streamsize>(offset - static_cast<std::uint64_t>(file.tellp())));
+        file.write(static_cast<const char*>(data), static_cast<std::streamsize>(bytes));
+    };
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    writeSection(header.objects.offset, scene.objects.data(), header.objects.count * sizeof(SceneObject));
+    writeSection(header.materials.offset, scene.materials.data(), header.materials.count * sizeof(Material));
+    writeSection(header.pointLights.offset, scene.pointLights.data(), header.pointLights.count * sizeof(PointLight));
+    writeSection(header.strings.offset, strings.data(), header.strings.count);
+    return static_cast<bool>(file);
+}
+
+// --convert-scene: readable form to compiled form
+inline bool ConvertScene(const std::string& textPath, const std::string& scenePath)
+{
+    SceneDescription scene;
+    if (!ParseSceneText(textPath, scene) || !WriteSceneFile(scenePath, scene))
+        return false;
+
+    std::cout << "Scene " << textPath << " compiled to " << scenePath << ": " << scene.objects.size() << " objects, " << scene.materials.size() << " materials, "
+        << scene.pointLights.size() << " point lights" << std::endl;
+    return true;
+}
+
+// How a scene came in, filled by whoever streams it
+struct SceneLoadStats
+{
+    size_t objects{};
+    size_t loaded{};
+    unsigned chunks{};
+    double openMs{};        // mapping and validating the file
+    double firstChunkMs{};  // what the first frame waited for
+    double loadMs{};        // every chunk, spread over the first frames
+    double completeMs{};    // from opening the file to the last chunk
+};
+
+inline void PrintSceneLoadStats(const SceneLoadStats& stats)
+{
+    std::cout << "Scene: " << stats.loaded << " of " << stats.objects << " objects in " << stats.chunks << " chunks, open " << stats.openMs << " ms, first chunk "
+        << stats.firstChunkMs << " ms, " << stats.loadMs << " ms loading in total, complete " << stats.completeMs << " ms after opening" << std::endl;
+}
+
+// A mapped, validated scene file
+class SceneFile
+{
+private:
+    MappedFile m_file;
+    const SceneFileHeader* m_header{};
+    std::chrono::steady_clock::time_point m_openedAt{};
+    double m_openMs{};
+
+    bool sectionFits(const SceneSection& section, size_t elementSize) const
+    {
+        return section.offset % SCENE_SECTION_ALIGNMENT == 0 && section.offset <= m_file.GetSize()
+            && section.count <= (m_file.GetSize() - section.offset) / elementSize;
+    }
+
+public:
+    SceneFile() = default;
+
+    SceneFile(const SceneFile&) = delete;
+    SceneFile& operator=(const SceneFile&) = delete;
+
+    // Maps the file and checks the header describes it, nothing past the header is read
+    bool Open(const std::string& path)
+    {
+        m_openedAt = std::chrono::steady_clock::now();
+        m_header = nullptr;
+        if (!m_file.Open(path) || m_file.GetSize() < sizeof(SceneFileHeader))
+        {
+            std::cout << "ERROR::SCENE::CANNOT_READ " << path << std::endl;
+            return false;
+        }
+
+        const SceneFileHeader* header{ reinterpret_cast<const SceneFileHeader*>(m_file.GetData()) };
+        const unsigned char* strings{ m_file.GetData() + header->strings.offset };
+        bool valid{ header->magic == SCENE_MAGIC && header->version == SCENE_VERSION && header->fileSize == m_file.GetSize()
+            && sectionFits(header->objects, sizeof(SceneObject)) && sectionFits(header->materials, sizeof(Material)) && header->materials.count <= MAX_MATERIALS
+            && sectionFits(header->pointLights, sizeof(PointLight)) && sectionFits(header->strings, 1)
+            && (header->environmentFaceCount == 0 || header->environmentFaceCount == SCENE_ENVIRONMENT_FACES) };
+
+        // Face names must start inside the string block, which has to end with a terminator
+        for (std::uint32_t i{ 0 }; valid && i < header->environmentFaceCount; ++i)
+            valid = header->environmentFaces[i] < header->strings.count && strings[header->strings.count - 1] == '\0';
+
+        if (!valid)
+        {
+            std::cout << "ERROR::SCENE::INVALID_FILE " << path << std::endl;
+            m_file.Close();
+            return false;
+        }
+
+        m_header = header;
+        m_openMs = ElapsedMilliseconds(m_openedAt, std::chrono::steady_clock::now());
+        return true;
+    }
+
+    bool IsOpen() const { return m_header != nullptr; }
+    size_t GetObjectCount() const { return static_cast<size_t>(m_header->objects.count); }
+    const SceneObject* GetObjects() const { return reinterpret_cast<const SceneObject*>(m_file.GetData() + m_header->objects.offset); }
+    size_t GetMaterialCount() const { return static_cast<size_t>(m_header->materials.count); }
+    const Material* GetMaterials() const { return reinterpret_cast<const Material*>(m_file.GetData() + m_header->materials.offset); }
+    size_t GetPointLightCount() const { return static_cast<size_t>(m_header->pointLights.count); }
+    const PointLight* GetPointLights() const { return reinterpret_cast<const PointLight*>(m_file.GetData() + m_header->pointLights.offset); }
+    glm::vec3 GetLightPosition() const { return m_header->lightPosition; }
+    std::chrono::steady_clock::time_point GetOpenTime() const { return m_openedAt; }
+    double GetOpenMs() const { return m_openMs; }
+
+    // Replaces the faces with the scene's when it names some, the names point into the mapping
+    void GetEnvironmentFaces(std::vector<const GLchar*>& faces) const
+    {
+        if (m_header->environmentFaceCount == 0)
+            return;
+
+        faces.clear();
+        const char* strings{ reinterpret_cast<const char*>(m_file.GetData() + m_header->strings.offset) };
+        for (std::uint32_t i{ 0 }; i < m_header->environmentFaceCount; ++i)
+            faces.push_back(strings + m_header->environmentFaces[i]);
+    }
+
+    // Adds up to count objects starting at first, returns how many were added
+    size_t AddObjects(TransformStore& transforms, size_t first, size_t count) const
+    {
+        count = std::min(count, GetObjectCount() - std::min(first, GetObjectCount()));
+        AddSceneObjects(transforms, GetObjects() + first, count);
+        return count;
+    }
+
+    // Brings in the pages of the objects [first, first + count), for a pool thread to run ahead of AddObjects
+    void PrefetchObjects(size_t first, size_t count) const
+    {
+        first = std::min(first, GetObjectCount());
+        count = std::min(count, GetObjectCount() - first);
+        m_file.Touch(static_cast<size_t>(m_header->objects.offset) + first * sizeof(SceneObject), count * sizeof(SceneObject));
+    }
+};
+
+#endif
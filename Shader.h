@@ -1,17 +1,32 @@
 #ifndef SHADER_H
 #define SHADER_H
 
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #include <GL/glew.h>
 
+#include "GLState.h"
+#include "Hash.h"
+
+// Default location of the program binary cache, relative to the working directory like the shader sources
+constexpr const char* SHADER_CACHE_DIRECTORY{ "shadercache" };
+
 class Shader
 {
 public:
     GLuint vertexShader, fragmentShader;
+    GLuint computeShader{};
+    GLuint geometryShader{};
 
     // Error handle
     GLenum glCheckError_(const char* file, int line)
@@ -36,76 +51,412 @@ public:
     }
 #define glCheckError() glCheckError_(__FILE__, __LINE__)
     GLuint Program;
-    // Constructor generates the shader on the fly
+    // Constructor generates the shader on the fly. Compiling and linking are only started here, the status is collected by Finish()
+    // (or the first Use()), so constructing every program before finishing any lets the driver build them in parallel
     Shader(const GLchar* vertexPath, const GLchar* fragmentPath)
+        : vertexShader{}, fragmentShader{}, m_name{ std::string(vertexPath) + " + " + fragmentPath }
     {
         // 1. Retrieve the vertex/fragment source code from filePath
-        std::string vertexCode;
-        std::string fragmentCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
+        m_sources.push_back({ GL_VERTEX_SHADER, readSource(vertexPath) });
+        m_sources.push_back({ GL_FRAGMENT_SHADER, readSource(fragmentPath) });
+        build();
+    }
+    // Constructor for programs with a geometry stage
+    Shader(const GLchar* vertexPath, const GLchar* geometryPath, const GLchar* fragmentPath)
+        : vertexShader{}, fragmentShader{}, m_name{ std::string(vertexPath) + " + " + geometryPath + " + " + fragmentPath }
+    {
+        m_sources.push_back({ GL_VERTEX_SHADER, readSource(vertexPath) });
+        m_sources.push_back({ GL_GEOMETRY_SHADER, readSource(geometryPath) });
+        m_sources.push_back({ GL_FRAGMENT_SHADER, readSource(fragmentPath) });
+        build();
+    }
+    // Constructor for a variant of a program: defines (lines of "#define NAME VALUE") are inserted after the #version line of
+    // every stage, and take part in the cache key with the rest of the source
+    Shader(const GLchar* vertexPath, const GLchar* fragmentPath, const std::string& defines)
+        : vertexShader{}, fragmentShader{}, m_name{ std::string(vertexPath) + " + " + fragmentPath + (defines.empty() ? "" : " [" + summarizeDefines(defines) + "]") }
+    {
+        m_sources.push_back({ GL_VERTEX_SHADER, injectDefines(readSource(vertexPath), defines) });
+        m_sources.push_back({ GL_FRAGMENT_SHADER, injectDefines(readSource(fragmentPath), defines) });
+        build();
+    }
+    // Constructor for compute programs
+    explicit Shader(const GLchar* computePath)
+        : vertexShader{}, fragmentShader{}, m_name{ computePath }
+    {
+        m_sources.push_back({ GL_COMPUTE_SHADER, readSource(computePath) });
+        build();
+    }
+
+    // Where linked programs are kept between runs, empty disables the cache. Applies to programs created afterwards
+    static void SetCacheDirectory(const std::string& directory) { cacheDirectory() = directory; }
+
+    // Waits for the program, reports compile and link errors and saves new binaries to the cache. Returns the link status
+    bool Finish()
+    {
+        if (m_finished)
+            return m_linked;
+        m_finished = true;
+
+        auto waitStart = std::chrono::steady_clock::now();
+        GLint linked{};
+        glGetProgramiv(this->Program, GL_LINK_STATUS, &linked);
+
+        m_linked = linked == GL_TRUE;
+        auto waitEnd = std::chrono::steady_clock::now();
+
+        if (!m_linked)
+            printBuildLog();
+        else if (!m_fromCache)
+            saveBinary();
+
+        std::cout << "Shader " << m_name << ": " << (m_fromCache ? "cached binary" : "compiled") << (m_linked ? "" : ", FAILED") << ", ready after "
+            << std::chrono::duration<double, std::milli>(waitEnd - m_buildStart).count() << " ms (waited "
+            << std::chrono::duration<double, std::milli>(waitEnd - waitStart).count() << " ms)" << std::endl;
+
+        // Cache the active uniforms and uniform blocks so nothing is looked up by name per frame
+        reflectInterface();
+        for (const auto& binding : m_pendingBlockBindings)
+            BindUniformBlock(binding.first, binding.second);
+        m_pendingBlockBindings.clear();
+        m_sources.clear();
+        return m_linked;
+    }
+
+    // True once the driver is done with the program, without blocking when parallel compilation is available
+    bool IsReady() const
+    {
+        if (m_finished || !parallelCompile())
+            return true;
+
+        GLint done{};
+        glGetProgramiv(this->Program, GL_COMPLETION_STATUS_KHR, &done);
+        return done == GL_TRUE;
+    }
+
+    // Uses the current shader
+    void Use()
+    {
+        if (!m_finished)
+            Finish();
+        GetGLState().UseProgram(this->Program);
+    }
+
+    // Returns the cached location of an active uniform, or -1 if the linker removed it
+    GLint GetUniformLocation(const std::string& name)
+    {
+        if (!m_finished)
+            Finish();
+        auto it = m_uniformLocations.find(name);
+        return it != m_uniformLocations.end() ? it->second : -1;
+    }
+
+    // Attaches an active uniform block to a uniform buffer binding point. Returns false if the block is not in this program.
+    // Before Finish() the binding is queued and true is returned
+    bool BindUniformBlock(const std::string& name, GLuint bindingPoint)
+    {
+        if (!m_finished)
+        {
+            m_pendingBlockBindings.push_back({ name, bindingPoint });
+            return true;
+        }
+
+        auto it = m_uniformBlockIndices.find(name);
+        if (it == m_uniformBlockIndices.end())
+            return false;
+
+        glUniformBlockBinding(this->Program, it->second, bindingPoint);
+        return true;
+    }
+    ~Shader()
+    {
+        GetGLState().DeleteProgram(Program);
+        glDeleteShader(fragmentShader);
+        glDeleteShader(vertexShader);
+        glDeleteShader(computeShader);
+        glDeleteShader(geometryShader);
+    }
+
+private:
+    std::unordered_map<std::string, GLint> m_uniformLocations;
+    std::unordered_map<std::string, GLuint> m_uniformBlockIndices;
+
+    std::string m_name;
+    std::vector<std::pair<GLenum, std::string>> m_sources;
+    std::vector<std::pair<std::string, GLuint>> m_pendingBlockBindings;
+    std::uint64_t m_cacheKey{};
+    std::chrono::steady_clock::time_point m_buildStart;
+    bool m_fromCache{};
+    bool m_finished{};
+    bool m_linked{};
+
+    // Layout of a cached program binary: this header then the driver's blob
+    struct ProgramBinaryHeader
+    {
+        char magic[4];
+        std::uint32_t version;
+        std::uint64_t key;
+        std::uint32_t format;
+        std::uint32_t length;
+    };
+    static constexpr std::uint32_t PROGRAM_BINARY_VERSION{ 1 };
+
+    static std::string& cacheDirectory()
+    {
+        static std::string directory{ SHADER_CACHE_DIRECTORY };
+        return directory;
+    }
+
+    // Asks the driver for background compiler threads once, true if it has them
+    static bool parallelCompile()
+    {
+        static bool available{ [] {
+            if (GLEW_KHR_parallel_shader_compile)
+                glMaxShaderCompilerThreadsKHR(0xFFFFFFFFu);
+            else if (GLEW_ARB_parallel_shader_compile)
+                glMaxShaderCompilerThreadsARB(0xFFFFFFFFu);
+            else
+                return false;
+            return true;
+        }() };
+        return available;
+    }
+
+    static std::string readSource(const GLchar* path)
+    {
+        std::ifstream shaderFile;
         // ensures ifstream objects can throw exceptions:
-        vShaderFile.exceptions(std::ifstream::badbit);
-        fShaderFile.exceptions(std::ifstream::badbit);
+        shaderFile.exceptions(std::ifstream::badbit);
         try
         {
-            // Open files
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
-            // Read file's buffer contents into streams
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();
-            // close file handlers
-            vShaderFile.close();
-            fShaderFile.close();
-            // Convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();
+            shaderFile.open(path);
+            std::stringstream shaderStream;
+            shaderStream << shaderFile.rdbuf();
+            shaderFile.close();
+            return shaderStream.str();
         }
-        catch (std::ifstream::failure e)
+        catch (const std::ifstream::failure&)
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
         }
-        const GLchar* vShaderCode = vertexCode.c_str();
-        const GLchar* fShaderCode = fragmentCode.c_str();
+        return {};
+    }
 
-        // Compile shaders
+    // The defines go right after the #version directive, which has to stay the first one in the source
+    static std::string injectDefines(const std::string& source, const std::string& defines)
+    {
+        size_t version{ source.find("#version") };
+        size_t lineEnd{ version == std::string::npos ? std::string::npos : source.find('\n', version) };
+        if (lineEnd == std::string::npos)
+            return source;
+        return source.substr(0, lineEnd + 1) + defines + (defines.empty() || defines.back() == '\n' ? "" : "\n") + source.substr(lineEnd + 1);
+    }
 
-        // Vertex Shader
-        vertexShader = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertexShader, 1, &vShaderCode, nullptr);
-        glCompileShader(vertexShader);
-        // Print compile errors if any
-        glCheckError();
+    // Names of the defines, for the messages about the program
+    static std::string summarizeDefines(const std::string& defines)
+    {
+        std::istringstream lines{ defines };
+        std::string line, summary;
+        while (std::getline(lines, line))
+        {
+            std::istringstream words{ line };
+            std::string directive, name;
+            if (!(words >> directive >> name) || directive != "#define")
+                continue;
+            summary += (summary.empty() ? "" : " ") + name;
+        }
+        return summary;
+    }
 
-        // Fragment Shader
-        fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragmentShader, 1, &fShaderCode, NULL);
-        glCompileShader(fragmentShader);
+    // Key of the program in the binary cache: every source plus the driver that would produce the binary
+    std::uint64_t computeCacheKey() const
+    {
+        std::uint64_t key{ FNV_OFFSET_BASIS };
+        for (const auto& source : m_sources)
+        {
+            key = HashBytes(&source.first, sizeof(source.first), key);
+            key = HashString(source.second, key);
+        }
+        for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
+        {
+            const GLubyte* text{ glGetString(name) };
+            if (text)
+                key = HashString(reinterpret_cast<const char*>(text), key);
+        }
+        return key;
+    }
 
-        // Print compile errors if any
-        glCheckError();
+    std::string cachePath() const
+    {
+        return cacheDirectory() + "/" + HashToString(m_cacheKey) + ".program";
+    }
 
-        // Shader Program
+    void build()
+    {
+        m_buildStart = std::chrono::steady_clock::now();
+        parallelCompile();
         this->Program = glCreateProgram();
-        glAttachShader(this->Program, vertexShader);
-        glAttachShader(this->Program, fragmentShader);
+        m_cacheKey = computeCacheKey();
+
+        m_fromCache = loadBinary();
+        if (!m_fromCache)
+            compileAndLink();
+    }
+
+    void compileAndLink()
+    {
+        for (const auto& source : m_sources)
+        {
+            const GLchar* code{ source.second.c_str() };
+            GLuint shader{ glCreateShader(source.first) };
+            glShaderSource(shader, 1, &code, nullptr);
+            glCompileShader(shader);
+            glAttachShader(this->Program, shader);
+
+            if (source.first == GL_VERTEX_SHADER)
+                vertexShader = shader;
+            else if (source.first == GL_FRAGMENT_SHADER)
+                fragmentShader = shader;
+            else if (source.first == GL_GEOMETRY_SHADER)
+                geometryShader = shader;
+            else
+                computeShader = shader;
+        }
+
+        glProgramParameteri(this->Program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
         glLinkProgram(this->Program);
-        // Print linking errors if any
         glCheckError();
+    }
+
+    bool loadBinary()
+    {
+        if (cacheDirectory().empty())
+            return false;
 
+        std::ifstream file(cachePath(), std::ios::binary);
+        ProgramBinaryHeader header{};
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || std::memcmp(header.magic, "PBIN", 4) != 0 ||
+            header.version != PROGRAM_BINARY_VERSION || header.key != m_cacheKey)
+            return false;
+
+        // The blob has to fit in what is left of the file, a truncated or corrupt cache never sizes the allocation
+        std::streamoff headerEnd{ file.tellg() };
+        file.seekg(0, std::ios::end);
+        std::streamoff remaining{ file.tellg() - headerEnd };
+        if (header.length == 0 || static_cast<std::streamoff>(header.length) > remaining)
+            return false;
+        file.seekg(headerEnd);
+
+        std::vector<char> binary(header.length);
+        if (!file.read(binary.data(), binary.size()))
+            return false;
+
+        // A binary from another driver build is refused through the link status, errors left by earlier calls are dropped first
+        while (glGetError() != GL_NO_ERROR)
+            continue;
+        glProgramBinary(this->Program, header.format, binary.data(), header.length);
+        GLint linked{};
+        glGetProgramiv(this->Program, GL_LINK_STATUS, &linked);
+        if (glGetError() != GL_NO_ERROR || !linked)
+        {
+            std::cout << "Shader cache: stale binary for " << m_name << ", recompiling" << std::endl;
+            return false;
+        }
+        return true;
     }
-    // Uses the current shader
-    void Use()
+
+    void saveBinary() const
     {
-        glUseProgram(this->Program);
+        GLint formats{};
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        if (cacheDirectory().empty() || formats == 0)
+            return;
+
+        GLint length{};
+        glGetProgramiv(this->Program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+
+        ProgramBinaryHeader header{};
+        std::memcpy(header.magic, "PBIN", 4);
+        header.version = PROGRAM_BINARY_VERSION;
+        header.key = m_cacheKey;
+        std::vector<char> binary(length);
+        glGetProgramBinary(this->Program, length, nullptr, &header.format, binary.data());
+        header.length = static_cast<std::uint32_t>(length);
+
+        std::error_code error{};
+        std::filesystem::create_directories(cacheDirectory(), error);
+
+        // Written under a temporary name and moved in place, so a crash never leaves a truncated binary behind
+        std::string path{ cachePath() }, temporary{ path + ".tmp" };
+        {
+            std::ofstream file(temporary, std::ios::binary);
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+            file.write(binary.data(), binary.size());
+            if (!file)
+                return;
+        }
+        std::filesystem::rename(temporary, path, error);
     }
-    ~Shader()
+
+    void printBuildLog() const
     {
-        glDeleteProgram(Program);
-        glDeleteShader(fragmentShader);
-        glDeleteShader(vertexShader);
+        GLchar infoLog[1024];
+        for (GLuint shader : { vertexShader, geometryShader, fragmentShader, computeShader })
+        {
+            GLint compiled{ GL_TRUE };
+            if (shader)
+                glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+            if (compiled)
+                continue;
+
+            glGetShaderInfoLog(shader, sizeof(infoLog), nullptr, infoLog);
+            std::cout << "ERROR::SHADER::COMPILATION_FAILED (" << m_name << ")\n" << infoLog << std::endl;
+        }
+
+        glGetProgramInfoLog(this->Program, sizeof(infoLog), nullptr, infoLog);
+        std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED (" << m_name << ")\n" << infoLog << std::endl;
+    }
+
+    // Queries every active uniform and uniform block once, right after linking
+    void reflectInterface()
+    {
+        GLint count{}, maxLength{};
+        glGetProgramiv(this->Program, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(this->Program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+        std::string name(maxLength > 0 ? maxLength : 1, '\0');
+        for (GLint i{ 0 }; i < count; ++i)
+        {
+            GLsizei length{};
+            GLint size{};
+            GLenum type{};
+            glGetActiveUniform(this->Program, i, maxLength, &length, &size, &type, &name[0]);
+            std::string uniformName{ name, 0, static_cast<size_t>(length) };
+
+            // Uniforms that live in a block have no location, they are set through the block's buffer
+            GLint location{ glGetUniformLocation(this->Program, uniformName.c_str()) };
+            if (location < 0)
+                continue;
+
+            m_uniformLocations[uniformName] = location;
+
+            // Arrays are reported as "name[0]", make them reachable by their plain name as well
+            if (uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0)
+                m_uniformLocations[uniformName.substr(0, uniformName.size() - 3)] = location;
+        }
+
+        glGetProgramiv(this->Program, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+        glGetProgramiv(this->Program, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxLength);
+
+        name.assign(maxLength > 0 ? maxLength : 1, '\0');
+        for (GLint i{ 0 }; i < count; ++i)
+        {
+            GLsizei length{};
+            glGetActiveUniformBlockName(this->Program, i, maxLength, &length, &name[0]);
+            m_uniformBlockIndices[std::string{ name, 0, static_cast<size_t>(length) }] = i;
+        }
+        glCheckError();
     }
 };
 
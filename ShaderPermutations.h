@@ -0,0 +1,251 @@
+#ifndef SHADER_PERMUTATIONS_H
+#define SHADER_PERMUTATIONS_H
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "Cubemap.h"
+#include "Shader.h"
+
+// Terms lighting.frag can be specialized for, keep in sync with its FEATURE_* defines. A material's mask (Material::features) picks
+// the first four, point lights are added for the whole frame when there are any
+enum LightingFeature : GLuint
+{
+    LIGHTING_PHONG = 1,             // ambient, diffuse and specular of the main light
+    LIGHTING_REFLECT = 2,           // environment along the reflected ray
+    LIGHTING_REFRACT = 4,           // environment along the refracted ray
+    LIGHTING_FRESNEL = 8,           // reflection and refraction looked up apart and weighed by the Fresnel factor, instead of one lookup between them
+    LIGHTING_POINT_LIGHTS = 16      // clustered point lights
+};
+
+// What every material was shaded with before the masks, and what a mask of 0 stands for
+constexpr GLuint LIGHTING_DEFAULT_FEATURES{ LIGHTING_PHONG | LIGHTING_REFLECT | LIGHTING_REFRACT };
+
+// Variant key of the program that reads each material's mask per pixel and branches on it
+constexpr GLuint LIGHTING_DYNAMIC_FEATURES{ 0 };
+
+// Frames between timing a variant's draws and reading the result, so reading never waits
+constexpr unsigned SHADER_VARIANT_QUERY_FRAMES{ 4 };
+
+inline GLuint ResolveMaterialFeatures(GLuint features)
+{
+    return features != 0 ? features : LIGHTING_DEFAULT_FEATURES;
+}
+
+const std::pair<GLuint, const char*> LIGHTING_FEATURE_NAMES[]{ { LIGHTING_PHONG, "phong" }, { LIGHTING_REFLECT, "reflect" },
+    { LIGHTING_REFRACT, "refract" }, { LIGHTING_FRESNEL, "fresnel" }, { LIGHTING_POINT_LIGHTS, "lights" } };
+
+inline std::string LightingFeatureNames(GLuint features)
+{
+    if (features == LIGHTING_DYNAMIC_FEATURES)
+        return "dynamic";
+
+    std::string result;
+    for (const auto& name : LIGHTING_FEATURE_NAMES)
+        if (features & name.first)
+            result += (result.empty() ? "" : "+") + std::string(name.second);
+    return result;
+}
+
+// The material part of a mask written by LightingFeatureNames ("phong+fresnel"), 0 when a name is unknown
+inline GLuint ParseMaterialFeatures(const std::string& text)
+{
+    GLuint features{ 0 };
+    for (size_t start{ 0 }; start <= text.size();)
+    {
+        size_t end{ std::min(text.find('+', start), text.size()) };
+        auto name = std::find_if(std::begin(LIGHTING_FEATURE_NAMES), std::end(LIGHTING_FEATURE_NAMES),
+            [&](const std::pair<GLuint, const char*>& entry) { return text.compare(start, end - start, entry.second) == 0; });
+        if (name == std::end(LIGHTING_FEATURE_NAMES) || name->first == LIGHTING_POINT_LIGHTS)
+            return 0;
+        features |= name->first;
+        start = end + 1;
+    }
+    return features;
+}
+
+// Defines lighting.frag is specialized with; the dynamic variant gets none and keeps the per pixel branches
+inline std::string LightingFeatureDefines(GLuint features)
+{
+    if (features == LIGHTING_DYNAMIC_FEATURES)
+        return {};
+    return "#define LIGHTING_FEATURES " + std::to_string(features) + "u\n";
+}
+
+// One program of the set, timed on the GPU whenever it draws
+struct ShaderVariantStats
+{
+    GLuint features{};
+    unsigned long long frames{};    // measured frames it drew in
+    double gpuMs{};                 // last measured, SHADER_VARIANT_QUERY_FRAMES behind
+    double averageGpuMs{};          // smoothed
+    double readyMs{};               // from the first request until it could draw
+};
+
+inline void PrintShaderVariantStats(const std::vector<ShaderVariantStats>& stats)
+{
+    if (stats.empty())
+        return;
+
+    std::cout << "  shader variants: " << stats.size() << " built" << std::endl;
+    for (const ShaderVariantStats& variant : stats)
+    {
+        std::cout << "    " << LightingFeatureNames(variant.features) << ": ";
+        if (variant.frames > 0)
+            std::cout << variant.averageGpuMs << " ms GPU (last " << variant.gpuMs << " ms) over " << variant.frames << " frames";
+        else
+            std::cout << "not measured yet";
+        std::cout << ", ready " << variant.readyMs << " ms after its first use" << std::endl;
+    }
+}
+
+// Variants of one vertex and fragment program pair, specialized by a feature mask. A variant is compiled the first time its mask is
+// asked for (or ahead of time with Prepare) and kept; the uniform block bindings given here apply to all of them. Draws between
+// BeginTiming and EndTiming are timed per variant with timestamp queries, read back a few frames later
+class ShaderPermutations
+{
+private:
+    struct Variant
+    {
+        std::unique_ptr<Shader> shader;
+        GLuint queries[SHADER_VARIANT_QUERY_FRAMES][2]{};
+        bool issued[SHADER_VARIANT_QUERY_FRAMES]{};
+        std::chrono::steady_clock::time_point requested;
+        bool ready{};
+        ShaderVariantStats stats{};
+    };
+
+    std::string m_vertexPath;
+    std::string m_fragmentPath;
+    std::string m_defines;              // common to every variant
+    std::vector<std::pair<std::string, GLuint>> m_blockBindings;
+    std::map<GLuint, std::unique_ptr<Variant>> m_variants;
+    unsigned m_frame{};
+
+    Variant& variant(GLuint features)
+    {
+        std::unique_ptr<Variant>& entry{ m_variants[features] };
+        if (entry)
+            return *entry;
+
+        entry.reset(new Variant{});
+        entry->stats.features = features;
+        entry->requested = std::chrono::steady_clock::now();
+        entry->shader.reset(new Shader(m_vertexPath.c_str(), m_fragmentPath.c_str(), m_defines + LightingFeatureDefines(features)));
+        for (const auto& binding : m_blockBindings)
+            entry->shader->BindUniformBlock(binding.first, binding.second);
+        for (GLuint* queries : entry->queries)
+            glGenQueries(2, queries);
+        return *entry;
+    }
+
+    // Reads a frame's timestamps if they are there, never waits
+    static void collectTiming(Variant& entry, unsigned slot)
+    {
+        if (!entry.issued[slot])
+            return;
+
+        GLint available{};
+        glGetQueryObjectiv(entry.queries[slot][1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            return;
+
+        GLuint64 begin{}, end{};
+        glGetQueryObjectui64v(entry.queries[slot][0], GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(entry.queries[slot][1], GL_QUERY_RESULT, &end);
+        entry.issued[slot] = false;
+
+        double ms{ (end - begin) / 1.0e6 };
+        ShaderVariantStats& stats{ entry.stats };
+        stats.gpuMs = ms;
+        stats.averageGpuMs = stats.frames > 0 ? 0.9 * stats.averageGpuMs + 0.1 * ms : ms;
+        ++stats.frames;
+    }
+
+public:
+    ShaderPermutations(const GLchar* vertexPath, const GLchar* fragmentPath, const std::string& defines = {})
+        : m_vertexPath{ vertexPath }, m_fragmentPath{ fragmentPath }, m_defines{ defines }
+    {
+    }
+
+    ~ShaderPermutations()
+    {
+        for (auto& entry : m_variants)
+            for (GLuint* queries : entry.second->queries)
+                glDeleteQueries(2, queries);
+    }
+
+    ShaderPermutations(const ShaderPermutations&) = delete;
+    ShaderPermutations& operator=(const ShaderPermutations&) = delete;
+
+    // Applies to the variants built so far and to every later one
+    void BindUniformBlock(const std::string& name, GLuint bindingPoint)
+    {
+        m_blockBindings.push_back({ name, bindingPoint });
+        for (auto& entry : m_variants)
+            entry.second->shader->BindUniformBlock(name, bindingPoint);
+    }
+
+    // Starts compiling a variant without waiting for it
+    void Prepare(GLuint features) { variant(features); }
+
+    // Waits for every variant requested so far
+    void Finish()
+    {
+        for (auto& entry : m_variants)
+            Get(entry.first);
+    }
+
+    // The variant for features, finished and ready to use
+    Shader& Get(GLuint features)
+    {
+        Variant& entry{ variant(features) };
+        if (!entry.ready)
+        {
+            entry.shader->Finish();
+            entry.ready = true;
+            entry.stats.readyMs = ElapsedMilliseconds(entry.requested, std::chrono::steady_clock::now());
+        }
+        return *entry.shader;
+    }
+
+    // Brackets one variant's draws of this frame, at most once per variant and frame
+    void BeginTiming(GLuint features)
+    {
+        Variant& entry{ variant(features) };
+        unsigned slot{ m_frame % SHADER_VARIANT_QUERY_FRAMES };
+        collectTiming(entry, slot);
+        glQueryCounter(entry.queries[slot][0], GL_TIMESTAMP);
+    }
+
+    void EndTiming(GLuint features)
+    {
+        Variant& entry{ variant(features) };
+        unsigned slot{ m_frame % SHADER_VARIANT_QUERY_FRAMES };
+        glQueryCounter(entry.queries[slot][1], GL_TIMESTAMP);
+        entry.issued[slot] = true;
+    }
+
+    void EndFrame() { ++m_frame; }
+
+    size_t GetVariantCount() const { return m_variants.size(); }
+
+    std::vector<ShaderVariantStats> GetStats() const
+    {
+        std::vector<ShaderVariantStats> stats;
+        for (const auto& entry : m_variants)
+            stats.push_back(entry.second->stats);
+        return stats;
+    }
+};
+
+#endif
@@ -0,0 +1,188 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cmath>
+
+// Float lanes for the software renderer: 8 wide with AVX2, 4 wide with SSE2 (every x86-64 target), one lane otherwise.
+// Only the handful of operations the shading code needs, everything else is done lane by lane through Store()/Load()
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_LANE_COUNT 8
+#define SIMD_INSTRUCTION_SET "AVX2"
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMD_LANE_COUNT 4
+#define SIMD_INSTRUCTION_SET "SSE2"
+#else
+#define SIMD_LANE_COUNT 1
+#define SIMD_INSTRUCTION_SET "scalar"
+#endif
+
+constexpr int LANES{ SIMD_LANE_COUNT };
+
+struct FloatLanes
+{
+#if SIMD_LANE_COUNT == 8
+    __m256 v;
+
+    FloatLanes() : v{ _mm256_setzero_ps() } {}
+    FloatLanes(__m256 value) : v{ value } {}
+    FloatLanes(float value) : v{ _mm256_set1_ps(value) } {}
+
+    static FloatLanes Load(const float* values) { return _mm256_loadu_ps(values); }
+    void Store(float* values) const { _mm256_storeu_ps(values, v); }
+    static FloatLanes Ramp() { return _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f); }
+
+    friend FloatLanes operator+(FloatLanes a, FloatLanes b) { return _mm256_add_ps(a.v, b.v); }
+    friend FloatLanes operator-(FloatLanes a, FloatLanes b) { return _mm256_sub_ps(a.v, b.v); }
+    friend FloatLanes operator*(FloatLanes a, FloatLanes b) { return _mm256_mul_ps(a.v, b.v); }
+    friend FloatLanes operator/(FloatLanes a, FloatLanes b) { return _mm256_div_ps(a.v, b.v); }
+    friend FloatLanes Min(FloatLanes a, FloatLanes b) { return _mm256_min_ps(a.v, b.v); }
+    friend FloatLanes Max(FloatLanes a, FloatLanes b) { return _mm256_max_ps(a.v, b.v); }
+    friend FloatLanes Sqrt(FloatLanes a) { return _mm256_sqrt_ps(a.v); }
+
+    // Comparisons return all-ones lanes where true, usable with Select() and Mask()
+    friend FloatLanes operator<(FloatLanes a, FloatLanes b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+    friend FloatLanes operator>(FloatLanes a, FloatLanes b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+    friend FloatLanes operator>=(FloatLanes a, FloatLanes b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+    friend FloatLanes operator&(FloatLanes a, FloatLanes b) { return _mm256_and_ps(a.v, b.v); }
+    friend FloatLanes operator|(FloatLanes a, FloatLanes b) { return _mm256_or_ps(a.v, b.v); }
+    friend FloatLanes Select(FloatLanes mask, FloatLanes a, FloatLanes b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+    friend int Mask(FloatLanes mask) { return _mm256_movemask_ps(mask.v); }
+#elif SIMD_LANE_COUNT == 4
+    __m128 v;
+
+    FloatLanes() : v{ _mm_setzero_ps() } {}
+    FloatLanes(__m128 value) : v{ value } {}
+    FloatLanes(float value) : v{ _mm_set1_ps(value) } {}
+
+    static FloatLanes Load(const float* values) { return _mm_loadu_ps(values); }
+    void Store(float* values) const { _mm_storeu_ps(values, v); }
+    static FloatLanes Ramp() { return _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f); }
+
+    friend FloatLanes operator+(FloatLanes a, FloatLanes b) { return _mm_add_ps(a.v, b.v); }
+    friend FloatLanes operator-(FloatLanes a, FloatLanes b) { return _mm_sub_ps(a.v, b.v); }
+    friend FloatLanes operator*(FloatLanes a, FloatLanes b) { return _mm_mul_ps(a.v, b.v); }
+    friend FloatLanes operator/(FloatLanes a, FloatLanes b) { return _mm_div_ps(a.v, b.v); }
+    friend FloatLanes Min(FloatLanes a, FloatLanes b) { return _mm_min_ps(a.v, b.v); }
+    friend FloatLanes Max(FloatLanes a, FloatLanes b) { return _mm_max_ps(a.v, b.v); }
+    friend FloatLanes Sqrt(FloatLanes a) { return _mm_sqrt_ps(a.v); }
+
+    friend FloatLanes operator<(FloatLanes a, FloatLanes b) { return _mm_cmplt_ps(a.v, b.v); }
+    friend FloatLanes operator>(FloatLanes a, FloatLanes b) { return _mm_cmpgt_ps(a.v, b.v); }
+    friend FloatLanes operator>=(FloatLanes a, FloatLanes b) { return _mm_cmpge_ps(a.v, b.v); }
+    friend FloatLanes operator&(FloatLanes a, FloatLanes b) { return _mm_and_ps(a.v, b.v); }
+    friend FloatLanes operator|(FloatLanes a, FloatLanes b) { return _mm_or_ps(a.v, b.v); }
+    friend FloatLanes Select(FloatLanes mask, FloatLanes a, FloatLanes b) { return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); }
+    friend int Mask(FloatLanes mask) { return _mm_movemask_ps(mask.v); }
+#else
+    float v;
+
+    FloatLanes() : v{ 0.0f } {}
+    FloatLanes(float value) : v{ value } {}
+
+    static FloatLanes Load(const float* values) { return values[0]; }
+    void Store(float* values) const { values[0] = v; }
+    static FloatLanes Ramp() { return 0.0f; }
+
+    friend FloatLanes operator+(FloatLanes a, FloatLanes b) { return a.v + b.v; }
+    friend FloatLanes operator-(FloatLanes a, FloatLanes b) { return a.v - b.v; }
+    friend FloatLanes operator*(FloatLanes a, FloatLanes b) { return a.v * b.v; }
+    friend FloatLanes operator/(FloatLanes a, FloatLanes b) { return a.v / b.v; }
+    friend FloatLanes Min(FloatLanes a, FloatLanes b) { return a.v < b.v ? a.v : b.v; }
+    friend FloatLanes Max(FloatLanes a, FloatLanes b) { return a.v > b.v ? a.v : b.v; }
+    friend FloatLanes Sqrt(FloatLanes a) { return std::sqrt(a.v); }
+
+    // Masks are 1.0 or 0.0 in the scalar build
+    friend FloatLanes operator<(FloatLanes a, FloatLanes b) { return a.v < b.v ? 1.0f : 0.0f; }
+    friend FloatLanes operator>(FloatLanes a, FloatLanes b) { return a.v > b.v ? 1.0f : 0.0f; }
+    friend FloatLanes operator>=(FloatLanes a, FloatLanes b) { return a.v >= b.v ? 1.0f : 0.0f; }
+    friend FloatLanes operator&(FloatLanes a, FloatLanes b) { return a.v != 0.0f && b.v != 0.0f ? 1.0f : 0.0f; }
+    friend FloatLanes operator|(FloatLanes a, FloatLanes b) { return a.v != 0.0f || b.v != 0.0f ? 1.0f : 0.0f; }
+    friend FloatLanes Select(FloatLanes mask, FloatLanes a, FloatLanes b) { return mask.v != 0.0f ? a.v : b.v; }
+    friend int Mask(FloatLanes mask) { return mask.v != 0.0f ? 1 : 0; }
+#endif
+
+    FloatLanes& operator+=(FloatLanes other) { return *this = *this + other; }
+    FloatLanes& operator*=(FloatLanes other) { return *this = *this * other; }
+};
+
+inline FloatLanes Clamp(FloatLanes value, FloatLanes low, FloatLanes high) { return Min(Max(value, low), high); }
+
+inline float HorizontalSum(FloatLanes a)
+{
+    alignas(32) float values[LANES];
+    a.Store(values);
+    float sum{ 0.0f };
+    for (int i{ 0 }; i < LANES; ++i)
+        sum += values[i];
+    return sum;
+}
+
+// Loads the first count values and zeros the remaining lanes, for the end of a row
+inline FloatLanes LoadPartial(const float* values, int count)
+{
+    if (count >= LANES)
+        return FloatLanes::Load(values);
+
+    alignas(32) float padded[LANES]{};
+    for (int i{ 0 }; i < count; ++i)
+        padded[i] = values[i];
+    return FloatLanes::Load(padded);
+}
+
+// Runs a scalar function on every lane, for the rare operations without a vector form (pow)
+template<typename Function>
+inline FloatLanes PerLane(FloatLanes a, FloatLanes b, Function function)
+{
+    alignas(32) float x[LANES], y[LANES];
+    a.Store(x);
+    b.Store(y);
+    for (int i{ 0 }; i < LANES; ++i)
+        x[i] = function(x[i], y[i]);
+    return FloatLanes::Load(x);
+}
+
+// Three float lanes, one vec3 per lane
+struct Vec3Lanes
+{
+    FloatLanes x, y, z;
+
+    Vec3Lanes() = default;
+    Vec3Lanes(FloatLanes x_, FloatLanes y_, FloatLanes z_) : x{ x_ }, y{ y_ }, z{ z_ } {}
+    Vec3Lanes(float x_, float y_, float z_) : x{ x_ }, y{ y_ }, z{ z_ } {}
+
+    friend Vec3Lanes operator+(const Vec3Lanes& a, const Vec3Lanes& b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+    friend Vec3Lanes operator-(const Vec3Lanes& a, const Vec3Lanes& b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+    friend Vec3Lanes operator*(const Vec3Lanes& a, const Vec3Lanes& b) { return { a.x * b.x, a.y * b.y, a.z * b.z }; }
+    friend Vec3Lanes operator*(const Vec3Lanes& a, FloatLanes s) { return { a.x * s, a.y * s, a.z * s }; }
+};
+
+inline FloatLanes Dot(const Vec3Lanes& a, const Vec3Lanes& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+
+inline Vec3Lanes Cross(const Vec3Lanes& a, const Vec3Lanes& b) { return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x }; }
+
+inline Vec3Lanes Normalize(const Vec3Lanes& a) { return a * (FloatLanes(1.0f) / Sqrt(Dot(a, a))); }
+
+inline Vec3Lanes Mix(const Vec3Lanes& a, const Vec3Lanes& b, FloatLanes t) { return a + (b - a) * t; }
+
+inline Vec3Lanes Select(FloatLanes mask, const Vec3Lanes& a, const Vec3Lanes& b)
+{
+    return { Select(mask, a.x, b.x), Select(mask, a.y, b.y), Select(mask, a.z, b.z) };
+}
+
+// GLSL reflect() and refract()
+inline Vec3Lanes Reflect(const Vec3Lanes& incident, const Vec3Lanes& normal)
+{
+    return incident - normal * (FloatLanes(2.0f) * Dot(normal, incident));
+}
+
+inline Vec3Lanes Refract(const Vec3Lanes& incident, const Vec3Lanes& normal, float eta)
+{
+    FloatLanes cosine{ Dot(normal, incident) };
+    FloatLanes k{ FloatLanes(1.0f) - FloatLanes(eta * eta) * (FloatLanes(1.0f) - cosine * cosine) };
+    Vec3Lanes refracted{ incident * FloatLanes(eta) - normal * (FloatLanes(eta) * cosine + Sqrt(Max(k, 0.0f))) };
+    return Select(k < FloatLanes(0.0f), Vec3Lanes(0.0f, 0.0f, 0.0f), refracted);
+}
+
+#endif
@@ -0,0 +1,847 @@
+#ifndef SOFTWARE_RENDERER_H
+#define SOFTWARE_RENDERER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <SOIL2.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Camera.h"
+#include "CameraPath.h"
+#include "Cubemap.h"
+#include "EnvironmentLighting.h"
+#include "GpuCulling.h"
+#include "Mesh.h"
+#include "Options.h"
+#include "Ppm.h"
+#include "Renderer.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include "UniformBlocks.h"
+
+// Screen tiles handed to the raster threads, a multiple of the lane count
+constexpr int SOFTWARE_TILE_SIZE{ 64 };
+static_assert(SOFTWARE_TILE_SIZE % LANES == 0, "tiles must hold whole lane groups");
+
+// Largest per-channel difference that still counts as a match when comparing against the GL frames
+constexpr int SOFTWARE_COMPARE_TOLERANCE{ 8 };
+
+constexpr GLuint NO_TRIANGLE{ 0xFFFFFFFFu };
+
+// The skybox faces on the CPU, sampled like the GL texture with GL_LINEAR and GL_CLAMP_TO_EDGE (no mipmaps, so compare
+// against a GL run using --no-environment-cache)
+class SoftwareCubemap
+{
+private:
+    DecodedImage m_faces[6]{};
+    int m_size{};
+
+    glm::vec3 texel(int face, int x, int y) const
+    {
+        const unsigned char* pixel{ m_faces[face].pixels + (static_cast<size_t>(y) * m_size + x) * 3 };
+        return glm::vec3(pixel[0], pixel[1], pixel[2]) * (1.0f / 255.0f);
+    }
+
+public:
+    // Decodes the six faces on the pool, in GL_TEXTURE_CUBE_MAP_POSITIVE_X + i order
+    SoftwareCubemap(ThreadPool& pool, const std::vector<const GLchar*>& faces)
+    {
+        std::vector<std::future<DecodedImage>> decoded;
+        for (GLuint i{ 0 }; i < faces.size() && i < 6; ++i)
+        {
+            const GLchar* path{ faces[i] };
+            decoded.push_back(pool.Submit([path, i]() { return DecodeCubemapImage(path, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0); }));
+        }
+        for (size_t i{ 0 }; i < decoded.size(); ++i)
+            m_faces[i] = decoded[i].get();
+
+        m_size = m_faces[0].width;
+        for (const DecodedImage& face : m_faces)
+            if (!face.pixels || face.width != m_size || face.height != m_size)
+                m_size = 0;
+    }
+
+    ~SoftwareCubemap()
+    {
+        for (DecodedImage& face : m_faces)
+            if (face.pixels)
+                SOIL_free_image_data(face.pixels);
+    }
+
+    SoftwareCubemap(const SoftwareCubemap&) = delete;
+    SoftwareCubemap& operator=(const SoftwareCubemap&) = delete;
+
+    bool IsValid() const { return m_size > 0; }
+
+    // Face selection as in the GL specification, then a bilinear fetch
+    glm::vec3 Sample(float x, float y, float z) const
+    {
+        float s{}, t{};
+        int face{ SelectCubemapFace(x, y, z, s, t) };
+        float u{ s * m_size - 0.5f };
+        float v{ t * m_size - 0.5f };
+        float u0{ std::floor(u) }, v0{ std::floor(v) };
+        float fu{ u - u0 }, fv{ v - v0 };
+
+        int x0{ std::clamp(static_cast<int>(u0), 0, m_size - 1) }, x1{ std::clamp(static_cast<int>(u0) + 1, 0, m_size - 1) };
+        int y0{ std::clamp(static_cast<int>(v0), 0, m_size - 1) }, y1{ std::clamp(static_cast<int>(v0) + 1, 0, m_size - 1) };
+
+        glm::vec3 top{ glm::mix(texel(face, x0, y0), texel(face, x1, y0), fu) };
+        glm::vec3 bottom{ glm::mix(texel(face, x0, y1), texel(face, x1, y1), fu) };
+        return glm::mix(top, bottom, fv);
+    }
+};
+
+// Values gathered per lane when shading a pixel, all of them planes or deltas so interpolation is a few multiply-adds
+enum SoftwareShadeField
+{
+    SHADE_L1_X, SHADE_L1_Y, SHADE_L1_C,     // screen-space barycentric of vertex 1 as a plane
+    SHADE_L2_X, SHADE_L2_Y, SHADE_L2_C,     // ... and of vertex 2
+    SHADE_INV_W0, SHADE_INV_W1, SHADE_INV_W2,
+    SHADE_POSITION = 9,                     // world position of vertex 0, then vertex 1 - 0 and vertex 2 - 0
+    SHADE_POSITION_D1 = 12,
+    SHADE_POSITION_D2 = 15,
+    SHADE_NORMAL = 18,                      // same for the normal
+    SHADE_NORMAL_D1 = 21,
+    SHADE_NORMAL_D2 = 24,
+    SHADE_FIELD_COUNT = 27
+};
+
+// Material fields in the same gather-friendly form
+enum SoftwareMaterialField
+{
+    MATERIAL_AMBIENT = 0,
+    MATERIAL_DIFFUSE = 3,
+    MATERIAL_SPECULAR = 6,
+    MATERIAL_SHININESS = 9,
+    MATERIAL_FIELD_COUNT = 10
+};
+
+// A set-up triangle in window coordinates (y up, like GL), counter-clockwise
+struct SoftwareTriangle
+{
+    float edgeX[3]{}, edgeY[3]{}, edgeC[3]{};   // edge i is opposite vertex i, positive inside
+    bool topLeft[3]{};                          // owns the pixels exactly on the edge
+    float depthX{}, depthY{}, depthC{};         // window depth as a plane
+    int minX{}, maxX{}, minY{}, maxY{};         // pixels whose centre is inside the bounds
+    GLuint materialIndex{};
+    float shade[SHADE_FIELD_COUNT]{};
+};
+
+// A transformed vertex before clipping
+struct SoftwareVertex
+{
+    glm::vec4 clip;
+    glm::vec3 position;
+    glm::vec3 normal;
+};
+
+// Triangles set up by one geometry task, binned per tile
+struct SoftwareChunk
+{
+    std::vector<SoftwareTriangle> triangles;
+    std::vector<std::vector<GLuint>> bins;
+};
+
+// One instance that survived the CPU copy of the culling pass
+struct SoftwareDraw
+{
+    GLuint instance{};
+    GLuint lod{};
+};
+
+struct SoftwareFrameStats
+{
+    double cullMs{};
+    double geometryMs{};
+    double rasterMs{};
+    double totalMs{};
+    size_t triangles{};
+    size_t visibleInstances{};
+};
+
+// Reference renderer for the GL path: the same scene, camera, culling/LOD choice and lighting.frag/skybox shading, rasterized on the CPU.
+// Geometry is transformed and binned by chunks of instances on the pool, then each tile is rasterized into a visibility buffer
+// (depth + triangle) and shaded once per pixel, LANES pixels at a time. Pixel centres, the top-left fill rule and the depth test
+// follow GL so the output can be compared with the GL frames pixel for pixel
+class SoftwareRenderer
+{
+private:
+    const SoftwareCubemap& m_cubemap;
+    FloatCubemap m_prefiltered;             // --ibl only, the chain lighting.frag reads with textureLod
+    glm::vec3 m_irradiance[9]{};
+    float m_prefilteredMaxLod{};
+    MeshData m_mesh;
+    TransformStore m_transforms;
+    std::vector<glm::vec3> m_basePositions;         // --animate moves the spheres around these every frame
+    std::vector<SphereInstance> m_instances;
+    bool m_animate{};
+    std::vector<float> m_materials;
+    glm::vec3 m_lightPosition{ LIGHT_POSITION };
+    bool m_culling{};
+
+    int m_width{};
+    int m_height{};
+    int m_tilesX{};
+    int m_tilesY{};
+    std::vector<unsigned char> m_color;     // RGB8, bottom row first
+
+    glm::mat4 m_projection{};
+    std::vector<SoftwareDraw> m_draws;
+    std::vector<SoftwareChunk> m_chunks;
+    std::vector<GLuint> m_chunkBase;
+
+    // Per-frame constants of the shading pass
+    glm::vec3 m_cameraPosition{};
+    glm::mat3 m_inverseRotation{};
+    LightBlock m_light{};
+
+    // Mirrors cull.comp: sphere against the frustum, then the LOD from the projected diameter
+    void cull(const glm::mat4& view, float viewportHeight)
+    {
+        m_draws.clear();
+        GLuint lodCount{ static_cast<GLuint>(std::min<size_t>(m_mesh.lods.size(), MAX_CULL_LODS)) };
+        if (!m_culling)
+        {
+            for (GLuint i{ 0 }; i < m_instances.size(); ++i)
+                m_draws.push_back({ i, 0 });
+            return;
+        }
+
+        glm::vec4 planes[6];
+        ExtractFrustumPlanes(m_projection * view, planes);
+        float projectionScale{ m_projection[1][1] * viewportHeight };
+
+        for (GLuint i{ 0 }; i < m_instances.size(); ++i)
+        {
+            const glm::mat4& model{ m_instances[i].model };
+            glm::vec3 center{ model[3] };
+            float scale{ std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2])))) };
+            float sphereRadius{ radius * scale };
+
+            bool visible{ true };
+            for (const glm::vec4& plane : planes)
+                visible = visible && glm::dot(glm::vec3(plane), center) + plane.w >= -sphereRadius;
+            if (!visible)
+                continue;
+
+            float distance{ std::max(glm::length(center - m_cameraPosition), 1e-4f) };
+            float diameter{ sphereRadius * projectionScale / distance };
+
+            GLuint lod{ 0 };
+            while (lod + 1 < lodCount && diameter < DEFAULT_LOD_THRESHOLDS[lod])
+                ++lod;
+            m_draws.push_back({ i, lod });
+        }
+    }
+
+    // Perspective divide, viewport transform, back-face rejection and binning of one clipped triangle
+    void setupTriangle(SoftwareChunk& chunk, const SoftwareVertex& v0, const SoftwareVertex& v1, const SoftwareVertex& v2, GLuint materialIndex) const
+    {
+        const SoftwareVertex* vertices[3]{ &v0, &v1, &v2 };
+        float x[3], y[3], z[3], invW[3];
+        for (int i{ 0 }; i < 3; ++i)
+        {
+            invW[i] = 1.0f / vertices[i]->clip.w;
+            x[i] = (vertices[i]->clip.x * invW[i] * 0.5f + 0.5f) * m_width;
+            y[i] = (vertices[i]->clip.y * invW[i] * 0.5f + 0.5f) * m_height;
+            z[i] = vertices[i]->clip.z * invW[i] * 0.5f + 0.5f;
+        }
+
+        // The spheres are closed, so back faces never survive the depth test and can be dropped here
+        float area{ (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]) };
+        if (!(area > 0.0f))
+            return;
+
+        SoftwareTriangle triangle{};
+        triangle.minX = std::max(0, static_cast<int>(std::ceil(std::min({ x[0], x[1], x[2] }) - 0.5f)));
+        triangle.maxX = std::min(m_width - 1, static_cast<int>(std::floor(std::max({ x[0], x[1], x[2] }) - 0.5f)));
+        triangle.minY = std::max(0, static_cast<int>(std::ceil(std::min({ y[0], y[1], y[2] }) - 0.5f)));
+        triangle.maxY = std::min(m_height - 1, static_cast<int>(std::floor(std::max({ y[0], y[1], y[2] }) - 0.5f)));
+        if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+            return;
+
+        for (int i{ 0 }; i < 3; ++i)
+        {
+            int a{ (i + 1) % 3 }, b{ (i + 2) % 3 };
+            float dx{ x[b] - x[a] }, dy{ y[b] - y[a] };
+            triangle.edgeX[i] = -dy;
+            triangle.edgeY[i] = dx;
+            triangle.edgeC[i] = dy * x[a] - dx * y[a];
+            triangle.topLeft[i] = dy < 0.0f || (dy == 0.0f && dx < 0.0f);
+        }
+
+        float invArea{ 1.0f / area };
+        float* shade{ triangle.shade };
+        shade[SHADE_L1_X] = triangle.edgeX[1] * invArea;
+        shade[SHADE_L1_Y] = triangle.edgeY[1] * invArea;
+        shade[SHADE_L1_C] = triangle.edgeC[1] * invArea;
+        shade[SHADE_L2_X] = triangle.edgeX[2] * invArea;
+        shade[SHADE_L2_Y] = triangle.edgeY[2] * invArea;
+        shade[SHADE_L2_C] = triangle.edgeC[2] * invArea;
+
+        triangle.depthX = shade[SHADE_L1_X] * (z[1] - z[0]) + shade[SHADE_L2_X] * (z[2] - z[0]);
+        triangle.depthY = shade[SHADE_L1_Y] * (z[1] - z[0]) + shade[SHADE_L2_Y] * (z[2] - z[0]);
+        triangle.depthC = z[0] + shade[SHADE_L1_C] * (z[1] - z[0]) + shade[SHADE_L2_C] * (z[2] - z[0]);
+
+        for (int i{ 0 }; i < 3; ++i)
+        {
+            shade[SHADE_INV_W0 + i] = invW[i];
+            shade[SHADE_POSITION + i] = v0.position[i];
+            shade[SHADE_POSITION_D1 + i] = v1.position[i] - v0.position[i];
+            shade[SHADE_POSITION_D2 + i] = v2.position[i] - v0.position[i];
+            shade[SHADE_NORMAL + i] = v0.normal[i];
+            shade[SHADE_NORMAL_D1 + i] = v1.normal[i] - v0.normal[i];
+            shade[SHADE_NORMAL_D2 + i] = v2.normal[i] - v0.normal[i];
+        }
+        triangle.materialIndex = materialIndex;
+
+        GLuint index{ static_cast<GLuint>(chunk.triangles.size()) };
+        for (int tileY{ triangle.minY / SOFTWARE_TILE_SIZE }; tileY <= triangle.maxY / SOFTWARE_TILE_SIZE; ++tileY)
+            for (int tileX{ triangle.minX / SOFTWARE_TILE_SIZE }; tileX <= triangle.maxX / SOFTWARE_TILE_SIZE; ++tileX)
+                chunk.bins[tileY * m_tilesX + tileX].push_back(index);
+        chunk.triangles.push_back(triangle);
+    }
+
+    static SoftwareVertex lerpVertex(const SoftwareVertex& a, const SoftwareVertex& b, float t)
+    {
+        return { a.clip + (b.clip - a.clip) * t, a.position + (b.position - a.position) * t, a.normal + (b.normal - a.normal) * t };
+    }
+
+    // Clips against the near plane (z >= -w), the other planes are handled by the guard band and the pixel bounds
+    void clipTriangle(SoftwareChunk& chunk, const SoftwareVertex& v0, const SoftwareVertex& v1, const SoftwareVertex& v2, GLuint materialIndex) const
+    {
+        const SoftwareVertex* input[3]{ &v0, &v1, &v2 };
+        float distance[3];
+        bool inside{ true };
+        for (int i{ 0 }; i < 3; ++i)
+        {
+            distance[i] = input[i]->clip.z + input[i]->clip.w;
+            inside = inside && distance[i] >= 0.0f;
+        }
+        if (inside)
+        {
+            setupTriangle(chunk, v0, v1, v2, materialIndex);
+            return;
+        }
+
+        SoftwareVertex polygon[4];
+        int count{ 0 };
+        for (int i{ 0 }; i < 3; ++i)
+        {
+            int next{ (i + 1) % 3 };
+            if (distance[i] >= 0.0f)
+                polygon[count++] = *input[i];
+            if ((distance[i] >= 0.0f) != (distance[next] >= 0.0f))
+                polygon[count++] = lerpVertex(*input[i], *input[next], distance[i] / (distance[i] - distance[next]));
+        }
+        for (int i{ 1 }; i + 1 < count; ++i)
+            setupTriangle(chunk, polygon[0], polygon[i], polygon[i + 1], materialIndex);
+    }
+
+    // Transforms, clips and bins the draws [first, last)
+    void processGeometry(SoftwareChunk& chunk, const glm::mat4& viewProjection, size_t first, size_t last) const
+    {
+        chunk.triangles.clear();
+        chunk.bins.assign(static_cast<size_t>(m_tilesX) * m_tilesY, {});
+
+        std::vector<SoftwareVertex> transformed;
+        for (size_t d{ first }; d < last; ++d)
+        {
+            const SphereInstance& instance{ m_instances[m_draws[d].instance] };
+            const glm::vec4* columns{ instance.normalMatrix };
+            const glm::mat3 normalMatrix{ glm::vec3(columns[0]), glm::vec3(columns[1]), glm::vec3(columns[2]) };
+            const MeshLod& lod{ m_mesh.lods[m_draws[d].lod] };
+
+            transformed.resize(lod.vertexCount);
+            for (GLuint v{ 0 }; v < lod.vertexCount; ++v)
+            {
+                const MeshVertex& vertex{ m_mesh.vertices[lod.baseVertex + v] };
+                glm::vec4 world{ instance.model * glm::vec4(vertex.position, 1.0f) };
+                transformed[v] = { viewProjection * world, glm::vec3(world), normalMatrix * vertex.normal };
+            }
+
+            for (GLuint i{ 0 }; i < lod.indexCount; i += 3)
+            {
+                const SoftwareVertex& a{ transformed[m_mesh.indices[lod.firstIndex + i]] };
+                const SoftwareVertex& b{ transformed[m_mesh.indices[lod.firstIndex + i + 1]] };
+                const SoftwareVertex& c{ transformed[m_mesh.indices[lod.firstIndex + i + 2]] };
+
+                // Trivially outside one of the frustum planes
+                if ((a.clip.x < -a.clip.w && b.clip.x < -b.clip.w && c.clip.x < -c.clip.w) || (a.clip.x > a.clip.w && b.clip.x > b.clip.w && c.clip.x > c.clip.w) ||
+                    (a.clip.y < -a.clip.w && b.clip.y < -b.clip.w && c.clip.y < -c.clip.w) || (a.clip.y > a.clip.w && b.clip.y > b.clip.w && c.clip.y > c.clip.w) ||
+                    (a.clip.z < -a.clip.w && b.clip.z < -b.clip.w && c.clip.z < -c.clip.w) || (a.clip.z > a.clip.w && b.clip.z > b.clip.w && c.clip.z > c.clip.w))
+                    continue;
+
+                clipTriangle(chunk, a, b, c, instance.materialIndex);
+            }
+        }
+    }
+
+    // Depth test against the tile's visibility buffer, LANES pixels per step
+    void rasterTriangle(const SoftwareTriangle& triangle, GLuint id, int tileX, int tileY, float* depth, GLuint* ids) const
+    {
+        int x0{ std::max(triangle.minX, tileX) }, x1{ std::min(triangle.maxX, tileX + SOFTWARE_TILE_SIZE - 1) };
+        int y0{ std::max(triangle.minY, tileY) }, y1{ std::min(triangle.maxY, tileY + SOFTWARE_TILE_SIZE - 1) };
+        int start{ tileX + ((x0 - tileX) & ~(LANES - 1)) };
+
+        for (int y{ y0 }; y <= y1; ++y)
+        {
+            FloatLanes py{ y + 0.5f };
+            for (int x{ start }; x <= x1; x += LANES)
+            {
+                FloatLanes px{ FloatLanes::Ramp() + FloatLanes(x + 0.5f) };
+
+                FloatLanes inside{ FloatLanes(0.0f) < FloatLanes(1.0f) };
+                for (int i{ 0 }; i < 3; ++i)
+                {
+                    FloatLanes edge{ FloatLanes(triangle.edgeX[i]) * px + FloatLanes(triangle.edgeY[i]) * py + FloatLanes(triangle.edgeC[i]) };
+                    inside = inside & (triangle.topLeft[i] ? edge >= FloatLanes(0.0f) : edge > FloatLanes(0.0f));
+                }
+                if (!Mask(inside))
+                    continue;
+
+                FloatLanes z{ FloatLanes(triangle.depthX) * px + FloatLanes(triangle.depthY) * py + FloatLanes(triangle.depthC) };
+                size_t offset{ static_cast<size_t>(y - tileY) * SOFTWARE_TILE_SIZE + (x - tileX) };
+                FloatLanes stored{ FloatLanes::Load(depth + offset) };
+                FloatLanes pass{ inside & (z < stored) };
+
+                int mask{ Mask(pass) };
+                if (!mask)
+                    continue;
+
+                Select(pass, z, stored).Store(depth + offset);
+                for (int lane{ 0 }; lane < LANES; ++lane)
+                    if (mask & (1 << lane))
+                        ids[offset + lane] = id;
+            }
+        }
+    }
+
+    // lighting.frag on the sphere pixels and skybox.frag on the rest
+    void shadeTile(int tileX, int tileY, const GLuint* ids)
+    {
+        alignas(32) float fields[SHADE_FIELD_COUNT][LANES];
+        alignas(32) float material[MATERIAL_FIELD_COUNT][LANES];
+        alignas(32) float direction[3][LANES];
+        alignas(32) float color[3][LANES];
+        const SoftwareTriangle* triangles[LANES]{};
+
+        const Vec3Lanes lightPosition{ m_light.position.x, m_light.position.y, m_light.position.z };
+        const Vec3Lanes lightAmbient{ m_light.ambient.x, m_light.ambient.y, m_light.ambient.z };
+        const Vec3Lanes lightDiffuse{ m_light.diffuse.x, m_light.diffuse.y, m_light.diffuse.z };
+        const FloatLanes lightSpecular{ m_light.specular };
+        const Vec3Lanes cameraPosition{ m_cameraPosition.x, m_cameraPosition.y, m_cameraPosition.z };
+
+        int xEnd{ std::min(tileX + SOFTWARE_TILE_SIZE, m_width) }, yEnd{ std::min(tileY + SOFTWARE_TILE_SIZE, m_height) };
+        for (int y{ tileY }; y < yEnd; ++y)
+        {
+            FloatLanes py{ y + 0.5f };
+            for (int x{ tileX }; x < xEnd; x += LANES)
+            {
+                FloatLanes px{ FloatLanes::Ramp() + FloatLanes(x + 0.5f) };
+                const GLuint* laneIds{ ids + static_cast<size_t>(y - tileY) * SOFTWARE_TILE_SIZE + (x - tileX) };
+
+                // Gather the triangle and material of every lane, sky lanes borrow a neighbour so the maths stays finite
+                int skyMask{ 0 };
+                const SoftwareTriangle* fallback{ nullptr };
+                for (int lane{ 0 }; lane < LANES; ++lane)
+                {
+                    triangles[lane] = laneIds[lane] == NO_TRIANGLE ? nullptr : &triangleById(laneIds[lane]);
+                    if (!triangles[lane])
+                        skyMask |= 1 << lane;
+                    else if (!fallback)
+                        fallback = triangles[lane];
+                }
+
+                Vec3Lanes result{};
+                if (fallback)
+                {
+                    for (int lane{ 0 }; lane < LANES; ++lane)
+                    {
+                        const SoftwareTriangle* triangle{ triangles[lane] ? triangles[lane] : fallback };
+                        for (int f{ 0 }; f < SHADE_FIELD_COUNT; ++f)
+                            fields[f][lane] = triangle->shade[f];
+                        const float* entry{ &m_materials[triangle->materialIndex * MATERIAL_FIELD_COUNT] };
+                        for (int f{ 0 }; f < MATERIAL_FIELD_COUNT; ++f)
+                            material[f][lane] = entry[f];
+                    }
+
+                    auto field = [&](int f) { return FloatLanes::Load(fields[f]); };
+                    auto vec3Field = [&](int f) { return Vec3Lanes(field(f), field(f + 1), field(f + 2)); };
+                    auto materialField = [&](int f) { return Vec3Lanes(FloatLanes::Load(material[f]), FloatLanes::Load(material[f + 1]), FloatLanes::Load(material[f + 2])); };
+
+                    // Perspective-correct barycentrics
+                    FloatLanes l1{ field(SHADE_L1_X) * px + field(SHADE_L1_Y) * py + field(SHADE_L1_C) };
+                    FloatLanes l2{ field(SHADE_L2_X) * px + field(SHADE_L2_Y) * py + field(SHADE_L2_C) };
+                    FloatLanes q0{ (FloatLanes(1.0f) - l1 - l2) * field(SHADE_INV_W0) };
+                    FloatLanes q1{ l1 * field(SHADE_INV_W1) };
+                    FloatLanes q2{ l2 * field(SHADE_INV_W2) };
+                    FloatLanes invSum{ FloatLanes(1.0f) / (q0 + q1 + q2) };
+                    FloatLanes p1{ q1 * invSum }, p2{ q2 * invSum };
+
+                    Vec3Lanes fragPos{ vec3Field(SHADE_POSITION) + vec3Field(SHADE_POSITION_D1) * p1 + vec3Field(SHADE_POSITION_D2) * p2 };
+                    Vec3Lanes normal{ vec3Field(SHADE_NORMAL) + vec3Field(SHADE_NORMAL_D1) * p1 + vec3Field(SHADE_NORMAL_D2) * p2 };
+
+                    Vec3Lanes norm{ Normalize(normal) };
+                    Vec3Lanes incident{ Normalize(fragPos - cameraPosition) };
+                    Vec3Lanes reflected{ Reflect(incident, norm) };
+                    Vec3Lanes refracted{ Refract(incident, norm, 1.00f / 1.33f) };
+                    Vec3Lanes lookup{ Mix(reflected, refracted, 0.5f) };
+
+                    lookup.x.Store(direction[0]);
+                    lookup.y.Store(direction[1]);
+                    lookup.z.Store(direction[2]);
+                    Vec3Lanes ambience{ lightAmbient * materialField(MATERIAL_AMBIENT) };
+                    if (!m_prefiltered.IsEmpty())
+                    {
+                        alignas(32) float lod[LANES];
+                        FloatLanes roughness{ Sqrt(Sqrt(FloatLanes(2.0f) / (FloatLanes::Load(material[MATERIAL_SHININESS]) + FloatLanes(2.0f)))) };
+                        (roughness * FloatLanes(m_prefilteredMaxLod)).Store(lod);
+                        for (int lane{ 0 }; lane < LANES; ++lane)
+                        {
+                            glm::vec3 sample{ m_prefiltered.Sample(glm::vec3(direction[0][lane], direction[1][lane], direction[2][lane]), lod[lane]) };
+                            color[0][lane] = sample.r;
+                            color[1][lane] = sample.g;
+                            color[2][lane] = sample.b;
+                        }
+                        ambience = ambience + EvaluateIrradiance(m_irradiance, norm) * materialField(MATERIAL_AMBIENT);
+                    }
+                    else
+                    {
+                        for (int lane{ 0 }; lane < LANES; ++lane)
+                        {
+                            glm::vec3 sample{ m_cubemap.Sample(direction[0][lane], direction[1][lane], direction[2][lane]) };
+                            color[0][lane] = sample.r;
+                            color[1][lane] = sample.g;
+                            color[2][lane] = sample.b;
+                        }
+                    }
+                    Vec3Lanes reflectedColor{ FloatLanes::Load(color[0]), FloatLanes::Load(color[1]), FloatLanes::Load(color[2]) };
+
+                    Vec3Lanes lightDir{ Normalize(fragPos - lightPosition) };
+                    FloatLanes coeff{ Max(FloatLanes(0.0f) - Dot(lightDir, norm), 0.0f) };
+
+                    Vec3Lanes diffuse{ lightDiffuse * (materialField(MATERIAL_DIFFUSE) * coeff) };
+
+                    FloatLanes base{ Max(FloatLanes(0.0f) - Dot(incident, Reflect(lightDir, norm)), 0.0f) };
+                    FloatLanes shininess{ PerLane(base, FloatLanes::Load(material[MATERIAL_SHININESS]), [](float b, float e) { return std::pow(b, e); }) };
+                    Vec3Lanes specular{ materialField(MATERIAL_SPECULAR) * (lightSpecular * shininess) };
+
+                    result = Mix(ambience + diffuse + reflectedColor * specular, reflectedColor, lightSpecular);
+                }
+
+                // Skybox lanes look up along the pixel's view ray, rotation only
+                if (skyMask)
+                {
+                    FloatLanes ndcX{ px * FloatLanes(2.0f / m_width) - FloatLanes(1.0f) };
+                    FloatLanes ndcY{ py * FloatLanes(2.0f / m_height) - FloatLanes(1.0f) };
+                    Vec3Lanes ray{ ndcX * FloatLanes(1.0f / m_projection[0][0]), ndcY * FloatLanes(1.0f / m_projection[1][1]), FloatLanes(-1.0f) };
+                    const glm::mat3& r{ m_inverseRotation };
+                    Vec3Lanes world{ ray.x * FloatLanes(r[0][0]) + ray.y * FloatLanes(r[1][0]) + ray.z * FloatLanes(r[2][0]),
+                        ray.x * FloatLanes(r[0][1]) + ray.y * FloatLanes(r[1][1]) + ray.z * FloatLanes(r[2][1]),
+                        ray.x * FloatLanes(r[0][2]) + ray.y * FloatLanes(r[1][2]) + ray.z * FloatLanes(r[2][2]) };
+
+                    world.x.Store(direction[0]);
+                    world.y.Store(direction[1]);
+                    world.z.Store(direction[2]);
+                    result.x.Store(color[0]);
+                    result.y.Store(color[1]);
+                    result.z.Store(color[2]);
+                    for (int lane{ 0 }; lane < LANES; ++lane)
+                    {
+                        if (!(skyMask & (1 << lane)))
+                            continue;
+                        glm::vec3 sample{ m_cubemap.Sample(direction[0][lane], direction[1][lane], direction[2][lane]) };
+                        color[0][lane] = sample.r;
+                        color[1][lane] = sample.g;
+                        color[2][lane] = sample.b;
+                    }
+                    result = Vec3Lanes(FloatLanes::Load(color[0]), FloatLanes::Load(color[1]), FloatLanes::Load(color[2]));
+                }
+
+                // Same conversion as an RGBA8 colour attachment
+                Clamp(result.x, 0.0f, 1.0f).Store(color[0]);
+                Clamp(result.y, 0.0f, 1.0f).Store(color[1]);
+                Clamp(result.z, 0.0f, 1.0f).Store(color[2]);
+                unsigned char* out{ &m_color[(static_cast<size_t>(y) * m_width + x) * 3] };
+                for (int lane{ 0 }; lane < LANES && x + lane < xEnd; ++lane)
+                    for (int c{ 0 }; c < 3; ++c)
+                        out[lane * 3 + c] = static_cast<unsigned char>(color[c][lane] * 255.0f + 0.5f);
+            }
+        }
+    }
+
+    const SoftwareTriangle& triangleById(GLuint id) const
+    {
+        size_t chunk{ static_cast<size_t>(std::upper_bound(m_chunkBase.begin(), m_chunkBase.end(), id) - m_chunkBase.begin()) - 1 };
+        return m_chunks[chunk].triangles[id - m_chunkBase[chunk]];
+    }
+
+    void renderTile(int tile)
+    {
+        alignas(32) float depth[SOFTWARE_TILE_SIZE * SOFTWARE_TILE_SIZE];
+        GLuint ids[SOFTWARE_TILE_SIZE * SOFTWARE_TILE_SIZE];
+        std::fill(std::begin(depth), std::end(depth), 1.0f);
+        std::fill(std::begin(ids), std::end(ids), NO_TRIANGLE);
+
+        int tileX{ (tile % m_tilesX) * SOFTWARE_TILE_SIZE }, tileY{ (tile / m_tilesX) * SOFTWARE_TILE_SIZE };
+        for (size_t c{ 0 }; c < m_chunks.size(); ++c)
+            for (GLuint index : m_chunks[c].bins[tile])
+                rasterTriangle(m_chunks[c].triangles[index], m_chunkBase[c] + index, tileX, tileY, depth, ids);
+
+        shadeTile(tileX, tileY, ids);
+    }
+
+    // Runs work(i) for i in [0, count) on every thread of the pool, items are handed out one at a time
+    template<typename Work>
+    static void parallelFor(ThreadPool& pool, int count, Work work)
+    {
+        std::atomic<int> next{ 0 };
+        std::vector<std::future<void>> workers;
+        for (unsigned t{ 0 }; t < pool.GetThreadCount(); ++t)
+            workers.push_back(pool.Submit([&]() { for (int i{ next++ }; i < count; i = next++) work(i); }));
+        for (std::future<void>& worker : workers)
+            worker.get();
+    }
+
+public:
+    // lighting is only given with --ibl. A scene is loaded whole, the reference has no reason to stream it
+    SoftwareRenderer(const Options& options, const SoftwareCubemap& cubemap, const EnvironmentLighting* lighting, int width, int height, const SceneFile* scene = nullptr)
+        : m_cubemap{ cubemap }, m_mesh{ BuildSphereMesh(STACKS, SLICES, radius) },
+        m_transforms{ scene ? TransformStore{} : BuildSphereTransforms(options.sphereCount, options.seed, MAX_MATERIALS) }, m_animate{ options.animate },
+        m_culling{ options.gpuCulling },
+        m_width{ width }, m_height{ height }
+    {
+        m_tilesX = (width + SOFTWARE_TILE_SIZE - 1) / SOFTWARE_TILE_SIZE;
+        m_tilesY = (height + SOFTWARE_TILE_SIZE - 1) / SOFTWARE_TILE_SIZE;
+        m_color.resize(static_cast<size_t>(width) * height * 3);
+        m_projection = glm::perspective(ZOOM, static_cast<float>(width) / static_cast<float>(height), 0.1f, 1000.0f);
+
+        if (lighting && lighting->IsValid())
+        {
+            m_prefiltered = lighting->CreateFloatCubemap();
+            std::copy(lighting->GetIrradiance(), lighting->GetIrradiance() + 9, m_irradiance);
+            m_prefilteredMaxLod = lighting->GetMaxLod();
+        }
+
+        if (scene)
+        {
+            m_transforms.Reserve(scene->GetObjectCount());
+            scene->AddObjects(m_transforms, 0, scene->GetObjectCount());
+            m_lightPosition = scene->GetLightPosition();
+        }
+        for (size_t i{ 0 }; i < m_transforms.Size(); ++i)
+            m_basePositions.push_back(m_transforms.GetPosition(i));
+        m_instances.resize(m_transforms.Size());
+        m_transforms.Update(nullptr, m_instances.data());
+
+        MaterialBlock materials{ BuildMaterials(scene) };
+        for (const Material& material : materials.materials)
+        {
+            const float values[MATERIAL_FIELD_COUNT]{ material.ambient.x, material.ambient.y, material.ambient.z, material.diffuse.x, material.diffuse.y,
+                material.diffuse.z, material.specular.x, material.specular.y, material.specular.z, material.shininess };
+            m_materials.insert(m_materials.end(), std::begin(values), std::end(values));
+        }
+    }
+
+    // Renders the frame the GL path would draw for this camera and time
+    SoftwareFrameStats RenderFrame(ThreadPool& pool, Camera& camera, float time)
+    {
+        SoftwareFrameStats stats{};
+        auto start = std::chrono::steady_clock::now();
+
+        glm::mat4 view{ camera.GetViewMatrix() };
+        m_cameraPosition = camera.GetPosition();
+        m_inverseRotation = glm::transpose(glm::mat3(view));
+        m_light = BuildLightBlock(time, m_lightPosition);
+        if (m_animate)
+        {
+            AnimateSphereTransforms(m_transforms, m_basePositions, time);
+            m_transforms.Update(&pool, m_instances.data());
+        }
+
+        cull(view, static_cast<float>(m_height));
+        auto culled = std::chrono::steady_clock::now();
+
+        // Chunks of draws, a few per thread so uneven LODs still balance
+        size_t chunkCount{ std::max<size_t>(1, std::min<size_t>(m_draws.size(), pool.GetThreadCount() * 4)) };
+        m_chunks.resize(chunkCount);
+        glm::mat4 viewProjection{ m_projection * view };
+        parallelFor(pool, static_cast<int>(chunkCount), [&](int c) {
+            processGeometry(m_chunks[c], viewProjection, m_draws.size() * c / chunkCount, m_draws.size() * (c + 1) / chunkCount);
+        });
+
+        m_chunkBase.assign(chunkCount, 0);
+        for (size_t c{ 1 }; c < chunkCount; ++c)
+            m_chunkBase[c] = m_chunkBase[c - 1] + static_cast<GLuint>(m_chunks[c - 1].triangles.size());
+        stats.triangles = m_chunkBase.back() + m_chunks.back().triangles.size();
+        auto binned = std::chrono::steady_clock::now();
+
+        parallelFor(pool, m_tilesX * m_tilesY, [&](int tile) { renderTile(tile); });
+        auto end = std::chrono::steady_clock::now();
+
+        stats.cullMs = ElapsedMilliseconds(start, culled);
+        stats.geometryMs = ElapsedMilliseconds(culled, binned);
+        stats.rasterMs = ElapsedMilliseconds(binned, end);
+        stats.totalMs = ElapsedMilliseconds(start, end);
+        stats.visibleInstances = m_draws.size();
+        return stats;
+    }
+
+    const std::vector<unsigned char>& GetColor() const { return m_color; }
+    int GetWidth() const { return m_width; }
+    int GetHeight() const { return m_height; }
+};
+
+// How far two RGB8 images are apart
+struct ImageDifference
+{
+    int maxDifference{};
+    double meanDifference{};
+    size_t pixelsOverTolerance{};
+    size_t pixels{};
+};
+
+// Also writes a difference image, scaled up 8x so small errors are visible
+inline ImageDifference CompareImages(const std::vector<unsigned char>& a, const std::vector<unsigned char>& b, int width, int height, const std::string& diffPath)
+{
+    ImageDifference difference{};
+    difference.pixels = static_cast<size_t>(width) * height;
+    std::vector<unsigned char> diff(a.size());
+
+    double sum{ 0.0 };
+    for (size_t p{ 0 }; p < difference.pixels; ++p)
+    {
+        int largest{ 0 };
+        for (int c{ 0 }; c < 3; ++c)
+        {
+            int channel{ std::abs(static_cast<int>(a[p * 3 + c]) - static_cast<int>(b[p * 3 + c])) };
+            largest = std::max(largest, channel);
+            sum += channel;
+            diff[p * 3 + c] = static_cast<unsigned char>(std::min(255, channel * 8));
+        }
+        difference.maxDifference = std::max(difference.maxDifference, largest);
+        if (largest > SOFTWARE_COMPARE_TOLERANCE)
+            ++difference.pixelsOverTolerance;
+    }
+    difference.meanDifference = sum / (difference.pixels * 3.0);
+
+    WritePPM(diffPath, width, height, diff.data());
+    return difference;
+}
+
+// Renders the headless run's frames on the CPU, writes them next to the GL ones and compares the two where both exist, then measures
+// how the frame time scales with the thread count
+inline int RunSoftwareBenchmark(const Options& options, ThreadPool& threadPool, const std::vector<const GLchar*>& faces, const SceneFile* scene = nullptr)
+{
+    std::error_code error{};
+    std::filesystem::create_directories(options.outputDirectory, error);
+    if (error)
+    {
+        std::cout << "ERROR::SOFTWARE::CANNOT_CREATE " << options.outputDirectory << std::endl;
+        return 1;
+    }
+
+    SoftwareCubemap cubemap(threadPool, faces);
+    if (!cubemap.IsValid())
+    {
+        std::cout << "ERROR::SOFTWARE::CUBEMAP_FACES_NOT_SQUARE_OR_MISSING" << std::endl;
+        return 1;
+    }
+
+    const int width{ static_cast<int>(options.width) }, height{ static_cast<int>(options.height) };
+    const double megapixels{ width * static_cast<double>(height) / 1.0e6 };
+    std::cout << "Software renderer (" << SIMD_INSTRUCTION_SET << ", " << LANES << " lanes, " << threadPool.GetThreadCount() << " threads), "
+        << width << "x" << height << ", " << options.frameCount << " frames" << std::endl;
+
+    // Image based lighting comes from the same cache as the GL path's
+    EnvironmentLighting lighting;
+    bool imageBasedLighting{ options.imageBasedLighting && LoadEnvironmentLighting(threadPool, faces, ENVIRONMENT_LIGHTING_PATH, lighting) };
+
+    SoftwareRenderer renderer(options, cubemap, imageBasedLighting ? &lighting : nullptr, width, height, scene);
+    Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
+    std::vector<unsigned> savedFrames{ SelectSavedFrames(options.frameCount, options.savedFrameCount) };
+
+    std::filesystem::path timingsPath{ std::filesystem::path(options.outputDirectory) / "software_timings.csv" };
+    std::ofstream csv(timingsPath);
+    csv << "# software renderer: " << SIMD_INSTRUCTION_SET << ", " << threadPool.GetThreadCount() << " threads\n# spheres: " << options.sphereCount
+        << ", seed: " << options.seed << ", frames: " << options.frameCount << ", size: " << width << "x" << height << "\n";
+    csv << "frame,total_ms,cull_ms,geometry_ms,raster_ms,triangles,megapixels_per_s\n";
+
+    std::vector<double> totalMs;
+    for (unsigned frame{ 0 }; frame < options.frameCount; ++frame)
+    {
+        float time{ frame * HEADLESS_TIMESTEP };
+        UpdateScriptedCamera(camera, time);
+        SoftwareFrameStats stats{ renderer.RenderFrame(threadPool, camera, time) };
+        totalMs.push_back(stats.totalMs);
+        csv << frame << "," << stats.totalMs << "," << stats.cullMs << "," << stats.geometryMs << "," << stats.rasterMs << "," << stats.triangles << ","
+            << megapixels / (stats.totalMs / 1000.0) << "\n";
+
+        if (std::find(savedFrames.begin(), savedFrames.end(), frame) == savedFrames.end())
+            continue;
+
+        std::string path{ FramePath(options.outputDirectory, frame, "_cpu") };
+        if (!WritePPM(path, width, height, renderer.GetColor().data()))
+            std::cout << "ERROR::SOFTWARE::CANNOT_WRITE " << path << std::endl;
+
+        // Compare with the GL frame of a previous --headless run into the same directory
+        int glWidth{}, glHeight{};
+        std::vector<unsigned char> glPixels;
+        if (ReadPPM(FramePath(options.outputDirectory, frame), glWidth, glHeight, glPixels) && glWidth == width && glHeight == height)
+        {
+            ImageDifference difference{ CompareImages(renderer.GetColor(), glPixels, width, height, FramePath(options.outputDirectory, frame, "_diff")) };
+            std::cout << "  frame " << frame << " against GL: max difference " << difference.maxDifference << ", mean " << difference.meanDifference << ", "
+                << 100.0 * difference.pixelsOverTolerance / difference.pixels << "% of the pixels off by more than " << SOFTWARE_COMPARE_TOLERANCE << std::endl;
+        }
+    }
+
+    if (totalMs.empty())
+        return 0;
+
+    std::sort(totalMs.begin(), totalMs.end());
+    std::cout << options.frameCount << " frames, median " << totalMs[totalMs.size() / 2] << " ms, " << megapixels / (totalMs[totalMs.size() / 2] / 1000.0)
+        << " MP/s, timings written to " << timingsPath.string() << std::endl;
+
+    // Thread scaling on the last frame, best of three at each count
+    float lastTime{ (options.frameCount - 1) * HEADLESS_TIMESTEP };
+    unsigned hardwareThreads{ std::max(1u, std::thread::hardware_concurrency()) };
+    double singleThreadMs{ 0.0 };
+    for (unsigned threads{ 1 }; ; threads = std::min(threads * 2, hardwareThreads))
+    {
+        ThreadPool pool{ threads };
+        double best{ 0.0 };
+        for (int run{ 0 }; run < 3; ++run)
+        {
+            UpdateScriptedCamera(camera, lastTime);
+            double ms{ renderer.RenderFrame(pool, camera, lastTime).totalMs };
+            best = run == 0 ? ms : std::min(best, ms);
+        }
+        if (threads == 1)
+            singleThreadMs = best;
+
+        std::cout << "  " << threads << " threads: " << best << " ms, " << megapixels / (best / 1000.0) << " MP/s, speed-up " << singleThreadMs / best << "x" << std::endl;
+        if (threads == hardwareThreads)
+            break;
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,197 @@
+#ifndef SPHERE_BVH_H
+#define SPHERE_BVH_H
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include "Cubemap.h"
+#include "GLState.h"
+#include "StorageBuffer.h"
+#include "TransformStore.h"
+#include "UniformBlocks.h"
+
+// Most instances in a leaf, the shader tests them one after the other
+constexpr GLuint BVH_LEAF_SIZE{ 4 };
+
+// Traversal stack of lighting.frag, keep in sync with BVH_STACK_SIZE there. Median splits keep the depth at log2(n / BVH_LEAF_SIZE)
+constexpr unsigned BVH_STACK_SIZE{ 32 };
+
+// Shape of the hierarchy and what keeping it up to date costs
+struct BvhStats
+{
+    bool valid{};
+    size_t instances{};
+    size_t nodes{};
+    unsigned depth{};
+    unsigned builds{};
+    double buildMs{};               // last build, upload included
+    unsigned long long refits{};
+    double refitMs{};               // last refit, upload included
+};
+
+inline void PrintBvhStats(const BvhStats& stats)
+{
+    if (!stats.valid)
+        return;
+
+    std::cout << "  bvh: " << stats.instances << " instances in " << stats.nodes << " nodes, depth " << stats.depth << ", built " << stats.builds
+        << " times (last " << stats.buildMs << " ms)";
+    if (stats.refits > 0)
+        std::cout << ", refitted " << stats.refits << " times (last " << stats.refitMs << " ms)";
+    std::cout << std::endl;
+}
+
+// Bounding volume hierarchy over the bounding spheres of a transform store's objects, for ray tracing them in lighting.frag.
+// Built top down with median splits along the widest axis of the centres, so it is balanced whatever the layout; moved objects
+// only refit the boxes, a node's children always come after it so one backwards pass does it. Both arrays live in storage buffers
+class SphereBvh
+{
+private:
+    std::vector<BvhNode> m_nodes;
+    std::vector<GLuint> m_instances;    // instance indices in leaf order
+    std::vector<glm::vec3> m_centers;
+    std::vector<float> m_radii;
+    StorageBuffer<BvhNode> m_nodeBuffer;
+    StorageBuffer<GLuint> m_instanceBuffer;
+    BvhStats m_stats{};
+
+    // Bounding sphere of every object: radius is the mesh's, before the object's largest scale
+    void gatherBounds(const TransformStore& transforms, float radius)
+    {
+        m_centers.resize(transforms.Size());
+        m_radii.resize(transforms.Size());
+        for (size_t i{ 0 }; i < transforms.Size(); ++i)
+        {
+            glm::vec3 scale{ glm::abs(transforms.GetScale(i)) };
+            m_centers[i] = transforms.GetPosition(i);
+            m_radii[i] = radius * std::max(scale.x, std::max(scale.y, scale.z));
+        }
+    }
+
+    // Splits the index list range [first, first + count) below node, returns the depth of the subtree
+    unsigned subdivide(GLuint node, GLuint first, GLuint count)
+    {
+        glm::vec3 low{ m_centers[m_instances[first]] }, high{ low };
+        for (GLuint i{ first + 1 }; i < first + count; ++i)
+        {
+            low = glm::min(low, m_centers[m_instances[i]]);
+            high = glm::max(high, m_centers[m_instances[i]]);
+        }
+        glm::vec3 extent{ high - low };
+        int axis{ extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2) };
+
+        // Objects sharing a centre cannot be split, they stay in one leaf
+        if (count <= BVH_LEAF_SIZE || extent[axis] <= 0.0f)
+        {
+            m_nodes[node].leftOrFirst = first;
+            m_nodes[node].count = count;
+            return 1;
+        }
+
+        GLuint middle{ first + count / 2 };
+        std::nth_element(m_instances.begin() + first, m_instances.begin() + middle, m_instances.begin() + first + count,
+            [this, axis](GLuint a, GLuint b) { return m_centers[a][axis] < m_centers[b][axis]; });
+
+        GLuint left{ static_cast<GLuint>(m_nodes.size()) };
+        m_nodes.resize(m_nodes.size() + 2);
+        m_nodes[node].leftOrFirst = left;
+        m_nodes[node].count = 0;
+        unsigned depth{ std::max(subdivide(left, first, middle - first), subdivide(left + 1, middle, first + count - middle)) };
+        return depth + 1;
+    }
+
+    // Boxes from the leaves up
+    void fitBounds()
+    {
+        for (size_t n{ m_nodes.size() }; n-- > 0;)
+        {
+            BvhNode& node{ m_nodes[n] };
+            if (node.count == 0 && !m_instances.empty())
+            {
+                node.boundsMin = glm::min(m_nodes[node.leftOrFirst].boundsMin, m_nodes[node.leftOrFirst + 1].boundsMin);
+                node.boundsMax = glm::max(m_nodes[node.leftOrFirst].boundsMax, m_nodes[node.leftOrFirst + 1].boundsMax);
+                continue;
+            }
+
+            // An empty tree is one inverted box, no ray enters it
+            node.boundsMin = glm::vec3(1e30f);
+            node.boundsMax = glm::vec3(-1e30f);
+            for (GLuint i{ node.leftOrFirst }; i < node.leftOrFirst + node.count; ++i)
+            {
+                GLuint instance{ m_instances[i] };
+                node.boundsMin = glm::min(node.boundsMin, m_centers[instance] - m_radii[instance]);
+                node.boundsMax = glm::max(node.boundsMax, m_centers[instance] + m_radii[instance]);
+            }
+        }
+    }
+
+public:
+    // Needs a current context
+    SphereBvh()
+        : m_nodeBuffer(BVH_NODE_BUFFER_BINDING), m_instanceBuffer(BVH_INSTANCE_BUFFER_BINDING)
+    {
+    }
+
+    SphereBvh(const SphereBvh&) = delete;
+    SphereBvh& operator=(const SphereBvh&) = delete;
+
+    // Rebuilds the hierarchy over every object of the store
+    void Build(const TransformStore& transforms, float radius)
+    {
+        auto start = std::chrono::steady_clock::now();
+        gatherBounds(transforms, radius);
+
+        GLuint count{ static_cast<GLuint>(transforms.Size()) };
+        m_instances.resize(count);
+        for (GLuint i{ 0 }; i < count; ++i)
+            m_instances[i] = i;
+
+        m_nodes.clear();
+        m_nodes.reserve(count > 0 ? 2 * ((count + BVH_LEAF_SIZE - 1) / BVH_LEAF_SIZE) : 1);
+        m_nodes.push_back(BvhNode{});
+        m_stats.depth = count > 0 ? subdivide(0, 0, count) : 1;
+        if (m_stats.depth >= BVH_STACK_SIZE)
+            std::cout << "ERROR::BVH::TOO_DEEP " << m_stats.depth << std::endl;
+        fitBounds();
+
+        m_nodeBuffer.Upload(m_nodes, GL_DYNAMIC_DRAW);
+        m_instanceBuffer.Upload(m_instances.empty() ? std::vector<GLuint>(1, 0) : m_instances);
+
+        m_stats.valid = true;
+        m_stats.instances = count;
+        m_stats.nodes = m_nodes.size();
+        ++m_stats.builds;
+        m_stats.buildMs = ElapsedMilliseconds(start, std::chrono::steady_clock::now());
+    }
+
+    // Moves the boxes to where the objects are now, the tree keeps its shape. The store must hold the objects it was built over
+    void Refit(const TransformStore& transforms, float radius)
+    {
+        auto start = std::chrono::steady_clock::now();
+        gatherBounds(transforms, radius);
+        fitBounds();
+        m_nodeBuffer.Upload(m_nodes, GL_DYNAMIC_DRAW);
+
+        ++m_stats.refits;
+        m_stats.refitMs = ElapsedMilliseconds(start, std::chrono::steady_clock::now());
+    }
+
+    // Both buffers on their binding points, other passes may have taken them
+    void Bind() const
+    {
+        GetGLState().BindBufferBase(GL_SHADER_STORAGE_BUFFER, BVH_NODE_BUFFER_BINDING, m_nodeBuffer.GetBuffer());
+        GetGLState().BindBufferBase(GL_SHADER_STORAGE_BUFFER, BVH_INSTANCE_BUFFER_BINDING, m_instanceBuffer.GetBuffer());
+    }
+
+    size_t Size() const { return m_instances.size(); }
+    const BvhStats& GetStats() const { return m_stats; }
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef STORAGE_BUFFER_H
+#define STORAGE_BUFFER_H
+
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "GLState.h"
+
+// Owns a shader storage buffer holding an array of std430 elements, bound to a fixed binding point.
+// The storage grows when more elements are uploaded than it can hold and is otherwise rewritten in place
+template <typename Element>
+class StorageBuffer
+{
+private:
+    GLuint m_buffer{};
+    GLuint m_bindingPoint{};
+    size_t m_capacity{};
+    size_t m_count{};
+
+public:
+    explicit StorageBuffer(GLuint bindingPoint)
+        : m_bindingPoint{ bindingPoint }
+    {
+        glGenBuffers(1, &m_buffer);
+    }
+
+    StorageBuffer(const StorageBuffer&) = delete;
+    StorageBuffer& operator=(const StorageBuffer&) = delete;
+
+    ~StorageBuffer()
+    {
+        GetGLState().DeleteBuffers(1, &m_buffer);
+    }
+
+    // Replaces the content with the given elements in one write
+    void Upload(const std::vector<Element>& elements, GLenum usage = GL_STATIC_DRAW)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_buffer);
+        if (elements.size() > m_capacity || m_capacity == 0)
+        {
+            m_capacity = elements.size() > 0 ? elements.size() : 1;
+            glBufferData(GL_SHADER_STORAGE_BUFFER, m_capacity * sizeof(Element), elements.data(), usage);
+        }
+        else if (!elements.empty())
+        {
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, elements.size() * sizeof(Element), elements.data());
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        m_count = elements.size();
+        GetGLState().BindBufferBase(GL_SHADER_STORAGE_BUFFER, m_bindingPoint, m_buffer);
+    }
+
+    // Rewrites the elements [first, first + count) in place, the storage must already hold them
+    void UploadRange(const std::vector<Element>& elements, size_t first, size_t count)
+    {
+        if (count == 0 || first + count > m_capacity || first + count > elements.size())
+            return;
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_buffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, first * sizeof(Element), count * sizeof(Element), elements.data() + first);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    GLuint GetBindingPoint() const { return m_bindingPoint; }
+    GLuint GetBuffer() const { return m_buffer; }
+    size_t GetCount() const { return m_count; }
+};
+
+#endif
@@ -0,0 +1,208 @@
+#ifndef STREAMING_BUFFER_H
+#define STREAMING_BUFFER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "GLState.h"
+
+// Frames the CPU may run ahead of the GPU, one ring segment each
+constexpr unsigned STREAMING_FRAMES{ 3 };
+
+// What a streaming buffer did, per frame and since it was created
+struct StreamingStats
+{
+    size_t bytesThisFrame{};
+    size_t bytesTotal{};
+    unsigned fenceWaits{};      // frames that found their segment still in use by the GPU
+    double fenceWaitMs{};
+    unsigned frames{};
+};
+
+inline void AccumulateStreamingStats(StreamingStats& total, const StreamingStats& stats)
+{
+    total.bytesThisFrame += stats.bytesThisFrame;
+    total.bytesTotal += stats.bytesTotal;
+    total.fenceWaits += stats.fenceWaits;
+    total.fenceWaitMs += stats.fenceWaitMs;
+    total.frames = std::max(total.frames, stats.frames);
+}
+
+inline void PrintStreamingStats(const StreamingStats& stats)
+{
+    std::cout << "  streaming: " << stats.bytesThisFrame / 1024.0 << " KiB last frame, " << (stats.frames ? stats.bytesTotal / 1024.0 / stats.frames : 0.0)
+        << " KiB/frame average, " << stats.fenceWaits << " fence waits (" << stats.fenceWaitMs << " ms) in " << stats.frames << " frames" << std::endl;
+}
+
+// Ring of STREAMING_FRAMES segments in one persistently mapped buffer (ARB_buffer_storage). Each frame writes into its own segment
+// straight through the mapping and binds ranges of it; a fence placed at the end of the frame guards the segment until the GPU has
+// read it, so nothing is ever reallocated, orphaned or implicitly synchronized. Without buffer storage the writes fall back to
+// glBufferSubData into the same segments
+class StreamingBuffer
+{
+private:
+    GLenum m_target{};
+    GLuint m_buffer{};
+    GLsizeiptr m_segmentSize{};
+    GLintptr m_alignment{ 1 };
+    unsigned char* m_mapped{};
+    GLsync m_fences[STREAMING_FRAMES]{};
+    unsigned m_segment{};
+    GLintptr m_offset{};
+    StreamingStats m_stats{};
+
+    void waitForSegment(unsigned segment)
+    {
+        GLsync fence{ m_fences[segment] };
+        if (!fence)
+            return;
+
+        if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+        {
+            ++m_stats.fenceWaits;
+            auto start = std::chrono::steady_clock::now();
+            while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+                ;
+            m_stats.fenceWaitMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        }
+        glDeleteSync(fence);
+        m_fences[segment] = nullptr;
+    }
+
+public:
+    // target is GL_UNIFORM_BUFFER or GL_SHADER_STORAGE_BUFFER, segmentSize the most one frame will write
+    StreamingBuffer(GLenum target, GLsizeiptr segmentSize)
+        : m_target{ target }
+    {
+        GLint alignment{ 1 };
+        glGetIntegerv(target == GL_UNIFORM_BUFFER ? GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT : GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        m_alignment = std::max(alignment, 1);
+        m_segmentSize = (std::max<GLsizeiptr>(segmentSize, 1) + m_alignment - 1) / m_alignment * m_alignment;
+
+        glGenBuffers(1, &m_buffer);
+        glBindBuffer(m_target, m_buffer);
+        if (GLEW_ARB_buffer_storage)
+        {
+            const GLbitfield flags{ GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT };
+            glBufferStorage(m_target, m_segmentSize * STREAMING_FRAMES, nullptr, flags);
+            m_mapped = static_cast<unsigned char*>(glMapBufferRange(m_target, 0, m_segmentSize * STREAMING_FRAMES, flags));
+        }
+        else
+        {
+            glBufferData(m_target, m_segmentSize * STREAMING_FRAMES, nullptr, GL_STREAM_DRAW);
+        }
+        glBindBuffer(m_target, 0);
+    }
+
+    StreamingBuffer(const StreamingBuffer&) = delete;
+    StreamingBuffer& operator=(const StreamingBuffer&) = delete;
+
+    ~StreamingBuffer()
+    {
+        for (GLsync fence : m_fences)
+            if (fence)
+                glDeleteSync(fence);
+
+        if (m_mapped)
+        {
+            glBindBuffer(m_target, m_buffer);
+            glUnmapBuffer(m_target);
+            glBindBuffer(m_target, 0);
+        }
+        GetGLState().DeleteBuffers(1, &m_buffer);
+    }
+
+    // Moves to the next segment, waiting only if the GPU is still reading it from STREAMING_FRAMES frames ago
+    void BeginFrame()
+    {
+        m_segment = (m_segment + 1) % STREAMING_FRAMES;
+        waitForSegment(m_segment);
+        m_offset = 0;
+        m_stats.bytesThisFrame = 0;
+        ++m_stats.frames;
+    }
+
+    // Fences everything written this frame
+    void EndFrame()
+    {
+        if (m_offset > 0)
+            m_fences[m_segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    // Copies size bytes into this frame's segment and returns their offset in the buffer, or -1 when the segment is full
+    GLintptr Write(const void* data, GLsizeiptr size)
+    {
+        GLintptr offset{ (m_offset + m_alignment - 1) / m_alignment * m_alignment };
+        if (offset + size > m_segmentSize)
+        {
+            std::cout << "ERROR::STREAMING_BUFFER::SEGMENT_FULL " << offset + size << " > " << m_segmentSize << std::endl;
+            return -1;
+        }
+        m_offset = offset + size;
+
+        GLintptr bufferOffset{ static_cast<GLintptr>(m_segment) * m_segmentSize + offset };
+        if (m_mapped)
+        {
+            std::memcpy(m_mapped + bufferOffset, data, size);
+        }
+        else
+        {
+            glBindBuffer(m_target, m_buffer);
+            glBufferSubData(m_target, bufferOffset, size, data);
+            glBindBuffer(m_target, 0);
+        }
+
+        m_stats.bytesThisFrame += size;
+        m_stats.bytesTotal += size;
+        return bufferOffset;
+    }
+
+    // Reserves size bytes of this frame's segment for the caller to fill in place, persistent mappings only. Returns nullptr when
+    // the buffer is not mapped or the segment is full, offset receives the range's offset in the buffer
+    void* Allocate(GLsizeiptr size, GLintptr& offset)
+    {
+        GLintptr segmentOffset{ (m_offset + m_alignment - 1) / m_alignment * m_alignment };
+        if (!m_mapped || segmentOffset + size > m_segmentSize)
+            return nullptr;
+
+        m_offset = segmentOffset + size;
+        offset = static_cast<GLintptr>(m_segment) * m_segmentSize + segmentOffset;
+        m_stats.bytesThisFrame += size;
+        m_stats.bytesTotal += size;
+        return m_mapped + offset;
+    }
+
+    // Writes the block and binds it to an indexed binding point of the buffer's target
+    template <typename Block>
+    bool WriteAndBind(const Block& block, GLuint bindingPoint)
+    {
+        return WriteAndBind(&block, sizeof(Block), bindingPoint);
+    }
+
+    bool WriteAndBind(const void* data, GLsizeiptr size, GLuint bindingPoint)
+    {
+        GLintptr offset{ Write(data, size) };
+        if (offset < 0)
+            return false;
+
+        BindRange(bindingPoint, offset, size);
+        return true;
+    }
+
+    // Binds a range returned by Write() again, after another range took its binding point
+    void BindRange(GLuint bindingPoint, GLintptr offset, GLsizeiptr size) const
+    {
+        GetGLState().BindBufferRange(m_target, bindingPoint, m_buffer, offset, size);
+    }
+
+    GLuint GetBuffer() const { return m_buffer; }
+    bool IsPersistent() const { return m_mapped != nullptr; }
+    const StreamingStats& GetStats() const { return m_stats; }
+};
+
+#endif
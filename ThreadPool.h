@@ -0,0 +1,88 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// A fixed set of worker threads pulling tasks from a shared queue.
+// Tasks never touch the GL context, anything that needs GL is handed back to the thread that owns it
+class ThreadPool
+{
+private:
+    std::vector<std::thread> m_workers;
+    std::queue<std::function<void()>> m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_stopping{ false };
+
+    void workerLoop()
+    {
+        for (;;)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_condition.wait(lock, [this] { return m_stopping || !m_tasks.empty(); });
+                if (m_stopping && m_tasks.empty())
+                    return;
+
+                task = std::move(m_tasks.front());
+                m_tasks.pop();
+            }
+            task();
+        }
+    }
+
+public:
+    // Zero threads means one per hardware thread
+    explicit ThreadPool(unsigned threadCount = 0)
+    {
+        if (threadCount == 0)
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+        m_workers.reserve(threadCount);
+        for (unsigned i{ 0 }; i < threadCount; ++i)
+            m_workers.emplace_back([this] { workerLoop(); });
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_condition.notify_all();
+        for (std::thread& worker : m_workers)
+            worker.join();
+    }
+
+    // Queues a callable and returns a future for its result
+    template <typename Function>
+    auto Submit(Function&& function) -> std::future<std::invoke_result_t<std::decay_t<Function>>>
+    {
+        using Result = std::invoke_result_t<std::decay_t<Function>>;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<Function>(function));
+        std::future<Result> result{ task->get_future() };
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_tasks.emplace([task] { (*task)(); });
+        }
+        m_condition.notify_one();
+        return result;
+    }
+
+    unsigned GetThreadCount() const { return static_cast<unsigned>(m_workers.size()); }
+};
+
+#endif
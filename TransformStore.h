@@ -0,0 +1,242 @@
+#ifndef TRANSFORM_STORE_H
+#define TRANSFORM_STORE_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <iostream>
+#include <vector>
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include "Cubemap.h"
+#include "Simd.h"
+#include "ThreadPool.h"
+#include "UniformBlocks.h"
+
+// Entries per pool task, smaller stores are updated on the calling thread
+constexpr size_t TRANSFORMS_PER_TASK{ 4096 };
+
+// What the last Update() did
+struct TransformStats
+{
+    size_t objects{};
+    size_t updated{};       // entries written, whole lane groups around the dirty ones
+    double updateMs{};
+    unsigned tasks{};
+};
+
+inline void PrintTransformStats(const TransformStats& stats)
+{
+    std::cout << "  transforms: " << stats.updated << " of " << stats.objects << " written last update in " << stats.updateMs << " ms ("
+        << stats.tasks << " tasks, " << SIMD_INSTRUCTION_SET << ")" << std::endl;
+}
+
+// Positions, rotations and scales of every object in structure-of-arrays form.
+// Update() builds the model and normal matrices LANES objects at a time, straight into SphereInstance entries (typically a mapped
+// instance buffer), and only for objects changed since they were last written. A change stays pending for `copies` updates so every
+// copy of a ring of destinations (one per frame in flight) receives it once; the destination of update n is assumed to hold what
+// update n - copies wrote
+class TransformStore
+{
+private:
+    std::vector<float> m_positionX, m_positionY, m_positionZ;
+    std::vector<float> m_rotationX, m_rotationY, m_rotationZ, m_rotationW;     // unit quaternions
+    std::vector<float> m_scaleX, m_scaleY, m_scaleZ;
+    std::vector<GLuint> m_materials;
+    std::vector<GLint> m_probes;
+    std::vector<std::uint8_t> m_pending;    // updates left before the object is written everywhere
+    size_t m_count{};
+    size_t m_pendingCount{};
+    std::uint8_t m_copies{ 1 };
+    TransformStats m_stats{};
+
+    void markDirty(size_t index)
+    {
+        if (m_pending[index] == 0)
+            ++m_pendingCount;
+        m_pending[index] = m_copies;
+    }
+
+    // Lane group starting at first; the arrays are padded to whole groups with identity transforms
+    void updateGroup(size_t first, SphereInstance* destination) const
+    {
+        FloatLanes qx{ FloatLanes::Load(&m_rotationX[first]) }, qy{ FloatLanes::Load(&m_rotationY[first]) };
+        FloatLanes qz{ FloatLanes::Load(&m_rotationZ[first]) }, qw{ FloatLanes::Load(&m_rotationW[first]) };
+        FloatLanes sx{ FloatLanes::Load(&m_scaleX[first]) }, sy{ FloatLanes::Load(&m_scaleY[first]) }, sz{ FloatLanes::Load(&m_scaleZ[first]) };
+
+        // Rotation matrix columns of the quaternions
+        FloatLanes one{ 1.0f }, two{ 2.0f };
+        FloatLanes xx{ qx * qx }, yy{ qy * qy }, zz{ qz * qz };
+        FloatLanes xy{ qx * qy }, xz{ qx * qz }, yz{ qy * qz };
+        FloatLanes wx{ qw * qx }, wy{ qw * qy }, wz{ qw * qz };
+        Vec3Lanes c0{ one - two * (yy + zz), two * (xy + wz), two * (xz - wy) };
+        Vec3Lanes c1{ two * (xy - wz), one - two * (xx + zz), two * (yz + wx) };
+        Vec3Lanes c2{ two * (xz + wy), two * (yz - wx), one - two * (xx + yy) };
+
+        // Model columns scale the rotation, the normal matrix (inverse transpose of the upper 3x3) divides by the scale instead
+        Vec3Lanes columns[6]{ c0 * sx, c1 * sy, c2 * sz, c0 * (one / sx), c1 * (one / sy), c2 * (one / sz) };
+        alignas(32) float values[6][3][LANES];
+        for (int c{ 0 }; c < 6; ++c)
+        {
+            columns[c].x.Store(values[c][0]);
+            columns[c].y.Store(values[c][1]);
+            columns[c].z.Store(values[c][2]);
+        }
+
+        size_t count{ std::min<size_t>(LANES, m_count - first) };
+        for (size_t lane{ 0 }; lane < count; ++lane)
+        {
+            size_t index{ first + lane };
+            SphereInstance instance{};
+            for (int c{ 0 }; c < 3; ++c)
+            {
+                instance.model[c] = glm::vec4(values[c][0][lane], values[c][1][lane], values[c][2][lane], 0.0f);
+                instance.normalMatrix[c] = glm::vec4(values[c + 3][0][lane], values[c + 3][1][lane], values[c + 3][2][lane], 0.0f);
+            }
+            instance.model[3] = glm::vec4(m_positionX[index], m_positionY[index], m_positionZ[index], 1.0f);
+            instance.materialIndex = m_materials[index];
+            instance.probeIndex = m_probes[index];
+            destination[index] = instance;
+        }
+    }
+
+    // Writes the lane groups of [first, last) holding a pending object, returns the objects written
+    size_t updateRange(size_t first, size_t last, SphereInstance* destination)
+    {
+        size_t written{ 0 };
+        for (size_t group{ first }; group < last; group += LANES)
+        {
+            size_t end{ std::min<size_t>(group + LANES, m_count) };
+            bool dirty{ false };
+            for (size_t i{ group }; i < end; ++i)
+                dirty |= m_pending[i] != 0;
+            if (!dirty)
+                continue;
+
+            updateGroup(group, destination);
+            for (size_t i{ group }; i < end; ++i)
+                if (m_pending[i] != 0)
+                    --m_pending[i];
+            written += end - group;
+        }
+        return written;
+    }
+
+public:
+    // copies: how many destinations Update() rotates through
+    explicit TransformStore(unsigned copies = 1)
+        : m_copies{ static_cast<std::uint8_t>(std::clamp(copies, 1u, 255u)) }
+    {
+    }
+
+    void Reserve(size_t count)
+    {
+        size_t padded{ (count + LANES - 1) / LANES * LANES };
+        for (std::vector<float>* values : { &m_positionX, &m_positionY, &m_positionZ, &m_rotationX, &m_rotationY, &m_rotationZ, &m_rotationW, &m_scaleX, &m_scaleY, &m_scaleZ })
+            values->reserve(padded);
+        m_materials.reserve(count);
+        m_probes.reserve(count);
+        m_pending.reserve(count);
+    }
+
+    size_t Add(const glm::vec3& position, const glm::vec4& rotation, const glm::vec3& scale, GLuint materialIndex, GLint probeIndex = -1)
+    {
+        size_t index{ m_count++ };
+        size_t padded{ (m_count + LANES - 1) / LANES * LANES };
+
+        // Padding lanes stay identity transforms so the reciprocal scales stay finite
+        const float identity[10]{ 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f };
+        std::vector<float>* arrays[10]{ &m_positionX, &m_positionY, &m_positionZ, &m_rotationX, &m_rotationY, &m_rotationZ, &m_rotationW, &m_scaleX, &m_scaleY, &m_scaleZ };
+        for (int a{ 0 }; a < 10; ++a)
+            arrays[a]->resize(padded, identity[a]);
+
+        m_materials.push_back(materialIndex);
+        m_probes.push_back(probeIndex);
+        m_pending.push_back(0);
+        SetPosition(index, position);
+        SetRotation(index, rotation);
+        SetScale(index, scale);
+        return index;
+    }
+
+    void SetPosition(size_t index, const glm::vec3& position)
+    {
+        m_positionX[index] = position.x;
+        m_positionY[index] = position.y;
+        m_positionZ[index] = position.z;
+        markDirty(index);
+    }
+
+    // Quaternion as (x, y, z, w)
+    void SetRotation(size_t index, const glm::vec4& rotation)
+    {
+        glm::vec4 unit{ glm::normalize(rotation) };
+        m_rotationX[index] = unit.x;
+        m_rotationY[index] = unit.y;
+        m_rotationZ[index] = unit.z;
+        m_rotationW[index] = unit.w;
+        markDirty(index);
+    }
+
+    void SetScale(size_t index, const glm::vec3& scale)
+    {
+        m_scaleX[index] = scale.x;
+        m_scaleY[index] = scale.y;
+        m_scaleZ[index] = scale.z;
+        markDirty(index);
+    }
+
+    void SetProbe(size_t index, GLint probeIndex)
+    {
+        m_probes[index] = probeIndex;
+        markDirty(index);
+    }
+
+    // Writes every pending object into destination (Size() entries), split across the pool when there is enough of them
+    size_t Update(ThreadPool* pool, SphereInstance* destination)
+    {
+        auto start = std::chrono::steady_clock::now();
+        m_stats = TransformStats{};
+        m_stats.objects = m_count;
+        if (m_pendingCount == 0)
+            return 0;
+
+        size_t taskCount{ pool ? std::min<size_t>((m_count + TRANSFORMS_PER_TASK - 1) / TRANSFORMS_PER_TASK, pool->GetThreadCount() * 4) : 1 };
+        if (taskCount <= 1)
+        {
+            m_stats.updated = updateRange(0, m_count, destination);
+            m_stats.tasks = 1;
+        }
+        else
+        {
+            // Whole lane groups per task, so no two tasks touch the same pending counters
+            size_t groups{ (m_count + LANES - 1) / LANES };
+            std::vector<std::future<size_t>> tasks;
+            for (size_t t{ 0 }; t < taskCount; ++t)
+            {
+                size_t first{ groups * t / taskCount * LANES }, last{ groups * (t + 1) / taskCount * LANES };
+                tasks.push_back(pool->Submit([this, first, last, destination]() { return updateRange(first, last, destination); }));
+            }
+            for (std::future<size_t>& task : tasks)
+                m_stats.updated += task.get();
+            m_stats.tasks = static_cast<unsigned>(taskCount);
+        }
+
+        m_pendingCount = static_cast<size_t>(std::count_if(m_pending.begin(), m_pending.end(), [](std::uint8_t pending) { return pending != 0; }));
+        m_stats.updateMs = ElapsedMilliseconds(start, std::chrono::steady_clock::now());
+        return m_stats.updated;
+    }
+
+    size_t Size() const { return m_count; }
+    glm::vec3 GetPosition(size_t index) const { return glm::vec3(m_positionX[index], m_positionY[index], m_positionZ[index]); }
+    glm::vec3 GetScale(size_t index) const { return glm::vec3(m_scaleX[index], m_scaleY[index], m_scaleZ[index]); }
+    GLuint GetMaterial(size_t index) const { return m_materials[index]; }
+    const TransformStats& GetStats() const { return m_stats; }
+};
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+
+// Lock-free single producer, single consumer triple buffer: the writer always has a slot to fill and the reader always has a complete
+// value to read, neither ever waits. Publishing swaps the written slot with the shared middle one; the reader takes the middle slot
+// only when it holds something newer than what it has, so intermediate values are skipped rather than queued
+template <typename Value>
+class TripleBuffer
+{
+private:
+    static constexpr unsigned INDEX_MASK{ 3u };
+    static constexpr unsigned FRESH_BIT{ 4u };
+
+    // Own cache line per slot, the two threads write different ones
+    struct alignas(64) Slot
+    {
+        Value value{};
+    };
+
+    Slot m_slots[3]{};
+    alignas(64) std::atomic<unsigned> m_middle{ 1u };   // slot index, plus FRESH_BIT until the reader takes it
+    alignas(64) unsigned m_back{ 0u };                  // writer only
+    alignas(64) unsigned m_front{ 2u };                 // reader only
+
+public:
+    TripleBuffer() = default;
+
+    explicit TripleBuffer(const Value& initial)
+    {
+        for (Slot& slot : m_slots)
+            slot.value = initial;
+    }
+
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    // Writer side
+    void Write(const Value& value)
+    {
+        m_slots[m_back].value = value;
+        m_back = m_middle.exchange(m_back | FRESH_BIT, std::memory_order_acq_rel) & INDEX_MASK;
+    }
+
+    // Reader side: moves to the latest published value if there is one, false when nothing new arrived
+    bool Update()
+    {
+        if (!(m_middle.load(std::memory_order_relaxed) & FRESH_BIT))
+            return false;
+
+        m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+
+    const Value& Read() const { return m_slots[m_front].value; }
+};
+
+#endif
@@ -0,0 +1,226 @@
+#ifndef UNIFORM_BLOCKS_H
+#define UNIFORM_BLOCKS_H
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+// CPU mirrors of the std140 uniform blocks and std430 storage blocks declared in the shaders.
+// In both layouts a vec3 is aligned to 16 bytes, so every vec3 is either followed by the float that shares its slot or by explicit padding
+
+// Binding points shared by every program that declares the matching block
+enum UniformBlockBinding : GLuint
+{
+    CAMERA_BLOCK_BINDING = 0,
+    LIGHT_BLOCK_BINDING = 1,
+    MATERIAL_BLOCK_BINDING = 2,
+    CULL_BLOCK_BINDING = 3,
+    ENVIRONMENT_BLOCK_BINDING = 4,
+    PROBE_BLOCK_BINDING = 5,
+    CLUSTER_BLOCK_BINDING = 6,
+    POST_BLOCK_BINDING = 7
+};
+
+// Binding points of the shader storage blocks
+enum StorageBlockBinding : GLuint
+{
+    INSTANCE_BUFFER_BINDING = 0,
+    DRAW_COMMAND_BUFFER_BINDING = 1,
+    VISIBLE_INSTANCE_BUFFER_BINDING = 2,
+    CULL_COUNTER_BUFFER_BINDING = 3,
+    POINT_LIGHT_BUFFER_BINDING = 4,
+    CLUSTER_LIGHT_COUNT_BUFFER_BINDING = 5,
+    CLUSTER_LIGHT_INDEX_BUFFER_BINDING = 6,
+    CLUSTER_COUNTER_BUFFER_BINDING = 7,
+    BVH_NODE_BUFFER_BINDING = 8,
+    BVH_INSTANCE_BUFFER_BINDING = 9,
+    POST_STATE_BUFFER_BINDING = 10,
+    DOWNSAMPLE_TILE_BUFFER_BINDING = 11
+};
+
+// Vertex attribute carrying the index of the instance being drawn, fed per instance from the visible instance list
+constexpr GLuint INSTANCE_INDEX_ATTRIBUTE{ 3 };
+
+// Texture unit of the prefiltered environment, fixed with layout (binding) in lighting.frag
+constexpr GLuint PREFILTERED_TEXTURE_UNIT{ 1 };
+
+// Texture unit of the reflection probe cubemap array, fixed the same way
+constexpr GLuint PROBE_TEXTURE_UNIT{ 2 };
+
+// Texture unit of the half rate reflections, fixed the same way
+constexpr GLuint REFLECTION_TEXTURE_UNIT{ 3 };
+
+// Texture units of the HDR scene and its downsample pyramid, fixed the same way in downsample.comp, downsample_level.comp and tonemap.frag
+constexpr GLuint POST_SCENE_TEXTURE_UNIT{ 4 };
+constexpr GLuint POST_PYRAMID_TEXTURE_UNIT{ 5 };
+
+// Largest LOD chain the culling pass can select from
+constexpr GLuint MAX_CULL_LODS{ 4 };
+
+// Size of the material table, keep in sync with MAX_MATERIALS in lighting.frag and cull.comp
+constexpr GLuint MAX_MATERIALS{ 16 };
+
+// Groups of materials the culling pass sorts the visible instances into, one lighting program each; keep in sync with cull.comp
+constexpr GLuint MAX_CULL_BINS{ 8 };
+
+// View-space light clusters: screen tiles times exponential depth slices, keep in sync with cluster.comp and lighting.frag
+constexpr GLuint CLUSTER_GRID_X{ 16 };
+constexpr GLuint CLUSTER_GRID_Y{ 9 };
+constexpr GLuint CLUSTER_GRID_Z{ 24 };
+constexpr GLuint CLUSTER_COUNT{ CLUSTER_GRID_X * CLUSTER_GRID_Y * CLUSTER_GRID_Z };
+
+// Light index slots of a cluster, the lights past it are dropped from that cluster
+constexpr GLuint MAX_LIGHTS_PER_CLUSTER{ 128 };
+
+// Per-frame camera data (CameraBlock in lighting.vs, lighting.frag and skybox.vs)
+struct CameraBlock
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec3 position;
+    GLfloat padding0;
+};
+
+// Per-light data (LightBlock in lighting.frag)
+struct LightBlock
+{
+    glm::vec3 position;
+    GLfloat padding0;
+    glm::vec3 ambient;
+    GLfloat padding1;
+    glm::vec3 diffuse;
+    GLfloat specular;
+};
+
+// One entry of the material table
+struct Material
+{
+    glm::vec3 ambient;
+    GLuint features;                // LightingFeature mask, 0 for LIGHTING_DEFAULT_FEATURES
+    glm::vec3 diffuse;
+    GLfloat padding1;
+    glm::vec3 specular;
+    GLfloat shininess;
+};
+
+// Every material in the scene (MaterialBlock in lighting.frag), instances pick theirs by index
+struct MaterialBlock
+{
+    Material materials[MAX_MATERIALS];
+};
+
+// Per-sphere data read by lighting.vs from the instance buffer (std430)
+struct SphereInstance
+{
+    glm::mat4 model;
+    glm::vec4 normalMatrix[3];      // mat3 columns, inverse transpose of the model's upper 3x3
+    GLuint materialIndex;
+    GLint probeIndex;               // layer of the reflection probe array this sphere reads, -1 for none
+    GLuint padding0[2];
+};
+
+// Inputs of the culling pass (CullBlock in cull.comp)
+struct CullBlock
+{
+    glm::vec4 frustumPlanes[6];     // xyz normal pointing inside, w distance
+    glm::vec4 lodThresholds;        // projected diameter in pixels under which LOD i + 1 is used
+    glm::vec3 cameraPosition;
+    GLfloat projectionScale;        // converts radius / distance to a diameter in pixels
+    GLuint instanceCount;
+    GLuint lodCount;
+    GLuint binCount;
+    GLfloat boundingRadius;         // radius of the mesh before the instance scale
+    glm::uvec4 materialBins[MAX_MATERIALS / 4];     // bin of material i in component i % 4 of entry i / 4
+    glm::uvec4 binRanges[MAX_CULL_BINS];            // x first visible slot of the bin, y slots per LOD, also the baseInstance stride
+};
+
+// Image based lighting inputs (EnvironmentBlock in lighting.frag)
+struct EnvironmentBlock
+{
+    glm::vec4 irradiance[9];        // SH9 coefficients of the diffuse radiance, rgb
+    GLfloat prefilteredMaxLod;      // last level of the prefiltered cubemap, the one filtered for roughness 1
+    GLint enabled;                  // 0 keeps the single unfiltered skybox lookup
+    GLfloat padding0[2];
+};
+
+// One probe update (ProbeBlock in probe.geom): the six face cameras and where the faces go in the probe array
+struct ProbeBlock
+{
+    glm::mat4 faceViewProjection[6];
+    GLint firstLayer;               // probe index * 6
+    GLint skipInstance;             // the sphere that owns the probe is not drawn into it
+    GLfloat padding0[2];
+};
+
+// One point light of the clustered set (std430, read by cluster.comp and lighting.frag)
+struct PointLight
+{
+    glm::vec3 position;
+    GLfloat radius;                 // the light has no effect past it
+    glm::vec3 color;
+    GLfloat padding0;
+};
+
+// Inputs of the light clustering pass and of the cluster lookup in lighting.frag (ClusterBlock)
+struct ClusterBlock
+{
+    glm::mat4 inverseProjection;
+    glm::vec2 viewportSize;
+    GLfloat nearPlane;
+    GLfloat farPlane;
+    GLuint lightCount;              // 0 skips the point lights entirely
+    GLuint padding0[3];
+};
+
+// Node of the BVH over the sphere instances (std430, read by lighting.frag when ray tracing). The two children of an inner node are
+// adjacent, a leaf lists count entries of the BVH's instance index list
+struct BvhNode
+{
+    glm::vec3 boundsMin;
+    GLuint leftOrFirst;             // first child of an inner node, first index list entry of a leaf
+    glm::vec3 boundsMax;
+    GLuint count;                   // instances of a leaf, 0 for an inner node
+};
+
+// Inputs of the post chain (PostBlock in downsample.comp, downsample_level.comp and tonemap.frag)
+struct PostBlock
+{
+    glm::ivec4 outputViewport;      // where the tonemapped frame goes in the output framebuffer
+    glm::ivec2 sceneSize;           // part of the scene texture in use
+    glm::ivec2 sceneTextureSize;    // its allocated size
+    GLint levelCount;               // pyramid levels built, level 1 is half the scene size
+    GLfloat deltaTime;              // seconds since the last frame, 0 snaps the exposure to the scene
+    GLfloat exposureKey;            // the average luminance is mapped to this
+    GLfloat adaptationRate;         // per second
+    GLfloat bloomStrength;          // share of the pyramid in the final colour
+    GLfloat minExposure;
+    GLfloat maxExposure;
+    GLfloat padding0;
+};
+
+// Layout of one glMultiDrawElementsIndirect command
+struct DrawElementsIndirectCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+static_assert(sizeof(CameraBlock) == 144, "CameraBlock must match the std140 layout");
+static_assert(sizeof(LightBlock) == 48, "LightBlock must match the std140 layout");
+static_assert(sizeof(Material) == 48, "Material must match the std140 layout");
+static_assert(sizeof(MaterialBlock) == 48 * MAX_MATERIALS, "MaterialBlock must match the std140 layout");
+static_assert(sizeof(SphereInstance) == 128, "SphereInstance must match the std430 layout");
+static_assert(sizeof(CullBlock) == 336, "CullBlock must match the std140 layout");
+static_assert(sizeof(PointLight) == 32, "PointLight must match the std430 layout");
+static_assert(sizeof(ClusterBlock) == 96, "ClusterBlock must match the std140 layout");
+static_assert(sizeof(EnvironmentBlock) == 160, "EnvironmentBlock must match the std140 layout");
+static_assert(sizeof(ProbeBlock) == 400, "ProbeBlock must match the std140 layout");
+static_assert(sizeof(PostBlock) == 64, "PostBlock must match the std140 layout");
+static_assert(sizeof(BvhNode) == 32, "BvhNode must match the std430 layout");
+static_assert(sizeof(DrawElementsIndirectCommand) == 20, "DrawElementsIndirectCommand must match the indirect command layout");
+
+#endif
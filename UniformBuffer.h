@@ -0,0 +1,50 @@
+#ifndef UNIFORM_BUFFER_H
+#define UNIFORM_BUFFER_H
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include "GLState.h"
+
+// Owns a uniform buffer object sized for one std140 block and keeps it bound to a fixed binding point.
+// The whole block is written with a single glBufferSubData, so updating it costs one call no matter how many fields it has
+template <typename Block>
+class UniformBuffer
+{
+private:
+    GLuint m_buffer{};
+    GLuint m_bindingPoint{};
+
+public:
+    explicit UniformBuffer(GLuint bindingPoint)
+        : m_bindingPoint{ bindingPoint }
+    {
+        glGenBuffers(1, &m_buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(Block), nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+        GetGLState().BindBufferBase(GL_UNIFORM_BUFFER, m_bindingPoint, m_buffer);
+    }
+
+    UniformBuffer(const UniformBuffer&) = delete;
+    UniformBuffer& operator=(const UniformBuffer&) = delete;
+
+    ~UniformBuffer()
+    {
+        GetGLState().DeleteBuffers(1, &m_buffer);
+    }
+
+    // Uploads the whole block in one write
+    void Update(const Block& data)
+    {
+        glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Block), &data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    GLuint GetBindingPoint() const { return m_bindingPoint; }
+    GLuint GetBuffer() const { return m_buffer; }
+};
+
+#endif
@@ -0,0 +1,23 @@
+#include <vector>
+
+//GLEW
+#define GLEW_STATIC
+#include <gl/glew.h>
+
+#include "Microbenchmarks.h"
+
+// CPU microbenchmarks of the viewer's hot paths, a program of its own: no window, context or GPU, so no SFML either
+int main(int argc, char* argv[])
+{
+    MicrobenchmarkOptions options{ ParseMicrobenchmarkOptions(argc, argv) };
+
+    std::vector<const GLchar*> faces;
+    faces.push_back("Yokohama3/posx.jpg");
+    faces.push_back("Yokohama3/negx.jpg");
+    faces.push_back("Yokohama3/posy.jpg");
+    faces.push_back("Yokohama3/negy.jpg");
+    faces.push_back("Yokohama3/posz.jpg");
+    faces.push_back("Yokohama3/negz.jpg");
+
+    return RunMicrobenchmarks(options, faces);
+}
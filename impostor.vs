@@ -0,0 +1,64 @@
+#version 430 core
+layout (location = 0) in vec3 position;         // corner of the unit quad, xy in [-1, 1]
+layout (location = 3) in uint instanceIndex;    // per instance, from the visible instance list
+
+// SPHERE_RADIUS comes from the renderer, the radius of the sphere before the instance's scale
+
+out vec3 QuadPos;
+flat out vec3 SphereCenter;
+flat out mat3 SphereNormalMatrix;
+flat out uint MaterialIndex;
+flat out int ProbeIndex;
+
+layout (std140) uniform CameraBlock
+{
+    mat4 view;
+    mat4 projection;
+    vec3 cameraPos;
+};
+
+struct Instance
+{
+    mat4 model;
+    mat3 normalMatrix;
+    uint materialIndex;
+    int probeIndex;
+};
+
+// One entry per sphere
+layout (std430, binding = 0) readonly buffer InstanceBuffer
+{
+    Instance instances[];
+};
+
+// The quad faces the camera and touches the bounding sphere at its nearest point, sized to cover the sphere's silhouette cone
+// there. Everything the ray cast in lighting.frag can hit is behind it, which is what lets it declare depth_greater
+void main()
+{
+    Instance instance = instances[instanceIndex];
+    vec3 center = instance.model[3].xyz;
+    float boundingRadius = SPHERE_RADIUS * max(length(instance.model[0].xyz), max(length(instance.model[1].xyz), length(instance.model[2].xyz)));
+
+    SphereCenter = center;
+    SphereNormalMatrix = instance.normalMatrix;
+    MaterialIndex = instance.materialIndex;
+    ProbeIndex = instance.probeIndex;
+
+    // From inside its bounds the sphere gets no quad at all
+    vec3 toCamera = cameraPos - center;
+    float distance = length(toCamera);
+    if (distance <= boundingRadius * 1.001)
+    {
+        QuadPos = center;
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+        return;
+    }
+
+    vec3 axis = toCamera / distance;
+    vec3 right = normalize(cross(abs(axis.y) < 0.99 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0), axis));
+    vec3 up = cross(axis, right);
+    float halfSize = (distance - boundingRadius) * boundingRadius / sqrt(distance * distance - boundingRadius * boundingRadius);
+
+    QuadPos = center + axis * boundingRadius + (right * position.x + up * position.y) * halfSize;
+    gl_Position = projection * view * vec4(QuadPos, 1.0);
+}
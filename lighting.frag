@@ -1,8 +1,9 @@
 // Reflection
-#version 330 core
+#version 430 core
 struct Material
 {
      vec3 ambient;
+     uint features;     // FEATURE_* mask, 0 for DEFAULT_FEATURES
      vec3 diffuse;
      vec3 specular;
      float shininess;
@@ -16,42 +17,444 @@ struct Light
      float specular;
 };
 
+struct PointLight
+{
+    vec3 position;
+    float radius;
+    vec3 color;
+};
+
 out vec4 FragColor;
 
+// IMPOSTOR (impostor.vs) and RAYTRACE (raytrace.vs) find the surface by casting the view ray against the sphere instead of
+// interpolating it, both come with SPHERE_RADIUS from the renderer. Everything after that point is shaded the same way
+#if defined(IMPOSTOR)
+in vec3 QuadPos;
+flat in vec3 SphereCenter;
+flat in mat3 SphereNormalMatrix;
+flat in uint MaterialIndex;
+flat in int ProbeIndex;
+#elif defined(RAYTRACE)
+in vec3 RayDirection;
+uint MaterialIndex;
+int ProbeIndex;
+#else
 in vec3 Normal;
 in vec3 FragPos;
+flat in uint MaterialIndex;
+flat in int ProbeIndex;     // -1 when the sphere has no reflection probe
+#endif
+
+#if defined(IMPOSTOR) || defined(RAYTRACE)
+vec3 Normal;
+vec3 FragPos;
+
+// The hit is always behind the primitive drawn for it, so early depth tests still reject covered fragments
+layout (depth_greater) out float gl_FragDepth;
+#endif
+
+// Keep in sync with MAX_MATERIALS and the CLUSTER_* constants in UniformBlocks.h
+#define MAX_MATERIALS 16
+#define CLUSTER_GRID_X 16
+#define CLUSTER_GRID_Y 9
+#define CLUSTER_GRID_Z 24
+#define MAX_LIGHTS_PER_CLUSTER 128
+
+// Terms a material can be shaded with, keep in sync with LightingFeature in ShaderPermutations.h. With LIGHTING_FEATURES defined the
+// mask is a constant and the compiler drops the unused terms; without it (probes, ray tracing, --no-shader-variants) the material's
+// own mask is read and branched on per pixel
+#define FEATURE_PHONG 1u
+#define FEATURE_REFLECT 2u
+#define FEATURE_REFRACT 4u
+#define FEATURE_FRESNEL 8u
+#define FEATURE_POINT_LIGHTS 16u
+#define DEFAULT_FEATURES (FEATURE_PHONG | FEATURE_REFLECT | FEATURE_REFRACT)
+
+// Keep in sync with ReflectionMode in Renderer.h
+#define REFLECTION_FULL_RATE 0
+#define REFLECTION_WRITE_HALF_RATE 1
+#define REFLECTION_READ_HALF_RATE 2
+
+// Half rate texels further than this fraction of the fragment's view depth from it are left out of the upsample
+#define REFLECTION_DEPTH_TOLERANCE 0.05
+
+layout (std140) uniform CameraBlock
+{
+    mat4 view;
+    mat4 projection;
+    vec3 cameraPos;
+};
+
+layout (std140) uniform LightBlock
+{
+    Light light;
+};
+
+layout (std140) uniform MaterialBlock
+{
+    Material materials[MAX_MATERIALS];
+};
+
+// Image based lighting baked on the CPU (EnvironmentLighting.h)
+layout (std140) uniform EnvironmentBlock
+{
+    vec4 irradiance[9];         // SH9 of the diffuse radiance
+    float prefilteredMaxLod;    // level filtered for roughness 1
+    int imageBasedLighting;
+};
+
+// Point lights binned into view-space clusters by cluster.comp
+layout (std140) uniform ClusterBlock
+{
+    mat4 inverseProjection;
+    vec2 viewportSize;
+    float nearPlane;
+    float farPlane;
+    uint lightCount;
+};
+
+layout (std430, binding = 4) readonly buffer PointLightBuffer
+{
+    PointLight pointLights[];
+};
+
+layout (std430, binding = 5) readonly buffer ClusterLightCountBuffer
+{
+    uint clusterLightCounts[];
+};
+
+layout (std430, binding = 6) readonly buffer ClusterLightIndexBuffer
+{
+    uint clusterLightIndices[];
+};
+
+#if defined(RAYTRACE)
+// Keep in sync with BVH_STACK_SIZE in SphereBvh.h
+#define BVH_STACK_SIZE 32
+
+struct Instance
+{
+    mat4 model;
+    mat3 normalMatrix;
+    uint materialIndex;
+    int probeIndex;
+};
+
+struct BvhNode
+{
+    vec3 boundsMin;
+    uint leftOrFirst;   // first child, or first index list entry of a leaf
+    vec3 boundsMax;
+    uint count;         // 0 for an inner node
+};
+
+layout (std430, binding = 0) readonly buffer InstanceBuffer
+{
+    Instance instances[];
+};
+
+// SphereBvh.h
+layout (std430, binding = 8) readonly buffer BvhNodeBuffer
+{
+    BvhNode bvhNodes[];
+};
+
+layout (std430, binding = 9) readonly buffer BvhInstanceBuffer
+{
+    uint bvhInstances[];
+};
+#endif
 
-uniform vec3 cameraPos;
 uniform samplerCube skybox;
+layout (binding = 1) uniform samplerCube prefiltered;   // PREFILTERED_TEXTURE_UNIT
+layout (binding = 2) uniform samplerCubeArray probes;   // PROBE_TEXTURE_UNIT, the other spheres as seen from each probe
+layout (binding = 3) uniform sampler2D halfReflection;  // REFLECTION_TEXTURE_UNIT, reflection and view depth at half resolution
 
-uniform Material material;
-uniform Light light;
+uniform int reflectionMode;     // REFLECTION_*, 0 unless the renderer shades reflections at half rate
+uniform ivec2 reflectionSize;   // texels of halfReflection in use
 
-void main()
-{             
-    vec3 norm = normalize(Normal);
-    
+#if defined(IMPOSTOR) || defined(RAYTRACE)
+// Nearest hit of a ray with an instance's sphere, an ellipsoid once scaled. The transposed normal matrix is the inverse of the model's
+// upper 3x3, it takes the ray into object space where the sphere is round; t is in units of direction
+bool IntersectInstance(vec3 origin, vec3 direction, vec3 center, mat3 normalMatrix, out float t, out vec3 objectPosition)
+{
+    mat3 worldToObject = transpose(normalMatrix);
+    vec3 o = worldToObject * (origin - center);
+    vec3 d = worldToObject * direction;
+
+    float a = dot(d, d);
+    float b = dot(o, d);
+    float discriminant = b * b - a * (dot(o, o) - SPHERE_RADIUS * SPHERE_RADIUS);
+    if (discriminant < 0.0)
+        return false;
+
+    t = (-b - sqrt(discriminant)) / a;
+    objectPosition = o + t * d;
+    return t > 0.0;
+}
+
+// Sets the surface the shading below works on and the depth of the hit
+void SetHit(vec3 position, mat3 normalMatrix, vec3 objectPosition)
+{
+    FragPos = position;
+    Normal = normalMatrix * objectPosition;
+    vec4 clip = projection * view * vec4(position, 1.0);
+    gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;
+}
+#endif
+
+#if defined(RAYTRACE)
+// Distance along the ray to where it enters the box, or a huge value when it misses it
+float BoxDistance(vec3 boundsMin, vec3 boundsMax, vec3 origin, vec3 inverseDirection)
+{
+    vec3 t0 = (boundsMin - origin) * inverseDirection;
+    vec3 t1 = (boundsMax - origin) * inverseDirection;
+    vec3 near = min(t0, t1);
+    vec3 far = max(t0, t1);
+    float entry = max(max(near.x, near.y), max(near.z, 0.0));
+    float exit = min(min(far.x, far.y), far.z);
+    return entry <= exit ? entry : 1e30;
+}
+
+// Closest instance along the ray. The nearer child is visited first and nodes further than the closest hit so far are skipped
+bool TraceInstances(vec3 origin, vec3 direction, out uint hitInstance, out float hitT, out vec3 hitObject)
+{
+    vec3 inverseDirection = 1.0 / direction;
+    hitT = 1e30;
+    hitInstance = 0u;
+    if (BoxDistance(bvhNodes[0].boundsMin, bvhNodes[0].boundsMax, origin, inverseDirection) >= hitT)
+        return false;
+
+    uint stack[BVH_STACK_SIZE];
+    int top = 0;
+    stack[top++] = 0u;
+    while (top > 0)
+    {
+        BvhNode node = bvhNodes[stack[--top]];
+        if (node.count > 0u)
+        {
+            for (uint i = node.leftOrFirst; i < node.leftOrFirst + node.count; ++i)
+            {
+                uint index = bvhInstances[i];
+                float t;
+                vec3 objectPosition;
+                if (IntersectInstance(origin, direction, instances[index].model[3].xyz, instances[index].normalMatrix, t, objectPosition) && t < hitT)
+                {
+                    hitT = t;
+                    hitInstance = index;
+                    hitObject = objectPosition;
+                }
+            }
+            continue;
+        }
+
+        uint near = node.leftOrFirst;
+        uint far = near + 1u;
+        float nearDistance = BoxDistance(bvhNodes[near].boundsMin, bvhNodes[near].boundsMax, origin, inverseDirection);
+        float farDistance = BoxDistance(bvhNodes[far].boundsMin, bvhNodes[far].boundsMax, origin, inverseDirection);
+        if (farDistance < nearDistance)
+        {
+            uint swapNode = near;
+            near = far;
+            far = swapNode;
+            float swapDistance = nearDistance;
+            nearDistance = farDistance;
+            farDistance = swapDistance;
+        }
+        if (farDistance < hitT && top < BVH_STACK_SIZE)
+            stack[top++] = far;
+        if (nearDistance < hitT && top < BVH_STACK_SIZE)
+            stack[top++] = near;
+    }
+    return hitT < 1e30;
+}
+#endif
+
+// Same basis constants as EvaluateSH9()
+vec3 IrradianceSH(vec3 n)
+{
+    vec3 result = irradiance[0].rgb * 0.282095
+        + irradiance[1].rgb * (0.488603 * n.y)
+        + irradiance[2].rgb * (0.488603 * n.z)
+        + irradiance[3].rgb * (0.488603 * n.x)
+        + irradiance[4].rgb * (1.092548 * n.x * n.y)
+        + irradiance[5].rgb * (1.092548 * n.y * n.z)
+        + irradiance[6].rgb * (0.315392 * (3.0 * n.z * n.z - 1.0))
+        + irradiance[7].rgb * (1.092548 * n.x * n.z)
+        + irradiance[8].rgb * (0.546274 * (n.x * n.x - n.y * n.y));
+    return max(result, 0.0);
+}
+
+// Diffuse and specular of the point lights whose range reaches this fragment's cluster
+vec3 ClusteredLights(Material material, vec3 norm, vec3 viewDir)
+{
+    float viewDepth = -(view * vec4(FragPos, 1.0)).z;
+    float slice = floor(log(max(viewDepth, nearPlane) / nearPlane) / log(farPlane / nearPlane) * float(CLUSTER_GRID_Z));
+    uvec3 coordinate = uvec3(clamp(gl_FragCoord.xy / viewportSize, 0.0, 0.999) * vec2(CLUSTER_GRID_X, CLUSTER_GRID_Y), min(uint(slice), uint(CLUSTER_GRID_Z - 1)));
+    uint cluster = coordinate.x + uint(CLUSTER_GRID_X) * (coordinate.y + uint(CLUSTER_GRID_Y) * coordinate.z);
+
+    vec3 result = vec3(0.0);
+    uint count = clusterLightCounts[cluster];
+    for (uint i = 0u; i < count; ++i)
+    {
+        PointLight pointLight = pointLights[clusterLightIndices[cluster * uint(MAX_LIGHTS_PER_CLUSTER) + i]];
+        vec3 toLight = pointLight.position - FragPos;
+        float distance = length(toLight);
+        if (distance >= pointLight.radius)
+            continue;
+
+        // Inverse square with a window that reaches zero at the radius
+        float window = 1.0 - pow(distance / pointLight.radius, 4.0);
+        float attenuation = window * window / (distance * distance + 1.0);
+        vec3 lightDir = toLight / distance;
+        float coeff = max(dot(lightDir, norm), 0.0);
+        float shininess = pow(max(-dot(viewDir, reflect(-lightDir, norm)), 0.0), material.shininess);
+        result += pointLight.color * attenuation * (coeff * material.diffuse + shininess * material.specular);
+    }
+    return result;
+}
+
+uint MaterialFeatures(Material material)
+{
+#if defined(LIGHTING_FEATURES)
+    return LIGHTING_FEATURES;
+#else
+    uint features = material.features != 0u ? material.features : DEFAULT_FEATURES;
+    return lightCount > 0u ? features | FEATURE_POINT_LIGHTS : features;
+#endif
+}
+
+// Environment (and probe) seen along a direction
+vec3 Environment(Material material, vec3 Color)
+{
+    vec3 reflectedColor;
+    if (imageBasedLighting != 0)
+    {
+        // Phong exponent to GGX roughness, level i of the prefiltered cubemap holds roughness i / prefilteredMaxLod
+        float roughness = sqrt(sqrt(2.0 / (material.shininess + 2.0)));
+        reflectedColor = textureLod(prefiltered, Color, roughness * prefilteredMaxLod).rgb;
+    }
+    else
+        reflectedColor = texture(skybox, Color).rgb;
+
+    // Alpha marks where other spheres cover the environment in this sphere's probe
+    if (ProbeIndex >= 0)
+    {
+        vec4 probe = texture(probes, vec4(Color, float(ProbeIndex)));
+        reflectedColor = mix(reflectedColor, probe.rgb, probe.a);
+    }
+    return reflectedColor;
+}
+
+// Environment seen along the reflected ray, the refracted one or the mix of both
+vec3 Reflection(Material material, vec3 norm, uint features)
+{
     vec3 Incident = normalize(FragPos - cameraPos);
     vec3 Refl = reflect(Incident, norm);
-
-    float refractiveFactor = 0.5 + (2.5 * pow(1 + dot(Incident, norm), 5.0));
     vec3 Refr = refract(Incident, norm, 1.00/1.33);
-    
-    vec3 Color = mix(Refl, Refr, 0.5);
-    vec3 reflectedColor = texture(skybox, Color).rgb;
 
-    vec3 lightDir = normalize(FragPos - light.position);
-    float coeff = max(-dot(lightDir, norm), 0.0f);
+    bool reflects = (features & FEATURE_REFLECT) != 0u;
+    bool refracts = (features & FEATURE_REFRACT) != 0u;
+    if (reflects && refracts && (features & FEATURE_FRESNEL) != 0u)
+    {
+        float refractiveFactor = clamp(0.5 + (2.5 * pow(1 + dot(Incident, norm), 5.0)), 0.0, 1.0);
+        return mix(Environment(material, Refr), Environment(material, Refl), refractiveFactor);
+    }
+    if (reflects && refracts)
+        return Environment(material, mix(Refl, Refr, 0.5));
+    return Environment(material, reflects ? Refl : Refr);
+}
+
+// Bilinear weights of the four nearest half rate texels, each scaled down by how far its view depth is from this fragment's.
+// False where none is close enough, on silhouettes the half rate pass missed or shared with another sphere
+bool UpsampleReflection(float viewDepth, out vec3 reflection)
+{
+    vec2 position = gl_FragCoord.xy * 0.5 - 0.5;
+    ivec2 base = ivec2(floor(position));
+    vec2 f = position - vec2(base);
+
+    vec3 sum = vec3(0.0);
+    float total = 0.0;
+    for (int i = 0; i < 4; ++i)
+    {
+        ivec2 offset = ivec2(i & 1, i >> 1);
+        vec4 texel = texelFetch(halfReflection, clamp(base + offset, ivec2(0), reflectionSize - 1), 0);
+        float bilinear = (offset.x == 1 ? f.x : 1.0 - f.x) * (offset.y == 1 ? f.y : 1.0 - f.y);
+        float similarity = max(0.0, 1.0 - abs(texel.a - viewDepth) / (REFLECTION_DEPTH_TOLERANCE * viewDepth));
+        float weight = (bilinear + 0.001) * similarity;
+        sum += texel.rgb * weight;
+        total += weight;
+    }
+    reflection = total > 0.0001 ? sum / total : vec3(0.0);
+    return total > 0.0001;
+}
+
+void main()
+{
+#if defined(IMPOSTOR)
+    vec3 direction = normalize(QuadPos - cameraPos);
+    float t;
+    vec3 objectPosition;
+    if (!IntersectInstance(cameraPos, direction, SphereCenter, SphereNormalMatrix, t, objectPosition))
+        discard;
+    SetHit(cameraPos + t * direction, SphereNormalMatrix, objectPosition);
+#elif defined(RAYTRACE)
+    vec3 direction = normalize(RayDirection);
+    uint instance;
+    float t;
+    vec3 objectPosition;
+    if (!TraceInstances(cameraPos, direction, instance, t, objectPosition))
+        discard;
+    SetHit(cameraPos + t * direction, instances[instance].normalMatrix, objectPosition);
+    MaterialIndex = instances[instance].materialIndex;
+    ProbeIndex = instances[instance].probeIndex;
+#endif
 
-    vec3 ambience = light.ambient * material.ambient;
-    vec3 diffuse = light.diffuse * (coeff * material.diffuse);
+    Material material = materials[MaterialIndex];
+    uint features = MaterialFeatures(material);
+    bool environment = (features & (FEATURE_REFLECT | FEATURE_REFRACT)) != 0u;
+    vec3 norm = normalize(Normal);
+    float viewDepth = -(view * vec4(FragPos, 1.0)).z;
+
+    // The half rate pass only needs the reflection, its alpha carries the depth for the upsample
+    vec3 reflectedColor = vec3(0.0);
+    if (reflectionMode == REFLECTION_WRITE_HALF_RATE)
+    {
+        FragColor = vec4(environment ? Reflection(material, norm, features) : reflectedColor, viewDepth);
+        return;
+    }
+    if (environment && (reflectionMode != REFLECTION_READ_HALF_RATE || !UpsampleReflection(viewDepth, reflectedColor)))
+        reflectedColor = Reflection(material, norm, features);
 
+    // Mirror-like materials without the Phong terms show only the environment
     vec3 viewDir = normalize(FragPos - cameraPos);
-    float shininess = pow(max(-dot(viewDir, reflect(lightDir, norm)), 0.0f), material.shininess);
-    vec3 specular = light.specular * (material.specular * shininess);
+    vec3 result = reflectedColor;
+    if ((features & FEATURE_PHONG) != 0u)
+    {
+        vec3 ambience = light.ambient * material.ambient;
+        if (imageBasedLighting != 0)
+            ambience += IrradianceSH(norm) * material.ambient;
+
+        vec3 lightDir = normalize(FragPos - light.position);
+        float coeff = max(-dot(lightDir, norm), 0.0f);
+
+        vec3 diffuse = light.diffuse * (coeff * material.diffuse);
+
+        float shininess = pow(max(-dot(viewDir, reflect(lightDir, norm)), 0.0f), material.shininess);
+        vec3 specular = light.specular * (material.specular * shininess);
+
+        // The environment tints the highlight and is blended over the result
+        if (environment)
+        {
+            result = ambience + diffuse + (reflectedColor * specular);
+            result = mix(result, reflectedColor, light.specular);
+        }
+        else
+            result = ambience + diffuse + specular;
+    }
 
-    vec3 result = ambience + diffuse + (reflectedColor * specular);
-  
-    result = mix(result, reflectedColor, light.specular);
+    // Added after the mirror blend, the reflective spheres would otherwise hide most of them
+    if ((features & FEATURE_POINT_LIGHTS) != 0u && lightCount > 0u)
+        result += ClusteredLights(material, norm, viewDir);
     FragColor = vec4(result, 1.0);
 }
@@ -1,17 +1,42 @@
-#version 330 core
+#version 430 core
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normal;
+layout (location = 3) in uint instanceIndex;    // per instance, from the visible instance list
 
 out vec3 Normal;
 out vec3 FragPos;
+flat out uint MaterialIndex;
+flat out int ProbeIndex;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+layout (std140) uniform CameraBlock
+{
+    mat4 view;
+    mat4 projection;
+    vec3 cameraPos;
+};
+
+struct Instance
+{
+    mat4 model;
+    mat3 normalMatrix;
+    uint materialIndex;
+    int probeIndex;
+};
+
+// One entry per sphere
+layout (std430, binding = 0) readonly buffer InstanceBuffer
+{
+    Instance instances[];
+};
 
 void main()
 {
-    gl_Position = projection * view * vec4(position, 1.0f);
-    FragPos = vec3(model * vec4(position, 1.0f));
-    Normal = mat3(transpose(inverse(model))) * normal;
+    Instance instance = instances[instanceIndex];
+    vec4 worldPosition = instance.model * vec4(position, 1.0f);
+
+    gl_Position = projection * view * worldPosition;
+    FragPos = vec3(worldPosition);
+    Normal = instance.normalMatrix * normal;
+    MaterialIndex = instance.materialIndex;
+    ProbeIndex = instance.probeIndex;
 }
\ No newline at end of file
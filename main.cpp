@@ -1,4 +1,6 @@
+#include <chrono>
 #include <iostream>
+#include <memory>
 #include <vector>
 #include "Camera.h"
 
@@ -10,131 +12,85 @@
 #include <SFML/Graphics.hpp>
 #include <SFML/Window.hpp>
 
-// SOIL2
-#include <SOIL2.h>
-
 // GLM
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
-#include "Shader.h"
-
-// Constants
-constexpr unsigned int WIDTH{ 800 }, HEIGHT{ 600 };
-float lastX = WIDTH / 2.0;
-float lastY = HEIGHT / 2.0;
-
-constexpr float M_PI{ glm::pi<GLfloat>() };
-constexpr int STACKS{ 50 };
-constexpr int SLICES{ 50 };
-constexpr float radius{ 0.5 };
-
-int numberOfPoints{ 0 };
-int numberOfIndexes{ 0 };
-
-float vertice[(STACKS + 1) * SLICES * 3];
-unsigned int indices[STACKS * SLICES * 10];
-
-void getSphereCoords()
+#include "EnvironmentCache.h"
+#include "EnvironmentLighting.h"
+#include "GLState.h"
+#include "GpuCulling.h"
+#include "Headless.h"
+#include "InputThread.h"
+#include "Options.h"
+#include "Renderer.h"
+#include "Scene.h"
+#include "SoftwareRenderer.h"
+#include "ThreadPool.h"
+
+int main(int argc, char* argv[])
 {
-    float theta{};
-    for (int i{ 0 }; i <= SLICES; ++i)
-    {
-        float phi{ i * (M_PI / SLICES) };
-        for (int j{ 0 }; j < STACKS; ++j)
-        {
-            theta = (j * (M_PI * 2 / STACKS));
-            float x = cosf(theta) * sinf(phi);
-            float y = cosf(phi);
-            float z = sinf(theta) * sinf(phi);
-
-            vertice[numberOfPoints++] = x * radius;
-            vertice[numberOfPoints++] = y * radius;
-            vertice[numberOfPoints++] = z * radius;
-        }
-    }
+    GetStartupTime();
+    Options options{ ParseOptions(argc, argv) };
+    GetGLState().SetEnabled(options.stateCache);
+    EnvironmentCacheFormat environmentFormat{ options.compressEnvironment ? ENVIRONMENT_FORMAT_BC1 : ENVIRONMENT_FORMAT_RGB8 };
 
-    for (int i = 0; i < numberOfPoints / 3 - STACKS; i++)
-    {
-        if ((i + 1) % STACKS == 0)
-        {
-            indices[numberOfIndexes++] = i;
-            indices[numberOfIndexes++] = i - STACKS + 1;
-            indices[numberOfIndexes++] = i + STACKS;
-
-            indices[numberOfIndexes++] = i - STACKS + 1;
-            indices[numberOfIndexes++] = i + STACKS;
-            if (i + 1 == numberOfPoints / 3)
-                indices[numberOfIndexes++] = numberOfPoints - STACKS;
-            else
-                indices[numberOfIndexes++] = i + 1;
-        }
-        else
-        {
-            indices[numberOfIndexes++] = i;
-            indices[numberOfIndexes++] = i + 1;
-            indices[numberOfIndexes++] = i + STACKS;
-
-            // Bottom tri of quad
-            indices[numberOfIndexes++] = i + 1;
-            indices[numberOfIndexes++] = i + STACKS;
-            indices[numberOfIndexes++] = i + STACKS + 1;
-        }
-    }
-}
-
-static GLuint LoadCubemap(std::vector<const GLchar* > faces)
-{
-    GLuint textureID;
-    glGenTextures(1, &textureID);
-
-    int imageWidth, imageHeight;
-    unsigned char* image;
-
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+    std::vector<const GLchar*> faces;
+    faces.push_back("Yokohama3/posx.jpg");
+    faces.push_back("Yokohama3/negx.jpg");
+    faces.push_back("Yokohama3/posy.jpg");
+    faces.push_back("Yokohama3/negy.jpg");
+    faces.push_back("Yokohama3/posz.jpg");
+    faces.push_back("Yokohama3/negz.jpg");
 
-    for (GLuint i = 0; i < faces.size(); i++)
+    ThreadPool threadPool{};
+
+    // Scene tools, no context needed either
+    if (!options.exportScene.empty())
+        return WriteSceneText(options.exportScene, BuildSceneDescription(options, faces)) ? 0 : 1;
+    if (!options.convertSceneInput.empty())
+        return ConvertScene(options.convertSceneInput, options.convertSceneOutput) ? 0 : 1;
+    if (options.sceneBenchmark)
+        return RunSceneBenchmark(options, faces);
+
+    // A compiled scene stays mapped for the whole run, its objects are read from the mapping while they stream in
+    SceneFile sceneFile;
+    if (!options.sceneFile.empty() && !sceneFile.Open(options.sceneFile))
+        return 1;
+    const SceneFile* scene{ sceneFile.IsOpen() ? &sceneFile : nullptr };
+    if (scene)
+        scene->GetEnvironmentFaces(faces);
+
+    // Offline step, no context needed
+    if (options.bakeEnvironment)
     {
-        image = SOIL_load_image(faces[i], &imageWidth, &imageHeight, 0, SOIL_LOAD_RGB);
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, imageWidth, imageHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, image);
-        SOIL_free_image_data(image);
+        EnvironmentLighting lighting;
+        bool baked{ BakeEnvironmentCache(threadPool, faces, ENVIRONMENT_CACHE_PATH, environmentFormat) && lighting.Bake(threadPool, faces)
+            && lighting.Write(ENVIRONMENT_LIGHTING_PATH, HashEnvironmentSources(faces)) };
+        return baked ? 0 : 1;
     }
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
-
-    return textureID;
-}
 
-bool firstMouse{ true };
-void MouseCallBack(Camera& camera, float xPos, float yPos)
-{
-    if (firstMouse)
+    // Scripted offscreen runs for benchmarking, on the GPU and/or the CPU reference renderer, no window either
+    if (options.headless || options.software)
     {
-        lastX = xPos;
-        lastY = yPos;
-        firstMouse = false;
+        int result{ 0 };
+        if (options.resourceBenchmark)
+            result = RunResourceBenchmark(options);
+        else if (options.postBenchmark)
+            result = RunPostBenchmark(options, threadPool, faces);
+        else if (options.sphereBenchmark)
+            result = RunSphereBenchmark(options, threadPool, faces);
+        else if (options.lightBenchmark)
+            result = RunLightBenchmark(options, threadPool, faces, scene);
+        else if (options.headless)
+            result = RunHeadlessBenchmark(options, threadPool, faces, scene);
+        if (result == 0 && options.software)
+            result = RunSoftwareBenchmark(options, threadPool, faces, scene);
+        return result;
     }
 
-    float xOffset{ xPos - lastX };
-    float yOffset{ lastY - yPos };
-
-
-    lastX = xPos;
-    lastY = yPos;
-
-    camera.ProcessMouseMovement(xOffset, yOffset);
-}
-
-int main()
-{
     Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
-    
-    glm::vec3 lightPos(1.2f, 1.0f, 2.0f);
     sf::Clock clock{};
 
     sf::ContextSettings settings;
@@ -147,136 +103,50 @@ int main()
     settings.stencilBits = 8;
     settings.antialiasingLevel = 0;
 
-    sf::Window window(sf::VideoMode(WIDTH, HEIGHT), "OpenGL", sf::Style::Titlebar | sf::Style::Close, settings);
+    sf::Window window(sf::VideoMode(options.width, options.height), "OpenGL", sf::Style::Titlebar | sf::Style::Close, settings);
     window.setActive();
+    if (options.frameLimit > 0)
+        window.setFramerateLimit(options.frameLimit);
 
     // Initialize GLEW
     glewExperimental = GL_TRUE;
     glewInit();
-    
-    // Setup OpenGL options
-    glEnable(GL_DEPTH_TEST);
-
-    // enable alpha support
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-    Shader lightingShader("lighting.vs", "lighting.frag");
-    Shader skyboxShader("skybox.vs", "skybox.frag");
-
-    getSphereCoords();
-
 
-    glm::vec3 spherePositions[] = {
-    glm::vec3(0.0f, 0.0f, 0.0f),
-    glm::vec3(-1.5f, -2.2f, -2.5f),
-    };
+    Shader::SetCacheDirectory(options.shaderCache ? SHADER_CACHE_DIRECTORY : "");
+    Renderer renderer(options, threadPool, faces, static_cast<float>(options.width) / static_cast<float>(options.height), scene);
+
+    // Camera input runs at a fixed rate on its own thread, or once per frame on this one with --frame-input (and always on macOS)
+    bool focused{ window.hasFocus() };
+    std::unique_ptr<InputThread> inputThread;
+    std::unique_ptr<CameraInput> frameInput;
+    if (options.frameInput || !INPUT_THREAD_SUPPORTED)
+        frameInput.reset(new CameraInput(camera));
+    else
+        inputThread.reset(new InputThread(camera, options.inputRate));
+    const char* inputMode{ frameInput ? "per frame" : "input thread" };
+    unsigned long long presentedInput{ 0 };
+    bool firstFramePresented{ false };
+    InputLatencyStats latencyStats{};
 
-    GLfloat skyboxVertices[] = {
-        // Positions
-        -1.0f,  1.0f, -1.0f,
-        -1.0f, -1.0f, -1.0f,
-        1.0f, -1.0f, -1.0f,
-        1.0f, -1.0f, -1.0f,
-        1.0f,  1.0f, -1.0f,
-        -1.0f,  1.0f, -1.0f,
-
-        -1.0f, -1.0f,  1.0f,
-        -1.0f, -1.0f, -1.0f,
-        -1.0f,  1.0f, -1.0f,
-        -1.0f,  1.0f, -1.0f,
-        -1.0f,  1.0f,  1.0f,
-        -1.0f, -1.0f,  1.0f,
-
-        1.0f, -1.0f, -1.0f,
-        1.0f, -1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f, -1.0f,
-        1.0f, -1.0f, -1.0f,
-
-        -1.0f, -1.0f,  1.0f,
-        -1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-        1.0f, -1.0f,  1.0f,
-        -1.0f, -1.0f,  1.0f,
-
-        -1.0f,  1.0f, -1.0f,
-        1.0f,  1.0f, -1.0f,
-        1.0f,  1.0f,  1.0f,
-        1.0f,  1.0f,  1.0f,
-        -1.0f,  1.0f,  1.0f,
-        -1.0f,  1.0f, -1.0f,
-
-        -1.0f, -1.0f, -1.0f,
-        -1.0f, -1.0f,  1.0f,
-        1.0f, -1.0f, -1.0f,
-        1.0f, -1.0f, -1.0f,
-        -1.0f, -1.0f,  1.0f,
-        1.0f, -1.0f,  1.0f
-    };
-
-    std::vector<const GLchar*> faces;
-    faces.push_back("Yokohama3/posx.jpg");
-    faces.push_back("Yokohama3/negx.jpg");
-    faces.push_back("Yokohama3/posy.jpg");
-    faces.push_back("Yokohama3/negy.jpg");
-    faces.push_back("Yokohama3/posz.jpg");
-    faces.push_back("Yokohama3/negz.jpg");
-
-    // Sphere
-
-    GLuint VBO, sphereVAO, EBO;
-    glGenVertexArrays(1, &sphereVAO);
-    glBindVertexArray(sphereVAO);
-
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, numberOfPoints * sizeof(GLfloat), vertice, GL_STATIC_DRAW);
-
-    glGenBuffers(1, &EBO);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, numberOfIndexes * sizeof(GLuint), indices, GL_STATIC_DRAW);
-
-    GLint posAttrib{ glGetAttribLocation(lightingShader.Program, "position") };
-    glVertexAttribPointer(posAttrib, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
-    glEnableVertexAttribArray(posAttrib);
-
-    // Normal attribute
-    GLint normalAttrib{ glGetAttribLocation(lightingShader.Program, "normal") };
-    glVertexAttribPointer(normalAttrib, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)(0));
-    glEnableVertexAttribArray(normalAttrib);
-    glBindVertexArray(0);
-
-    // Skybox
-    GLuint skyboxVAO{}, skyboxVBO{};
-
-    glGenVertexArrays(1, &skyboxVAO);
-    glBindVertexArray(skyboxVAO);
-
-    glGenBuffers(1, &skyboxVBO);
-    glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
-
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
-    glBindVertexArray(0);
-
-    GLuint cubemapTexture = LoadCubemap(faces);
-
-    glm::mat4 projection = glm::perspective(camera.GetZoom(), (float)WIDTH / (float)HEIGHT, 0.1f, 1000.0f);
-            
     bool running{ true };
+    float viewportHeight{ static_cast<float>(options.height) };
     float currentFrame{};
     float deltaTime{};
     float lastFrame{};
 
+    // Frame time and sphere submission cost, averaged and printed every couple of seconds
+    unsigned reportFrames{ 0 };
+    float reportStart{ 0.0f };
+    double submitMs{ 0.0 };
+
+    Profiler& profiler{ renderer.GetProfiler() };
     while (running)
     {
         currentFrame = clock.getElapsedTime().asSeconds();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
+        profiler.BeginFrame();
+        profiler.BeginScope("events", false);
 
         sf::Event event{};
         while (window.pollEvent(event))
@@ -284,113 +154,76 @@ int main()
             switch (event.type)
             {
             case sf::Event::Closed:             running = false;    break;
-            case sf::Event::Resized:            glViewport(0, 0, event.size.width, event.size.height);  break;
-            case sf::Event::KeyPressed:
-                switch (event.key.code)
-                {
-                case sf::Keyboard::Escape:      running = false;
-                case sf::Keyboard::Up:
-                case sf::Keyboard::W:           camera.ProcessKeyboard(Camera_Movement::FORWARD, deltaTime); break;
-                case sf::Keyboard::Down:
-                case sf::Keyboard::S:           camera.ProcessKeyboard(Camera_Movement::BACKWARD, deltaTime); break;
-                case sf::Keyboard::Right:
-                case sf::Keyboard::D:           camera.ProcessKeyboard(Camera_Movement::RIGHT, deltaTime); break;
-                case sf::Keyboard::Left:
-                case sf::Keyboard::A:           camera.ProcessKeyboard(Camera_Movement::LEFT, deltaTime); break;
-                default:    break;
-                }
-            case sf::Event::MouseMoved: MouseCallBack(camera, sf::Mouse::getPosition().x, sf::Mouse::getPosition().y);
-                                                break;
+            case sf::Event::Resized:            GetGLState().Viewport(0, 0, event.size.width, event.size.height); viewportHeight = static_cast<float>(event.size.height); break;
+            case sf::Event::KeyPressed:         if (event.key.code == sf::Keyboard::Escape) running = false; break;
+            case sf::Event::GainedFocus:        focused = true;     break;
+            case sf::Event::LostFocus:          focused = false;    break;
             default:                            break;
             }
         }
-        glm::mat4 model;
-        glm::mat4 view;
-        glClearColor(0.1f, 0.1f, 0.1f, 0.1f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        lightingShader.Use();
-
-        // get camera view
-        view = camera.GetViewMatrix();
-
-        // Get the uniform locations
-        GLint modelLoc{ glGetUniformLocation(lightingShader.Program, "model") };
-        GLint viewLoc{ glGetUniformLocation(lightingShader.Program, "view") };
-        GLint projLoc{ glGetUniformLocation(lightingShader.Program, "projection") };
-        GLint cameraPosLoc{ glGetUniformLocation(lightingShader.Program, "cameraPos") };
-
-        // Pass the matrices to the shader
-        glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-        glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-        glUniform3fv(cameraPosLoc, 1, glm::value_ptr(camera.GetPosition()));
-
-        
-
-        GLint lightPosLoc = glGetUniformLocation(lightingShader.Program, "light.position");
-        glUniform3f(lightPosLoc, lightPos.x, lightPos.y, lightPos.z);
-
-        glm::vec3 lightColor{};
-        lightColor.r = sin(clock.getElapsedTime().asSeconds() * 2.0f);
-        lightColor.g = sin(clock.getElapsedTime().asSeconds() * 0.7f);
-        lightColor.b = sin(clock.getElapsedTime().asSeconds() * 1.3f);
-
-        glm::vec3 diffuseColor{ lightColor * glm::vec3(0.7f) }; // Decrease the influence
-        glm::vec3 ambientColor{ diffuseColor * glm::vec3(0.2f) }; // Low influence
+        profiler.EndScope();
 
-        // Set light properties
-        glUniform3f(glGetUniformLocation(lightingShader.Program, "light.ambient"), ambientColor.r, ambientColor.g, ambientColor.b);
-        glUniform3f(glGetUniformLocation(lightingShader.Program, "light.diffuse"), diffuseColor.r, diffuseColor.g, diffuseColor.b);
-
-        // Light specular
-        glUniform1f(glGetUniformLocation(lightingShader.Program, "light.specular"), 0.75f);
-        
-        // Set material properties
-        glUniform3f(glGetUniformLocation(lightingShader.Program, "material.ambient"), 1.0f, 0.5f, 0.31f);
-        glUniform3f(glGetUniformLocation(lightingShader.Program, "material.diffuse"), 1.0f, 0.5f, 0.31f);
-        glUniform3f(glGetUniformLocation(lightingShader.Program, "material.specular"), 0.5f, 0.5f, 0.5f); // Specular doesn't have full effect on this object's material
-        glUniform1f(glGetUniformLocation(lightingShader.Program, "material.shininess"), 32.0f);
+        // Pick up the newest camera as late as possible, right before the frame is recorded
+        if (frameInput)
+            frameInput->Sample(deltaTime, focused);
+        else
+            inputThread->SetFocused(focused);
+        CameraSnapshot snapshot{ frameInput ? frameInput->GetSnapshot() : inputThread->GetLatest() };
+        camera.SetPose(snapshot.position, snapshot.yaw, snapshot.pitch);
 
-        // Draw the sphere
-        glBindVertexArray(sphereVAO);
-        for (GLuint i{ 0 }; i < 2; ++i)
         {
-            model = glm::mat4();
-            model = glm::translate(model, spherePositions[i]);
-            glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
-            glDrawElements(GL_TRIANGLES, numberOfIndexes, GL_UNSIGNED_INT, 0);
+            ProfileScope scope(profiler, "render");
+            renderer.RenderFrame(camera, currentFrame, viewportHeight);
         }
-       
-        //glDrawElements(GL_TRIANGLES, numberOfIndexes, GL_UNSIGNED_INT, 0);
-        glBindVertexArray(0);
+        submitMs += renderer.GetSubmitMs();
 
-        glDepthFunc(GL_LEQUAL);  // Change depth function so depth test passes when values are equal to depth buffer's content
-        skyboxShader.Use();
-        
-        glBindVertexArray(skyboxVAO);
-        view = glm::mat4(glm::mat3(camera.GetViewMatrix()));
+        {
+            ProfileScope scope(profiler, "display", false);
+            window.display();
+        }
+        profiler.EndFrame();
 
-        glUniformMatrix4fv(glGetUniformLocation(skyboxShader.Program, "view"), 1, GL_FALSE, glm::value_ptr(view));
-        glUniformMatrix4fv(glGetUniformLocation(skyboxShader.Program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        if (!firstFramePresented)
+        {
+            PrintFirstFrame(renderer, scene);
+            firstFramePresented = true;
+        }
 
-        glBindVertexArray(skyboxVAO);
-        glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-        glBindVertexArray(0);
-        glDepthFunc(GL_LESS);
+        // The first frame presented with a new move closes its latency sample
+        if (snapshot.inputSequence != presentedInput)
+        {
+            latencyStats.Add(ElapsedMilliseconds(snapshot.inputTime, std::chrono::steady_clock::now()));
+            presentedInput = snapshot.inputSequence;
+        }
 
-        window.display();
+        ++reportFrames;
+        if (currentFrame - reportStart >= 2.0f)
+        {
+            std::cout << renderer.GetSphereCount() << " spheres: " << 1000.0f * (currentFrame - reportStart) / reportFrames << " ms/frame, sphere submission "
+                << submitMs / reportFrames << " ms/frame (CPU)" << std::endl;
+            PrintCullStats(renderer.GetCullStats());
+            PrintClusterStats(renderer.GetClusterStats());
+            PrintStreamingStats(renderer.GetStreamingStats());
+            PrintTransformStats(renderer.GetTransformStats());
+            PrintEnvironmentStreamStats(renderer.GetEnvironmentStreamStats());
+            PrintResolutionStats(renderer.GetResolutionStats());
+            PrintGLStateStats(GetGLState().GetStats());
+            PrintProbeStats(renderer.GetProbeStats());
+            PrintBvhStats(renderer.GetBvhStats());
+            PrintShaderVariantStats(renderer.GetShaderVariantStats());
+            PrintPostProcessStats(renderer.GetPostProcessStats());
+            PrintResourceStats(renderer.GetResourceStats());
+            PrintInputLatencyStats(latencyStats, inputMode);
+            profiler.PrintSummary();
+            latencyStats = InputLatencyStats{};
+            reportFrames = 0;
+            reportStart = currentFrame;
+            submitMs = 0.0;
+        }
     }
-    
-    glDeleteBuffers(1, &skyboxVBO);
-    glDeleteBuffers(1, &VBO);
-    glDeleteVertexArrays(1, &skyboxVAO);
-    glDeleteVertexArrays(1, &sphereVAO);
+
+    if (!options.traceFile.empty() && profiler.WriteTrace(options.traceFile))
+        std::cout << profiler.GetTraceEventCount() << " trace events written to " << options.traceFile << std::endl;
 
     return 0;
 }
@@ -0,0 +1,9 @@
+#version 430 core
+// One triangle covering the viewport, no vertex buffer
+out vec2 TexCoords;
+
+void main()
+{
+    TexCoords = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(TexCoords * 2.0 - 1.0, 0.0, 1.0);
+}
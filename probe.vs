@@ -0,0 +1,35 @@
+#version 430 core
+layout (location = 0) in vec3 position;
+layout (location = 1) in vec3 normal;
+
+// World space, probe.geom projects each triangle onto the six faces
+out vec3 ProbeNormal;
+out vec3 ProbeFragPos;
+flat out uint ProbeMaterialIndex;
+flat out int ProbeInstance;
+
+struct Instance
+{
+    mat4 model;
+    mat3 normalMatrix;
+    uint materialIndex;
+    int probeIndex;
+};
+
+layout (std430, binding = 0) readonly buffer InstanceBuffer
+{
+    Instance instances[];
+};
+
+// Drawn with a plain instanced call, every sphere in order
+void main()
+{
+    Instance instance = instances[gl_InstanceID];
+    vec4 worldPosition = instance.model * vec4(position, 1.0f);
+
+    gl_Position = worldPosition;
+    ProbeFragPos = vec3(worldPosition);
+    ProbeNormal = instance.normalMatrix * normal;
+    ProbeMaterialIndex = instance.materialIndex;
+    ProbeInstance = gl_InstanceID;
+}
@@ -0,0 +1,20 @@
+#version 430 core
+out vec3 RayDirection;
+
+layout (std140) uniform CameraBlock
+{
+    mat4 view;
+    mat4 projection;
+    vec3 cameraPos;
+};
+
+// One triangle covering the screen on the near plane, drawn without vertex buffers. The world space direction through each corner
+// is interpolated linearly, which is exact for a perspective projection
+void main()
+{
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0 - 1.0;
+    gl_Position = vec4(corner, -1.0, 1.0);
+
+    vec3 viewDirection = vec3(corner.x / projection[0][0], corner.y / projection[1][1], -1.0);
+    RayDirection = transpose(mat3(view)) * viewDirection;
+}
@@ -2,12 +2,17 @@
 layout (location = 0) in vec3 position;
 out vec3 TexCoords;
 
-uniform mat4 projection;
-uniform mat4 view;
+layout (std140) uniform CameraBlock
+{
+    mat4 view;
+    mat4 projection;
+    vec3 cameraPos;
+};
 
 void main()
 {
-    vec4 pos = projection * view * vec4(position, 1.0);
+    // Drop the translation so the skybox stays centered on the camera
+    vec4 pos = projection * mat4(mat3(view)) * vec4(position, 1.0);
     gl_Position = pos.xyww;
     TexCoords = position;
 }
\ No newline at end of file
@@ -0,0 +1,61 @@
+#version 430 core
+// Bloom from the downsample pyramid, the adapted exposure and a filmic curve, from the half float scene to the output framebuffer
+in vec2 TexCoords;
+
+out vec4 FragColor;
+
+layout (std140) uniform PostBlock
+{
+    ivec4 outputViewport;
+    ivec2 sceneSize;
+    ivec2 sceneTextureSize;
+    int levelCount;
+    float deltaTime;
+    float exposureKey;
+    float adaptationRate;
+    float bloomStrength;
+    float minExposure;
+    float maxExposure;
+};
+
+layout (binding = 4) uniform sampler2D scene;      // POST_SCENE_TEXTURE_UNIT
+layout (binding = 5) uniform sampler2D pyramid;    // POST_PYRAMID_TEXTURE_UNIT, level i holds pyramid level i + 1
+
+layout (std430, binding = 10) readonly buffer PostStateBuffer
+{
+    uint workgroupsDone;
+    float exposure;
+    float averageLogLuminance;
+    uint frames;
+};
+
+// Filtered lookup of the part of a level in use, kept half a texel inside it so nothing past the scene bleeds in
+vec3 SampleRegion(sampler2D image, vec2 pixel, vec2 usedSize, int lod)
+{
+    vec2 size = vec2(textureSize(image, lod));
+    return textureLod(image, clamp(pixel, vec2(0.5), usedSize - 0.5) / size, float(lod)).rgb;
+}
+
+// Narkowicz's fit of the ACES reference tonemapper
+vec3 ACESFilm(vec3 x)
+{
+    return clamp((x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14), 0.0, 1.0);
+}
+
+void main()
+{
+    vec2 scenePixel = TexCoords * vec2(sceneSize);
+    vec3 color = SampleRegion(scene, scenePixel, vec2(sceneSize), 0);
+
+    // Every level weighs the same, the coarse ones spread the light the furthest
+    vec3 bloom = vec3(0.0);
+    for (int level = 1; level <= levelCount; ++level)
+    {
+        float scale = float(1 << level);
+        bloom += SampleRegion(pyramid, scenePixel / scale, ceil(vec2(sceneSize) / scale), level - 1);
+    }
+    if (levelCount > 0)
+        color = mix(color, bloom / float(levelCount), bloomStrength);
+
+    FragColor = vec4(ACESFilm(color * exposure), 1.0);
+}